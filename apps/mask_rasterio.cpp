@@ -16,6 +16,11 @@
 
 #include "mask_rasterio.h"
 
+#ifndef WINDOWS
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif /* WINDOWS */
+
 IOMODE StringToIOMode(const string& str) {
     string mode_str = GetUpper(str);
     if (mode_str == "DEC" || mode_str == "DECOMPOSE") { return DEC; }
@@ -49,8 +54,12 @@ void Usage(const string& appname, const string& error_msg /* = std::string() */)
             " [-include_nodata <includeNoData>]"
             " [-mongo <host> <port> <DB> <GFS>]"
             " [-thread <threadsNum>]"
+            " [-memory <memoryLimit>]"
             " [-opts <options>]\n\n";
-    cout << "2. " << corename << " -configfile <configFile> [-thread <threadsNum>]\n\n";
+    cout << "2. " << corename << " -configfile <configFile> [-thread <threadsNum>] [-memory <memoryLimit>]\n\n";
+    cout << "Server mode that keeps masks and MongoDB connections resident between jobs:\n";
+    cout << "    " << corename << " -server <endpoint> [-thread <threadsNum>] [-memory <memoryLimit>]"
+            " [-mongo <host> <port> <DB> <GFS>]\n\n";
 
     cout << "\t<xxFmt> is data format for <in>, <out>, and <mask>, can be FILE or GFS.\n";
     cout << "\t<xxFile> and <xxFile2>... are full paths of raster, ASCII and GeoTIFF are recommended.\n";
@@ -66,6 +75,7 @@ void Usage(const string& appname, const string& error_msg /* = std::string() */)
     cout << "\t<updatedNodata> is updated nodata value.\n";
     cout << "\t<includeNoData> is used when output raster data into MongoDB, can be 1 or 0.\n";
     cout << "\t<threadsNum> is the number of thread used by OpenMP, which must be >= 1 (default).\n";
+    cout << "\t<memoryLimit> is the memory (MB) that entries run concurrently may use, 0 means no limit (default).\n";
     cout << "\t-mongo specify the MongoDB configuration, including host, port, DB, and GFS.\n";
     cout << "\t<configFile> is a plain text file that defines all input parameters, the format is:\n";
     cout << "\t\t[-mode\t<IOMode>]";
@@ -78,6 +88,10 @@ void Usage(const string& appname, const string& error_msg /* = std::string() */)
     cout << "\t\t\"<in1>,<in2>,...;<out>;[<defaultValue>];[<updatedNodata>];[<outDataType>];"
             "[<reclassifyList>]\"\n";
     cout << "\t\t...\n\n";
+    cout << "\t<endpoint> is stdin (or -), or path of a local Unix socket that accepts jobs.\n";
+    cout << "\tEach job consists of lines in format of <configFile> that ended by an empty line or RUN,\n";
+    cout << "\t\tthe reply is: JOB <id> STATUS <returnCode> TIME <seconds>.\n";
+    cout << "\tCLEAR releases resident masks and connections, QUIT or EXIT stops the server.\n";
 }
 
 
@@ -169,17 +183,107 @@ bool parse_key_values(string& kvstrs, STRING_MAP& res) {
     }
     return true;
 }
-/*!
- * \return
- *   0. Succeed
- *   1. Format error of input arguments
- *   2. File specified but not existed, including configuration file and input data files
- *   3. File content loaded failed or wrong format
- *
- */
-int main(const int argc, const char** argv) {
+void TaskAdmission::Acquire(const size_t bytes) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (limit_ > 0 && running_ > 0 && used_ + bytes > limit_) {
+        cond_.wait(lock);
+    }
+    used_ += bytes;
+    running_++;
+}
+
+void TaskAdmission::Release(const size_t bytes) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        used_ -= bytes;
+        running_--;
+    }
+    cond_.notify_all();
+}
+
+void TaskProgress::Finish(const int idx, const string& name, const int status) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    n_finished_++;
+    cout << "Progress: [" << n_finished_ << "/" << n_tasks_ << "] entry " << idx + 1 << " ";
+    if (status == TASK_SUCCEEDED) { cout << "succeeded"; }
+    else if (status == TASK_FAILED) { cout << "failed"; }
+    else { cout << "skipped"; }
+    if (!name.empty()) { cout << ": " << name; }
+    cout << endl;
+}
+
+size_t EstimateTaskMemory(const vector<string>& in_files, const DATAFMT fmt, DblRaster* mask) {
+    size_t bytes = 0;
+    if (fmt == SFILE) { // size of files approximates the size of decoded data
+        for (auto it = in_files.begin(); it != in_files.end(); ++it) {
+            std::ifstream ifs(it->c_str(), std::ios::binary | std::ios::ate);
+            if (!ifs.is_open()) { continue; }
+            std::streamoff len = ifs.tellg();
+            if (len > 0) { bytes += CVT_SIZET(len); }
+        }
+    }
+    if (nullptr != mask && mask->GetCellNumber() > 0) { // masked data and buffer for output
+        bytes += CVT_SIZET(mask->GetCellNumber()) * in_files.size() * sizeof(double) * 2;
+    }
+    return bytes;
+}
+
+int PrintTaskSummary(const vector<vector<string> >& in_paths, const vector<int>& status) {
+    int succeeded = 0;
+    int failed = 0;
+    int skipped = 0;
+    for (size_t i = 0; i < status.size(); i++) {
+        if (status[i] == TASK_SUCCEEDED) { succeeded++; continue; }
+        if (status[i] == TASK_SKIPPED) { skipped++; continue; }
+        failed++;
+        cout << "Failed entry " << i + 1 << ":";
+        for (auto it = in_paths[i].begin(); it != in_paths[i].end(); ++it) { cout << " " << *it; }
+        cout << endl;
+    }
+    cout << "Summary: " << status.size() << " entries, " << succeeded << " succeeded, "
+            << failed << " failed, " << skipped << " skipped." << endl;
+    return failed;
+}
+
+void ServerCache::EraseMask(const string& key) {
+    auto it = masks.find(key);
+    if (it != masks.end()) {
+        delete it->second;
+        masks.erase(it);
+    }
+    mask_stamps.erase(key);
+    mappings.erase(key);
+}
+
+void ServerCache::Clear() {
+    for (auto it = masks.begin(); it != masks.end(); ++it) {
+        delete it->second;
+    }
+    masks.clear();
+    mask_stamps.clear();
+    mappings.clear();
+#ifdef USE_MONGODB
+    for (auto it = pools.begin(); it != pools.end(); ++it) {
+        delete it->second;
+    }
+    pools.clear();
+    for (auto it = gridfs.begin(); it != gridfs.end(); ++it) {
+        delete it->second;
+    }
+    gridfs.clear();
+    for (auto it = clients.begin(); it != clients.end(); ++it) {
+        it->second->Destroy();
+        delete it->second;
+    }
+    clients.clear();
+#endif
+}
+
+int RunJob(map<string, vector<string> > key_args, const vector<string>& config_strs,
+           ServerCache* cache /* = nullptr */) {
     IOMODE mode = MASK;
     int thread_num = 1;
+    size_t memory_limit = 0; // bytes, 0 means no limit
     bool inc_nodata = true;
 
     bool use_mongo = false;
@@ -213,59 +317,7 @@ int main(const int argc, const char** argv) {
     vector<map<vint, vector<double> > > reclass_keyvalues;
     STRING_MAP opts; // Additional options, e.g., output data type
 
-    if (argc < 2) {
-        Usage(argv[0], "To run the program, "
-              "use either a single configuration file and/or detail arguments as below.");
-        return 1;
-    }
-    string config_path;
-    vector<int> arg_sep;
-    for (int idx = 1; idx < argc; idx++) {
-        if (argv[idx] == nullptr || argv[idx][0] != '-') { continue; }
-        if (StringMatch(argv[idx], "-configfile") && argc > idx && argv[idx + 1][0] != '-') {
-            config_path = argv[idx + 1];
-        }
-        bool tmp_dbl_flag = false;
-        IsDouble(argv[idx], tmp_dbl_flag);
-        if (tmp_dbl_flag) { continue; }
-        arg_sep.push_back(idx);
-    }
-    arg_sep.push_back(argc);
-
-    map<string, vector<string> > key_args;
-    if (arg_sep.empty()) {
-        if (config_path.empty()) {
-            if (argc >= 2 && argv[1][0] != '-') {
-                config_path = argv[1];
-            }
-            else {
-                Usage(argv[0], "Illegal inputs!");
-                return 1;
-            }
-        }
-    }
-    else {
-        for (auto arg_idx = arg_sep.begin(); arg_idx != arg_sep.end() - 1; ++arg_idx) {
-            vector<string> tmpargs(argv + *arg_idx + 1, argv + *(arg_idx + 1));
-            if (tmpargs.empty()) { continue; }
-            string key(argv[*arg_idx]);
-            if (StringMatch(key, "-configfile")) { continue; }
-            key_args.insert(std::make_pair(GetUpper(key.substr(1, string::npos)), tmpargs));
-        }
-    }
-    vector<string> config_strs;
     vector<vector<string> > io_strs;
-    if (!config_path.empty()) {
-        if (!FileExists(config_path)) {
-            Usage(argv[0], "Configuration file specified but not existed!");
-            return 2;
-        }
-        // Read configuration file
-        if (!LoadPlainTextFile(config_path, config_strs)) {
-            Usage(argv[0]);
-            return 3;
-        }
-    }
     // Concatenate arguments from command line and configuration file
     for (auto it = config_strs.begin(); it != config_strs.end(); ++it) {
         string tmpstr = *it;
@@ -354,12 +406,24 @@ int main(const int argc, const char** argv) {
                                                       &strend, 10));
             dbname = itkv->second.at(2);
             gfsname = itkv->second.at(3);
-            client = MongoClient::Init(mongo_host.c_str(), mongo_port);
+            string client_key = mongo_host + ":" + itoa(CVT_VINT(mongo_port));
+            string gfs_key = client_key + "/" + dbname + "/" + gfsname;
+            if (nullptr != cache && cache->clients.find(client_key) != cache->clients.end()) {
+                client = cache->clients.at(client_key);
+            } else {
+                client = MongoClient::Init(mongo_host.c_str(), mongo_port);
+                if (nullptr != cache && nullptr != client) { cache->clients[client_key] = client; }
+            }
             if (nullptr == client) {
                 cout << "Warning: Illegal arguments for MongoDB!\n";
             }
             else {
-                gfs = client->GridFs(dbname, gfsname);
+                if (nullptr != cache && cache->gridfs.find(gfs_key) != cache->gridfs.end()) {
+                    gfs = cache->gridfs.at(gfs_key);
+                } else {
+                    gfs = client->GridFs(dbname, gfsname);
+                    if (nullptr != cache && nullptr != gfs) { cache->gridfs[gfs_key] = gfs; }
+                }
                 if (nullptr == gfs) {
                     cout << "Warning: Get or create GridFS failed!\n";
                     use_mongo = false;
@@ -377,6 +441,14 @@ int main(const int argc, const char** argv) {
                 thread_num = 1;
             }
         }
+        else if (itkv->first == "MEMORY") {
+            double tmp_memory = IsDouble(itkv->second.at(0), str2num_flag);
+            if (!str2num_flag || tmp_memory < 0.) {
+                cout << "Warning: Illegal memory limit, no limit will be used instead!\n";
+                tmp_memory = 0.;
+            }
+            memory_limit = CVT_SIZET(tmp_memory * 1024. * 1024.);
+        }
         else if (itkv->first == "INCLUDE_NODATA") {
             inc_nodata = IsInt(itkv->second.at(0), str2num_flag) > 0;
             if (!str2num_flag) {
@@ -493,15 +565,36 @@ int main(const int argc, const char** argv) {
         }
     }
 
-#ifdef USE_GDAL
-    GDALAllRegister();
-#endif
-
     SetOpenMPThread(thread_num);
 
-    // Load mask layer
+    // Load mask layer, or reuse the resident one of server mode if the mask is unchanged
     DblRaster* mask_layer = nullptr;
-    if (!mask_path.empty()) {
+    string mask_key = itoa(CVT_VINT(mask_fmt)) + ":" + mask_path;
+    string mask_stamp; // version of the mask, i.e., size and modified time of file
+    if (mask_fmt == SFILE) {
+        vint64_t mask_size = 0;
+        vint64_t mask_mtime = 0;
+        if (GetFileStamp(mask_path, mask_size, mask_mtime)) {
+            mask_stamp = itoa(mask_size) + "@" + itoa(mask_mtime);
+        }
+    }
+#ifdef USE_MONGODB
+    else if (mask_fmt == GFS && use_mongo) { // also identified by DB and GridFS, upload date and length
+        mask_key += "@" + mongo_host + ":" + itoa(CVT_VINT(mongo_port)) + "/" + dbname + "/" + gfsname;
+        vector<GridFsFileInfo> mask_infos;
+        if (gfs->GetFilesInfo(vector<string>(1, mask_path), mask_infos) && !mask_infos.empty()) {
+            mask_stamp = itoa(mask_infos[0].length) + "@" + itoa(mask_infos[0].upload_date);
+        }
+    }
+#endif
+    if (nullptr != cache && cache->masks.find(mask_key) != cache->masks.end()) {
+        if (!mask_stamp.empty() && cache->mask_stamps[mask_key] == mask_stamp) {
+            mask_layer = cache->masks.at(mask_key);
+        } else { // changed or not accessible, reload it
+            cache->EraseMask(mask_key);
+        }
+    }
+    if (nullptr == mask_layer && !mask_path.empty()) {
         if (mask_fmt == SFILE && FileExists(mask_path)) {
             mask_layer = DblRaster::Init(mask_path);
             if (nullptr == mask_layer) { return 3; }
@@ -513,6 +606,15 @@ int main(const int argc, const char** argv) {
         } else {
             // No mask layer
         }
+        if (nullptr != cache && nullptr != mask_layer) {
+            cache->masks[mask_key] = mask_layer;
+            cache->mask_stamps[mask_key] = mask_stamp;
+        }
+    }
+
+    if (mode == COM && nullptr == mask_layer && !in_paths.empty()) {
+        cout << "Error: The COMBINE mode MUST based on a mask layer!";
+        return 1;
     }
 
     // Load input raster
@@ -533,98 +635,36 @@ int main(const int argc, const char** argv) {
     } else {
         UpdateStringMap(opts, HEADER_INC_NODATA, "FALSE");
     }
-    for (auto in_it = in_paths.begin(); in_it != in_paths.end(); ++in_it) {
-        size_t in_idx = in_it - in_paths.begin();
-        if (out_types.at(in_idx) == RDT_Unknown) {
-            UpdateStringMap(opts, HEADER_RSOUT_DATATYPE, "DOUBLE");
-            out_types.at(in_idx) = RDT_Double;
-        } else {
-            UpdateStringMap(opts, HEADER_RSOUT_DATATYPE, RasterDataTypeToString(out_types.at(in_idx)));
-        }
-        if (mode == MASK || mode == DEC || mode == MASKDEC) { // paths in *in_it are regarded as multiple layers
-            DblRaster* rs = nullptr;
-            if (in_fmts.at(in_idx) == SFILE && FilesExist(*in_it)) {
-                rs = DblRaster::Init(*in_it,
-                                     false,            // No need to calculate valid positions
-                                     mask_layer, true, // Use entire extent of Mask
-                                     default_values.at(in_idx));
-                if (out_types.at(in_idx) != RDT_Unknown) { rs->SetOutDataType(out_types.at(in_idx)); }
-            }
-            else if (in_fmts.at(in_idx) == GFS && use_mongo) {
 #ifdef USE_MONGODB
-                rs = DblRaster::Init(gfs, (*in_it).at(0).c_str(),
-                                     false,
-                                     mask_layer, true,
-                                     default_values.at(in_idx), opts);
-#endif
-            }
-            else {
-                continue;
-            }
-            if (nullptr == rs) { continue; }
-
-            if (update_nodata.at(in_idx)) { rs->ReplaceNoData(nodata_values.at(in_idx)); }
-
-            if (reclass_data.at(in_idx)) {
-                rs->BuildSubSet();
-            }
-
-            if (out_fmts.at(in_idx) == SFILE) {
-                if (reclass_data.at(in_idx)) {
-                    if (output_subset) {
-                        rs->OutputSubsetToFile(true, false,
-                                               out_paths.at(in_idx), reclass_keyvalues.at(in_idx),
-                                               default_values.at(in_idx));
-                    }
-                    if (output_all) {
-                        rs->OutputSubsetToFile(true, true,
-                                               out_paths.at(in_idx), reclass_keyvalues.at(in_idx),
-                                               default_values.at(in_idx));
-                    }
-                } else {
-                    if (output_subset) { rs->OutputToFile(out_paths.at(in_idx), false); }
-                    if (output_all) { rs->OutputToFile(out_paths.at(in_idx), true); }
-                }
-            } else if (out_fmts.at(in_idx) == GFS && use_mongo) {
-#ifdef USE_MONGODB
-                if (reclass_data.at(in_idx)) {
-                    if (output_subset) {
-                        rs->OutputSubsetToMongoDB(gfs, out_paths.at(in_idx), opts,
-                                                  inc_nodata, true, false,
-                                                  reclass_keyvalues.at(in_idx),
-                                                  default_values.at(in_idx));
-                    }
-                    if (output_all) {
-                        rs->OutputSubsetToMongoDB(gfs, out_paths.at(in_idx), opts,
-                                                  inc_nodata, true, true,
-                                                  reclass_keyvalues.at(in_idx),
-                                                  default_values.at(in_idx));
-                    }
-                } else {
-                    if (output_subset) {
-                        if (nullptr == mask_layer) {
-                            rs->BuildSubSet();
-                        }
-                        rs->OutputSubsetToMongoDB(gfs, out_paths.at(in_idx), opts,
-                                                  inc_nodata, true, false);
-                    }
-                    if (output_all) {
-                        rs->OutputToMongoDB(gfs, "0_" + out_paths.at(in_idx), opts,
-                                            inc_nodata, true);
-                    }
-                }
+    bool gfs_prefetched = false;
+    std::set<string> gfs_existed; // GridFS inputs existed, valid if gfs_prefetched
+    if (use_mongo) { // check existence of GridFS inputs by one query, the files documents are cached
+        vector<string> gfs_inputs;
+        for (size_t i = 0; i < in_paths.size(); i++) {
+            if (in_fmts.at(i) != GFS) { continue; }
+            gfs_inputs.insert(gfs_inputs.end(), in_paths[i].begin(), in_paths[i].end());
+        }
+        gfs->SetMetadataCacheTtl(60000); // enabled during this job only, see the end of RunJob()
+        vector<GridFsFileInfo> gfs_infos;
+        gfs_prefetched = gfs->GetFilesInfo(gfs_inputs, gfs_infos, STRING_MAP(), true);
+        for (auto it = gfs_infos.begin(); it != gfs_infos.end(); ++it) { gfs_existed.insert(it->filename); }
+    }
 #endif
+    int failed_tasks = 0;
+    if (mode == COM && !in_paths.empty()) {
+        // Entries of COM update subsets of the same mask layer, hence run one after another.
+        //   The resident mask is copied to keep it intact, e.g., default value and subset data.
+        DblRaster* com_mask = nullptr != cache ? new DblRaster(mask_layer) : mask_layer;
+        for (auto in_it = in_paths.begin(); in_it != in_paths.end(); ++in_it) {
+            size_t in_idx = in_it - in_paths.begin();
+            if (out_types.at(in_idx) == RDT_Unknown) {
+                UpdateStringMap(opts, HEADER_RSOUT_DATATYPE, "DOUBLE");
+                out_types.at(in_idx) = RDT_Double;
             } else {
-                // Nothing to do
+                UpdateStringMap(opts, HEADER_RSOUT_DATATYPE, RasterDataTypeToString(out_types.at(in_idx)));
             }
-            delete rs;
-        } else if (mode == COM) {
-            if (nullptr == mask_layer) {
-                cout << "Error: The COMBINE mode MUST based on a mask layer!";
-                return 1;
-            }
-            mask_layer->SetDefaultValue(default_values.at(in_idx));
-            map<int, SubsetPositions*>& subset = mask_layer->GetSubset();
+            com_mask->SetDefaultValue(default_values.at(in_idx));
+            map<int, SubsetPositions*>& subset = com_mask->GetSubset();
             for (auto it = subset.begin(); it != subset.end(); ++it) {
                 it->second->usable = false;
             }
@@ -648,36 +688,387 @@ int main(const int argc, const char** argv) {
                 }
                 else if (in_fmts.at(in_idx) == GFS && use_mongo) {
 #ifdef USE_MONGODB
-                    subset.at(subid)->ReadFromMongoDB(gfs, *inf_it, opts);
+                    if (gfs->HasFile(*inf_it)) { subset.at(subid)->ReadFromMongoDB(gfs, *inf_it, opts); }
 #endif
                 } else {
                     // Nothing to do
                 }
             }
-            mask_layer->SetOutDataType(out_types.at(in_idx));
+            com_mask->SetOutDataType(out_types.at(in_idx));
             if (out_fmts.at(in_idx) == SFILE) {
-                mask_layer->OutputToFile(out_paths.at(in_idx), false);
+                com_mask->OutputToFile(out_paths.at(in_idx), false);
             }
             else if (out_fmts.at(in_idx) == GFS && use_mongo) {
 #ifdef USE_MONGODB
-                mask_layer->OutputToMongoDB(gfs, out_paths.at(in_idx), opts,
+                com_mask->OutputToMongoDB(gfs, out_paths.at(in_idx), opts,
                                             inc_nodata, false);
 #endif
             }
             else {
                 // Nothing to do
             }
-        } else {
-            // Nothing to do
         }
-    }
-    delete mask_layer;
+        if (com_mask != mask_layer) { delete com_mask; }
+    } else if (mode != COM) {
+        // Entries of MASK, DEC, and MASK&DEC are independent tasks executed by a pool of workers,
+        //   inputs of the same grid share the mapping of mask layer
+        int ntasks = CVT_INT(in_paths.size());
+        vector<int> status(ntasks, TASK_SKIPPED);
+        std::shared_ptr<MaskMappingCache> mappings = nullptr;
+        if (nullptr != mask_layer) {
+            mask_layer->PrepareAsMask();
+            if (nullptr != cache && cache->mappings.find(mask_key) != cache->mappings.end()) {
+                mappings = cache->mappings.at(mask_key);
+            } else {
+                mappings = std::make_shared<MaskMappingCache>();
+                if (nullptr != cache) { cache->mappings[mask_key] = mappings; }
+            }
+        }
+        TaskAdmission admission(memory_limit);
+        TaskProgress progress(ntasks);
+        int worker_num = thread_num > 0 ? thread_num : 1;
+#ifdef USE_MONGODB
+        // Clients and GridFS handles are not thread-safe, each worker checks out its own from a pool
+        MongoClientPool* pool = nullptr;
+        if (use_mongo && worker_num > 1) {
+            string client_key = mongo_host + ":" + itoa(CVT_VINT(mongo_port));
+            if (nullptr != cache && cache->pools.find(client_key) != cache->pools.end()) {
+                pool = cache->pools.at(client_key);
+            } else {
+                pool = MongoClientPool::Init(mongo_host.c_str(), mongo_port);
+                if (nullptr != cache && nullptr != pool) { cache->pools[client_key] = pool; }
+            }
+            if (nullptr == pool) {
+                cout << "Warning: Create pool of MongoDB clients failed, use thread = 1 instead!\n";
+                worker_num = 1;
+            }
+        }
+#endif
+#pragma omp parallel num_threads(worker_num)
+        {
+#ifdef USE_MONGODB
+            MongoPooledClient worker_client(pool); // nothing checked out if pool is nullptr
+            MongoGridFs* worker_gfs = nullptr != pool ? worker_client.GridFs(dbname, gfsname) : gfs;
+#endif
+#pragma omp for schedule(dynamic)
+            for (int in_idx = 0; in_idx < ntasks; in_idx++) {
+                vector<string>& in_files = in_paths[in_idx];
+                STRING_MAP task_opts;
+                CopyStringMap(opts, task_opts);
+                if (out_types.at(in_idx) == RDT_Unknown) {
+                    UpdateStringMap(task_opts, HEADER_RSOUT_DATATYPE, "DOUBLE");
+                    out_types.at(in_idx) = RDT_Double;
+                } else {
+                    UpdateStringMap(task_opts, HEADER_RSOUT_DATATYPE, RasterDataTypeToString(out_types.at(in_idx)));
+                }
+                size_t task_bytes = EstimateTaskMemory(in_files, in_fmts.at(in_idx), mask_layer);
+                admission.Acquire(task_bytes);
+                DblRaster* rs = nullptr;
+                bool flag = true;
+                // paths in in_files are regarded as multiple layers
+                if (in_fmts.at(in_idx) == SFILE && FilesExist(in_files)) {
+                    vector<vector<string> > batch_paths(1, in_files);
+                    vector<DblRaster*> batch_rs;
+                    DblRaster::BatchMask(batch_paths, mask_layer,
+                                         batch_rs, false, // No need to calculate valid positions
+                                         true,            // Use entire extent of Mask
+                                         vector<double>(1, default_values.at(in_idx)),
+                                         STRING_MAP(), 1, mappings);
+                    rs = batch_rs.empty() ? nullptr : batch_rs[0];
+                    if (nullptr == rs) { flag = false; }
+                    else if (out_types.at(in_idx) != RDT_Unknown) { rs->SetOutDataType(out_types.at(in_idx)); }
+                }
+                else if (in_fmts.at(in_idx) == GFS && use_mongo) {
+#ifdef USE_MONGODB
+                    if (nullptr == worker_gfs) {
+                        flag = false;
+                    } else if (gfs_prefetched ? gfs_existed.count(in_files.at(0)) > 0
+                                              : worker_gfs->HasFile(in_files.at(0))) {
+                        rs = DblRaster::Init(worker_gfs, in_files.at(0).c_str(),
+                                             false,
+                                             mask_layer, true,
+                                             default_values.at(in_idx), task_opts);
+                        if (nullptr == rs) { flag = false; }
+                    }
+#endif
+                }
+                if (nullptr != rs) {
+                    if (update_nodata.at(in_idx)) { rs->ReplaceNoData(nodata_values.at(in_idx)); }
+
+                    if (reclass_data.at(in_idx)) {
+                        rs->BuildSubSet();
+                    }
+
+                    if (out_fmts.at(in_idx) == SFILE) {
+                        if (reclass_data.at(in_idx)) {
+                            if (output_subset) {
+                                flag = rs->OutputSubsetToFile(true, false,
+                                                              out_paths.at(in_idx), reclass_keyvalues.at(in_idx),
+                                                              default_values.at(in_idx)) && flag;
+                            }
+                            if (output_all) {
+                                flag = rs->OutputSubsetToFile(true, true,
+                                                              out_paths.at(in_idx), reclass_keyvalues.at(in_idx),
+                                                              default_values.at(in_idx)) && flag;
+                            }
+                        } else {
+                            if (output_subset) { flag = rs->OutputToFile(out_paths.at(in_idx), false) && flag; }
+                            if (output_all) { flag = rs->OutputToFile(out_paths.at(in_idx), true) && flag; }
+                        }
+                    } else if (out_fmts.at(in_idx) == GFS && use_mongo) {
+#ifdef USE_MONGODB
+                        if (nullptr == worker_gfs) {
+                            flag = false;
+                        } else if (reclass_data.at(in_idx)) {
+                            if (output_subset) {
+                                flag = rs->OutputSubsetToMongoDB(worker_gfs, out_paths.at(in_idx), task_opts,
+                                                                 inc_nodata, true, false,
+                                                                 reclass_keyvalues.at(in_idx),
+                                                                 default_values.at(in_idx)) && flag;
+                            }
+                            if (output_all) {
+                                flag = rs->OutputSubsetToMongoDB(worker_gfs, out_paths.at(in_idx), task_opts,
+                                                                 inc_nodata, true, true,
+                                                                 reclass_keyvalues.at(in_idx),
+                                                                 default_values.at(in_idx)) && flag;
+                            }
+                        } else {
+                            if (output_subset) {
+                                if (nullptr == mask_layer) {
+                                    rs->BuildSubSet();
+                                }
+                                flag = rs->OutputSubsetToMongoDB(worker_gfs, out_paths.at(in_idx), task_opts,
+                                                                 inc_nodata, true, false) && flag;
+                            }
+                            if (output_all) {
+                                flag = rs->OutputToMongoDB(worker_gfs, "0_" + out_paths.at(in_idx), task_opts,
+                                                           inc_nodata, true) && flag;
+                            }
+                        }
+#endif
+                    } else {
+                        // Nothing to do
+                    }
+                    delete rs;
+                    status[in_idx] = flag ? TASK_SUCCEEDED : TASK_FAILED;
+                } else if (!flag) {
+                    status[in_idx] = TASK_FAILED;
+                }
+                admission.Release(task_bytes);
+                progress.Finish(in_idx, out_paths.at(in_idx), status[in_idx]);
+            }
+        }
 #ifdef USE_MONGODB
-    if (use_mongo) {
-        delete gfs;
-        client->Destroy();
-        delete client;
+        if (nullptr == cache) { delete pool; } // all clients have been pushed back
+#endif
+        // Summary in the order of entries, independent of the execution order
+        failed_tasks = PrintTaskSummary(in_paths, status);
     }
+#ifdef USE_MONGODB
+    // Never serve the following jobs by files documents of this job, which may be changed meanwhile
+    if (use_mongo) { gfs->SetMetadataCacheTtl(0); }
 #endif
+    if (nullptr == cache) { // otherwise, kept resident for the following jobs
+        delete mask_layer;
+#ifdef USE_MONGODB
+        if (use_mongo) {
+            delete gfs;
+            client->Destroy();
+            delete client;
+        }
+#endif
+    }
+    return failed_tasks > 0 ? 4 : 0;
+}
+
+bool ServeJobs(const map<string, vector<string> >& key_args, ServerCache& cache,
+               const std::function<bool(string&)>& read_line,
+               const std::function<void(const string&)>& reply) {
+    vector<string> job_lines;
+    string line;
+    bool quit = false;
+    while (!quit) {
+        bool has_line = read_line(line);
+        string cmd = line;
+        TrimSpaces(cmd);
+        if (has_line && (StringMatch(cmd, "QUIT") || StringMatch(cmd, "EXIT"))) {
+            quit = true; // run the pending job before quit
+        }
+        else if (has_line && StringMatch(cmd, "CLEAR")) {
+            cache.Clear();
+            reply("CLEARED");
+            continue;
+        }
+        else if (has_line && !cmd.empty() && !StringMatch(cmd, "RUN")) {
+            job_lines.emplace_back(line);
+            continue;
+        }
+        if (!job_lines.empty()) {
+            cache.job_count++;
+            double stime = utils_time::TimeCounting();
+            int code = RunJob(key_args, job_lines, &cache);
+            std::ostringstream oss;
+            oss << "JOB " << cache.job_count << " STATUS " << code << " TIME "
+                    << std::fixed << std::setprecision(3) << utils_time::TimeCounting() - stime;
+            reply(oss.str());
+            vector<string>().swap(job_lines);
+        }
+        if (!has_line) { break; }
+    }
+    return quit;
+}
+
+int RunServer(const string& endpoint, const map<string, vector<string> >& key_args) {
+    ServerCache cache;
+    if (StringMatch(endpoint, "stdin") || endpoint == "-") {
+        ServeJobs(key_args, cache,
+                  [](string& line) { return static_cast<bool>(std::getline(std::cin, line)); },
+                  [](const string& msg) { cout << msg << endl; });
+        return 0;
+    }
+#ifndef WINDOWS
+    sockaddr_un addr;
+    if (endpoint.length() >= sizeof(addr.sun_path)) {
+        cout << "Error: Path of the Unix socket is too long: " << endpoint << endl;
+        return 1;
+    }
+    int server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server_fd < 0) {
+        cout << "Error: Create Unix socket failed!" << endl;
+        return 1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, endpoint.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(endpoint.c_str());
+    if (bind(server_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0
+        || listen(server_fd, 1) < 0) {
+        cout << "Error: Listen on Unix socket " << endpoint << " failed!" << endl;
+        close(server_fd);
+        return 1;
+    }
+    cout << "Listening on " << endpoint << endl;
+    bool quit = false;
+    while (!quit) { // one client after another, resident data are shared by all clients
+        int client_fd = accept(server_fd, nullptr, nullptr);
+        if (client_fd < 0) {
+            if (errno == EINTR) { continue; }
+            break;
+        }
+        string buffer;
+        auto read_line = [client_fd, &buffer](string& line) {
+            string::size_type pos;
+            while ((pos = buffer.find('\n')) == string::npos) {
+                char chunk[4096];
+                ssize_t len = recv(client_fd, chunk, sizeof(chunk), 0);
+                if (len <= 0) {
+                    if (buffer.empty()) { return false; }
+                    line.swap(buffer);
+                    buffer.clear();
+                    return true;
+                }
+                buffer.append(chunk, CVT_SIZET(len));
+            }
+            line = buffer.substr(0, pos);
+            buffer.erase(0, pos + 1);
+            if (!line.empty() && line[line.length() - 1] == '\r') { line.erase(line.length() - 1); }
+            return true;
+        };
+        auto reply = [client_fd](const string& msg) {
+            string out = msg + "\n";
+            const char* data = out.c_str();
+            size_t left = out.length();
+            while (left > 0) {
+                ssize_t len = send(client_fd, data, left, 0);
+                if (len <= 0) { break; }
+                data += len;
+                left -= CVT_SIZET(len);
+            }
+        };
+        quit = ServeJobs(key_args, cache, read_line, reply);
+        close(client_fd);
+    }
+    close(server_fd);
+    unlink(endpoint.c_str());
     return 0;
+#else
+    cout << "Error: Unix socket is not supported, use stdin as endpoint instead!" << endl;
+    return 1;
+#endif /* WINDOWS */
+}
+
+/*!
+ * \return
+ *   0. Succeed
+ *   1. Format error of input arguments
+ *   2. File specified but not existed, including configuration file and input data files
+ *   3. File content loaded failed or wrong format
+ *   4. Some entries failed
+ *
+ */
+int main(const int argc, const char** argv) {
+    if (argc < 2) {
+        Usage(argv[0], "To run the program, "
+              "use either a single configuration file and/or detail arguments as below.");
+        return 1;
+    }
+    string config_path;
+    vector<int> arg_sep;
+    for (int idx = 1; idx < argc; idx++) {
+        if (argv[idx] == nullptr || argv[idx][0] != '-') { continue; }
+        if (StringMatch(argv[idx], "-configfile") && argc > idx && argv[idx + 1][0] != '-') {
+            config_path = argv[idx + 1];
+        }
+        bool tmp_dbl_flag = false;
+        IsDouble(argv[idx], tmp_dbl_flag);
+        if (tmp_dbl_flag) { continue; }
+        arg_sep.push_back(idx);
+    }
+    arg_sep.push_back(argc);
+
+    map<string, vector<string> > key_args;
+    if (arg_sep.empty()) {
+        if (config_path.empty()) {
+            if (argc >= 2 && argv[1][0] != '-') {
+                config_path = argv[1];
+            }
+            else {
+                Usage(argv[0], "Illegal inputs!");
+                return 1;
+            }
+        }
+    }
+    else {
+        for (auto arg_idx = arg_sep.begin(); arg_idx != arg_sep.end() - 1; ++arg_idx) {
+            vector<string> tmpargs(argv + *arg_idx + 1, argv + *(arg_idx + 1));
+            if (tmpargs.empty()) { continue; }
+            string key(argv[*arg_idx]);
+            if (StringMatch(key, "-configfile")) { continue; }
+            key_args.insert(std::make_pair(GetUpper(key.substr(1, string::npos)), tmpargs));
+        }
+    }
+    vector<string> config_strs;
+    vector<vector<string> > io_strs;
+    if (!config_path.empty()) {
+        if (!FileExists(config_path)) {
+            Usage(argv[0], "Configuration file specified but not existed!");
+            return 2;
+        }
+        // Read configuration file
+        if (!LoadPlainTextFile(config_path, config_strs)) {
+            Usage(argv[0]);
+            return 3;
+        }
+    }
+#ifdef USE_GDAL
+    GDALAllRegister();
+#endif
+
+    auto server = key_args.find("SERVER");
+    if (server != key_args.end()) {
+        string endpoint = server->second.at(0);
+        key_args.erase(server);
+        return RunServer(endpoint, key_args);
+    }
+    return RunJob(key_args, config_strs);
 }
@@ -1,7 +1,13 @@
 #ifndef CCGL_APP_MASK_RASTERIO_H
 #define CCGL_APP_MASK_RASTERIO_H
 
+#include <mutex>
+#include <set>
+#include <condition_variable>
+#include <functional>
+
 #include "data_raster.hpp"
+#include "utils_time.h"
 
 using namespace ccgl;
 using namespace data_raster;
@@ -47,5 +53,121 @@ bool parse_fmt_paths(string& tag, vector<string>& strs, DATAFMT& fmt, vector<str
 
 bool parse_key_values(string& kvstrs, map<vint, vector<double> >& kv);
 
+/// Status of each entry executed as a task
+enum TASKSTATUS {
+    TASK_FAILED = -1,   ///< read or write failed
+    TASK_SKIPPED = 0,   ///< nothing to do, e.g., input not existed
+    TASK_SUCCEEDED = 1  ///< read and write succeeded
+};
+
+/*!
+ * \class TaskAdmission
+ * \brief Memory-aware admission of tasks, i.e., a task waits until the estimated memory
+ *        of running tasks plus its own does not exceed the limit.
+ *        A task is always admitted if no task is running, and 0 means no limit.
+ */
+class TaskAdmission: NotCopyable {
+public:
+    explicit TaskAdmission(size_t limit) : limit_(limit), used_(0), running_(0) {}
+
+    /// Wait until the task of the estimated memory is admitted
+    void Acquire(size_t bytes);
+
+    /// Release the memory of a finished task
+    void Release(size_t bytes);
+
+private:
+    size_t limit_;
+    size_t used_;
+    int running_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+};
+
+/*!
+ * \class TaskProgress
+ * \brief Thread-safe progress reporting of tasks
+ */
+class TaskProgress: NotCopyable {
+public:
+    explicit TaskProgress(int ntasks) : n_tasks_(ntasks), n_finished_(0) {}
+
+    /// Report a finished task
+    void Finish(int idx, const string& name, int status);
+
+private:
+    int n_tasks_;
+    int n_finished_;
+    std::mutex mutex_;
+};
+
+/// Rough estimation of memory used by a task, i.e., decoded inputs and masked data
+size_t EstimateTaskMemory(const vector<string>& in_files, DATAFMT fmt, DblRaster* mask);
+
+/// Print the summary of tasks in the order of entries, return the number of failed tasks
+int PrintTaskSummary(const vector<vector<string> >& in_paths, const vector<int>& status);
+
+/*!
+ * \class ServerCache
+ * \brief Mask layers (with subsets built) and MongoDB connections kept resident
+ *        between jobs of the server mode
+ */
+class ServerCache: NotCopyable {
+public:
+    ServerCache() : job_count(0) {}
+
+    ~ServerCache() { Clear(); }
+
+    /// Release all cached masks and connections
+    void Clear();
+
+    /// Remove the mask layer and its mappings
+    void EraseMask(const string& key);
+
+    map<string, DblRaster*> masks; ///< Mask layers, key: format and path of mask
+    map<string, string> mask_stamps; ///< Versions of masks when loaded, key: same as masks
+    map<string, std::shared_ptr<MaskMappingCache> > mappings; ///< Mappings to masks, key: same as masks
+    int job_count; ///< Number of jobs served, i.e., ID of the last job
+#ifdef USE_MONGODB
+    map<string, MongoClient*> clients; ///< MongoDB clients, key: host:port
+    map<string, MongoGridFs*> gridfs; ///< GridFS handles, key: host:port/DB/GFS
+    map<string, MongoClientPool*> pools; ///< Pools of clients for parallel workers, key: host:port
+#endif
+};
+
+/*!
+ * \brief Run one job defined by arguments and lines of configuration
+ *
+ * \param[in] key_args Arguments from command line, take precedence over configuration
+ * \param[in] config_strs Lines of configuration, the same format as configuration file
+ * \param[in] cache Resident masks and connections, nullptr means no cache.
+ *                  A resident mask is reused only if the file is unchanged,
+ *                  and a COMBINE job works on a copy of it.
+ * \return Exit code, see main()
+ */
+int RunJob(map<string, vector<string> > key_args, const vector<string>& config_strs,
+           ServerCache* cache = nullptr);
+
+/*!
+ * \brief Serve jobs read line by line until QUIT/EXIT or end of input
+ *
+ *        Lines of a job use the configuration file syntax and are ended by an empty line
+ *        or RUN, then a status line "JOB <id> STATUS <code> TIME <seconds>" is replied.
+ *        CLEAR releases the cached masks and connections.
+ *
+ * \return true if QUIT/EXIT is received
+ */
+bool ServeJobs(const map<string, vector<string> >& key_args, ServerCache& cache,
+               const std::function<bool(string&)>& read_line,
+               const std::function<void(const string&)>& reply);
+
+/*!
+ * \brief Run as a persistent server that reads jobs from stdin or a local Unix socket
+ *
+ * \param[in] endpoint "stdin" (or "-") or path of the Unix socket to be created
+ * \param[in] key_args Arguments shared by all jobs, e.g., -thread, -memory, and -mongo
+ */
+int RunServer(const string& endpoint, const map<string, vector<string> >& key_args);
+
 
 #endif /* CCGL_APP_MASK_RASTERIO_H */
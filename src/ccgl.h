@@ -18,6 +18,7 @@
 #include "utils_string.h"
 #include "utils_array.h"
 #include "utils_math.h"
+#include "utils_codec.h"
 #include "utils_time.h"
 #include "utils_filesystem.h"
 #include "db_mongoc.h"
@@ -27,6 +28,7 @@ using namespace ccgl;
 using namespace utils_string;
 using namespace utils_array;
 using namespace utils_math;
+using namespace utils_codec;
 using namespace utils_time;
 using namespace utils_filesystem;
 #ifdef USE_MONGODB
@@ -76,6 +76,295 @@ double DefaultNoDataByType(const RasterDataType type) {
     }
 }
 
+size_t RasterDataTypeSize(const RasterDataType type) {
+    switch (type) {
+        case RDT_UInt8:
+        case RDT_Int8:      return sizeof(vint8_t);
+        case RDT_UInt16:
+        case RDT_Int16:     return sizeof(vint16_t);
+        case RDT_UInt32:
+        case RDT_Int32:     return sizeof(vint32_t);
+        case RDT_UInt64:
+        case RDT_Int64:     return sizeof(vint64_t);
+        case RDT_Float:     return sizeof(float);
+        case RDT_Double:    return sizeof(double);
+        default:            return 0;
+    }
+}
+
+RasterTiles::RasterTiles(const int nrows, const int ncols, const int tile_size) :
+    n_rows_(nrows), n_cols_(ncols), size_(tile_size), n_tile_rows_(0), n_tile_cols_(0) {
+    if (Valid()) {
+        n_tile_rows_ = (n_rows_ + size_ - 1) / size_;
+        n_tile_cols_ = (n_cols_ + size_ - 1) / size_;
+    }
+}
+
+void RasterTiles::Extent(const int tile, int& srow, int& erow, int& scol, int& ecol) const {
+    srow = tile / n_tile_cols_ * size_;
+    scol = tile % n_tile_cols_ * size_;
+    erow = Min(srow + size_, n_rows_) - 1;
+    ecol = Min(scol + size_, n_cols_) - 1;
+}
+
+int RasterTiles::CellsNumber(const int tile) const {
+    int srow, erow, scol, ecol;
+    Extent(tile, srow, erow, scol, ecol);
+    return (erow - srow + 1) * (ecol - scol + 1);
+}
+
+bool RasterTiles::InWindow(const int srow, const int erow, const int scol, const int ecol,
+                           vector<int>& tiles) const {
+    tiles.clear();
+    if (!Valid() || srow < 0 || scol < 0 || srow > erow || scol > ecol
+        || erow >= n_rows_ || ecol >= n_cols_) {
+        return false;
+    }
+    for (int i = srow / size_; i <= erow / size_; i++) {
+        for (int j = scol / size_; j <= ecol / size_; j++) {
+            tiles.emplace_back(i * n_tile_cols_ + j);
+        }
+    }
+    return true;
+}
+
+void RasterTiles::RawOffsets(const int n_lyrs, const size_t size_dtype, vector<vint>& offsets) const {
+    offsets.resize(CVT_SIZET(Count()) + 1);
+    offsets[0] = 0;
+    for (int i = 0; i < Count(); i++) {
+        offsets[i + 1] = offsets[i] + CVT_VINT(CVT_SIZET(CellsNumber(i)) * n_lyrs * size_dtype);
+    }
+}
+
+void AppendTileIndex(const vector<vint>& offsets, vector<char>& dst) {
+    for (auto it = offsets.begin(); it != offsets.end(); ++it) {
+        vuint64_t offset = static_cast<vuint64_t>(*it);
+        for (size_t j = 0; j < sizeof(vint64_t); j++) {
+            dst.emplace_back(static_cast<char>((offset >> (8 * j)) & 0xFF));
+        }
+    }
+}
+
+bool ParseTileIndex(const char* src, const size_t len, vector<vint>& offsets) {
+    offsets.clear();
+    if (nullptr == src || len == 0 || len % sizeof(vint64_t) != 0) { return false; }
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(src);
+    for (size_t i = 0; i < len; i += sizeof(vint64_t)) {
+        vuint64_t offset = 0;
+        for (size_t j = 0; j < sizeof(vint64_t); j++) {
+            offset |= static_cast<vuint64_t>(bytes[i + j]) << (8 * j);
+        }
+        offsets.emplace_back(CVT_VINT(offset));
+    }
+    return true;
+}
+
+#ifdef USE_MONGODB
+void ParseGridFsMetadata(const bson_t* bmeta, STRDBL_MAP& header, STRING_MAP& header_str) {
+    bson_iter_t iter; // Loop the metadata, add to `header_str` or `header`
+    if (nullptr == bmeta || !bson_iter_init(&iter, bmeta)) { return; }
+    while (bson_iter_next(&iter)) {
+        const char* key = bson_iter_key(&iter);
+        if (strcmp(key, HEADER_RS_TILE_INDEX) == 0) { continue; } // \sa GridFsHeader::TileOffsets()
+        auto it = header.find(key);
+        if (it != header.end()) {
+            GetNumericFromBsonIterator(&iter, it->second);
+        }
+        else {
+            header_str[key] = GetStringFromBsonIterator(&iter);
+        }
+    }
+}
+
+GridFsHeader::GridFsHeader() : out_type_(RDT_Unknown), tile_size_(0), meta_(nullptr) {
+    Reset();
+}
+
+GridFsHeader::~GridFsHeader() {
+    if (nullptr != meta_) { bson_destroy(meta_); }
+}
+
+int GridFsHeader::NumericKeyIndex(const char* key) {
+    static const char* numeric_keys[KEY_COUNT] = {
+        HEADER_RS_NCOLS, HEADER_RS_NROWS, HEADER_RS_XLL, HEADER_RS_YLL,
+        HEADER_RS_CELLSIZE, HEADER_RS_NODATA, HEADER_RS_LAYERS, HEADER_RS_CELLSNUM
+    };
+    for (int i = 0; i < KEY_COUNT; i++) {
+        // mostly differ in the first character
+        if (key[0] == numeric_keys[i][0] && strcmp(key, numeric_keys[i]) == 0) { return i; }
+    }
+    return -1;
+}
+
+void GridFsHeader::Reset() {
+    for (int i = 0; i < KEY_COUNT; i++) { values_[i] = NODATA_VALUE; }
+    out_type_ = RDT_Unknown;
+    codec_.clear();
+    tile_size_ = 0;
+    if (nullptr != meta_) {
+        bson_destroy(meta_);
+        meta_ = nullptr;
+    }
+}
+
+bool GridFsHeader::Parse(const bson_t* bmeta) {
+    Reset();
+    bson_iter_t iter;
+    if (nullptr == bmeta || !bson_iter_init(&iter, bmeta)) { return false; }
+    meta_ = bson_copy(bmeta);
+    while (bson_iter_next(&iter)) {
+        const char* key = bson_iter_key(&iter);
+        int idx = NumericKeyIndex(key);
+        if (idx >= 0) {
+            GetNumericFromBsonIterator(&iter, values_[idx]);
+        }
+        else if (strcmp(key, HEADER_RSOUT_DATATYPE) == 0) {
+            out_type_ = StringToRasterDataType(GetStringFromBsonIterator(&iter));
+        }
+        else if (strcmp(key, HEADER_RS_CODEC) == 0) {
+            codec_ = GetStringFromBsonIterator(&iter);
+        }
+        else if (strcmp(key, HEADER_RS_TILE_SIZE) == 0) {
+            double size = 0.;
+            double intpart;
+            tile_size_ = -1;
+            if (GetNumericFromBsonIterator(&iter, size) && size >= 1.
+                && std::modf(size, &intpart) == 0.0) {
+                tile_size_ = CVT_INT(size);
+            }
+        }
+        // the others are kept in meta_
+    }
+    return true;
+}
+
+bool GridFsHeader::TileOffsets(vector<vint>& offsets) const {
+    offsets.clear();
+    bson_iter_t iter;
+    if (nullptr == meta_ || !bson_iter_init_find(&iter, meta_, HEADER_RS_TILE_INDEX)) { return false; }
+    if (BSON_ITER_HOLDS_BINARY(&iter)) { // 64-bit integers in little-endian
+        bson_subtype_t subtype;
+        uint32_t len = 0;
+        const uint8_t* bytes = NULL;
+        bson_iter_binary(&iter, &subtype, &len, &bytes);
+        return ParseTileIndex(reinterpret_cast<const char*>(bytes), len, offsets);
+    }
+    if (!BSON_ITER_HOLDS_UTF8(&iter)) { return false; }
+    const char* str = bson_iter_utf8(&iter, NULL);
+    while (true) { // e.g., "0,1024,2048"
+        char* end = nullptr;
+        vint64_t offset = strtoll(str, &end, 10);
+        if (end == str) { return false; }
+        offsets.emplace_back(CVT_VINT(offset));
+        if (*end == '\0') { break; }
+        if (*end != ',') { return false; }
+        str = end + 1;
+    }
+    return true;
+}
+
+bool GridFsHeader::ValidWindow(const int srow, const int erow, const int scol, const int ecol,
+                               const string& filename) const {
+    int n_rows = Rows();
+    int n_cols = Cols();
+    if (n_rows <= 0 || n_cols <= 0 || Layers() <= 0 || CellsNumber() != n_rows * n_cols) {
+        StatusMessage("Only full-sized raster data can be read by window!");
+        return false;
+    }
+    if (srow < 0 || scol < 0 || srow > erow || scol > ecol || erow >= n_rows || ecol >= n_cols) {
+        StatusMessage("Window is out of the extent of raster " + filename + "!");
+        return false;
+    }
+    return true;
+}
+
+bool GridFsHeader::GetString(const char* key, string& value) const {
+    bson_iter_t iter;
+    if (nullptr == meta_ || !bson_iter_init_find(&iter, meta_, key)) { return false; }
+    value = GetStringFromBsonIterator(&iter);
+    return true;
+}
+
+void GridFsHeader::ToHeaders(STRDBL_MAP& header, STRING_MAP& header_str) const {
+    bson_iter_t iter;
+    if (nullptr == meta_ || !bson_iter_init(&iter, meta_)) { return; }
+    while (bson_iter_next(&iter)) {
+        const char* key = bson_iter_key(&iter);
+        if (strcmp(key, HEADER_RS_TILE_INDEX) == 0) { continue; }
+        auto it = header.find(key);
+        if (it == header.end()) {
+            header_str[key] = GetStringFromBsonIterator(&iter);
+            continue;
+        }
+        int idx = NumericKeyIndex(key);
+        if (idx >= 0) {
+            it->second = values_[idx]; // decoded already
+        }
+        else {
+            GetNumericFromBsonIterator(&iter, it->second);
+        }
+    }
+}
+#endif /* USE_MONGODB */
+
+vint64_t HilbertCurveIndex(const int n, int row, int col) {
+    vint64_t d = 0;
+    for (int s = n / 2; s > 0; s /= 2) {
+        int rx = (col & s) > 0 ? 1 : 0;
+        int ry = (row & s) > 0 ? 1 : 0;
+        d += static_cast<vint64_t>(s) * s * ((3 * rx) ^ ry);
+        if (ry == 0) { // rotate the quadrant
+            if (rx == 1) {
+                col = n - 1 - col;
+                row = n - 1 - row;
+            }
+            int tmp = col;
+            col = row;
+            row = tmp;
+        }
+    }
+    return d;
+}
+
+bool PartitionByHilbertCurve(const int nrows, const int ncols, const int n, const int* posidx,
+                             const double* weights, const int nparts, vector<vector<int> >& parts) {
+    if (nrows <= 0 || ncols <= 0 || n <= 0 || nullptr == posidx || nparts <= 0) { return false; }
+    int side = 1;
+    while (side < nrows || side < ncols) { side *= 2; }
+    vector<std::pair<vint64_t, int> > curve(n);
+#pragma omp parallel for
+    for (int i = 0; i < n; i++) {
+        curve[i] = std::make_pair(HilbertCurveIndex(side, posidx[i] / ncols, posidx[i] % ncols), i);
+    }
+    std::sort(curve.begin(), curve.end());
+
+    double total = 0.;
+    if (nullptr != weights) {
+        for (int i = 0; i < n; i++) {
+            if (weights[i] > 0.) { total += weights[i]; } // NaN and negative weights are ignored
+        }
+    }
+    bool equal_weights = total <= 0.;
+    if (equal_weights) { total = CVT_DBL(n); }
+
+    parts.assign(nparts, vector<int>());
+    double cum = 0.;
+    for (int i = 0; i < n; i++) {
+        int cell = curve[i].second;
+        double w = 1.;
+        if (!equal_weights) { w = weights[cell] > 0. ? weights[cell] : 0.; }
+        // the part where the midpoint of the cell's weight falls into
+        int part = CVT_INT((cum + w * 0.5) * nparts / total);
+        if (part >= nparts) { part = nparts - 1; }
+        parts[part].emplace_back(cell);
+        cum += w;
+    }
+    for (auto it = parts.begin(); it != parts.end(); ++it) {
+        std::sort(it->begin(), it->end());
+    }
+    return true;
+}
+
 #ifdef USE_GDAL
 GDALDataType CvtToGDALDataType(const RasterDataType type) {
     switch (type) {
@@ -206,6 +495,223 @@ bool WriteAscHeaders(const string& filename, const STRDBL_MAP& header) {
     return true;
 }
 
+/* Start ValidCellSpans */
+ValidCellSpans::ValidCellSpans(): n_rows_(0), n_cols_(0), n_cells_(0) {
+}
+
+ValidCellSpans::ValidCellSpans(const int nrows, const int ncols, const int n, const int* posidx):
+    n_rows_(0), n_cols_(0), n_cells_(0) {
+    Build(nrows, ncols, n, posidx);
+}
+
+bool ValidCellSpans::Build(const int nrows, const int ncols, const int n, const int* posidx) {
+    n_rows_ = 0;
+    n_cols_ = 0;
+    n_cells_ = 0;
+    vector<Span>().swap(spans_);
+    vector<int>().swap(row_start_);
+    if (nrows <= 0 || ncols <= 0 || n < 0 || (n > 0 && nullptr == posidx)) { return false; }
+    vector<Span> spans;
+    for (int i = 0; i < n; i++) {
+        if (posidx[i] < 0 || posidx[i] >= nrows * ncols) { return false; }
+        if (i > 0 && posidx[i] <= posidx[i - 1]) { return false; } // MUST be ascending
+        int row = posidx[i] / ncols;
+        int col = posidx[i] % ncols;
+        if (!spans.empty() && spans.back().row == row && spans.back().ecol + 1 == col) {
+            spans.back().ecol = col;
+            continue;
+        }
+        Span span = {row, col, col, i};
+        spans.emplace_back(span);
+    }
+    row_start_.resize(nrows + 1, 0);
+    size_t ispan = 0;
+    for (int row = 0; row <= nrows; row++) {
+        while (ispan < spans.size() && spans[ispan].row < row) { ispan++; }
+        row_start_[row] = CVT_INT(ispan);
+    }
+    spans_.swap(spans);
+    n_rows_ = nrows;
+    n_cols_ = ncols;
+    n_cells_ = n;
+    return true;
+}
+
+bool ValidCellSpans::GetRowSpans(const int row, int* first, int* last) const {
+    if (row < 0 || row >= n_rows_) { return false; }
+    *first = row_start_[row];
+    *last = row_start_[row + 1];
+    return true;
+}
+
+int ValidCellSpans::GetIndex(const int row, const int col) const {
+    if (row < 0 || row >= n_rows_ || col < 0 || col >= n_cols_) { return -1; }
+    int left = row_start_[row];
+    int right = row_start_[row + 1] - 1;
+    while (left <= right) {
+        int middle = (left + right) / 2;
+        const Span& span = spans_[middle];
+        if (col < span.scol) { right = middle - 1; }
+        else if (col > span.ecol) { left = middle + 1; }
+        else { return span.offset + col - span.scol; }
+    }
+    return -1;
+}
+
+bool ValidCellSpans::GetRowCol(const int index, int* row, int* col) const {
+    if (index < 0 || index >= n_cells_ || spans_.empty()) { return false; }
+    int left = 0;
+    int right = CVT_INT(spans_.size()) - 1;
+    while (left < right) { // find the last span whose offset <= index
+        int middle = (left + right + 1) / 2;
+        if (spans_[middle].offset > index) { right = middle - 1; }
+        else { left = middle; }
+    }
+    *row = spans_[left].row;
+    *col = spans_[left].scol + index - spans_[left].offset;
+    return true;
+}
+
+bool ValidCellSpans::ToPositionIndex(int* posidx) const {
+    if (nullptr == posidx) { return false; }
+    for (auto it = spans_.begin(); it != spans_.end(); ++it) {
+        int start = it->row * n_cols_ + it->scol;
+        for (int k = 0; k <= it->ecol - it->scol; k++) {
+            posidx[it->offset + k] = start + k;
+        }
+    }
+    return true;
+}
+
+size_t ValidCellSpans::GetMemorySize() const {
+    return sizeof(ValidCellSpans) + spans_.capacity() * sizeof(Span) + row_start_.capacity() * sizeof(int);
+}
+/* End ValidCellSpans */
+
+/* Start SubsetArena */
+static const size_t SUBSET_ARENA_ALIGNMENT = 16; // alignment of each array handed out
+static const size_t SUBSET_ARENA_MIN_BLOCK = 64 * 1024;
+static const size_t SUBSET_ARENA_MAX_BLOCK = 64 * 1024 * 1024;
+
+static size_t AlignArenaBytes(const size_t bytes) {
+    return (bytes + SUBSET_ARENA_ALIGNMENT - 1) / SUBSET_ARENA_ALIGNMENT * SUBSET_ARENA_ALIGNMENT;
+}
+
+SubsetArena::SubsetArena(const size_t reserve /* = 0 */): offset_(0), used_(0) {
+    if (reserve > 0) { NewBlock(AlignArenaBytes(reserve)); }
+}
+
+SubsetArena::~SubsetArena() {
+    for (auto it = blocks_.begin(); it != blocks_.end(); ++it) {
+        ReleaseAlignedMemory(it->first);
+    }
+    blocks_.clear();
+}
+
+bool SubsetArena::NewBlock(const size_t bytes) {
+    char* block = static_cast<char*>(AllocateAlignedMemory(bytes));
+    if (nullptr == block) { return false; }
+    blocks_.emplace_back(block, bytes);
+    offset_ = 0;
+    return true;
+}
+
+void* SubsetArena::Allocate(const size_t bytes) {
+    if (bytes == 0) { return nullptr; }
+    size_t need = AlignArenaBytes(bytes);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (blocks_.empty() || offset_ + need > blocks_.back().second) {
+        size_t size = SUBSET_ARENA_MIN_BLOCK;
+        if (!blocks_.empty()) { size = Min(blocks_.back().second * 2, SUBSET_ARENA_MAX_BLOCK); }
+        if (size < need) { size = need; }
+        if (!NewBlock(size)) { return nullptr; }
+    }
+    char* ptr = blocks_.back().first + offset_;
+    offset_ += need;
+    used_ += need;
+    return ptr;
+}
+
+size_t SubsetArena::EstimatePositionBytes(const int nsubsets, const int ncells) {
+    if (nsubsets <= 0 || ncells <= 0) { return 0; }
+    // global_, local_posidx_, local_pos_ (row pointers and pool)
+    return CVT_SIZET(ncells) * (4 * sizeof(int) + sizeof(int*))
+            + CVT_SIZET(nsubsets) * 4 * SUBSET_ARENA_ALIGNMENT;
+}
+
+size_t SubsetArena::EstimateDataBytes(const int nsubsets, const int ncells, const int nlyrs) {
+    if (nsubsets <= 0 || ncells <= 0 || nlyrs <= 0) { return 0; }
+    if (nlyrs == 1) {
+        return CVT_SIZET(ncells) * sizeof(double) + CVT_SIZET(nsubsets) * SUBSET_ARENA_ALIGNMENT;
+    }
+    return CVT_SIZET(ncells) * (nlyrs * sizeof(double) + sizeof(double*))
+            + CVT_SIZET(nsubsets) * SUBSET_ARENA_ALIGNMENT;
+}
+
+size_t SubsetArena::GetBlockNumber() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return blocks_.size();
+}
+
+size_t SubsetArena::GetMemorySize() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t bytes = 0;
+    for (auto it = blocks_.begin(); it != blocks_.end(); ++it) { bytes += it->second; }
+    return bytes;
+}
+
+size_t SubsetArena::GetUsedSize() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return used_;
+}
+/* End SubsetArena */
+
+/* Start PositionTables */
+PositionTables::PositionTables(const int n, int** posdata, int* posidx, int* globalidx /* = nullptr */,
+                               const std::shared_ptr<SubsetArena>& owner /* = nullptr */):
+    n_cells(n), pos_data(posdata), pos_idx(posidx), global_idx(globalidx), arena(owner) {
+}
+
+PositionTables::~PositionTables() {
+    if (nullptr != arena) { return; } // the arrays will be released by the arena
+    if (nullptr != pos_data) { Release2DArray(pos_data); }
+    if (nullptr != pos_idx) { Release1DArray(pos_idx); }
+    if (nullptr != global_idx) { Release1DArray(global_idx); }
+}
+
+int** PositionTables::MaterializePositionData(const int* posidx, const int ncols) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (nullptr != pos_data || nullptr == posidx || ncols <= 0 || n_cells <= 0) { return pos_data; }
+    if (nullptr != arena) {
+        pos_data = arena->Allocate2D(n_cells, 2, 0);
+        if (nullptr == pos_data) { return nullptr; }
+    } else {
+        Initialize2DArray(n_cells, 2, pos_data, 0);
+    }
+#pragma omp parallel for
+    for (int i = 0; i < n_cells; i++) {
+        pos_data[i][0] = posidx[i] / ncols;
+        pos_data[i][1] = posidx[i] % ncols;
+    }
+    return pos_data;
+}
+
+int** PositionTables::GetPositionData() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pos_data;
+}
+
+std::shared_ptr<ValidCellSpans> PositionTables::MaterializeSpans(const int* posidx, const int nrows,
+                                                                 const int ncols) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (nullptr != spans || nullptr == posidx) { return spans; }
+    std::shared_ptr<ValidCellSpans> tmp = std::make_shared<ValidCellSpans>();
+    if (!tmp->Build(nrows, ncols, n_cells, posidx)) { return nullptr; }
+    spans = tmp;
+    return spans;
+}
+/* End PositionTables */
+
 /* Start SubsetPositions */
 bool SubsetPositions::Initialization() {
     usable = true;
@@ -216,14 +722,136 @@ bool SubsetPositions::Initialization() {
     g_scol = -1;
     g_ecol = -1;
     alloc_ = false;
+    tables_ = nullptr;
+    arena_ = nullptr;
+    halo_ = nullptr;
     local_pos_ = nullptr;
     local_posidx_ = nullptr;
     global_ = nullptr;
-    data_ = nullptr;
-    data2d_ = nullptr;
+    data_type_ = RDT_Unknown;
+    payload_ = nullptr;
+    payload2d_ = nullptr;
+    payload_bytes_ = 0;
+    payload2d_bytes_ = 0;
+    payload_in_arena_ = false;
+    payload2d_in_arena_ = false;
+    arena_released_ = false;
+    spare_ = nullptr;
+    spare_bytes_ = 0;
     return true;
 }
 
+void SubsetPositions::ReleasePositions() {
+    if (alloc_) {
+        if (nullptr != local_pos_) { Release2DArray(local_pos_); }
+        if (nullptr != local_posidx_) { Release1DArray(local_posidx_); }
+        if (nullptr != global_) { Release1DArray(global_); }
+    }
+    local_pos_ = nullptr;
+    local_posidx_ = nullptr;
+    global_ = nullptr;
+    tables_ = nullptr; // the shared tables will be released by the last owner
+    halo_ = nullptr; // the halo depends on positions
+    alloc_ = false;
+}
+
+bool SubsetPositions::AllocatePositions() {
+    ReleasePositions();
+    if (n_cells <= 0) { return false; }
+    if (nullptr != arena_) {
+        global_ = arena_->Allocate1D(n_cells, -1);
+        local_pos_ = arena_->Allocate2D(n_cells, 2, -1);
+        local_posidx_ = arena_->Allocate1D(n_cells, -1);
+        return nullptr != global_ && nullptr != local_pos_ && nullptr != local_posidx_;
+    }
+    alloc_ = true;
+    return Initialize1DArray(n_cells, global_, -1)
+            && Initialize2DArray(n_cells, 2, local_pos_, -1)
+            && Initialize1DArray(n_cells, local_posidx_, -1);
+}
+
+void* SubsetPositions::AllocatePayload(const size_t bytes, size_t& capacity, bool& in_arena) {
+    capacity = bytes;
+    in_arena = false;
+    if (nullptr != spare_ && bytes <= spare_bytes_) { // reuse the slot of released data
+        void* block = spare_;
+        capacity = spare_bytes_;
+        in_arena = true;
+        spare_ = nullptr;
+        spare_bytes_ = 0;
+        return block;
+    }
+    if (nullptr != arena_ && !arena_released_) {
+        void* block = arena_->Allocate(bytes);
+        in_arena = nullptr != block;
+        return block;
+    }
+    return AllocateAlignedMemory(bytes);
+}
+
+void SubsetPositions::ReleasePayload(void*& block, size_t& capacity, bool& in_arena) {
+    if (nullptr != block) {
+        if (in_arena) { // released by the arena, keep the larger slot to be reused
+            arena_released_ = true;
+            if (capacity > spare_bytes_) {
+                spare_ = block;
+                spare_bytes_ = capacity;
+            }
+        } else {
+            ReleaseAlignedMemory(block);
+        }
+    }
+    block = nullptr;
+    capacity = 0;
+    in_arena = false;
+}
+
+void SubsetPositions::ReleaseData() {
+    ReleasePayload(payload_, payload_bytes_, payload_in_arena_);
+    ReleasePayload(payload2d_, payload2d_bytes_, payload2d_in_arena_);
+    data_type_ = RDT_Unknown;
+}
+
+bool SubsetPositions::CopyPayload(const SubsetPositions* src) {
+    if (nullptr == src->payload_ && nullptr == src->payload2d_) { return true; }
+    bool flag = false;
+    switch (src->data_type_) {
+        case RDT_UInt8:  flag = CopyPayloadAs<vuint8_t>(src); break;
+        case RDT_Int8:   flag = CopyPayloadAs<vint8_t>(src); break;
+        case RDT_UInt16: flag = CopyPayloadAs<vuint16_t>(src); break;
+        case RDT_Int16:  flag = CopyPayloadAs<vint16_t>(src); break;
+        case RDT_UInt32: flag = CopyPayloadAs<vuint32_t>(src); break;
+        case RDT_Int32:  flag = CopyPayloadAs<vint32_t>(src); break;
+        case RDT_UInt64: flag = CopyPayloadAs<vuint64_t>(src); break;
+        case RDT_Int64:  flag = CopyPayloadAs<vint64_t>(src); break;
+        case RDT_Float:  flag = CopyPayloadAs<float>(src); break;
+        case RDT_Double: flag = CopyPayloadAs<double>(src); break;
+        default: return false;
+    }
+    n_lyrs = src->n_lyrs;
+    usable = src->usable;
+    return flag;
+}
+
+std::shared_ptr<ValidCellSpans> SubsetPositions::GetSpans() {
+    if (nullptr == local_posidx_ || n_cells <= 0) { return nullptr; }
+    std::shared_ptr<PositionTables> tables = GetSharedPositions();
+    if (nullptr == tables || tables->pos_idx != local_posidx_) { return nullptr; }
+    return tables->MaterializeSpans(local_posidx_, g_erow - g_srow + 1, g_ecol - g_scol + 1);
+}
+
+std::shared_ptr<PositionTables> SubsetPositions::GetSharedPositions() {
+    if (alloc_) { // transfer the ownership of self-allocated tables
+        tables_ = std::make_shared<PositionTables>(n_cells, local_pos_, local_posidx_, global_);
+        alloc_ = false;
+    }
+    else if (nullptr == tables_ && nullptr != arena_ && nullptr != local_posidx_) {
+        // tables allocated from arena, which will be kept alive by the shared tables
+        tables_ = std::make_shared<PositionTables>(n_cells, local_pos_, local_posidx_, global_, arena_);
+    }
+    return tables_;
+}
+
 SubsetPositions::SubsetPositions() {
     Initialization();
 }
@@ -236,8 +864,10 @@ SubsetPositions::SubsetPositions(const int srow, const int erow, const int scol,
     g_ecol = ecol;
 }
 
-SubsetPositions::SubsetPositions(SubsetPositions*& src, const bool deep_copy) {
+SubsetPositions::SubsetPositions(SubsetPositions*& src, const bool deep_copy,
+                                 const std::shared_ptr<SubsetArena>& arena /* = nullptr */) {
     Initialization();
+    arena_ = arena;
     usable = src->usable;
     n_cells = src->n_cells;
     n_lyrs = src->n_lyrs;
@@ -246,93 +876,30 @@ SubsetPositions::SubsetPositions(SubsetPositions*& src, const bool deep_copy) {
     g_scol = src->g_scol;
     g_ecol = src->g_ecol;
     if (deep_copy) {
-        alloc_ = true;
-        Initialize1DArray(n_cells, global_, src->global_);
-        Initialize2DArray(n_cells, 2, local_pos_, src->local_pos_);
-        Initialize1DArray(n_cells, local_posidx_, src->local_posidx_);
-        if (nullptr != src->data_) {
-            Initialize1DArray(n_cells, data_, src->data_);
-        }
-        if (nullptr != src->data2d_) {
-            Initialize2DArray(n_cells, n_lyrs, data2d_, src->data2d_);
+        if (AllocatePositions()) {
+            for (int i = 0; i < n_cells; i++) {
+                global_[i] = src->global_[i];
+                local_pos_[i][0] = src->local_pos_[i][0];
+                local_pos_[i][1] = src->local_pos_[i][1];
+                local_posidx_[i] = src->local_posidx_[i];
+            }
         }
+        CopyPayload(src);
     }
-    else {
+    else { // share the immutable positions, while data MUST be set independently
         alloc_ = false;
+        tables_ = src->GetSharedPositions();
         global_ = src->global_;
         local_pos_ = src->local_pos_;
         local_posidx_ = src->local_posidx_;
-        if (nullptr != src->data_) { data_ = src->data_; }
-        if (nullptr != src->data2d_) { data2d_ = src->data2d_; }
     }
+    halo_ = src->halo_; // immutable, and valid for the same positions
 }
 
 SubsetPositions::~SubsetPositions() {
-    if (nullptr != local_pos_) {
-        if (alloc_) { Release2DArray(local_pos_); }
-        else { local_pos_ = nullptr; }
-    }
-    if (nullptr != local_posidx_) {
-        if (alloc_) { Release1DArray(local_posidx_); }
-        else { local_posidx_ = nullptr; }
-    }
-    if (nullptr != global_) {
-        if (alloc_) { Release1DArray(global_); }
-        else { global_ = nullptr; }
-    }
-    if (nullptr != data_) { Release1DArray(data_); }
-    if (nullptr != data2d_) { Release2DArray(data2d_); }
-}
-
-#ifdef USE_MONGODB
-bool SubsetPositions::ReadFromMongoDB(MongoGridFs* gfs, const string& fname, const STRING_MAP& opts) {
-    double* dbdata = nullptr;
-    STRDBL_MAP header_dbl = InitialHeader();
-    STRING_MAP header_str = InitialStrHeader();
-    if (!ReadGridFsFile(gfs, fname, dbdata, header_dbl, header_str, opts)) { return false; }
-    int nrows = g_erow - g_srow + 1;
-    int ncols = g_ecol - g_scol + 1;
-    int nfull = nrows * ncols;
-    int db_ncells = CVT_INT(header_dbl.at(HEADER_RS_CELLSNUM));
-    int db_nlyrs = CVT_INT(header_dbl.at(HEADER_RS_LAYERS));
-    if ((nfull != db_ncells && n_cells != db_ncells) || db_nlyrs < 0) {
-        Release1DArray(dbdata);
-        return false;
-    }
-    n_lyrs = db_nlyrs;
-    if (n_lyrs == 1) {
-        if (n_cells == db_ncells) {
-            bool set_success = SetData(db_ncells, dbdata);
-            Release1DArray(dbdata);
-            return set_success;
-        }
-        if (nullptr == data_) {
-            Initialize1DArray(n_cells, data_, NODATA_VALUE);
-        }
-        for (int i = 0; i < n_cells; i++) {
-            //data_[i] = dbdata[local_pos_[i][0] * ncols + local_pos_[i][1]];
-            data_[i] = dbdata[local_posidx_[i]];
-        }
-    }
-    else {
-        if (nullptr == data2d_) {
-            Initialize2DArray(n_cells, n_lyrs, data2d_, NODATA_VALUE);
-        }
-        for (int i = 0; i < n_cells; i++) {
-            for (int j = 0; j < n_lyrs; j++) {
-                if (nfull == db_ncells) { // consider data from MongoDB is fullsize data
-                    //data2d_[i][j] = dbdata[(local_pos_[i][0] * ncols + local_pos_[i][1]) * n_lyrs + j];
-                    data2d_[i][j] = dbdata[local_posidx_[i] * n_lyrs + j];
-                }
-                else { data2d_[i][j] = dbdata[i * n_lyrs + j]; }
-            }
-        }
-    }
-    usable = true;
-    Release1DArray(dbdata);
-    return true;
+    ReleasePositions();
+    ReleaseData();
 }
-#endif
 
 void SubsetPositions::GetHeader(const double gxll, const double gyll, const int gnrows,
                                 const double cellsize, const double nodata, STRDBL_MAP& subheader) {
@@ -347,5 +914,67 @@ void SubsetPositions::GetHeader(const double gxll, const double gyll, const int
 }
 
 /* End SubsetPositions */
+
+MaskGridMapping::MaskGridMapping(const STRDBL_MAP& header) :
+    n_rows(-1), n_cols(-1), xll(NODATA_VALUE), yll(NODATA_VALUE), cellsize(NODATA_VALUE) {
+    if (header.find(HEADER_RS_NROWS) != header.end()) { n_rows = CVT_INT(header.at(HEADER_RS_NROWS)); }
+    if (header.find(HEADER_RS_NCOLS) != header.end()) { n_cols = CVT_INT(header.at(HEADER_RS_NCOLS)); }
+    if (header.find(HEADER_RS_XLL) != header.end()) { xll = header.at(HEADER_RS_XLL); }
+    if (header.find(HEADER_RS_YLL) != header.end()) { yll = header.at(HEADER_RS_YLL); }
+    if (header.find(HEADER_RS_CELLSIZE) != header.end()) { cellsize = header.at(HEADER_RS_CELLSIZE); }
+}
+
+bool MaskGridMapping::Matches(const STRDBL_MAP& header) const {
+    MaskGridMapping other(header);
+    return n_rows == other.n_rows && n_cols == other.n_cols
+            && FloatEqual(xll, other.xll) && FloatEqual(yll, other.yll)
+            && FloatEqual(cellsize, other.cellsize);
+}
+
+void SubsetCombinePlan::Build(const map<int, SubsetPositions*>& subsets, const int* pos_idx) {
+    ids.clear();
+    subs.clear();
+    globals.clear();
+    offset.clear();
+    dst.clear();
+    posidx = pos_idx;
+    size_t ncells = 0;
+    offset.emplace_back(ncells);
+    for (auto it = subsets.begin(); it != subsets.end(); ++it) {
+        if (nullptr == it->second) { continue; }
+        ids.emplace_back(it->first);
+        subs.emplace_back(it->second);
+        globals.emplace_back(it->second->global_);
+        ncells += it->second->n_cells > 0 ? CVT_SIZET(it->second->n_cells) : 0;
+        offset.emplace_back(ncells);
+    }
+    dst.resize(ncells);
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < CVT_INT(subs.size()); i++) {
+        int* cur = dst.empty() ? nullptr : &dst[offset[i]];
+        const int* global = subs[i]->global_;
+        int n = CVT_INT(offset[i + 1] - offset[i]);
+        if (nullptr == pos_idx) {
+            for (int vi = 0; vi < n; vi++) { cur[vi] = global[vi]; }
+        } else {
+            for (int vi = 0; vi < n; vi++) { cur[vi] = pos_idx[global[vi]]; }
+        }
+    }
+}
+
+bool SubsetCombinePlan::Matches(const map<int, SubsetPositions*>& subsets, const int* pos_idx) const {
+    if (pos_idx != posidx) { return false; }
+    size_t i = 0;
+    for (auto it = subsets.begin(); it != subsets.end(); ++it) {
+        if (nullptr == it->second) { continue; }
+        if (i >= subs.size() || ids[i] != it->first || subs[i] != it->second
+            || globals[i] != it->second->global_
+            || offset[i + 1] - offset[i] != CVT_SIZET(it->second->n_cells > 0 ? it->second->n_cells : 0)) {
+            return false;
+        }
+        i++;
+    }
+    return i == subs.size();
+}
 } // namespace data_raster
 } // namespace ccgl
@@ -24,6 +24,9 @@
  *                     Add subset feature to support data decomposition and combination.
  *   -12. Jul. 2023 lj Add valid position index (1D array, pos_idx_) and will remove pos_data_ in next version.
  *   -13. Aug. 2023 lj Add GDAL data types added from versions 3.5 and 3.7
+ *   -14. 2026-10-18 agent SubsetPositions stores data in its own type, i.e., payload_ and payload2d_
+ *                         accessed by GetData<T>() and Get2DData<T>(), which replace the double
+ *                         arrays data_ and data2d_.
  *
  * \author Liangjun Zhu, zlj(at)lreis.ac.cn
  * \version 2.8
@@ -35,10 +38,15 @@
 #include <string>
 #include <map>
 #include <set>
+#include <algorithm>
 #include <fstream>
 #include <iomanip>
 #include <typeinfo>
 #include <cassert>
+#include <memory>
+#include <list>
+#include <mutex>
+#include <atomic>
 // include openmp if supported
 #ifdef SUPPORT_OMP
 #include <omp.h>
@@ -49,6 +57,7 @@
 #include "utils_string.h"
 #include "utils_array.h"
 #include "utils_math.h"
+#include "utils_codec.h"
 
 #include "gdal_handler.h"
 #include "db_mongoc.h"
@@ -69,6 +78,7 @@ using namespace utils_string;
 using namespace utils_filesystem;
 using namespace utils_array;
 using namespace utils_math;
+using namespace utils_codec;
 #ifdef USE_MONGODB
 using namespace db_mongoc;
 #endif /* USE_MONGODB */
@@ -93,6 +103,9 @@ CONST_CHARS HEADER_RS_DATATYPE = "DATATYPE"; /// Data type of original raster
 CONST_CHARS HEADER_RSOUT_DATATYPE = "DATATYPE_OUT"; /// Desired output data type of raster
 CONST_CHARS HEADER_INC_NODATA = "INCLUDE_NODATA"; /// Include nodata ("TRUE") or not ("FALSE"), for DB only
 CONST_CHARS HEADER_MASK_NAME = "MASK_NAME"; /// Mask layer's name if only store valid values
+CONST_CHARS HEADER_RS_CODEC = "CODEC"; /// Codecs of GridFS file, e.g., "DELTA+BITPACK", for DB only
+CONST_CHARS HEADER_RS_TILE_SIZE = "TILE_SIZE"; /// Size (cells) of square tiles of GridFS file, for DB only
+CONST_CHARS HEADER_RS_TILE_INDEX = "TILE_INDEX"; /// Byte offsets of raw tiles in GridFS file as binary, for DB only
 CONST_CHARS STATS_RS_VALIDNUM = "VALID_CELLNUMBER"; /// Valid cell number
 CONST_CHARS STATS_RS_MEAN = "MEAN"; /// Mean value
 CONST_CHARS STATS_RS_MIN = "MIN"; /// Minimum value
@@ -149,6 +162,33 @@ RasterDataType TypeToRasterDataType(const std::type_info& t);
  */
 double DefaultNoDataByType(RasterDataType type);
 
+/*!
+ * \brief Size in bytes of RasterDataType, 0 for RDT_Unknown
+ */
+size_t RasterDataTypeSize(RasterDataType type);
+
+/*!
+ * \brief Index of cell (row, col) along the Hilbert curve that fills a square of n * n cells
+ * \param[in] n Side length of the square, which MUST be a power of 2
+ * \param[in] row Row of the cell
+ * \param[in] col Col of the cell
+ */
+vint64_t HilbertCurveIndex(int n, int row, int col);
+
+/*!
+ * \brief Partition cells into contiguous and compact parts with balanced weights along the Hilbert curve
+ * \param[in] nrows Rows number of the raster
+ * \param[in] ncols Cols number of the raster
+ * \param[in] n Number of cells
+ * \param[in] posidx Position index of cells, i.e., row * ncols + col
+ * \param[in] weights Weights of cells, nullptr means equal weights. Negative weights are treated as 0.
+ * \param[in] nparts Number of parts
+ * \param[out] parts Index of cells (0 ~ n-1) of each part in ascending order, a part may be empty
+ *                   if the weights are extremely uneven
+ */
+bool PartitionByHilbertCurve(int nrows, int ncols, int n, const int* posidx, const double* weights,
+                             int nparts, vector<vector<int> >& parts);
+
 #ifdef USE_GDAL
 GDALDataType CvtToGDALDataType(RasterDataType type);
 #endif
@@ -855,440 +895,1983 @@ bool WriteRasterToFile(const string& filename, const STRDBL_MAP& header,
 #endif /* USE_GDAL */
 }
 
-#ifdef USE_MONGODB
 /*!
- * \brief Read GridFs file from MongoDB
- * \param[in] gfs MongoGridFs pointer
- * \param[in] filename GridFs filename
- * \param[out] data Data stored in GridFs file
- * \param[out] header Header information
- * \param[out] header_str Header information in strings
- * \param[in] opts Optional key-value stored in metadata, used to filter GridFs file
+ * \brief Copy values stored as SRC_T in a byte stream, which may be not aligned
  */
-template <typename T>
-bool ReadGridFsFile(MongoGridFs* gfs, const string& filename,
-                    T*& data, STRDBL_MAP& header,
-                    STRING_MAP& header_str,
-                    const STRING_MAP& opts /* = STRING_MAP() */) {
-    // Get stream data and metadata by file name
-    vint length;
-    char* buf = nullptr;
-    if (!gfs->GetStreamData(filename, buf, length, nullptr, &opts) ||
-        nullptr == buf) {
-        return false;
-    }
-    bson_t* bmeta = gfs->GetFileMetadata(filename, nullptr, opts);
-
-    // Retrieve raster header values
-    bson_iter_t iter; // Loop the metadata, add to `header_str` or `header`
-    if (nullptr != bmeta && bson_iter_init(&iter, bmeta)) {
-        while (bson_iter_next(&iter)) {
-            const char* key = bson_iter_key(&iter);
-            if (header.find(key) != header.end()) {
-                GetNumericFromBsonIterator(&iter, header[key]);
-            }
-            else {
-                header_str[key] = GetStringFromBsonIterator(&iter);
-            }
-        }
-    }
-    bson_destroy(bmeta); // Destroy bson of metadata immediately after use
-
-    int n_rows = CVT_INT(header.at(HEADER_RS_NROWS));
-    int n_cols = CVT_INT(header.at(HEADER_RS_NCOLS));
-    int n_lyrs = CVT_INT(header.at(HEADER_RS_LAYERS));
-    int n_cells = CVT_INT(header.at(HEADER_RS_CELLSNUM));
-    if (n_rows < 0 || n_cols < 0 || n_lyrs < 0) { // missing essential metadata
-        delete[] buf;
-        return false;
+template <typename SRC_T, typename T>
+void CopyStreamValues(const char* src, const vint count, T* dst) {
+    for (vint i = 0; i < count; i++) {
+        SRC_T v;
+        memcpy(&v, src + i * sizeof(SRC_T), sizeof(SRC_T));
+        dst[i] = static_cast<T>(v);
     }
-    int value_count = n_cells * n_lyrs;
-    size_t size_dtype = length / value_count;
+}
 
-    RasterDataType rstype = RDT_Unknown;
-    if (header_str.find(HEADER_RSOUT_DATATYPE) != header_str.end()) {
-        rstype = StringToRasterDataType(header_str.at(HEADER_RSOUT_DATATYPE));
-    }
-    if (rstype == RDT_Unknown) {
-        StatusMessage("Unknown data type in MongoDB GridFS!");
-        delete[] buf;
-        return false;
+/*!
+ * \brief Convert values of a given data type in a byte stream to the destination array
+ * \param[in] type Data type of values in stream
+ * \param[in] src Byte stream with at least `count * RasterDataTypeSize(type)` bytes
+ * \param[in] count Count of values
+ * \param[out] dst Destination array with at least `count` elements
+ * \return false if the data type is unknown
+ */
+template <typename T>
+bool ConvertStreamValues(const RasterDataType type, const char* src, const vint count, T* dst) {
+    switch (type) {
+        case RDT_UInt8:  CopyStreamValues<vuint8_t>(src, count, dst); return true;
+        case RDT_Int8:   CopyStreamValues<vint8_t>(src, count, dst); return true;
+        case RDT_UInt16: CopyStreamValues<vuint16_t>(src, count, dst); return true;
+        case RDT_Int16:  CopyStreamValues<vint16_t>(src, count, dst); return true;
+        case RDT_UInt32: CopyStreamValues<vuint32_t>(src, count, dst); return true;
+        case RDT_Int32:  CopyStreamValues<vint32_t>(src, count, dst); return true;
+        case RDT_UInt64: CopyStreamValues<vuint64_t>(src, count, dst); return true;
+        case RDT_Int64:  CopyStreamValues<vint64_t>(src, count, dst); return true;
+        case RDT_Float:  CopyStreamValues<float>(src, count, dst); return true;
+        case RDT_Double: CopyStreamValues<double>(src, count, dst); return true;
+        default:         return false;
     }
+}
 
-    if (rstype == RDT_Double && size_dtype == sizeof(double)) {
-        double* data_dbl = reinterpret_cast<double*>(buf);
-        Initialize1DArray(value_count, data, data_dbl);
-        //Release1DArray(data_dbl);
-    }
-    else if (rstype == RDT_Float && size_dtype == sizeof(float)) {
-        float* data_flt = reinterpret_cast<float*>(buf);
-        Initialize1DArray(value_count, data, data_flt);
-        //Release1DArray(data_flt);
-    }
-    else if (rstype == RDT_Int32 && size_dtype == sizeof(vint32_t)) {
-        vint32_t* data_int32 = reinterpret_cast<vint32_t*>(buf);
-        Initialize1DArray(value_count, data, data_int32);
-        //Release1DArray(data_int32);
-    }
-    else if (rstype == RDT_UInt32 && size_dtype == sizeof(vuint32_t)) {
-        vuint32_t* data_uint32 = reinterpret_cast<vuint32_t*>(buf);
-        Initialize1DArray(value_count, data, data_uint32);
-        //Release1DArray(data_uint32);
-    }
-    else if (rstype == RDT_Int64 && size_dtype == sizeof(vint64_t)) {
-        vint64_t* data_int64 = reinterpret_cast<vint64_t*>(buf);
-        Initialize1DArray(value_count, data, data_int64);
-        //Release1DArray(data_int64);
-    }
-    else if (rstype == RDT_UInt64 && size_dtype == sizeof(vuint64_t)) {
-        vuint64_t* data_uint64 = reinterpret_cast<vuint64_t*>(buf);
-        Initialize1DArray(value_count, data, data_uint64);
-        //Release1DArray(data_uint64);
-    }
-    else if (rstype == RDT_Int16 && size_dtype == sizeof(vint16_t)) {
-        vint16_t* data_int16 = reinterpret_cast<vint16_t*>(buf);
-        Initialize1DArray(value_count, data, data_int16);
-        //Release1DArray(data_int16);
-    }
-    else if (rstype == RDT_UInt16 && size_dtype == sizeof(vuint16_t)) {
-        vuint16_t* data_uint16 = reinterpret_cast<vuint16_t*>(buf);
-        Initialize1DArray(value_count, data, data_uint16);
-        //Release1DArray(data_uint16);
-    }
-    else if (rstype == RDT_Int8 && size_dtype == sizeof(vint8_t)) {
-        vint8_t* data_int8 = reinterpret_cast<vint8_t*>(buf);
-        Initialize1DArray(value_count, data, data_int8);
-        //Release1DArray(data_int8);
-    }
-    else if (rstype == RDT_UInt8 && size_dtype == sizeof(vuint8_t)) {
-        vuint8_t* data_uint8 = reinterpret_cast<vuint8_t*>(buf);
-        Initialize1DArray(value_count, data, data_uint8);
-        //Release1DArray(data_uint8);
-    }
-    else {
-        StatusMessage("Unconsistent of data type and size!");
-        delete[] buf;
-        return false;
+/*!
+ * \brief Copy values to a byte stream as DST_T, which may be not aligned
+ */
+template <typename DST_T, typename T>
+void CopyToStreamValues(const T* src, const vint count, char* dst) {
+    for (vint i = 0; i < count; i++) {
+        DST_T v = static_cast<DST_T>(src[i]);
+        memcpy(dst + i * sizeof(DST_T), &v, sizeof(DST_T));
     }
-    delete[] buf;
-    return true;
 }
 
 /*!
- * \brief Write array data (both valid and full-sized raster data) as GridFS file.
- *        If the file exists, delete it first.
- * \param[in] gfs GridFs of MongoDB
- * \param[in] filename GridFS file name
- * \param[in] header header information
- * \param[in] values float raster data array
- * \param[in] datalength Length of data
- * \param[in] opts (optional) Key-value map for user-specific metadata
+ * \brief Convert values to a byte stream of a given data type, \sa ConvertStreamValues()
+ * \param[in] type Data type of values in stream
+ * \param[in] src Source array with at least `count` elements
+ * \param[in] count Count of values
+ * \param[out] dst Byte stream with at least `count * RasterDataTypeSize(type)` bytes
+ * \return false if the data type is unknown
  */
 template <typename T>
-bool WriteStreamDataAsGridfs(MongoGridFs* gfs, const string& filename,
-                             STRDBL_MAP& header, T* values, const int datalength,
-                             const STRING_MAP& opts = STRING_MAP()) {
-    STRING_MAP curopts;
-    CopyStringMap(opts, curopts);
-    RasterDataType temp_type = TypeToRasterDataType(typeid(T));
-    if (curopts.find(HEADER_RSOUT_DATATYPE) == curopts.end()) {
-        UpdateStringMap(curopts, HEADER_RSOUT_DATATYPE, RasterDataTypeToString(temp_type));
-    }
-    gfs->RemoveFile(filename, nullptr, curopts);
-    bson_t p = BSON_INITIALIZER;
-    double intpart; // https://stackoverflow.com/a/1521682/4837280
-    for (auto iter = header.begin(); iter != header.end(); ++iter) {
-        if (!StringMatch(HEADER_RS_NODATA, iter->first)
-            && std::modf(iter->second, &intpart) == 0.0) {
-            // std::modf consider inf as an integer,
-            // hence cannot handle -3.40282346639e+38 which is one of commonly used Nodata
-            BSON_APPEND_INT32(&p, iter->first.c_str(), CVT_INT(iter->second));
-        }
-        else {
-            BSON_APPEND_DOUBLE(&p, iter->first.c_str(), iter->second);
-        }
-    }
-    // Check DATATYPE in metadata is consistent with T, transform if necessary
-    char* buf = nullptr;
-    vint buflength = -1;
-    bool transformed = true;
-    RasterDataType opt_type = StringToRasterDataType(curopts.at(HEADER_RSOUT_DATATYPE));
-    if (opt_type == temp_type) {
-        buf = reinterpret_cast<char*>(values);
-        buflength = datalength * sizeof(T);
-        transformed = false;
-    } else {
-        if (opt_type == RDT_UInt8) {
-            vuint8_t* newdata = nullptr;
-            Initialize1DArray(datalength, newdata, values);
-            buf = reinterpret_cast<char*>(newdata);
-            buflength = datalength * sizeof(vuint8_t);
-        } else if (opt_type == RDT_Int8) {
-            vint8_t* newdata = nullptr;
-            Initialize1DArray(datalength, newdata, values);
-            buf = reinterpret_cast<char*>(newdata);
-            buflength = datalength * sizeof(vint8_t);
-        } else if (opt_type == RDT_UInt16) {
-            vuint16_t* newdata = nullptr;
-            Initialize1DArray(datalength, newdata, values);
-            buf = reinterpret_cast<char*>(newdata);
-            buflength = datalength * sizeof(vuint16_t);
-        } else if (opt_type == RDT_Int16) {
-            vint16_t* newdata = nullptr;
-            Initialize1DArray(datalength, newdata, values);
-            buf = reinterpret_cast<char*>(newdata);
-            buflength = datalength * sizeof(vint16_t);
-        } else if (opt_type == RDT_UInt32) {
-            vuint32_t* newdata = nullptr;
-            Initialize1DArray(datalength, newdata, values);
-            buf = reinterpret_cast<char*>(newdata);
-            buflength = datalength * sizeof(vuint32_t);
-        } else if (opt_type == RDT_Int32) {
-            vint32_t* newdata = nullptr;
-            Initialize1DArray(datalength, newdata, values);
-            buf = reinterpret_cast<char*>(newdata);
-            buflength = datalength * sizeof(vint32_t);
-        } else if (opt_type == RDT_Float) {
-            float* newdata = nullptr;
-            Initialize1DArray(datalength, newdata, values);
-            buf = reinterpret_cast<char*>(newdata);
-            buflength = datalength * sizeof(float);
-        } else if (opt_type == RDT_Double) {
-            double* newdata = nullptr;
-            Initialize1DArray(datalength, newdata, values);
-            buf = reinterpret_cast<char*>(newdata);
-            buflength = datalength * sizeof(double);
-        }
-    }
-    // Add user-specific key-values into metadata
-    AppendStringOptionsToBson(&p, curopts);
-
-    int try_times = 0;
-    bool gstatus = false;
-    while (try_times <= 3) { // Try 3 times
-        gstatus = gfs->WriteStreamData(filename, buf, buflength, &p);
-        if (gstatus) { break; }
-        SleepMs(2); // Sleep 0.002 sec and retry
-        try_times++;
+bool ConvertToStreamValues(const RasterDataType type, const T* src, const vint count, char* dst) {
+    switch (type) {
+        case RDT_UInt8:  CopyToStreamValues<vuint8_t>(src, count, dst); return true;
+        case RDT_Int8:   CopyToStreamValues<vint8_t>(src, count, dst); return true;
+        case RDT_UInt16: CopyToStreamValues<vuint16_t>(src, count, dst); return true;
+        case RDT_Int16:  CopyToStreamValues<vint16_t>(src, count, dst); return true;
+        case RDT_UInt32: CopyToStreamValues<vuint32_t>(src, count, dst); return true;
+        case RDT_Int32:  CopyToStreamValues<vint32_t>(src, count, dst); return true;
+        case RDT_UInt64: CopyToStreamValues<vuint64_t>(src, count, dst); return true;
+        case RDT_Int64:  CopyToStreamValues<vint64_t>(src, count, dst); return true;
+        case RDT_Float:  CopyToStreamValues<float>(src, count, dst); return true;
+        case RDT_Double: CopyToStreamValues<double>(src, count, dst); return true;
+        default:         return false;
     }
-    bson_destroy(&p);
-    if (transformed) { delete[] buf; }
-    return gstatus;
 }
 
-#endif /* USE_MONGODB */
-
 /*!
- * \class SubsetPositions
- * \brief Subset positions of raster data
+ * \class RasterTiles
+ * \brief Square tiles of a raster in row-major order, the tiles in the last row and column
+ *        may be smaller. Tiles are the separately addressable parts of tiled GridFS file.
  */
-class SubsetPositions: NotCopyable {
+class RasterTiles {
 public:
-    SubsetPositions();
+    /*! Constructor by the raster size and the tile size (cells) */
+    RasterTiles(int nrows, int ncols, int tile_size);
 
-    SubsetPositions(int srow, int erow, int scol, int ecol);
+    /*! The raster size and the tile size are valid */
+    bool Valid() const { return n_rows_ > 0 && n_cols_ > 0 && size_ > 0; }
 
-    explicit SubsetPositions(SubsetPositions*& src, bool deep_copy = false);
+    /*! Tiles number */
+    int Count() const { return n_tile_rows_ * n_tile_cols_; }
 
-    ~SubsetPositions();
+    /*! Tile size (cells) */
+    int TileSize() const { return size_; }
 
-    bool Initialization();
+    /*! Extent of a tile, i.e., rows from srow to erow and columns from scol to ecol */
+    void Extent(int tile, int& srow, int& erow, int& scol, int& ecol) const;
 
-    template <typename T>
-    bool SetData(const int n, T* data) {
-        if (n != n_cells) { return false; }
-        if (nullptr == data) { return false; }
-        if (1 != n_lyrs) { n_lyrs = 1; }
-        if (nullptr != data_) {
-            for (int i = 0; i < n_cells; i++) { data_[i] = CVT_DBL(data[i]); }
-        } else {
-            Initialize1DArray(n_cells, data_, data);
-        }
-        usable = true;
-        return true;
-    }
+    /*! Cells number of a tile */
+    int CellsNumber(int tile) const;
 
-    template <typename T>
-    bool Set2DData(const int n, const int lyr, T** data2d) {
-        if (n != n_cells) { return false; }
-        if (nullptr == data2d) { return false; }
-        if (lyr != n_lyrs) { n_lyrs = lyr; }
-        if (nullptr != data2d_) {
-            for (int i = 0; i < n_cells; i++) {
-                for (int j = 0; j < n_lyrs; j++) {
-                    data2d_[i][j] = CVT_DBL(data2d[i][j]);
-                }
-            }
-        } else {
-            Initialize2DArray(n_cells, n_lyrs, data2d_, data2d);
+    /*! Tiles intersecting with the window in ascending order, false if the window is invalid */
+    bool InWindow(int srow, int erow, int scol, int ecol, vector<int>& tiles) const;
+
+    /*!
+     * \brief Byte offsets of tiles without codecs, i.e., Count() + 1 offsets
+     * \param[in] n_lyrs Layers number
+     * \param[in] size_dtype Bytes of each value
+     * \param[out] offsets Offset of each tile and the total bytes
+     */
+    void RawOffsets(int n_lyrs, size_t size_dtype, vector<vint>& offsets) const;
+
+private:
+    int n_rows_;      ///< Rows number of raster
+    int n_cols_;      ///< Columns number of raster
+    int size_;        ///< Rows and columns number of each tile
+    int n_tile_rows_; ///< Rows number of tiles
+    int n_tile_cols_; ///< Columns number of tiles
+};
+
+/*!
+ * \brief Append byte offsets of tiles to the tile index, i.e., 64-bit integers in little-endian,
+ *        which is stored in metadata (TILE_INDEX) or appended to the encoded tiles
+ */
+void AppendTileIndex(const vector<vint>& offsets, vector<char>& dst);
+
+/*! Parse byte offsets of tiles from the tile index, \sa AppendTileIndex() */
+bool ParseTileIndex(const char* src, size_t len, vector<vint>& offsets);
+
+/*!
+ * \brief Convert values of a tile from the full-sized raster data to a byte stream
+ * \param[in] tiles Tiles of raster
+ * \param[in] tile Tile index
+ * \param[in] n_lyrs Layers number, values of layers are continuous for each cell
+ * \param[in] type Data type of values in stream
+ * \param[in] values Full-sized raster data
+ * \param[in] ncols Columns number of raster
+ * \param[out] dst Byte stream with at least `CellsNumber(tile) * n_lyrs * RasterDataTypeSize(type)` bytes
+ */
+template <typename T>
+bool ConvertToTileValues(const RasterTiles& tiles, const int tile, const int n_lyrs,
+                         const RasterDataType type, const T* values, const int ncols, char* dst) {
+    int srow, erow, scol, ecol;
+    tiles.Extent(tile, srow, erow, scol, ecol);
+    size_t row_bytes = CVT_SIZET(ecol - scol + 1) * n_lyrs * RasterDataTypeSize(type);
+    for (int i = srow; i <= erow; i++) {
+        if (!ConvertToStreamValues(type, values + (CVT_VINT(i) * ncols + scol) * n_lyrs,
+                                   CVT_VINT(ecol - scol + 1) * n_lyrs, dst)) {
+            return false;
         }
-        usable = true;
-        return true;
+        dst += row_bytes;
     }
-#ifdef USE_MONGODB
-    bool ReadFromMongoDB(MongoGridFs* gfs, const string& fname,
-                         const STRING_MAP& opts = STRING_MAP());
-#endif
-    void GetHeader(double gxll, double gyll, int gnrows, double cellsize,
-                   double nodata, STRDBL_MAP& subheader);
-    template <typename T>
-    void Output(T nodata, vector<T*>& fulldata) {
-        if (nullptr == data_ && nullptr == data2d_) { return; }
-        int nrows = g_erow - g_srow + 1;
-        int ncols = g_ecol - g_scol + 1;
-        int fullsize = nrows * ncols;
-        for (int ilyr = 0; ilyr < n_lyrs; ilyr++) {
-            T* tmpdata = nullptr;
-            Initialize1DArray(fullsize, tmpdata, nodata);
-            for (int vi = 0; vi < n_cells; vi++) {
-                //int j = local_pos_[vi][0] * ncols + local_pos_[vi][1];
-                int j = local_posidx_[vi];
-                if (n_lyrs > 1 && nullptr != data2d_) {
-                    tmpdata[j] = static_cast<T>(data2d_[vi][ilyr]);
-                }
-                else if (n_lyrs == 1 && nullptr != data_) {
-                    tmpdata[j] = static_cast<T>(data_[vi]);
-                }
-            }
-            fulldata.emplace_back(tmpdata);
+    return true;
+}
+
+/*!
+ * \brief Convert values of a tile in a byte stream to the intersected part of a window
+ * \param[in] tiles Tiles of raster
+ * \param[in] tile Tile index
+ * \param[in] n_lyrs Layers number, values of layers are continuous for each cell
+ * \param[in] type Data type of values in stream
+ * \param[in] src Byte stream of the tile, \sa ConvertToTileValues()
+ * \param[in] srow,erow,scol,ecol Extent of the window
+ * \param[out] window Data of the window in row-major order
+ */
+template <typename T>
+bool ConvertTileValues(const RasterTiles& tiles, const int tile, const int n_lyrs,
+                       const RasterDataType type, const char* src,
+                       const int srow, const int erow, const int scol, const int ecol, T* window) {
+    int t_srow, t_erow, t_scol, t_ecol;
+    tiles.Extent(tile, t_srow, t_erow, t_scol, t_ecol);
+    int r0 = Max(srow, t_srow);
+    int r1 = Min(erow, t_erow);
+    int c0 = Max(scol, t_scol);
+    int c1 = Min(ecol, t_ecol);
+    if (r0 > r1 || c0 > c1) { return true; } // no intersection
+    size_t size_dtype = RasterDataTypeSize(type);
+    int tile_cols = t_ecol - t_scol + 1;
+    int win_cols = ecol - scol + 1;
+    for (int i = r0; i <= r1; i++) {
+        const char* row_src = src + (CVT_SIZET(i - t_srow) * tile_cols + (c0 - t_scol)) * n_lyrs * size_dtype;
+        T* row_dst = window + (CVT_VINT(i - srow) * win_cols + (c0 - scol)) * n_lyrs;
+        if (!ConvertStreamValues(type, row_src, CVT_VINT(c1 - c0 + 1) * n_lyrs, row_dst)) {
+            return false;
         }
     }
+    return true;
+}
 
-    bool usable; ///< flag for usable subset data
-    int n_cells; ///< valid cell count
-    int n_lyrs; ///< layer count
-    int g_srow; ///< start row in global data
-    int g_erow; ///< end row in global data
-    int g_scol; ///< start col in global data
-    int g_ecol; ///< end col in global data
-    bool alloc_; ///< local_pos_ and global_ are allocated?
-    int** local_pos_; ///< local position data
-    int* local_posidx_; ///< local position index
-    int* global_; ///< global position index
-    double* data_; ///< valid data array
-    double** data2d_; ///< valid 2d data array
-};
+#ifdef USE_MONGODB
+/*!
+ * \brief Parse metadata of GridFS file, the keys existed in `header` are parsed as numeric values,
+ *        and the others except TILE_INDEX are parsed as strings into `header_str`
+ */
+void ParseGridFsMetadata(const bson_t* bmeta, STRDBL_MAP& header, STRING_MAP& header_str);
 
 /*!
- * \class clsRasterData
- * \brief Raster data (1D and 2D) I/O class
- *        Support I/O among ASCII file, TIFF, and MongoDB database.
+ * \class GridFsHeader
+ * \brief Header of GridFS raster file decoded from metadata by the known keys.
+ *
+ *        The numeric keys of InitialHeader() and the storage options (DATATYPE_OUT, CODEC,
+ *        and TILE_SIZE) are decoded into typed fields directly without any map,
+ *        the other keys, e.g., TILE_INDEX and user-specific options, are kept in metadata
+ *        and converted only when requested, e.g., by ToHeaders().
  */
-template <typename T, typename MASK_T = T>
-class clsRasterData {
+class GridFsHeader: NotCopyable {
 public:
-    /************* Construct functions ***************/
+    GridFsHeader();
 
-    /*!
-     * \brief Constructor an empty clsRasterData instance for 1D or 2D raster
-     */
-    explicit clsRasterData(bool is_2d = false);
+    ~GridFsHeader();
 
     /*!
-     * \brief Constructor 1D raster from necessary data.
+     * \brief Decode metadata, which is copied to keep the other keys
+     * \return false if the metadata is null or invalid
      */
-    clsRasterData(T* data, int cols, int rows, T nodata, double dx, double xll,
-                  double yll, const STRING_MAP& opts = STRING_MAP());
+    bool Parse(const bson_t* bmeta);
 
-    /*!
-     * \brief Constructor 1D raster from necessary data.
-     * \deprecated The input parameter `srs` is highly recommended replaced by `map<string, string>`.
-     */
-    clsRasterData(T* data, int cols, int rows, T nodata, double dx, double xll,
-                  double yll, const string& srs);
+    /*! Metadata has been decoded */
+    bool Parsed() const { return nullptr != meta_; }
 
-    /*!
-    * \brief Constructor 2D raster from necessary data
-    */
-    clsRasterData(T** data2d, int cols, int rows, int nlayers, T nodata,
-                  double dx, double xll, double yll, const STRING_MAP& opts = STRING_MAP());
+    int Rows() const { return CVT_INT(values_[KEY_NROWS]); }
+    int Cols() const { return CVT_INT(values_[KEY_NCOLS]); }
+    int Layers() const { return CVT_INT(values_[KEY_LAYERS]); }
+    int CellsNumber() const { return CVT_INT(values_[KEY_CELLSNUM]); }
+    double Nodata() const { return values_[KEY_NODATA]; }
+    double Xll() const { return values_[KEY_XLL]; }
+    double Yll() const { return values_[KEY_YLL]; }
+    double CellSize() const { return values_[KEY_CELLSIZE]; }
 
-    /*!
-     * \brief Constructor 2D raster from necessary data
-     * \deprecated The input parameter `srs` is highly recommended replaced by `map<string, string>`.
-     */
-    clsRasterData(T** data2d, int cols, int rows, int nlayers, T nodata,
-                  double dx, double xll, double yll, const string& srs);
+    /*! Data type of values stored in GridFS, i.e., DATATYPE_OUT */
+    RasterDataType DataType() const { return out_type_; }
 
-    /*!
-     * \brief Constructor of clsRasterData instance from TIFF, ASCII, or other GDAL supported format,
-     *        which has one data layer, referred to as Raster1D.
-     *
-     * \param[in] filename Full path of the raster file
-     * \param[in] calc_pos Calculate positions of valid cells excluding NODATA. The default is false.
-     * \param[in] mask \a clsRasterData<MASK_T> Mask layer
-     * \param[in] use_mask_ext Use mask layer extent, even NoDATA exists.
-     * \param[in] default_value Default value when mask data exceeds the raster extend.
-     * \param[in] opts (Optional) Additional options of the raster data with the format of key-value
-     */
-    explicit clsRasterData(const string& filename, bool calc_pos = false,
-                           clsRasterData<MASK_T>* mask = nullptr, bool use_mask_ext = true,
-                           double default_value = NODATA_VALUE, const STRING_MAP& opts = STRING_MAP());
+    /*! Codec pipeline, empty if not encoded */
+    const string& Codec() const { return codec_; }
 
-    /*!
-     * \brief Validation check before the construction of clsRasterData,
-     *        i.e., the raster file is existed and the data format supported.
-     *        This is the recommended way to construct an instance of clsRasterData.
-     *
-     * \code
-     *       clsRasterData<T> *rs = clsRasterData<T>::Init(filename)
-     *       if (nullptr == rs) {
-     *           throw exception("clsRasterData initialization failed!");
-     *           // or other error handling code.
-     *       }
-     * \endcode
-     */
-    static clsRasterData<T, MASK_T>* Init(const string& filename, bool calc_pos = false,
-                                          clsRasterData<MASK_T>* mask = nullptr, bool use_mask_ext = true,
-                                          double default_value = NODATA_VALUE, const STRING_MAP& opts = STRING_MAP());
+    /*! Stored by tiles, i.e., TILE_SIZE exists */
+    bool Tiled() const { return tile_size_ != 0; }
+
+    /*! Size of tiles, 0 if not tiled, and -1 if invalid */
+    int TileSize() const { return tile_size_; }
 
     /*!
-     * \brief Constructor of clsRasterData instance from TIFF, ASCII, or other GDAL supported raster file,
-     *        which may have one or more data layers, i.e., compatible with Raster1D and Rater2D.
-     *
-     * \param[in] filenames Full paths vector of the 2D raster data
-     * \param[in] calc_pos Calculate positions of valid cells excluding NODATA. The default is false.
-     * \param[in] mask \a clsRasterData<MASK_T> Mask layer
-     * \param[in] use_mask_ext Use mask layer extent, even NoDATA exists.
-     * \param[in] default_value Default value when mask data exceeds the raster extend.
-     * \param[in] opts (Optional) Additional options of the raster data with the format of key-value
+     * \brief Parse byte offsets of tiles from TILE_INDEX in metadata, i.e., binary of 64-bit
+     *        integers in little-endian, or comma-separated string written by early versions.
+     * \return false if absent, e.g., the index of encoded tiles is appended to them in the file
      */
-    explicit clsRasterData(vector<string>& filenames, bool calc_pos = false,
-                           clsRasterData<MASK_T>* mask = nullptr, bool use_mask_ext = true,
-                           double default_value = NODATA_VALUE, const STRING_MAP& opts = STRING_MAP());
+    bool TileOffsets(vector<vint>& offsets) const;
 
     /*!
-     * \brief Validation check before the constructor of clsRasterData,
-     *        i.e., the raster files are all existed and the data format supported.
-     *        This is the recommended way to construct an instance of clsRasterData,
-     *        compatible with Raster1D and Rater2D.
-     *
-     * \code
-     *       vector<string> filenames = {"layer1.tif", "layer2.tif", "layer3.tif"};
-     *       clsRasterData<T> *rs = clsRasterData<T>::Init(filenames)
-     *       if (nullptr == rs) {
-     *           throw exception("clsRasterData initialization failed!");
-     *           // or other error handling code.
-     *       }
-     * \endcode
+     * \brief Check the raster is full-sized and the window is inside it
+     * \param[in] srow,erow,scol,ecol Extent of the window
+     * \param[in] filename GridFS file name used in the error message
      */
-    static clsRasterData<T, MASK_T>* Init(vector<string>& filenames, bool calc_pos = false,
-                                          clsRasterData<MASK_T>* mask = nullptr, bool use_mask_ext = true,
-                                          double default_value = NODATA_VALUE, const STRING_MAP& opts = STRING_MAP());
+    bool ValidWindow(int srow, int erow, int scol, int ecol, const string& filename) const;
 
     /*!
-     * \brief Construct an clsRasterData instance by 1D array data and mask
+     * \brief Get value of any key in metadata as string
      */
-    clsRasterData(clsRasterData<MASK_T>* mask, T* values, int len,
-                  const STRING_MAP& opts = STRING_MAP());
+    bool GetString(const char* key, string& value) const;
 
     /*!
-     * \brief Construct an clsRasterData instance by 2D array data and mask
+     * \brief Convert to header information as ParseGridFsMetadata(),
+     *        except TILE_INDEX which is only used to locate tiles
      */
-    clsRasterData(clsRasterData<MASK_T>* mask, T** values, int len, int lyrs,
-                  const STRING_MAP& opts = STRING_MAP());
-
-#ifdef USE_MONGODB
+    void ToHeaders(STRDBL_MAP& header, STRING_MAP& header_str) const;
+
+private:
+    /*! Index of numeric keys, in the same order as InitialHeader() */
+    enum NumericKey {
+        KEY_NCOLS, KEY_NROWS, KEY_XLL, KEY_YLL, KEY_CELLSIZE, KEY_NODATA, KEY_LAYERS, KEY_CELLSNUM,
+        KEY_COUNT
+    };
+
+    /*! Index of numeric key, -1 if not a numeric key */
+    static int NumericKeyIndex(const char* key);
+
+    /*! Reset to the initial values */
+    void Reset();
+
+    double values_[KEY_COUNT];  ///< Numeric values, NODATA_VALUE if absent
+    RasterDataType out_type_;   ///< Data type of values stored in GridFS
+    string codec_;              ///< Codec pipeline
+    int tile_size_;             ///< Size of tiles
+    bson_t* meta_;              ///< Copy of metadata
+};
+
+template <typename T>
+bool ReadGridFsFile(MongoGridFs* gfs, const string& filename,
+                    T*& data, GridFsHeader& header,
+                    const STRING_MAP& opts = STRING_MAP());
+
+template <typename T>
+bool ReadGridFsFile(MongoGridFs* gfs, const string& filename,
+                    T*& data, STRDBL_MAP& header, STRING_MAP& header_str,
+                    const STRING_MAP& opts = STRING_MAP());
+
+template <typename T>
+bool ReadGridFsWindow(MongoGridFs* gfs, const string& filename,
+                      int srow, int erow, int scol, int ecol,
+                      T*& data, GridFsHeader& header,
+                      const STRING_MAP& opts = STRING_MAP(),
+                      MongoClientPool* pool = nullptr);
+
+template <typename T>
+bool ReadGridFsTiles(MongoGridFs* gfs, const string& filename, const GridFsHeader& header,
+                     vint length, int srow, int erow, int scol, int ecol, T*& data,
+                     const STRING_MAP& opts = STRING_MAP(),
+                     MongoClientPool* pool = nullptr);
+
+template <typename T>
+bool ReadGridFsWindow(MongoGridFs* gfs, const string& filename,
+                      int srow, int erow, int scol, int ecol,
+                      T*& data, STRDBL_MAP& header, STRING_MAP& header_str,
+                      const STRING_MAP& opts = STRING_MAP(),
+                      MongoClientPool* pool = nullptr);
+
+/*!
+ * \brief Read GridFS file chunk by chunk and convert the values into `data` directly,
+ *        which is shared by ReadGridFsFile() and ReadGridFsWindow().
+ *
+ *        The encoded blocks are decoded as soon as a batch of them, one per thread, arrives,
+ *        i.e., only the blocks of the current batch are buffered additionally.
+ *        Reading a window stops once the last row of the window has been converted.
+ *
+ * \param[in] window Only the values in the window (srow, erow, scol, ecol) of full-sized raster
+ *                   are converted, otherwise all values are converted
+ * \param[out] tiled_length Length (bytes) of a tiled file, which is left to be read by tiles
+ *                          with the parsed header, otherwise -1
+ */
+template <typename T>
+bool ReadGridFsStream(MongoGridFs* gfs, const string& filename, GridFsHeader& header,
+                      const bool window, const int srow, const int erow, const int scol, const int ecol,
+                      T*& data, const STRING_MAP& opts, vint& tiled_length) {
+    tiled_length = -1;
+    RasterDataType rstype = RDT_Unknown;
+    size_t size_dtype = 0;
+    vint value_count = 0;
+    vint converted = 0;
+    vint row_values = 0;   // values of each row
+    vint window_end = 0;   // index of the value next to the window
+    bool done = false;     // all values of the window have been converted
+    char partial[sizeof(vint64_t)]; // bytes of a value split by two chunks
+    size_t partial_len = 0;
+    vector<CodecType> codecs;
+    bool encoded = false;
+    vector<char> pending;  // encoded bytes not decoded yet, i.e., a batch of blocks at most
+    size_t decoded_raw = 0; // bytes of raw values decoded
+    int batch_blocks = 1;  // complete blocks to be decoded in parallel
+#ifdef SUPPORT_OMP
+    batch_blocks = omp_get_max_threads();
+#endif /* SUPPORT_OMP */
+    // Convert `count` values from the `first` value of the stream, the values outside the window are skipped
+    auto store = [&](const char* raw, vint first, vint count) -> bool {
+        if (!window) { return ConvertStreamValues(rstype, raw, count, data + first); }
+        vint win_values = CVT_VINT(ecol - scol + 1) * header.Layers();
+        while (count > 0) {
+            vint row = first / row_values;
+            vint n = Min(count, (row + 1) * row_values - first);
+            if (row >= srow && row <= erow) {
+                vint win_begin = row * row_values + CVT_VINT(scol) * header.Layers();
+                vint c0 = Max(first, win_begin);
+                vint c1 = Min(first + n, win_begin + win_values);
+                if (c0 < c1 && !ConvertStreamValues(rstype, raw + CVT_SIZET(c0 - first) * size_dtype, c1 - c0,
+                                                    data + (row - srow) * win_values + c0 - win_begin)) {
+                    return false;
+                }
+            }
+            first += n;
+            raw += CVT_SIZET(n) * size_dtype;
+            count -= n;
+        }
+        return true;
+    };
+    // Decode the complete blocks in pending, wait for a batch of blocks unless it is the last
+    auto decode_pending = [&](const bool last) -> bool {
+        size_t pos = 0;
+        size_t raw_bytes_sum = 0;
+        int nblocks = 0;
+        size_t block_bytes = 0;
+        size_t raw_bytes = 0;
+        while (ParseBlockHeader(pending.data() + pos, pending.size() - pos, block_bytes, raw_bytes)
+               && block_bytes <= pending.size() - pos) {
+            pos += block_bytes;
+            raw_bytes_sum += raw_bytes;
+            nblocks++;
+        }
+        if (last && pos != pending.size()) { return false; } // incomplete block
+        if (nblocks == 0 || (!last && nblocks < batch_blocks)) { return true; }
+        size_t raw_total = CVT_SIZET(value_count) * size_dtype;
+        auto consumer = [&](const char* raw, const size_t raw_offset, const size_t nbytes) -> bool {
+            size_t offset = decoded_raw + raw_offset;
+            if (offset % size_dtype != 0 || nbytes % size_dtype != 0 || offset + nbytes > raw_total) {
+                return false;
+            }
+            return store(raw, CVT_VINT(offset / size_dtype), CVT_VINT(nbytes / size_dtype));
+        };
+        if (DecodeStream(codecs, size_dtype, pending.data(), pos, consumer,
+                         Min(batch_blocks, nblocks)) != CVT_VINT(raw_bytes_sum)) {
+            return false;
+        }
+        decoded_raw += raw_bytes_sum;
+        pending.erase(pending.begin(), pending.begin() + pos);
+        return true;
+    };
+    auto on_open = [&](const bson_t* bmeta, const vint length) -> bool {
+        // Retrieve raster header values
+        if (!header.Parse(bmeta)) { return false; }
+        if (header.Tiled()) {
+            tiled_length = length; // read by tiles instead
+            return false;
+        }
+        int n_lyrs = header.Layers();
+        int n_cells = header.CellsNumber();
+        if (header.Rows() < 0 || header.Cols() < 0 || n_lyrs < 0 || n_cells <= 0) { // missing essential metadata
+            return false;
+        }
+        if (window && !header.ValidWindow(srow, erow, scol, ecol, filename)) { return false; }
+        value_count = CVT_VINT(n_cells) * n_lyrs;
+        row_values = CVT_VINT(header.Cols()) * n_lyrs;
+        window_end = window ? (CVT_VINT(erow) * header.Cols() + ecol + 1) * n_lyrs : value_count;
+        rstype = header.DataType();
+        if (rstype == RDT_Unknown) {
+            StatusMessage("Unknown data type in MongoDB GridFS!");
+            return false;
+        }
+        size_dtype = RasterDataTypeSize(rstype);
+        if (!ParseCodecs(header.Codec(), codecs) || !CodecsApplicable(codecs, size_dtype)) {
+            StatusMessage("Unsupported codec " + header.Codec() + " of GridFS file!");
+            return false;
+        }
+        encoded = !codecs.empty();
+        if (encoded) {
+            if (value_count <= 0 || length <= 0) { return false; }
+        }
+        else if (value_count <= 0 || CVT_SIZET(length / value_count) != size_dtype) {
+            StatusMessage("Unconsistent of data type and size!");
+            return false;
+        }
+        vint count = window ? CVT_VINT(erow - srow + 1) * (ecol - scol + 1) * n_lyrs : value_count;
+        return Initialize1DArray(CVT_INT(count), data, T());
+    };
+    auto on_chunk = [&](const char* chunk, const vint size, const vint) -> bool {
+        if (encoded) {
+            pending.insert(pending.end(), chunk, chunk + size);
+            if (!decode_pending(false)) {
+                StatusMessage("Failed to decode GridFS file " + filename + "!");
+                return false;
+            }
+            done = window && CVT_VINT(decoded_raw / size_dtype) >= window_end;
+            return !done;
+        }
+        const char* src = chunk;
+        size_t left = CVT_SIZET(size);
+        if (partial_len > 0) { // complete the value split by the previous chunk
+            size_t len = Min(size_dtype - partial_len, left);
+            memcpy(partial + partial_len, src, len);
+            partial_len += len;
+            src += len;
+            left -= len;
+            if (partial_len < size_dtype) { return true; }
+            if (converted < value_count) {
+                store(partial, converted, 1);
+                converted++;
+            }
+            partial_len = 0;
+        }
+        vint count = Min(CVT_VINT(left / size_dtype), value_count - converted);
+        if (count > 0) {
+            store(src, converted, count);
+            converted += count;
+            src += count * size_dtype;
+            left -= count * size_dtype;
+        }
+        if (left > 0 && left < size_dtype && converted < value_count) {
+            memcpy(partial, src, left);
+            partial_len = left;
+        }
+        done = window && converted >= window_end;
+        return !done;
+    };
+    if (!gfs->ReadStreamChunks(filename, on_open, on_chunk, nullptr, &opts)) {
+        if (done) { return true; }
+        Release1DArray(data);
+        return false;
+    }
+    if (encoded) {
+        if (decode_pending(true) && decoded_raw == CVT_SIZET(value_count) * size_dtype) {
+            converted = value_count;
+        }
+        else {
+            StatusMessage("Failed to decode GridFS file " + filename + "!");
+        }
+    }
+    if (converted != value_count) {
+        Release1DArray(data);
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * \brief Read GridFs file from MongoDB
+ *
+ *        The file is read chunk by chunk and converted into `data` directly,
+ *        i.e., the peak memory is `data` plus one chunk of GridFS, \sa ReadGridFsStream().
+ *        A tiled file is read by tiles with the header parsed on opening.
+ *
+ * \param[in] gfs MongoGridFs pointer
+ * \param[in] filename GridFs filename
+ * \param[out] data Data stored in GridFs file
+ * \param[out] header Header decoded from metadata
+ * \param[in] opts Optional key-value stored in metadata, used to filter GridFs file
+ */
+template <typename T>
+bool ReadGridFsFile(MongoGridFs* gfs, const string& filename,
+                    T*& data, GridFsHeader& header,
+                    const STRING_MAP& opts /* = STRING_MAP() */) {
+    vint tiled_length = -1;
+    if (ReadGridFsStream(gfs, filename, header, false, 0, 0, 0, 0, data, opts, tiled_length)) {
+        return true;
+    }
+    if (tiled_length < 0) { return false; }
+    return ReadGridFsTiles(gfs, filename, header, tiled_length, 0, header.Rows() - 1, 0, header.Cols() - 1,
+                           data, opts);
+}
+
+/*!
+ * \brief Read GridFs file from MongoDB with header information in maps
+ * \param[out] header Header information
+ * \param[out] header_str Header information in strings
+ * \sa ReadGridFsFile(MongoGridFs*, const string&, T*&, GridFsHeader&, const STRING_MAP&)
+ */
+template <typename T>
+bool ReadGridFsFile(MongoGridFs* gfs, const string& filename,
+                    T*& data, STRDBL_MAP& header, STRING_MAP& header_str,
+                    const STRING_MAP& opts /* = STRING_MAP() */) {
+    GridFsHeader gheader;
+    bool read = ReadGridFsFile(gfs, filename, data, gheader, opts);
+    gheader.ToHeaders(header, header_str);
+    return read;
+}
+
+/*!
+ * \brief Read a window of full-sized raster data from GridFS file.
+ *
+ *        Only the tiles intersecting with the window are fetched from a tiled GridFS file,
+ *        and the tiles are fetched in parallel by clients checked out from the pool if provided.
+ *        Otherwise, the file is streamed with the header parsed on opening, only the values
+ *        in the window are kept, and the reading stops after the last row of the window.
+ *
+ * \param[in] gfs MongoGridFs pointer
+ * \param[in] filename GridFs filename
+ * \param[in] srow,erow,scol,ecol Extent of the window
+ * \param[out] data Data of the window in row-major order, values of layers are continuous for each cell
+ * \param[out] header Header of the entire raster decoded from metadata
+ * \param[in] opts Optional key-value stored in metadata, used to filter GridFs file
+ * \param[in] pool Client pool to fetch tiles in parallel, the GridFS is opened by the names of gfs
+ */
+template <typename T>
+bool ReadGridFsWindow(MongoGridFs* gfs, const string& filename,
+                      const int srow, const int erow, const int scol, const int ecol,
+                      T*& data, GridFsHeader& header,
+                      const STRING_MAP& opts /* = STRING_MAP() */,
+                      MongoClientPool* pool /* = nullptr */) {
+    vint tiled_length = -1;
+    if (ReadGridFsStream(gfs, filename, header, true, srow, erow, scol, ecol, data, opts, tiled_length)) {
+        return true;
+    }
+    if (tiled_length < 0) { return false; }
+    return ReadGridFsTiles(gfs, filename, header, tiled_length, srow, erow, scol, ecol, data, opts, pool);
+}
+
+/*!
+ * \brief Read a window of tiled GridFS file whose header has been parsed,
+ *        i.e., only the tiles intersecting with the window are fetched.
+ *        The tile index of encoded tiles is read from the end of the file firstly.
+ * \param[in] length Length (bytes) of the file
+ * \sa ReadGridFsWindow(MongoGridFs*, const string&, int, int, int, int, T*&, GridFsHeader&,
+ *                      const STRING_MAP&, MongoClientPool*)
+ */
+template <typename T>
+bool ReadGridFsTiles(MongoGridFs* gfs, const string& filename, const GridFsHeader& header,
+                     const vint length, const int srow, const int erow, const int scol, const int ecol,
+                     T*& data, const STRING_MAP& opts /* = STRING_MAP() */,
+                     MongoClientPool* pool /* = nullptr */) {
+    if (!header.ValidWindow(srow, erow, scol, ecol, filename)) { return false; }
+    int n_rows = header.Rows();
+    int n_cols = header.Cols();
+    int n_lyrs = header.Layers();
+    int win_cols = ecol - scol + 1;
+    vint win_count = CVT_VINT(erow - srow + 1) * win_cols * n_lyrs;
+    RasterTiles tiles(n_rows, n_cols, header.TileSize());
+    vector<vint> offsets;
+    if (tiles.Valid() && !header.TileOffsets(offsets)) { // appended to the encoded tiles
+        vint index_bytes = CVT_VINT(tiles.Count() + 1) * CVT_VINT(sizeof(vint64_t));
+        vector<std::pair<vint, vint> > index_range(1, std::make_pair(length - index_bytes, index_bytes));
+        auto on_index = [&offsets](const size_t, const char* src, const vint size) -> bool {
+            return ParseTileIndex(src, CVT_SIZET(size), offsets);
+        };
+        if (length < index_bytes || !gfs->ReadStreamRanges(filename, index_range, on_index, NULL, &opts)
+            || offsets.back() != length - index_bytes) {
+            offsets.clear();
+        }
+    }
+    if (!tiles.Valid() || CVT_INT(offsets.size()) != tiles.Count() + 1) {
+        StatusMessage("Invalid tile index of GridFS file " + filename + "!");
+        return false;
+    }
+    RasterDataType rstype = header.DataType();
+    size_t size_dtype = RasterDataTypeSize(rstype);
+    if (size_dtype == 0) {
+        StatusMessage("Unknown data type in MongoDB GridFS!");
+        return false;
+    }
+    vector<CodecType> codecs;
+    if (!ParseCodecs(header.Codec(), codecs) || !CodecsApplicable(codecs, size_dtype)) {
+        StatusMessage("Unsupported codec " + header.Codec() + " of GridFS file!");
+        return false;
+    }
+    vector<int> tile_ids;
+    tiles.InWindow(srow, erow, scol, ecol, tile_ids);
+    if (!Initialize1DArray(CVT_INT(win_count), data, T())) { return false; }
+    // Convert a tile into the window, the tile is decoded into the scratch buffer firstly if encoded
+    auto on_tile = [&](const int tile, const char* src, const vint size, vector<char>& raw) -> bool {
+        size_t raw_bytes = CVT_SIZET(tiles.CellsNumber(tile)) * n_lyrs * size_dtype;
+        if (!codecs.empty()) {
+            raw.resize(raw_bytes);
+            auto consumer = [&raw, raw_bytes](const char* block, const size_t offset, const size_t nbytes) {
+                if (offset + nbytes > raw_bytes) { return false; }
+                memcpy(raw.data() + offset, block, nbytes);
+                return true;
+            };
+            if (DecodeStream(codecs, size_dtype, src, CVT_SIZET(size), consumer, 1) != CVT_VINT(raw_bytes)) {
+                return false;
+            }
+            src = raw.data();
+        }
+        else if (CVT_SIZET(size) != raw_bytes) {
+            return false;
+        }
+        return ConvertTileValues(tiles, tile, n_lyrs, rstype, src, srow, erow, scol, ecol, data);
+    };
+    int nthreads = 1;
+    if (nullptr != pool && !gfs->GetDbName().empty() && !gfs->GetGfsName().empty()) {
+#ifdef SUPPORT_OMP
+        nthreads = omp_get_max_threads();
+#endif /* SUPPORT_OMP */
+        int max_clients = pool->GetMetrics().max_size;
+        if (max_clients > 0) { nthreads = Min(nthreads, max_clients); }
+        nthreads = Max(1, Min(nthreads, CVT_INT(tile_ids.size())));
+    }
+    bool read_ok = true;
+#pragma omp parallel num_threads(nthreads)
+    {
+        int tid = 0;
+        int nt = 1;
+#ifdef SUPPORT_OMP
+        tid = omp_get_thread_num();
+        nt = omp_get_num_threads();
+#endif /* SUPPORT_OMP */
+        // Neighbouring tiles are fetched by the same thread, i.e., the ranges are continuous
+        size_t begin = tile_ids.size() * tid / nt;
+        size_t end = tile_ids.size() * (tid + 1) / nt;
+        vector<std::pair<vint, vint> > ranges;
+        for (size_t k = begin; k < end; k++) {
+            int tile = tile_ids[k];
+#ifdef HAS_VARIADIC_TEMPLATES
+            ranges.emplace_back(offsets[tile], offsets[tile + 1] - offsets[tile]);
+#else
+            ranges.push_back(make_pair(offsets[tile], offsets[tile + 1] - offsets[tile]));
+#endif
+        }
+        vector<char> raw;
+        auto on_range = [&](const size_t idx, const char* src, const vint size) -> bool {
+            return on_tile(tile_ids[begin + idx], src, size, raw);
+        };
+        bool fetched = true;
+        if (!ranges.empty()) {
+            if (nthreads > 1) {
+                MongoPooledClient client(pool);
+                MongoGridFs* thread_gfs = client.GridFs(gfs->GetDbName(), gfs->GetGfsName());
+                if (nullptr != thread_gfs) { thread_gfs->SetLocalCache(gfs->GetLocalCache()); }
+                fetched = nullptr != thread_gfs
+                        && thread_gfs->ReadStreamRanges(filename, ranges, on_range, NULL, &opts);
+            }
+            else {
+                fetched = gfs->ReadStreamRanges(filename, ranges, on_range, NULL, &opts);
+            }
+        }
+        if (!fetched) {
+#pragma omp critical
+            {
+                read_ok = false;
+            }
+        }
+    }
+    if (!read_ok) {
+        StatusMessage("Failed to read tiles of GridFS file " + filename + "!");
+        Release1DArray(data);
+    }
+    return read_ok;
+}
+
+/*!
+ * \brief Read a window of full-sized raster data from GridFS file with header information in maps
+ * \param[out] header Header information of the entire raster
+ * \param[out] header_str Header information in strings
+ * \sa ReadGridFsWindow(MongoGridFs*, const string&, int, int, int, int, T*&, GridFsHeader&,
+ *                      const STRING_MAP&, MongoClientPool*)
+ */
+template <typename T>
+bool ReadGridFsWindow(MongoGridFs* gfs, const string& filename,
+                      const int srow, const int erow, const int scol, const int ecol,
+                      T*& data, STRDBL_MAP& header, STRING_MAP& header_str,
+                      const STRING_MAP& opts /* = STRING_MAP() */,
+                      MongoClientPool* pool /* = nullptr */) {
+    GridFsHeader gheader;
+    bool read = ReadGridFsWindow(gfs, filename, srow, erow, scol, ecol, data, gheader, opts, pool);
+    gheader.ToHeaders(header, header_str);
+    return read;
+}
+
+/*!
+ * \class GridFsRasterStream
+ * \brief Metadata and byte stream of raster data to be written as GridFS file.
+ *
+ *        The values are converted to DATATYPE_OUT chunk by chunk while producing the stream,
+ *        and encoded by CODEC or stored by tiles of TILE_SIZE if specified in options.
+ *        Each tile is encoded once while producing, and the tile index of encoded tiles,
+ *        whose sizes are unknown until encoded, is appended to the end of the stream.
+ *        The storage options are stored in metadata but not used to filter the replaced files.
+ */
+template <typename T>
+class GridFsRasterStream: NotCopyable {
+public:
+    /*!
+     * \brief Constructor
+     * \param[in] header Header information
+     * \param[in] values Raster data, which MUST live longer than the stream
+     * \param[in] datalength Length of data
+     * \param[in] opts Key-value map for user-specific metadata and the storage options
+     */
+    GridFsRasterStream(STRDBL_MAP& header, T* values, const int datalength, const STRING_MAP& opts) :
+        values_(values), datalength_(datalength), valid_(false), opt_type_(RDT_Unknown),
+        size_dtype_(0), n_cols_(-1), n_lyrs_(-1), tiles_(0, 0, 0),
+        converted_(0), next_tile_(0), pending_pos_(0) {
+        bson_init(&meta_);
+        STRING_MAP curopts;
+        CopyStringMap(opts, curopts);
+        RasterDataType temp_type = TypeToRasterDataType(typeid(T));
+        if (curopts.find(HEADER_RSOUT_DATATYPE) == curopts.end()) {
+            UpdateStringMap(curopts, HEADER_RSOUT_DATATYPE, RasterDataTypeToString(temp_type));
+        }
+        double intpart; // https://stackoverflow.com/a/1521682/4837280
+        for (auto iter = header.begin(); iter != header.end(); ++iter) {
+            if (!StringMatch(HEADER_RS_NODATA, iter->first)
+                && std::modf(iter->second, &intpart) == 0.0) {
+                // std::modf consider inf as an integer,
+                // hence cannot handle -3.40282346639e+38 which is one of commonly used Nodata
+                BSON_APPEND_INT32(&meta_, iter->first.c_str(), CVT_INT(iter->second));
+            }
+            else {
+                BSON_APPEND_DOUBLE(&meta_, iter->first.c_str(), iter->second);
+            }
+        }
+        // Values are converted to DATATYPE in metadata chunk by chunk while producing
+        opt_type_ = StringToRasterDataType(curopts.at(HEADER_RSOUT_DATATYPE));
+        size_dtype_ = CVT_VINT(RasterDataTypeSize(opt_type_));
+        if (size_dtype_ <= 0) {
+            StatusMessage("Unknown data type to be written into MongoDB GridFS!");
+            return;
+        }
+        // Optional codecs
+        CopyStringMap(curopts, replace_opts_);
+        if (curopts.find(HEADER_RS_CODEC) != curopts.end()) {
+            if (!ParseCodecs(curopts.at(HEADER_RS_CODEC), codecs_)
+                || !CodecsApplicable(codecs_, CVT_SIZET(size_dtype_))) {
+                StatusMessage("Unsupported codec " + curopts.at(HEADER_RS_CODEC)
+                              + " of data type " + curopts.at(HEADER_RSOUT_DATATYPE) + "!");
+                return;
+            }
+            if (codecs_.empty()) {
+                curopts.erase(HEADER_RS_CODEC);
+            }
+            else {
+                curopts[HEADER_RS_CODEC] = CodecsToString(codecs_);
+            }
+            replace_opts_.erase(HEADER_RS_CODEC);
+        }
+        // Optional tiled layout of full-sized raster data, the tile index is always regenerated
+        curopts.erase(HEADER_RS_TILE_INDEX);
+        replace_opts_.erase(HEADER_RS_TILE_INDEX);
+        replace_opts_.erase(HEADER_RS_TILE_SIZE);
+        int n_rows = header.find(HEADER_RS_NROWS) != header.end() ? CVT_INT(header.at(HEADER_RS_NROWS)) : -1;
+        n_cols_ = header.find(HEADER_RS_NCOLS) != header.end() ? CVT_INT(header.at(HEADER_RS_NCOLS)) : -1;
+        n_lyrs_ = header.find(HEADER_RS_LAYERS) != header.end() ? CVT_INT(header.at(HEADER_RS_LAYERS)) : -1;
+        int tile_size = 0;
+        if (curopts.find(HEADER_RS_TILE_SIZE) != curopts.end()) {
+            bool valid_size = false;
+            tile_size = CVT_INT(IsInt(curopts.at(HEADER_RS_TILE_SIZE), valid_size));
+            if (!valid_size || n_rows <= 0 || n_cols_ <= 0 || n_lyrs_ <= 0
+                || CVT_VINT(n_rows) * n_cols_ * n_lyrs_ != datalength_) {
+                tile_size = 0; // stored as a plain stream
+            }
+            curopts.erase(HEADER_RS_TILE_SIZE);
+        }
+        tiles_ = RasterTiles(n_rows, n_cols_, tile_size);
+        if (tiles_.Valid()) {
+            curopts[HEADER_RS_TILE_SIZE] = ValueToString(tile_size);
+        }
+        // Add user-specific key-values into metadata
+        AppendStringOptionsToBson(&meta_, curopts);
+        if (tiles_.Valid() && codecs_.empty()) { // sizes of encoded tiles are known after encoding
+            vector<vint> offsets;
+            tiles_.RawOffsets(n_lyrs_, CVT_SIZET(size_dtype_), offsets);
+            vector<char> tile_index;
+            AppendTileIndex(offsets, tile_index);
+            BSON_APPEND_BINARY(&meta_, HEADER_RS_TILE_INDEX, BSON_SUBTYPE_BINARY,
+                               reinterpret_cast<const uint8_t*>(tile_index.data()),
+                               static_cast<uint32_t>(tile_index.size()));
+        }
+        valid_ = true;
+    }
+
+    ~GridFsRasterStream() { bson_destroy(&meta_); }
+
+    /*! The metadata is ready and the stream can be produced */
+    bool Valid() const { return valid_; }
+
+    /*! Metadata of GridFS file */
+    const bson_t* Metadata() const { return &meta_; }
+
+    /*! Metadata used to filter the replaced files */
+    const STRING_MAP* ReplaceOptions() const { return &replace_opts_; }
+
+    /*! Produce the stream from the beginning, e.g., retry writing */
+    void Rewind() {
+        converted_ = 0;
+        next_tile_ = 0;
+        pending_.clear();
+        pending_pos_ = 0;
+        tile_offsets_.clear();
+    }
+
+    /*!
+     * \brief Fill the buffer with the following stream
+     * \return Bytes filled, 0 means the end of stream and negative means failure
+     */
+    vint Produce(char* buf, const vint capacity) {
+        if (!tiles_.Valid() && codecs_.empty()) {
+            vint count = Min(capacity / size_dtype_, CVT_VINT(datalength_) - converted_);
+            if (count <= 0) { return 0; }
+            ConvertToStreamValues(opt_type_, values_ + converted_, count, buf);
+            converted_ += count;
+            return count * size_dtype_;
+        }
+        if (pending_pos_ >= pending_.size() && tiles_.Valid()) { // convert and encode the next tile
+            if (!codecs_.empty()) { // offsets of encoded tiles, and the tile index after the last one
+                if (next_tile_ > tiles_.Count()) { return 0; }
+                tile_offsets_.emplace_back(tile_offsets_.empty() ? 0
+                                           : tile_offsets_.back() + CVT_VINT(pending_.size()));
+            }
+            pending_.clear();
+            pending_pos_ = 0;
+            if (next_tile_ == tiles_.Count() && !codecs_.empty()) {
+                AppendTileIndex(tile_offsets_, pending_);
+            }
+            else if (next_tile_ >= tiles_.Count()) {
+                return 0;
+            }
+            else if (codecs_.empty()) {
+                pending_.resize(CVT_SIZET(tiles_.CellsNumber(next_tile_)) * n_lyrs_ * size_dtype_);
+                if (!ConvertToTileValues(tiles_, next_tile_, n_lyrs_, opt_type_, values_, n_cols_,
+                                         pending_.data())) {
+                    return -1;
+                }
+            }
+            else if (!EncodeTile(next_tile_, pending_)) {
+                return -1;
+            }
+            next_tile_++;
+        }
+        else if (pending_pos_ >= pending_.size()) { // encode the next block
+            pending_.clear();
+            pending_pos_ = 0;
+            vint count = Min(CVT_VINT(CODEC_BLOCK_SIZE) / size_dtype_,
+                             CVT_VINT(datalength_) - converted_);
+            if (count <= 0) { return 0; }
+            raw_block_.resize(CVT_SIZET(count * size_dtype_));
+            ConvertToStreamValues(opt_type_, values_ + converted_, count, raw_block_.data());
+            if (!EncodeBlock(codecs_, CVT_SIZET(size_dtype_), raw_block_.data(),
+                             raw_block_.size(), pending_)) {
+                return -1;
+            }
+            converted_ += count;
+        }
+        size_t len = Min(CVT_SIZET(capacity), pending_.size() - pending_pos_);
+        memcpy(buf, pending_.data() + pending_pos_, len);
+        pending_pos_ += len;
+        return CVT_VINT(len);
+    }
+
+private:
+    /*! Convert a tile and encode it to dst, which is cleared firstly */
+    bool EncodeTile(const int tile, vector<char>& dst) {
+        dst.clear();
+        raw_block_.resize(CVT_SIZET(tiles_.CellsNumber(tile)) * n_lyrs_ * size_dtype_);
+        return ConvertToTileValues(tiles_, tile, n_lyrs_, opt_type_, values_, n_cols_, raw_block_.data())
+                && EncodeStream(codecs_, CVT_SIZET(size_dtype_), raw_block_.data(), raw_block_.size(), dst);
+    }
+
+    T* values_;                 ///< Raster data
+    int datalength_;            ///< Length of data
+    bool valid_;                ///< Metadata is ready
+    bson_t meta_;               ///< Metadata
+    STRING_MAP replace_opts_;   ///< Metadata used to filter the replaced files
+    RasterDataType opt_type_;   ///< Data type in stream
+    vint size_dtype_;           ///< Bytes of each value in stream
+    vector<CodecType> codecs_;  ///< Codecs, empty means raw values
+    int n_cols_;                ///< Columns number of raster
+    int n_lyrs_;                ///< Layers number of raster
+    RasterTiles tiles_;         ///< Tiles, invalid means not tiled
+    vint converted_;            ///< Number of values converted
+    int next_tile_;             ///< Index of the next tile to be converted
+    vector<char> raw_block_;    ///< Converted values of one block or tile to be encoded
+    vector<char> pending_;      ///< Encoded blocks or tile not yet produced
+    size_t pending_pos_;        ///< Produced bytes of pending_
+    vector<vint> tile_offsets_; ///< Offsets of the encoded tiles produced
+};
+
+/*!
+ * \brief Write array data (both valid and full-sized raster data) as GridFS file.
+ *        If the file exists, delete it first.
+ * \param[in] gfs GridFs of MongoDB
+ * \param[in] filename GridFS file name
+ * \param[in] header header information
+ * \param[in] values float raster data array
+ * \param[in] datalength Length of data
+ * \param[in] opts (optional) Key-value map for user-specific metadata, and the storage options:
+ *                 CODEC, e.g., "DELTA+BITPACK", and TILE_SIZE, e.g., "256" for full-sized raster data
+ */
+template <typename T>
+bool WriteStreamDataAsGridfs(MongoGridFs* gfs, const string& filename,
+                             STRDBL_MAP& header, T* values, const int datalength,
+                             const STRING_MAP& opts = STRING_MAP()) {
+    GridFsRasterStream<T> stream(header, values, datalength, opts);
+    if (!stream.Valid()) { return false; }
+    auto producer = [&stream](char* buf, const vint capacity) { return stream.Produce(buf, capacity); };
+    int try_times = 0;
+    bool gstatus = false;
+    while (try_times <= 3) { // Try 3 times
+        stream.Rewind();
+        // Existing file with the same name and options is replaced
+        gstatus = gfs->WriteStreamChunks(filename, stream.Metadata(), producer, stream.ReplaceOptions());
+        if (gstatus) { break; }
+        SleepMs(2); // Sleep 0.002 sec and retry
+        try_times++;
+    }
+    return gstatus;
+}
+
+/*!
+ * \brief Add array data to the batch of GridFS files, which is written once the batch is full.
+ * \sa WriteStreamDataAsGridfs(MongoGridFs*, const string&, STRDBL_MAP&, T*, int, const STRING_MAP&)
+ * \return false if the data cannot be added or failed in the batch flushed meanwhile,
+ *         see MongoGridFsBulkWriter::Add() and MongoGridFsBulkWriter::FailedFiles()
+ */
+template <typename T>
+bool WriteStreamDataAsGridfs(MongoGridFsBulkWriter* writer, const string& filename,
+                             STRDBL_MAP& header, T* values, const int datalength,
+                             const STRING_MAP& opts = STRING_MAP()) {
+    GridFsRasterStream<T> stream(header, values, datalength, opts);
+    if (!stream.Valid()) { return false; }
+    auto producer = [&stream](char* buf, const vint capacity) { return stream.Produce(buf, capacity); };
+    return writer->Add(filename, stream.Metadata(), producer, stream.ReplaceOptions());
+}
+
+#endif /* USE_MONGODB */
+
+/*!
+ * \class ValidCellSpans
+ * \brief Run-length compressed valid cells, i.e., spans of consecutive valid cells in each row.
+ *
+ * Valid cells of a watershed are usually compact blobs inside a large bounding rectangle,
+ *   spans make the lookup and iteration of valid cells cache-friendly, e.g.,
+ *
+ * \code
+ *   for (auto it = spans.GetSpans().begin(); it != spans.GetSpans().end(); ++it) {
+ *       T* values = raster + it->offset; // it->ecol - it->scol + 1 consecutive valid cells
+ *   }
+ * \endcode
+ */
+class ValidCellSpans {
+public:
+    /*!
+     * \brief Span of consecutive valid cells in a row
+     */
+    struct Span {
+        int row; ///< row index
+        int scol; ///< start col
+        int ecol; ///< end col (inclusive)
+        int offset; ///< index of the first cell of the span in the valid cells
+    };
+
+    ValidCellSpans();
+
+    /*!
+     * \brief Constructor from position index, \sa Build()
+     */
+    ValidCellSpans(int nrows, int ncols, int n, const int* posidx);
+
+    /*!
+     * \brief Build spans from position index
+     * \param[in] nrows Rows number
+     * \param[in] ncols Cols number
+     * \param[in] n Valid cells number
+     * \param[in] posidx Position index of valid cells in ascending order, i.e., row * ncols + col
+     * \return true if succeed, otherwise the spans will be empty.
+     */
+    bool Build(int nrows, int ncols, int n, const int* posidx);
+
+    int GetRows() const { return n_rows_; } ///< Rows number
+    int GetCols() const { return n_cols_; } ///< Cols number
+    int GetCellNumber() const { return n_cells_; } ///< Valid cells number
+    int GetSpanNumber() const { return CVT_INT(spans_.size()); } ///< Spans number
+    const vector<Span>& GetSpans() const { return spans_; } ///< All spans ordered by row and col
+
+    /*!
+     * \brief Get spans of the given row, i.e., GetSpans()[first, last)
+     * \return false if the row is out of range
+     */
+    bool GetRowSpans(int row, int* first, int* last) const;
+
+    /*!
+     * \brief Get index of the valid cell at (row, col), O(log spans of the row)
+     * \return -1 if the cell is invalid
+     */
+    int GetIndex(int row, int col) const;
+
+    /*!
+     * \brief Get row and col of the valid cell index, O(log spans)
+     */
+    bool GetRowCol(int index, int* row, int* col) const;
+
+    /*!
+     * \brief Convert spans to position index
+     * \param[out] posidx Position index array with the length of GetCellNumber()
+     */
+    bool ToPositionIndex(int* posidx) const;
+
+    //! Approximate memory size in bytes
+    size_t GetMemorySize() const;
+
+private:
+    int n_rows_; ///< Rows number
+    int n_cols_; ///< Cols number
+    int n_cells_; ///< Valid cells number
+    vector<Span> spans_; ///< Spans ordered by row and col
+    vector<int> row_start_; ///< Start span of each row, the size is n_rows_ + 1
+};
+
+/*!
+ * \class MaskGridMapping
+ * \brief Row and column in the grid of a raster for each valid cell of a mask layer,
+ *        which only depends on the grid geometry of the raster and thus can be shared by
+ *        all rasters of the same geometry that are masked by the same mask layer.
+ */
+class MaskGridMapping: NotCopyable {
+public:
+    //! Constructor by the header of raster data
+    explicit MaskGridMapping(const STRDBL_MAP& header);
+
+    //! Is the mapping for the grid geometry of the header?
+    bool Matches(const STRDBL_MAP& header) const;
+
+    int n_rows; ///< row count of the raster
+    int n_cols; ///< column count of the raster
+    double xll; ///< X coordinate of left lower center of the raster
+    double yll; ///< Y coordinate of left lower center of the raster
+    double cellsize; ///< cell size of the raster
+    vector<int> rows; ///< row of each valid cell of mask, -1 if exceeds the extent of the raster
+    vector<int> cols; ///< column of each valid cell of mask, -1 if exceeds the extent of the raster
+};
+
+/*!
+ * \class MaskMappingCache
+ * \brief Thread-safe cache of MaskGridMapping of one mask layer, one for each distinct grid geometry
+ */
+class MaskMappingCache: NotCopyable {
+public:
+    /*!
+     * \brief Get the mapping for the grid geometry of the header, which will be built once by
+     *        the build function if not existed, i.e., `std::shared_ptr<MaskGridMapping> build()`
+     */
+    template <typename F>
+    std::shared_ptr<MaskGridMapping> Get(const STRDBL_MAP& header, F build) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto it = mappings_.begin(); it != mappings_.end(); ++it) {
+            if ((*it)->Matches(header)) { return *it; }
+        }
+        std::shared_ptr<MaskGridMapping> mapping = build();
+        if (nullptr != mapping) { mappings_.emplace_back(mapping); }
+        return mapping;
+    }
+
+    //! Count of distinct grid geometries
+    size_t GetMappingNumber() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return mappings_.size();
+    }
+
+private:
+    std::mutex mutex_;
+    vector<std::shared_ptr<MaskGridMapping> > mappings_;
+};
+
+/*!
+ * \class SubsetArena
+ * \brief Bump allocator of subset tables and data, which are released all at once
+ *        when the last owner is destroyed.
+ *
+ * Building, copying, and releasing a decomposition of lots of subsets (e.g., subbasins)
+ *   thus turn into a handful of large allocations rather than several allocations per subset.
+ * The allocation is thread-safe.
+ */
+class SubsetArena: NotCopyable {
+public:
+    /*!
+     * \brief Constructor
+     * \param[in] reserve Bytes of the first block, 0 means allocating blocks on demand
+     */
+    explicit SubsetArena(size_t reserve = 0);
+
+    ~SubsetArena();
+
+    //! Allocate uninitialized memory, nullptr if failed
+    void* Allocate(size_t bytes);
+
+    //! Allocate 1D array with initial value, nullptr if failed
+    template <typename T>
+    T* Allocate1D(const int n, const T init) {
+        if (n <= 0) { return nullptr; }
+        T* data = static_cast<T*>(Allocate(CVT_SIZET(n) * sizeof(T)));
+        if (nullptr == data) { return nullptr; }
+        for (int i = 0; i < n; i++) { data[i] = init; }
+        return data;
+    }
+
+    //! Allocate 2D array with continuous memory and initial value, nullptr if failed
+    template <typename T>
+    T** Allocate2D(const int rows, const int cols, const T init) {
+        if (rows <= 0 || cols <= 0) { return nullptr; }
+        T** data = static_cast<T**>(Allocate(CVT_SIZET(rows) * sizeof(T*)));
+        T* pool = Allocate1D(rows * cols, init);
+        if (nullptr == data || nullptr == pool) { return nullptr; }
+        for (int i = 0; i < rows; i++) { data[i] = pool + i * cols; }
+        return data;
+    }
+
+    //! Estimate bytes of position tables, i.e., global_, local_pos_, and local_posidx_, of subsets
+    static size_t EstimatePositionBytes(int nsubsets, int ncells);
+
+    //! Estimate bytes of data of subsets, i.e., the upper bound that data is stored in double
+    static size_t EstimateDataBytes(int nsubsets, int ncells, int nlyrs);
+
+    //! Get number of allocated blocks
+    size_t GetBlockNumber();
+
+    //! Get bytes of allocated blocks
+    size_t GetMemorySize();
+
+    //! Get bytes handed out
+    size_t GetUsedSize();
+
+private:
+    //! Allocate a new block, the caller MUST hold the lock
+    bool NewBlock(size_t bytes);
+
+    vector<std::pair<char*, size_t> > blocks_; ///< allocated blocks and their sizes
+    size_t offset_; ///< used bytes of the last block
+    size_t used_; ///< bytes handed out
+    std::mutex mutex_; ///< guard of allocation
+};
+
+/*!
+ * \class PositionTables
+ * \brief Immutable position tables of valid cells, i.e., row/col pairs, position index,
+ *        and global index (for subset only), which are shared by reference counting.
+ *
+ * The tables take over the given arrays and release them when the last owner is destroyed,
+ *   e.g., rasters masked by the same mask layer share the mask's positions even if
+ *   the mask layer has been released.
+ * If the arrays are allocated from a SubsetArena, the tables keep the arena alive instead.
+ */
+class PositionTables: NotCopyable {
+public:
+    PositionTables(int n, int** posdata, int* posidx, int* globalidx = nullptr,
+                   const std::shared_ptr<SubsetArena>& owner = nullptr);
+
+    ~PositionTables();
+
+    /*!
+     * \brief Get row/col pairs, which will be materialized from position index on the first call
+     * \param[in] posidx Position index, i.e., row * ncols + col
+     * \param[in] ncols Columns number that the position index based on
+     */
+    int** MaterializePositionData(const int* posidx, int ncols);
+
+    /*!
+     * \brief Get spans of valid cells, which will be built from position index on the first call
+     * \param[in] posidx Position index, i.e., row * ncols + col
+     * \param[in] nrows Rows number
+     * \param[in] ncols Columns number that the position index based on
+     */
+    std::shared_ptr<ValidCellSpans> MaterializeSpans(const int* posidx, int nrows, int ncols);
+
+    /*! Get row/col pairs, nullptr if not materialized yet, which may be materialized concurrently */
+    int** GetPositionData();
+
+    int n_cells; ///< valid cell count
+    int** pos_data; ///< position data, i.e., row and col, nullptr if not materialized
+    int* pos_idx; ///< position index, i.e., row * ncols + col
+    int* global_idx; ///< global position index of subset
+    std::shared_ptr<ValidCellSpans> spans; ///< spans of valid cells, nullptr if not materialized
+    std::shared_ptr<SubsetArena> arena; ///< owner of the arrays if not nullptr
+private:
+    std::mutex mutex_; ///< guard of materializing pos_data and spans
+};
+
+/*!
+ * \class SubsetHalo
+ * \brief Ghost cells of a subset, i.e., valid cells of other subsets within the halo width
+ *        around the subset, and the exchange plan that names the subset owning each ghost cell.
+ *
+ * The ghost cells are located in the subset's extent expanded by the halo width, e.g.,
+ *   the ghost cell of local (row, col) is GetIndex(row, col), -1 if not a ghost cell.
+ * The halo is immutable once built, and shared by subsets that share the positions.
+ */
+class SubsetHalo: NotCopyable {
+public:
+    /*!
+     * \brief Ghost cells owned by one subset
+     */
+    struct Exchange {
+        int owner; ///< ID of the subset that owns the ghost cells
+        vector<int> ghost; ///< index of the ghost cells, i.e., 0 ~ n_cells - 1
+        vector<int> source; ///< index of the ghost cells in valid cells of the owner subset
+    };
+
+    SubsetHalo(): width(0), n_cells(0) {}
+
+    //! Index of ghost cell by local (row, col) of the subset extent, which may be negative
+    int GetIndex(const int row, const int col) const { return spans.GetIndex(row + width, col + width); }
+
+    int width; ///< halo width in cells
+    int n_cells; ///< count of ghost cells
+    vector<int> global; ///< index of ghost cells in valid cells of the raster
+    vector<int> posidx; ///< ascending position index of ghost cells in the expanded extent
+    vector<Exchange> plan; ///< exchange plan ordered by owner ID
+    ValidCellSpans spans; ///< spans of ghost cells in the expanded extent
+};
+
+/*!
+ * \class SubsetPositions
+ * \brief Subset positions of raster data
+ */
+class SubsetPositions: NotCopyable {
+public:
+    SubsetPositions();
+
+    SubsetPositions(int srow, int erow, int scol, int ecol);
+
+    /*!
+     * \brief Copy constructor
+     * \param[in] src Source subset
+     * \param[in] deep_copy Copy positions and data (true), or share the positions
+     *                      with src by reference counting without data (false)
+     * \param[in] arena Arena to allocate positions and data, nullptr means allocating from heap
+     */
+    explicit SubsetPositions(SubsetPositions*& src, bool deep_copy = false,
+                             const std::shared_ptr<SubsetArena>& arena = nullptr);
+
+    ~SubsetPositions();
+
+    bool Initialization();
+
+    /*!
+     * \brief Release or detach the position tables, i.e., global_, local_pos_, and local_posidx_
+     */
+    void ReleasePositions();
+
+    /*!
+     * \brief Allocate global_, local_pos_, and local_posidx_ of n_cells from arena_ or heap
+     */
+    bool AllocatePositions();
+
+    /*!
+     * \brief Allocate payload_ (1D) or payload2d_ (2D) of n_cells and n_lyrs in type T
+     *        from arena_ or heap if not existed.
+     *
+     * Data in other type will be released firstly, since payload_ and payload2d_ share the same type.
+     */
+    template <typename T>
+    bool AllocateData(const bool is2d, const T init) {
+        RasterDataType type = TypeToRasterDataType(typeid(T));
+        if (RDT_Unknown == type || n_cells <= 0 || (is2d && n_lyrs <= 0)) { return false; }
+        if ((nullptr != payload_ || nullptr != payload2d_) && type != data_type_) { ReleaseData(); }
+        if (is2d ? nullptr != payload2d_ : nullptr != payload_) { return true; }
+        // values are continuous and follow the row pointers of 2D data in one block
+        size_t nvalues = CVT_SIZET(n_cells) * (is2d ? n_lyrs : 1);
+        size_t ptr_bytes = is2d ? CVT_SIZET(n_cells) * sizeof(T*) : 0;
+        size_t capacity = 0;
+        bool in_arena = false;
+        void* block = AllocatePayload(ptr_bytes + nvalues * sizeof(T), capacity, in_arena);
+        if (nullptr == block) { return false; }
+        T* values = reinterpret_cast<T*>(static_cast<char*>(block) + ptr_bytes);
+        for (size_t i = 0; i < nvalues; i++) { values[i] = init; }
+        if (is2d) {
+            T** rows = static_cast<T**>(block);
+            for (int i = 0; i < n_cells; i++) { rows[i] = values + i * n_lyrs; }
+            payload2d_ = block;
+            payload2d_bytes_ = capacity;
+            payload2d_in_arena_ = in_arena;
+        } else {
+            payload_ = block;
+            payload_bytes_ = capacity;
+            payload_in_arena_ = in_arena;
+        }
+        data_type_ = type;
+        return true;
+    }
+
+    //! Release or detach payload_ and payload2d_
+    void ReleaseData();
+
+    //! Element type of payload_ and payload2d_, RDT_Unknown if no data
+    RasterDataType GetDataType() const { return data_type_; }
+
+    //! Get 1D data in type T, nullptr if not existed or stored in other type
+    template <typename T>
+    T* GetData() const {
+        if (nullptr == payload_ || TypeToRasterDataType(typeid(T)) != data_type_) { return nullptr; }
+        return static_cast<T*>(payload_);
+    }
+
+    //! Get 2D data in type T, i.e., data[cell][lyr], nullptr if not existed or stored in other type
+    template <typename T>
+    T** Get2DData() const {
+        if (nullptr == payload2d_ || TypeToRasterDataType(typeid(T)) != data_type_) { return nullptr; }
+        return static_cast<T**>(payload2d_);
+    }
+
+    /*!
+     * \brief Get the position tables to be shared, the self-allocated tables
+     *        will be transferred to PositionTables firstly.
+     */
+    std::shared_ptr<PositionTables> GetSharedPositions();
+
+    /*!
+     * \brief Get spans of valid cells in local extent, which is shared with subsets that share positions
+     * \return nullptr if local positions are not available
+     */
+    std::shared_ptr<ValidCellSpans> GetSpans();
+
+    /*!
+     * \brief Set 1D data, which is stored in its own type T without conversion
+     */
+    template <typename T>
+    bool SetData(const int n, T* data) {
+        if (n != n_cells) { return false; }
+        if (nullptr == data) { return false; }
+        if (1 != n_lyrs) { n_lyrs = 1; }
+        if (!AllocateData(false, T())) { return false; }
+        T* values = static_cast<T*>(payload_);
+        for (int i = 0; i < n_cells; i++) { values[i] = data[i]; }
+        usable = true;
+        return true;
+    }
+
+    /*!
+     * \brief Set 2D data, which is stored in its own type T without conversion
+     */
+    template <typename T>
+    bool Set2DData(const int n, const int lyr, T** data2d) {
+        if (n != n_cells) { return false; }
+        if (nullptr == data2d) { return false; }
+        if (lyr != n_lyrs) {
+            if (nullptr != payload2d_) { ReleaseData(); } // layer count changed
+            n_lyrs = lyr;
+        }
+        if (!AllocateData(true, T())) { return false; }
+        T** values = static_cast<T**>(payload2d_);
+        for (int i = 0; i < n_cells; i++) {
+            for (int j = 0; j < n_lyrs; j++) {
+                values[i][j] = data2d[i][j];
+            }
+        }
+        usable = true;
+        return true;
+    }
+#ifdef USE_MONGODB
+    /*!
+     * \brief Read subset data from MongoDB, which is stored in type T
+     */
+    template <typename T = double>
+    bool ReadFromMongoDB(MongoGridFs* gfs, const string& fname,
+                         const STRING_MAP& opts = STRING_MAP()) {
+        T* dbdata = nullptr;
+        GridFsHeader header; // only the typed fields are used
+        if (!ReadGridFsFile(gfs, fname, dbdata, header, opts)) { return false; }
+        int nrows = g_erow - g_srow + 1;
+        int ncols = g_ecol - g_scol + 1;
+        int nfull = nrows * ncols;
+        int db_ncells = header.CellsNumber();
+        int db_nlyrs = header.Layers();
+        if ((nfull != db_ncells && n_cells != db_ncells) || db_nlyrs < 0) {
+            Release1DArray(dbdata);
+            return false;
+        }
+        if (n_lyrs != db_nlyrs && nullptr != payload2d_) { ReleaseData(); }
+        n_lyrs = db_nlyrs;
+        if (n_lyrs == 1) {
+            if (n_cells == db_ncells) {
+                bool set_success = SetData(db_ncells, dbdata);
+                Release1DArray(dbdata);
+                return set_success;
+            }
+            if (!AllocateData(false, T())) {
+                Release1DArray(dbdata);
+                return false;
+            }
+            T* values = static_cast<T*>(payload_);
+            for (int i = 0; i < n_cells; i++) {
+                values[i] = dbdata[local_posidx_[i]];
+            }
+        }
+        else {
+            if (!AllocateData(true, T())) {
+                Release1DArray(dbdata);
+                return false;
+            }
+            T** values = static_cast<T**>(payload2d_);
+            for (int i = 0; i < n_cells; i++) {
+                for (int j = 0; j < n_lyrs; j++) {
+                    if (nfull == db_ncells) { // consider data from MongoDB is fullsize data
+                        values[i][j] = dbdata[local_posidx_[i] * n_lyrs + j];
+                    }
+                    else { values[i][j] = dbdata[i * n_lyrs + j]; }
+                }
+            }
+        }
+        usable = true;
+        Release1DArray(dbdata);
+        return true;
+    }
+
+    /*!
+     * \brief Read subset data from the full-sized raster in MongoDB, which is stored in type T.
+     *        Only the tiles intersecting with the subset are fetched if the GridFS file is tiled.
+     * \sa ReadGridFsWindow()
+     */
+    template <typename T = double>
+    bool ReadWindowFromMongoDB(MongoGridFs* gfs, const string& fname,
+                               const STRING_MAP& opts = STRING_MAP(),
+                               MongoClientPool* pool = nullptr) {
+        if (nullptr == local_posidx_) { return false; }
+        T* dbdata = nullptr;
+        GridFsHeader header;
+        if (!ReadGridFsWindow(gfs, fname, g_srow, g_erow, g_scol, g_ecol,
+                              dbdata, header, opts, pool)) {
+            return false;
+        }
+        int db_nlyrs = header.Layers();
+        if (n_lyrs != db_nlyrs && nullptr != payload2d_) { ReleaseData(); }
+        n_lyrs = db_nlyrs;
+        if (!AllocateData(n_lyrs > 1, T())) {
+            Release1DArray(dbdata);
+            return false;
+        }
+        if (n_lyrs == 1) {
+            T* values = static_cast<T*>(payload_);
+            for (int i = 0; i < n_cells; i++) {
+                values[i] = dbdata[local_posidx_[i]];
+            }
+        }
+        else {
+            T** values = static_cast<T**>(payload2d_);
+            for (int i = 0; i < n_cells; i++) {
+                for (int j = 0; j < n_lyrs; j++) {
+                    values[i][j] = dbdata[local_posidx_[i] * n_lyrs + j];
+                }
+            }
+        }
+        usable = true;
+        Release1DArray(dbdata);
+        return true;
+    }
+#endif
+    void GetHeader(double gxll, double gyll, int gnrows, double cellsize,
+                   double nodata, STRDBL_MAP& subheader);
+
+    /*!
+     * \brief Output data as fullsize arrays in local extent of each layer,
+     *        the data is converted to T only if it is stored in other type
+     */
+    template <typename T>
+    void Output(T nodata, vector<T*>& fulldata) {
+        switch (data_type_) {
+            case RDT_UInt8:  OutputPayload<T, vuint8_t>(nodata, fulldata); break;
+            case RDT_Int8:   OutputPayload<T, vint8_t>(nodata, fulldata); break;
+            case RDT_UInt16: OutputPayload<T, vuint16_t>(nodata, fulldata); break;
+            case RDT_Int16:  OutputPayload<T, vint16_t>(nodata, fulldata); break;
+            case RDT_UInt32: OutputPayload<T, vuint32_t>(nodata, fulldata); break;
+            case RDT_Int32:  OutputPayload<T, vint32_t>(nodata, fulldata); break;
+            case RDT_UInt64: OutputPayload<T, vuint64_t>(nodata, fulldata); break;
+            case RDT_Int64:  OutputPayload<T, vint64_t>(nodata, fulldata); break;
+            case RDT_Float:  OutputPayload<T, float>(nodata, fulldata); break;
+            case RDT_Double: OutputPayload<T, double>(nodata, fulldata); break;
+            default: break;
+        }
+    }
+
+    /*!
+     * \brief Gather values of ghost cells from values of all valid cells of the raster,
+     *        e.g., the raster data, without copying the whole array
+     * \param[in] values Values of all valid cells of the raster
+     * \param[out] halo_values Values of ghost cells with the length of halo_->n_cells
+     */
+    template <typename T>
+    bool GatherHalo(const T* values, T* halo_values) const {
+        if (nullptr == halo_ || nullptr == values || nullptr == halo_values) { return false; }
+        const int* global = halo_->global.empty() ? nullptr : &halo_->global[0];
+        for (int i = 0; i < halo_->n_cells; i++) { halo_values[i] = values[global[i]]; }
+        return true;
+    }
+
+    /*!
+     * \brief Gather values of ghost cells from the 1D data of owner subsets by the exchange plan
+     * \param[in] subsets Subsets that include the owners of ghost cells
+     * \param[out] halo_values Values of ghost cells with the length of halo_->n_cells
+     * \return false if any owner subset does not exist or has no 1D data in type T
+     */
+    template <typename T>
+    bool ExchangeHalo(const map<int, SubsetPositions*>& subsets, T* halo_values) const {
+        if (nullptr == halo_ || nullptr == halo_values) { return false; }
+        for (auto it = halo_->plan.begin(); it != halo_->plan.end(); ++it) {
+            auto owner = subsets.find(it->owner);
+            if (owner == subsets.end() || nullptr == owner->second) { return false; }
+            const T* src = owner->second->GetData<T>();
+            if (nullptr == src) { return false; }
+            for (size_t i = 0; i < it->ghost.size(); i++) {
+                halo_values[it->ghost[i]] = src[it->source[i]];
+            }
+        }
+        return true;
+    }
+
+    /*!
+     * \brief Scatter data of valid cells to the destination array with lyrs layers, i.e.,
+     *        dst[j * lyrs + ilyr], the data is converted to T only if it is stored in other type
+     * \param[out] dst Destination array
+     * \param[in] lyrs Layer count, 1 for payload_ and greater than 1 for payload2d_
+     * \param[in] cellidx Index j of each valid cell, nullptr means the valid cell index itself
+     * \param[in] dstidx Index mapping of j if not nullptr, i.e., dstidx[j]
+     * \return false if no data to scatter
+     */
+    template <typename T>
+    bool ScatterTo(T* dst, const int lyrs, const int* cellidx, const int* dstidx = nullptr) const {
+        if (nullptr == dst) { return false; }
+        switch (data_type_) {
+            case RDT_UInt8:  return ScatterPayload<T, vuint8_t>(dst, lyrs, cellidx, dstidx);
+            case RDT_Int8:   return ScatterPayload<T, vint8_t>(dst, lyrs, cellidx, dstidx);
+            case RDT_UInt16: return ScatterPayload<T, vuint16_t>(dst, lyrs, cellidx, dstidx);
+            case RDT_Int16:  return ScatterPayload<T, vint16_t>(dst, lyrs, cellidx, dstidx);
+            case RDT_UInt32: return ScatterPayload<T, vuint32_t>(dst, lyrs, cellidx, dstidx);
+            case RDT_Int32:  return ScatterPayload<T, vint32_t>(dst, lyrs, cellidx, dstidx);
+            case RDT_UInt64: return ScatterPayload<T, vuint64_t>(dst, lyrs, cellidx, dstidx);
+            case RDT_Int64:  return ScatterPayload<T, vint64_t>(dst, lyrs, cellidx, dstidx);
+            case RDT_Float:  return ScatterPayload<T, float>(dst, lyrs, cellidx, dstidx);
+            case RDT_Double: return ScatterPayload<T, double>(dst, lyrs, cellidx, dstidx);
+            default: return false;
+        }
+    }
+
+    bool usable; ///< flag for usable subset data
+    int n_cells; ///< valid cell count
+    int n_lyrs; ///< layer count
+    int g_srow; ///< start row in global data
+    int g_erow; ///< end row in global data
+    int g_scol; ///< start col in global data
+    int g_ecol; ///< end col in global data
+    bool alloc_; ///< local_pos_ and global_ are allocated?
+    std::shared_ptr<PositionTables> tables_; ///< shared owner of local_pos_ and global_ if not alloc_
+    std::shared_ptr<SubsetArena> arena_; ///< owner of positions and data allocated from arena
+    std::shared_ptr<SubsetHalo> halo_; ///< ghost cells around the subset, nullptr if not built
+    int** local_pos_; ///< local position data
+    int* local_posidx_; ///< local position index
+    int* global_; ///< global position index
+    RasterDataType data_type_; ///< element type of payload_ and payload2d_
+    void* payload_; ///< valid data array in data_type_, \sa GetData()
+    void* payload2d_; ///< valid 2d data array in data_type_, \sa Get2DData()
+
+private:
+    /*!
+     * \brief Allocate memory of data from the released slot, arena_, or heap.
+     *        Once data allocated from arena_ is released, the others are allocated from heap,
+     *        since arena_ reclaims its memory only when destroyed.
+     * \param[in] bytes Memory size in bytes
+     * \param[out] capacity Actual size of the memory
+     * \param[out] in_arena The memory belongs to arena_
+     */
+    void* AllocatePayload(size_t bytes, size_t& capacity, bool& in_arena);
+
+    //! Release memory of data, the memory of arena_ is kept as a slot to be reused
+    void ReleasePayload(void*& block, size_t& capacity, bool& in_arena);
+
+    size_t payload_bytes_; ///< memory size of payload_
+    size_t payload2d_bytes_; ///< memory size of payload2d_ including row pointers
+    bool payload_in_arena_; ///< payload_ is allocated from arena_
+    bool payload2d_in_arena_; ///< payload2d_ is allocated from arena_
+    bool arena_released_; ///< any data allocated from arena_ has been released
+    void* spare_; ///< released memory of arena_ to be reused
+    size_t spare_bytes_; ///< memory size of spare_
+
+    //! Copy data of src in its own type
+    bool CopyPayload(const SubsetPositions* src);
+
+    template <typename P>
+    bool CopyPayloadAs(const SubsetPositions* src) {
+        bool flag = true;
+        if (nullptr != src->payload_) { flag = SetData(n_cells, src->GetData<P>()); }
+        if (nullptr != src->payload2d_) { flag = Set2DData(n_cells, src->n_lyrs, src->Get2DData<P>()) && flag; }
+        return flag;
+    }
+
+    template <typename T, typename P>
+    void OutputPayload(T nodata, vector<T*>& fulldata) {
+        const P* data = static_cast<const P*>(payload_);
+        P** data2d = static_cast<P**>(payload2d_);
+        int nrows = g_erow - g_srow + 1;
+        int ncols = g_ecol - g_scol + 1;
+        int fullsize = nrows * ncols;
+        std::shared_ptr<ValidCellSpans> spans = GetSpans();
+        for (int ilyr = 0; ilyr < n_lyrs; ilyr++) {
+            T* tmpdata = nullptr;
+            Initialize1DArray(fullsize, tmpdata, nodata);
+            if (nullptr != spans) { // iterate whole runs of valid cells
+                const vector<ValidCellSpans::Span>& runs = spans->GetSpans();
+                for (auto it = runs.begin(); it != runs.end(); ++it) {
+                    T* dst = tmpdata + it->row * ncols + it->scol;
+                    int len = it->ecol - it->scol + 1;
+                    if (n_lyrs > 1 && nullptr != data2d) {
+                        for (int k = 0; k < len; k++) { dst[k] = static_cast<T>(data2d[it->offset + k][ilyr]); }
+                    }
+                    else if (n_lyrs == 1 && nullptr != data) {
+                        const P* src = data + it->offset;
+                        for (int k = 0; k < len; k++) { dst[k] = static_cast<T>(src[k]); }
+                    }
+                }
+                fulldata.emplace_back(tmpdata);
+                continue;
+            }
+            for (int vi = 0; vi < n_cells; vi++) {
+                int j = local_posidx_[vi];
+                if (n_lyrs > 1 && nullptr != data2d) {
+                    tmpdata[j] = static_cast<T>(data2d[vi][ilyr]);
+                }
+                else if (n_lyrs == 1 && nullptr != data) {
+                    tmpdata[j] = static_cast<T>(data[vi]);
+                }
+            }
+            fulldata.emplace_back(tmpdata);
+        }
+    }
+
+    template <typename T, typename P>
+    bool ScatterPayload(T* dst, const int lyrs, const int* cellidx, const int* dstidx) const {
+        if (lyrs > 1 && nullptr != payload2d_) {
+            P** data2d = static_cast<P**>(payload2d_);
+            for (int vi = 0; vi < n_cells; vi++) {
+                int j = nullptr == cellidx ? vi : cellidx[vi];
+                if (nullptr != dstidx) { j = dstidx[j]; }
+                T* values = dst + CVT_SIZET(j) * lyrs;
+                for (int ilyr = 0; ilyr < lyrs; ilyr++) { values[ilyr] = static_cast<T>(data2d[vi][ilyr]); }
+            }
+            return true;
+        }
+        if (lyrs == 1 && nullptr != payload_) {
+            const P* data = static_cast<const P*>(payload_);
+            for (int vi = 0; vi < n_cells; vi++) {
+                int j = nullptr == cellidx ? vi : cellidx[vi];
+                if (nullptr != dstidx) { j = dstidx[j]; }
+                dst[j] = static_cast<T>(data[vi]);
+            }
+            return true;
+        }
+        return false;
+    }
+};
+
+/*!
+ * \class SubsetCombinePlan
+ * \brief Destination index of each valid cell of subsets in the combined raster data,
+ *        which is built once per decomposition and reused by every combination.
+ *
+ * Destination indexes of all subsets are stored contiguously in ascending order of subset IDs,
+ *   i.e., dst[offset[i]] ~ dst[offset[i + 1] - 1] for the i-th subset.
+ */
+class SubsetCombinePlan: NotCopyable {
+public:
+    SubsetCombinePlan(): posidx(nullptr) {}
+
+    /*!
+     * \brief Build plan of subsets
+     * \param[in] subsets Subsets with global_ of valid cells
+     * \param[in] pos_idx Position index of valid cells, i.e., the destination of combined data
+     *                    including nodata, nullptr means the index of valid cells itself
+     */
+    void Build(const map<int, SubsetPositions*>& subsets, const int* pos_idx);
+
+    //! Is the plan built from the same subsets and position index?
+    bool Matches(const map<int, SubsetPositions*>& subsets, const int* pos_idx) const;
+
+    //! Destination indexes of the i-th subset
+    const int* GetDestination(const size_t i) const { return dst.empty() ? nullptr : &dst[offset[i]]; }
+
+    vector<int> ids; ///< subset IDs in ascending order
+    vector<SubsetPositions*> subs; ///< subsets in the order of ids
+    vector<const int*> globals; ///< global_ of subsets when built, to validate the plan
+    vector<size_t> offset; ///< start of each subset in dst, the size is subs.size() + 1
+    vector<int> dst; ///< destination indexes of all subsets
+    const int* posidx; ///< position index used to build the plan
+};
+
+/*!
+ * \class RasterView
+ * \brief Non-owning read-only view of raster data, positions, and header, which is
+ *        designed for zero-copy hand-off between stages, \sa clsRasterData::GetView()
+ *
+ * The view does not release any data. It is valid as long as the viewed clsRasterData
+ *   exists and is not modified, and if the positions are borrowed (i.e., PositionsOwned() is false),
+ *   the mask layer that owns the positions MUST also exist.
+ * If the raster data is shared from clsRasterCache, the shared data is kept alive by the view.
+ */
+template <typename T>
+class RasterView {
+public:
+    //! Constructor an empty view
+    RasterView(): data_(nullptr), data2d_(nullptr), is_2d_(false), n_cells_(-1), n_lyrs_(-1),
+                  pos_data_(nullptr), pos_idx_(nullptr), header_(), nodata_(),
+                  calc_pos_(false), own_pos_(false), mask_ext_(false), owner_() {
+    }
+
+    //! Constructor a view by raster data, positions, header, and ownership flags of source
+    RasterView(const T* data, const T* const* data2d, const bool is_2d, const int ncells, const int nlyrs,
+               const int* const* posdata, const int* posidx, const STRDBL_MAP& header, T nodata,
+               const bool calc_pos, const bool own_pos, const bool mask_ext,
+               const std::shared_ptr<const void>& owner = std::shared_ptr<const void>()):
+        data_(data), data2d_(data2d), is_2d_(is_2d), n_cells_(ncells), n_lyrs_(nlyrs),
+        pos_data_(posdata), pos_idx_(posidx), header_(header), nodata_(nodata),
+        calc_pos_(calc_pos), own_pos_(own_pos), mask_ext_(mask_ext), owner_(owner) {
+    }
+
+    //! Is the view of valid raster data?
+    bool Valid() const { return n_cells_ > 0 && (is_2d_ ? nullptr != data2d_ : nullptr != data_); }
+    bool Is2DRaster() const { return is_2d_; } ///< Is 2D raster data?
+    int GetCellNumber() const { return n_cells_; } ///< Get the first dimension size
+    int GetLayers() const { return n_lyrs_; } ///< Get layer number
+    int GetCols() const { return CVT_INT(header_.at(HEADER_RS_NCOLS)); } ///< Get column number
+    int GetRows() const { return CVT_INT(header_.at(HEADER_RS_NROWS)); } ///< Get row number
+    T GetNoDataValue() const { return nodata_; } ///< Get NoDATA value
+    const T* GetRasterDataPointer() const { return data_; } ///< Get pointer of raster 1D data
+    const T* const* Get2DRasterDataPointer() const { return data2d_; } ///< Get pointer of raster 2D data
+    const int* const* GetRasterPositionDataPointer() const { return pos_data_; } ///< Get position data, nullptr if not materialized
+    const int* GetRasterPositionIndexPointer() const { return pos_idx_; } ///< Get position index
+    const STRDBL_MAP& GetRasterHeader() const { return header_; } ///< Get header information
+    bool PositionsCalculated() const { return calc_pos_; } ///< Data is stored by valid positions
+    bool PositionsOwned() const { return own_pos_; } ///< Positions owned by the viewed raster or borrowed
+    bool MaskExtented() const { return mask_ext_; } ///< Use mask extent or not
+
+    //! Get value by index of valid cells, NoDATA will be returned if failed
+    T GetValueByIndex(const int cell_index, const int lyr = 1) const {
+        if (!Valid() || cell_index < 0 || cell_index >= n_cells_ || lyr < 1 || lyr > n_lyrs_) {
+            return nodata_;
+        }
+        return is_2d_ ? data2d_[cell_index][lyr - 1] : data_[cell_index];
+    }
+
+    //! Get index of valid cells by row and col, -1 for NoDATA location, -2 for error
+    int GetPosition(const int row, const int col) const {
+        if (!Valid() || row < 0 || col < 0 || row >= GetRows() || col >= GetCols()) { return -2; }
+        int idx = row * GetCols() + col;
+        if (!calc_pos_) { return idx; }
+        if (nullptr == pos_idx_) { return -2; } // positions are required but unavailable
+        int left = 0;
+        int right = n_cells_ - 1;
+        while (left <= right) {
+            int middle = left + (right - left) / 2;
+            if (pos_idx_[middle] > idx) { right = middle - 1; }
+            else if (pos_idx_[middle] < idx) { left = middle + 1; }
+            else { return middle; }
+        }
+        return -1;
+    }
+
+    //! Get value by row and col, NoDATA will be returned if failed
+    T GetValue(const int row, const int col, const int lyr = 1) const {
+        int idx = GetPosition(row, col);
+        return idx < 0 ? nodata_ : GetValueByIndex(idx, lyr);
+    }
+
+private:
+    const T* data_;
+    const T* const* data2d_;
+    bool is_2d_;
+    int n_cells_;
+    int n_lyrs_;
+    const int* const* pos_data_;
+    const int* pos_idx_;
+    STRDBL_MAP header_;
+    T nodata_;
+    bool calc_pos_;
+    bool own_pos_;
+    bool mask_ext_;
+    //! Keep shared data alive if the viewed raster is a consumer of clsRasterCache
+    std::shared_ptr<const void> owner_;
+};
+
+/*!
+ * \class clsRasterData
+ * \brief Raster data (1D and 2D) I/O class
+ *        Support I/O among ASCII file, TIFF, and MongoDB database.
+ */
+template <typename T, typename MASK_T = T>
+class clsRasterData {
+public:
+    /************* Construct functions ***************/
+
+    /*!
+     * \brief Constructor an empty clsRasterData instance for 1D or 2D raster
+     */
+    explicit clsRasterData(bool is_2d = false);
+
+    /*!
+     * \brief Constructor 1D raster from necessary data.
+     */
+    clsRasterData(T* data, int cols, int rows, T nodata, double dx, double xll,
+                  double yll, const STRING_MAP& opts = STRING_MAP());
+
+    /*!
+     * \brief Constructor 1D raster from necessary data.
+     * \deprecated The input parameter `srs` is highly recommended replaced by `map<string, string>`.
+     */
+    clsRasterData(T* data, int cols, int rows, T nodata, double dx, double xll,
+                  double yll, const string& srs);
+
+    /*!
+    * \brief Constructor 2D raster from necessary data
+    */
+    clsRasterData(T** data2d, int cols, int rows, int nlayers, T nodata,
+                  double dx, double xll, double yll, const STRING_MAP& opts = STRING_MAP());
+
+    /*!
+     * \brief Constructor 2D raster from necessary data
+     * \deprecated The input parameter `srs` is highly recommended replaced by `map<string, string>`.
+     */
+    clsRasterData(T** data2d, int cols, int rows, int nlayers, T nodata,
+                  double dx, double xll, double yll, const string& srs);
+
+    /*!
+     * \brief Constructor of clsRasterData instance from TIFF, ASCII, or other GDAL supported format,
+     *        which has one data layer, referred to as Raster1D.
+     *
+     * \param[in] filename Full path of the raster file
+     * \param[in] calc_pos Calculate positions of valid cells excluding NODATA. The default is false.
+     * \param[in] mask \a clsRasterData<MASK_T> Mask layer
+     * \param[in] use_mask_ext Use mask layer extent, even NoDATA exists.
+     * \param[in] default_value Default value when mask data exceeds the raster extend.
+     * \param[in] opts (Optional) Additional options of the raster data with the format of key-value
+     */
+    explicit clsRasterData(const string& filename, bool calc_pos = false,
+                           clsRasterData<MASK_T>* mask = nullptr, bool use_mask_ext = true,
+                           double default_value = NODATA_VALUE, const STRING_MAP& opts = STRING_MAP());
+
+    /*!
+     * \brief Validation check before the construction of clsRasterData,
+     *        i.e., the raster file is existed and the data format supported.
+     *        This is the recommended way to construct an instance of clsRasterData.
+     *
+     * \code
+     *       clsRasterData<T> *rs = clsRasterData<T>::Init(filename)
+     *       if (nullptr == rs) {
+     *           throw exception("clsRasterData initialization failed!");
+     *           // or other error handling code.
+     *       }
+     * \endcode
+     */
+    static clsRasterData<T, MASK_T>* Init(const string& filename, bool calc_pos = false,
+                                          clsRasterData<MASK_T>* mask = nullptr, bool use_mask_ext = true,
+                                          double default_value = NODATA_VALUE, const STRING_MAP& opts = STRING_MAP());
+
+    /*!
+     * \brief Constructor of clsRasterData instance from TIFF, ASCII, or other GDAL supported raster file,
+     *        which may have one or more data layers, i.e., compatible with Raster1D and Rater2D.
+     *
+     * \param[in] filenames Full paths vector of the 2D raster data
+     * \param[in] calc_pos Calculate positions of valid cells excluding NODATA. The default is false.
+     * \param[in] mask \a clsRasterData<MASK_T> Mask layer
+     * \param[in] use_mask_ext Use mask layer extent, even NoDATA exists.
+     * \param[in] default_value Default value when mask data exceeds the raster extend.
+     * \param[in] opts (Optional) Additional options of the raster data with the format of key-value
+     */
+    explicit clsRasterData(vector<string>& filenames, bool calc_pos = false,
+                           clsRasterData<MASK_T>* mask = nullptr, bool use_mask_ext = true,
+                           double default_value = NODATA_VALUE, const STRING_MAP& opts = STRING_MAP());
+
+    /*!
+     * \brief Validation check before the constructor of clsRasterData,
+     *        i.e., the raster files are all existed and the data format supported.
+     *        This is the recommended way to construct an instance of clsRasterData,
+     *        compatible with Raster1D and Rater2D.
+     *
+     * \code
+     *       vector<string> filenames = {"layer1.tif", "layer2.tif", "layer3.tif"};
+     *       clsRasterData<T> *rs = clsRasterData<T>::Init(filenames)
+     *       if (nullptr == rs) {
+     *           throw exception("clsRasterData initialization failed!");
+     *           // or other error handling code.
+     *       }
+     * \endcode
+     */
+    static clsRasterData<T, MASK_T>* Init(vector<string>& filenames, bool calc_pos = false,
+                                          clsRasterData<MASK_T>* mask = nullptr, bool use_mask_ext = true,
+                                          double default_value = NODATA_VALUE, const STRING_MAP& opts = STRING_MAP());
+
+    /*!
+     * \brief Read and mask multiple rasters by one mask layer, the inputs are decoded concurrently.
+     *
+     *        The mapping from valid cells of mask to the grid of inputs is calculated once for
+     *        each distinct grid geometry, and shared by all inputs of the same geometry.
+     *
+     * \param[in] filenames Full paths of each input, paths of one input are regarded as multiple layers
+     * \param[in] mask \a clsRasterData<MASK_T> Mask layer
+     * \param[out] rasters Rasters in the order of \a filenames, nullptr if failed
+     * \param[in] calc_pos Calculate positions of valid cells excluding NODATA. The default is false.
+     * \param[in] use_mask_ext Use mask layer extent, even NoDATA exists.
+     * \param[in] default_values Default value of each input, empty means NODATA_VALUE for all
+     * \param[in] opts (Optional) Additional options of the raster data with the format of key-value
+     * \param[in] nthreads (Optional) Thread number, 0 means the default thread number of OpenMP
+     * \param[in] mappings (Optional) Mappings of mask shared with other batches, e.g., batches
+     *                     run concurrently after PrepareAsMask() of the mask layer
+     * \return Count of rasters read successfully
+     */
+    static int BatchMask(vector<vector<string> >& filenames, clsRasterData<MASK_T>* mask,
+                         vector<clsRasterData<T, MASK_T>*>& rasters,
+                         bool calc_pos = false, bool use_mask_ext = true,
+                         const vector<double>& default_values = vector<double>(),
+                         const STRING_MAP& opts = STRING_MAP(), int nthreads = 0,
+                         const std::shared_ptr<MaskMappingCache>& mappings = nullptr);
+
+    /*!
+     * \brief Create members that are lazily created when used as a mask layer,
+     *        e.g., positions and the shared position tables of subsets,
+     *        so that rasters can be masked by this layer concurrently.
+     */
+    bool PrepareAsMask();
+
+    /*!
+     * \brief Construct an clsRasterData instance by 1D array data and mask
+     */
+    clsRasterData(clsRasterData<MASK_T>* mask, T* values, int len,
+                  const STRING_MAP& opts = STRING_MAP());
+
+    /*!
+     * \brief Construct an clsRasterData instance by 2D array data and mask
+     */
+    clsRasterData(clsRasterData<MASK_T>* mask, T** values, int len, int lyrs,
+                  const STRING_MAP& opts = STRING_MAP());
+
+#ifdef USE_MONGODB
 
     /*!
      * \brief Constructor based on mongoDB
@@ -1331,6 +2914,24 @@ public:
      */
     explicit clsRasterData(clsRasterData<T, MASK_T>* another);
 
+    /*!
+     * \brief Move constructor, the data of `other` is taken over without copying,
+     *        and `other` is left as an empty instance.
+     *        Rasters depending on `other`, e.g., masked by it, see it released.
+     *
+     * \code
+     *   vector<clsRasterData<T> > rasters;
+     *   clsRasterData<T> rs(filename);
+     *   rasters.emplace_back(std::move(rs));
+     * \endcode
+     */
+    clsRasterData(clsRasterData<T, MASK_T>&& other);
+
+    /*!
+     * \brief Move assignment, current data will be released before taking over `other`
+     */
+    clsRasterData<T, MASK_T>& operator=(clsRasterData<T, MASK_T>&& other);
+
     //! Destructor
     ~clsRasterData();
 
@@ -1388,11 +2989,16 @@ public:
      * \param outname (Optional) Output filename, if not specified, use origin directory and default name
      * \param recls (Optional) Reclassification map, no need to SetData before output subset
      * \param default_value (Optional) Default value for missed type of reclassification map
+     * \param nthreads (Optional) Maximum number of workers writing subsets concurrently,
+     *                 0 means the default thread number of OpenMP
+     *
+     * Each worker reuses one scratch buffer for all the subsets it writes.
+     * Failed subsets are reported in the ascending order of subset IDs after all writes finished.
      */
     bool OutputSubsetToFile(bool out_origin = false, bool out_combined = true,
                             const string& outname = string(),
                             const map<vint, vector<double> >& recls = map<vint, vector<double> >(),
-                            double default_value = NODATA_VALUE);
+                            double default_value = NODATA_VALUE, int nthreads = 0);
 
     /*!
      * \brief Write 1D or 2D raster data into ASC file(s)
@@ -1421,6 +3027,32 @@ public:
                          bool include_nodata = true,
                          bool out_origin = true);
 
+    /*!
+     * \brief Write the whole raster data to MongoDB asynchronously by the write-behind writer,
+     *        hence the computing continues while the data is being written.
+     *
+     *        By default, the raster data is copied into a buffer pooled by the writer and
+     *        the raster can be modified once this function returns. If `release` is true,
+     *        the raster data (including subsets) is moved into the write task without copying
+     *        and this raster becomes empty, in which case the mask layer MUST live until
+     *        the task finishes.
+     *
+     * \param writer Write-behind writer
+     * \param filename (Optional) File name, default is the core file name of input
+     * \param opts (Optional) Key-value map for user-specific metadata
+     * \param include_nodata (Optional) Include nodata or not
+     * \param out_origin (Optional) Output original raster data or subset's data,
+     *                   the latter requires `release` to be true
+     * \param release (Optional) Give up the raster data to avoid copying
+     * \return Status of the write task, which is false if the task cannot be submitted
+     * \sa OutputToMongoDB(), MongoGridFsAsyncWriter::Flush()
+     */
+    std::shared_future<bool> OutputToMongoDBAsync(MongoGridFsAsyncWriter* writer,
+                                                  const string& filename = string(),
+                                                  const STRING_MAP& opts = STRING_MAP(),
+                                                  bool include_nodata = true,
+                                                  bool out_origin = true, bool release = false);
+
     /*!
      * \brief Write one or more raster's subset to MongoDB,
      *
@@ -1443,6 +3075,44 @@ public:
                                const map<vint, vector<double> >& recls = map<vint, vector<double> >(),
                                double default_value = NODATA_VALUE);
 
+    /*!
+     * \brief Write raster's subsets to MongoDB concurrently, one worker per GridFS handle
+     *
+     *        Since `mongoc_client_t` is not thread-safe, each handle MUST be created from
+     *        a distinct client, e.g., clients popped from a `mongoc_client_pool_t`.
+     *        Failed subsets are reported in the ascending order of subset IDs.
+     *
+     * \param gfs_handles GridFS handles, the number of handles bounds the number of workers
+     * \sa OutputSubsetToMongoDB(MongoGridFs*, const string&, const STRING_MAP&, bool, bool, bool,
+     *                            const map<vint, vector<double> >&, double)
+     */
+    bool OutputSubsetToMongoDB(const vector<MongoGridFs*>& gfs_handles,
+                               const string& filename = string(),
+                               const STRING_MAP& opts = STRING_MAP(),
+                               bool include_nodata = true,
+                               bool out_origin = false, bool out_combined = true,
+                               const map<vint, vector<double> >& recls = map<vint, vector<double> >(),
+                               double default_value = NODATA_VALUE);
+
+    /*!
+     * \brief Write each subset of raster as a GridFS file by batches, which is efficient for
+     *        a large number of small subsets. Each worker checks out a client from the pool and
+     *        writes its subsets by MongoGridFsBulkWriter.
+     *
+     * \param pool Client pool, the number of workers is bounded by its maximum size
+     * \param dbname Database name
+     * \param gfsname GridFS name
+     * \param batch_files Maximum files number of each batch
+     * \sa OutputSubsetToMongoDB(MongoGridFs*, const string&, const STRING_MAP&, bool, bool, bool,
+     *                            const map<vint, vector<double> >&, double)
+     */
+    bool OutputSubsetToMongoDB(MongoClientPool* pool, const string& dbname, const string& gfsname,
+                               const string& filename = string(),
+                               const STRING_MAP& opts = STRING_MAP(),
+                               bool include_nodata = true, bool out_origin = false,
+                               const map<vint, vector<double> >& recls = map<vint, vector<double> >(),
+                               double default_value = NODATA_VALUE, int batch_files = 64);
+
 #endif /* USE_MONGODB */
 
     /************************************************************************/
@@ -1489,13 +3159,36 @@ public:
     /// Set output raster data type
     void SetOutDataType(const string& strtype);
 
-    /// Set default value
-    void SetDefaultValue(const double defaultv) { default_value_ = defaultv; }
+    /// Set default value
+    void SetDefaultValue(const double defaultv) { default_value_ = defaultv; }
+
+    /*!
+     * \brief Build subsets by given groups (cell value->group ID) or by discrete values (default)
+     */
+    bool BuildSubSet(map<int, int> groups = map<int, int>());
+
+    /*!
+     * \brief Build nparts subsets of valid cells with balanced weights, which are contiguous and
+     *        compact along the Hilbert curve, rather than by cell values. The subset IDs are 1 ~ nparts,
+     *        and the existing subsets will be released.
+     * \param[in] nparts Number of subsets
+     * \param[in] weights Weights of valid cells with the length of n_cells_, nullptr means equal weights
+     */
+    bool BuildBalancedSubSet(int nparts, const double* weights = nullptr);
+
+    /*!
+     * \brief Build balanced subsets weighted by another raster, which is located by
+     *        the coordinates of valid cells. NoData or cells outside the weight raster weigh 0.
+     */
+    template <typename W, typename WMASK>
+    bool BuildBalancedSubSet(int nparts, clsRasterData<W, WMASK>* weight_rs);
 
     /*!
-     * \brief Build subsets by given groups (cell value->group ID) or by discrete values (default)
+     * \brief Build halo of each subset, i.e., valid cells of other subsets within width cells
+     *        around the subset (including diagonal), and the exchange plan, \sa SubsetHalo
+     * \param[in] width Halo width in cells, e.g., 1 for 3x3 neighborhood operations
      */
-    bool BuildSubSet(map<int, int> groups = map<int, int>());
+    bool BuildSubSetHalo(int width = 1);
 
     /*!
      * \brief Release subsets
@@ -1672,13 +3365,34 @@ public:
     //! Get subset
     map<int, SubsetPositions*>& GetSubset() { return subset_; }
 
-    /*! \brief Get raster data, include valid cell number and data
+    /*!
+     * \brief Get combine plan of subsets, which will be rebuilt only if subsets changed
+     * \param[in] include_nodata The combined data include nodata or not
+     */
+    std::shared_ptr<SubsetCombinePlan> GetCombinePlan(const bool include_nodata = true) {
+        const int* dstidx = include_nodata ? pos_idx_ : nullptr;
+        if (nullptr == comb_plan_ || !comb_plan_->Matches(subset_, dstidx)) {
+            comb_plan_ = std::make_shared<SubsetCombinePlan>();
+            comb_plan_->Build(subset_, dstidx);
+        }
+        return comb_plan_;
+    }
+
+    //! Get arena of subsets' positions and data, which will be created on the first call
+    std::shared_ptr<SubsetArena> GetSubsetArena() {
+        if (nullptr == subset_arena_) { subset_arena_ = std::make_shared<SubsetArena>(); }
+        return subset_arena_;
+    }
+
+    /*! \brief Get raster data to be modified, include valid cell number and data,
+     *         the shared data is promoted to a private copy firstly (copy-on-write)
      * \return true if the raster data has been initialized, otherwise return false and print error info.
      */
     bool GetRasterData(int* n_cells, T** data);
 
     /*!
-     * \brief Get 2D raster data, include valid cell number of each layer, layer number, and data
+     * \brief Get 2D raster data to be modified, include valid cell number of each layer,
+     *        layer number, and data, the shared data is promoted to a private copy firstly
      * \return true if the 2D raster has been initialized, otherwise return false and print error info.
      */
     bool Get2DRasterData(int* n_cells, int* n_lyrs, T*** data);
@@ -1699,7 +3413,12 @@ public:
     string GetCoreName() const { return core_name_; }
 
     /*!
-     * \brief Get position index data and the data length
+     * \brief Get position data (row, col) and the data length
+     *
+     * Only position index is stored by default, the row/col pairs will be
+     *   materialized from position index on the first call and shared with
+     *   rasters that share the same positions.
+     *
      * \param[out] datalength Data length
      * \param[out] positiondata The pointer of 2D array (pointer)
      */
@@ -1707,10 +3426,33 @@ public:
 
     void GetRasterPositionData(int* datalength, int** positiondata);
 
-    T* GetRasterDataPointer() const { return raster_; } /// Get pointer of raster 1D data
-    int** GetRasterPositionDataPointer() const { return pos_data_; } /// Get pointer of position data
+    /*!
+     * \brief Get pointer of raster 1D data to be modified, the shared data
+     *        is promoted to a private copy firstly (copy-on-write), \sa ShareFrom()
+     */
+    T* GetRasterDataPointer() {
+        if (IsSharedData()) { DetachSharedData(); }
+        return raster_;
+    }
+    const T* GetRasterDataPointer() const { return raster_; } /// Get read-only pointer of raster 1D data
+    int** GetRasterPositionDataPointer() const { return MaterializePositionData(); } /// Get pointer of position data
+
+    /*!
+     * \brief Get run-length compressed valid cells, which will be built on the first call
+     *        and shared with rasters that share the same positions.
+     * \return nullptr if positions are not calculated, \sa SetCalcPositions()
+     */
+    std::shared_ptr<ValidCellSpans> GetValidCellSpans() const;
     int* GetRasterPositionIndexPointer() const { return pos_idx_; } /// Get pointer of position data
-    T** Get2DRasterDataPointer() const { return raster_2d_; } /// Get pointer of raster 2D data
+    /*!
+     * \brief Get pointer of raster 2D data to be modified, the shared data
+     *        is promoted to a private copy firstly (copy-on-write), \sa ShareFrom()
+     */
+    T** Get2DRasterDataPointer() {
+        if (IsSharedData()) { DetachSharedData(); }
+        return raster_2d_;
+    }
+    const T* const* Get2DRasterDataPointer() const { return raster_2d_; } /// Get read-only pointer of 2D data
     const char* GetSrs(); /// Get the spatial reference (char*)
     string GetSrsString(); /// Get the spatial reference (string)
     string GetOption(const char* key); /// Get option by key, including the spatial reference by "SRS"
@@ -1808,14 +3550,45 @@ public:
     //! Get full filename
     string GetFullFileName() const { return full_path_; }
 
-    //! Get mask data pointer
-    clsRasterData<MASK_T>* GetMask() const { return mask_; }
+    //! Get mask data pointer, nullptr if the mask layer has been released
+    clsRasterData<MASK_T>* GetMask() const { return mask_alive_.expired() ? nullptr : mask_; }
+
+    /*!
+     * \brief Get the position tables to be shared by other rasters, e.g., rasters masked by this layer
+     * \return nullptr if positions are not calculated or just pointers assigned by SetPositions()
+     */
+    std::shared_ptr<PositionTables> GetSharedPositions() const { return pos_tables_; }
+
+    //! Token to observe the lifetime of this instance, e.g., used by masked rasters
+    std::weak_ptr<bool> GetLifetimeToken() const { return alive_; }
 
     /*!
      * \brief Copy clsRasterData object
      */
     void Copy(clsRasterData<T, MASK_T>* orgraster);
 
+    /*!
+     * \brief Share the raster data and positions of a read-only source without copying.
+     *
+     * The source is kept alive by reference counting. Any modification of values, e.g.,
+     * SetValue(), ReplaceNoData(), and Reclassify(), promotes the shared data to
+     * a private copy first (copy-on-write), so the source and other consumers are not affected.
+     * \sa clsRasterCache
+     */
+    bool ShareFrom(const std::shared_ptr<clsRasterData<T, MASK_T> >& src);
+
+    //! Raster data is shared from another instance (true) or owned by itself (false)
+    bool IsSharedData() const { return nullptr != shared_src_; }
+
+    //! Identity of the loaded raster data, which will never be reused in the process
+    vuint64_t GetUniqueId() const { return unique_id_; }
+
+    /*!
+     * \brief Get a non-owning read-only view of raster data, positions, and header
+     * \sa RasterView
+     */
+    RasterView<T> GetView() const;
+
     /*!
      * \brief Replace NoData value by the given value
      */
@@ -1885,6 +3658,13 @@ private:
      */
     int MaskAndCalculateValidPosition();
 
+    /*!
+     * \brief Build the mapping from valid cells of mask to the grid of this raster
+     * \param[in] valid_pos Position index of valid cells of mask
+     * \param[in] mask_ncells Count of valid cells of mask
+     */
+    std::shared_ptr<MaskGridMapping> BuildMaskMapping(const int* valid_pos, int mask_ncells);
+
     /*!
      * \brief Calculate position index from rectangle grid values, if necessary.
      * To use this function, mask should be nullptr.
@@ -1902,12 +3682,46 @@ private:
 
     /*!
      * \brief Prepare data array of subsets for output
+     *
+     * If \a capacity is not nullptr, \a values is treated as a reusable scratch buffer
+     * of \a capacity elements owned by the caller, which will be enlarged if necessary.
      */
     bool PrepareSubsetData(int sub_id, SubsetPositions* sub,
                            T** values, int* datalen, int* datalyrs,
                            bool out_origin = false, bool include_nodata = true,
                            const map<vint, vector<double> >& recls = map<vint, vector<double> >(),
-                           double default_value = NODATA_VALUE);
+                           double default_value = NODATA_VALUE, int* capacity = nullptr);
+
+    /*!
+     * \brief Collect usable subsets in the ascending order of subset IDs
+     */
+    void GetUsableSubsets(vector<int>& subids, vector<SubsetPositions*>& subs);
+
+#ifdef USE_MONGODB
+    /*!
+     * \brief Update options_ by user-specific options for subsets output to MongoDB
+     */
+    void UpdateSubsetOutputOptions(const STRING_MAP& opts, bool include_nodata);
+
+    /*!
+     * \brief Update options_ and prepare header and data of the whole raster to be output to MongoDB
+     * \param[in] opts Key-value map for user-specific metadata
+     * \param[in] include_nodata Include nodata or not
+     * \param[out] header Header information
+     * \param[out] data Raster data, which refers to raster_ (or raster_2d_) or is newly allocated
+     * \param[out] datalength Length of data
+     * \return true if data is newly allocated, which should be released by Release1DArray()
+     */
+    bool PrepareMongoDBOutput(const STRING_MAP& opts, bool include_nodata,
+                              STRDBL_MAP& header, T*& data, int& datalength);
+#endif /* USE_MONGODB */
+
+    /*!
+     * \brief Number of workers bounded by the number of tasks
+     * \param[in] nthreads Required thread number, 0 or negative means the OpenMP default
+     * \param[in] ntasks Number of tasks, i.e., subsets
+     */
+    static int BoundedThreadNumber(int nthreads, int ntasks);
 
     /*!
      * \brief Output full size raster data to files
@@ -1938,9 +3752,70 @@ private:
     }
 
     /*!
-     * \brief Operator= without implementation
+     * \brief Release raster data, positions, statistics, and subsets owned by the instance
+     */
+    void ReleaseRasterData();
+
+    //! Set mask layer and observe its lifetime
+    void SetMask(clsRasterData<MASK_T>* mask) {
+        mask_ = mask;
+        if (nullptr == mask) { mask_alive_.reset(); }
+        else { mask_alive_ = mask->GetLifetimeToken(); }
+    }
+
+    //! Release or detach the positions, the shared positions will be released by the last owner
+    void ReleasePositions() {
+        pos_tables_ = nullptr;
+        pos_data_ = nullptr;
+        pos_idx_ = nullptr;
+        store_pos_ = false;
+    }
+
+    //! Transfer newly allocated pos_data_ and pos_idx_ to shared position tables
+    void AdoptPositions() {
+        pos_tables_ = std::make_shared<PositionTables>(n_cells_, pos_data_, pos_idx_);
+        store_pos_ = true;
+    }
+
+    //! Share positions of mask layer rather than copy them
+    void SharePositionsFromMask();
+
+    //! Build subsets by index of valid cells (in ascending order) of each subset ID
+    bool BuildSubSetFromIndices(map<int, vector<int> >& global_idx);
+
+    //! Materialize row/col pairs of valid cells from pos_idx_ if necessary
+    int** MaterializePositionData() const;
+
+    //! Write a row of valid cells to ASC file by iterating spans
+    void OutputAscRowBySpans(std::ofstream& raster_file, const ValidCellSpans& spans,
+                             int row, int lyr, double nodata);
+
+    /*!
+     * \brief Promote the shared raster data (and positions owned by the source) to private copies.
+     * \param[in] copy_data Copy the values (true), or just detach them to be reassigned (false)
+     */
+    void DetachSharedData(bool copy_data = true);
+
+    //! Generate a new identity of raster data
+    static vuint64_t NewUniqueId() {
+        static std::atomic<vuint64_t> counter(0);
+        return ++counter;
+    }
+
+    /*!
+     * \brief Copy constructor without implementation, use clsRasterData(clsRasterData*) or Copy() instead
+     */
+    clsRasterData(const clsRasterData&);
+
+    /*!
+     * \brief Operator= without implementation, use Copy() instead
+     */
+    clsRasterData& operator=(const clsRasterData&);
+
+    /*!
+     * \brief Take over all data of `other` and leave it as an empty instance
      */
-    clsRasterData& operator=(const clsRasterData&) { }
+    void MoveFrom(clsRasterData<T, MASK_T>& other);
 
     /*! cell number of raster data, i.e. the data length of \sa raster_data_ or \sa raster_2d_
      * 1. all grid cell number, i.e., ncols * nrows, when m_calcPositions is False
@@ -1967,10 +3842,13 @@ private:
     T* raster_;
     //! 2D raster data, data access format: raster_2d_[cellIndex][layer], layer starts from 1
     T** raster_2d_;
-    //! valid cells' position (row, col) in raster_data_ or the first layer of raster_2d_ (2D array)
-    int** pos_data_;
+    //! valid cells' position (row, col) in raster_data_ or the first layer of raster_2d_ (2D array),
+    //!   which is materialized from pos_idx_ on demand
+    mutable int** pos_data_;
     //! valid cells' index (row * cols + col) in raster_data_ or the first layer of raster_2d_
     int* pos_idx_;
+    //! Shared owner of pos_data_ and pos_idx_, nullptr means they are pointers assigned by users
+    mutable std::shared_ptr<PositionTables> pos_tables_;
     //! Key-value options in string format, including spatial reference
     STRING_MAP options_;
     //! Header information, using double in case of truncation of coordinate value
@@ -1981,8 +3859,18 @@ private:
     map<string, double *> stats_2d_;
     //! mask clsRasterData instance
     clsRasterData<MASK_T>* mask_;
+    //! Observer of mask's lifetime
+    std::weak_ptr<bool> mask_alive_;
+    //! Lifetime token observed by other rasters, renewed once the instance is reset
+    std::shared_ptr<bool> alive_;
     //! Subset by user-specific groups or discrete values of the raster data
     map<int, SubsetPositions*> subset_;
+    //! Arena of subsets' positions and data, released after all subsets sharing it
+    std::shared_ptr<SubsetArena> subset_arena_;
+    //! Combine plan of subsets, \sa GetCombinePlan()
+    std::shared_ptr<SubsetCombinePlan> comb_plan_;
+    //! Mappings of mask shared by rasters masked together, only used while constructing
+    std::shared_ptr<MaskMappingCache> mask_mappings_;
     //! initial once
     bool initialized_;
     //! Flag to identify 1D or 2D raster
@@ -1995,6 +3883,10 @@ private:
     bool use_mask_ext_;
     //! Statistics calculated?
     bool stats_calculated_;
+    //! Source of the shared raster data, nullptr means the raster data is owned by itself
+    std::shared_ptr<clsRasterData<T, MASK_T> > shared_src_;
+    //! Identity of the loaded raster data, e.g., used as part of key by clsRasterCache
+    vuint64_t unique_id_;
 };
 
 /******** Define common used raster types **************/
@@ -2017,6 +3909,110 @@ private:
 #define DblIntRaster       clsRasterData<double, int>
 #endif
 
+/*!
+ * \class clsRasterCache
+ * \brief Process-wide registry of read-only raster data shared by reference counting
+ *
+ * Requests with the same file path(s), size and modification time (in nanoseconds if supported),
+ *   mask identity, data type (i.e., the template arguments), and reading options share one copy
+ *   of raster data in memory.
+ * Each request gets a lightweight clsRasterData instance that should be deleted as usual,
+ *   and modifying its values, including by the mutable data pointers, will promote the data
+ *   to a private copy (copy-on-write).
+ * Unreferenced entries are kept for further requests until the memory budget is exceeded,
+ *   then evicted in least-recently-used order.
+ *
+ * \code
+ *   clsRasterCache<float, int>& cache = clsRasterCache<float, int>::Instance();
+ *   cache.SetMemoryBudget(1024 * 1024 * 1024); // 1 GB
+ *   clsRasterData<float, int>* rs = cache.Acquire(filename, true, mask);
+ *   if (nullptr == rs) {
+ *       // error handling code.
+ *   }
+ *   // ...
+ *   delete rs;
+ * \endcode
+ */
+template <typename T, typename MASK_T = T>
+class clsRasterCache: NotCopyable {
+public:
+    //! Get the process-wide instance
+    static clsRasterCache<T, MASK_T>& Instance();
+
+    /*!
+     * \brief Get a shared raster from cache, or read it if not cached yet
+     * \sa clsRasterData::Init()
+     * \return Newly created clsRasterData instance which should be released by the caller,
+     *         or nullptr if failed.
+     */
+    clsRasterData<T, MASK_T>* Acquire(const string& filename, bool calc_pos = false,
+                                      clsRasterData<MASK_T>* mask = nullptr, bool use_mask_ext = true,
+                                      double default_value = NODATA_VALUE,
+                                      const STRING_MAP& opts = STRING_MAP());
+
+    /*!
+     * \brief Get a shared multi-layers raster from cache, or read it if not cached yet
+     */
+    clsRasterData<T, MASK_T>* Acquire(vector<string>& filenames, bool calc_pos = false,
+                                      clsRasterData<MASK_T>* mask = nullptr, bool use_mask_ext = true,
+                                      double default_value = NODATA_VALUE,
+                                      const STRING_MAP& opts = STRING_MAP());
+
+    //! Set memory budget in bytes, 0 means unlimited. Unreferenced entries will be evicted if exceeded.
+    void SetMemoryBudget(size_t bytes);
+    //! Get memory budget in bytes
+    size_t GetMemoryBudget();
+    //! Get estimated memory usage in bytes of all cached entries
+    size_t GetMemoryUsage();
+    //! Get count of cached entries
+    int GetEntryCount();
+    //! Get count of requests served by cached entries
+    vuint64_t GetHitCount();
+    //! Get count of requests that read raster data
+    vuint64_t GetMissCount();
+    //! Get count of evicted entries
+    vuint64_t GetEvictionCount();
+    //! Reset hit, miss, and eviction counters
+    void ResetCounters();
+    //! Evict unreferenced entries until the memory usage is within the budget
+    void Trim();
+    //! Remove all unreferenced entries
+    void Clear();
+
+private:
+    clsRasterCache();
+
+    //! Cached raster data and its bookkeeping
+    struct CacheEntry {
+        std::shared_ptr<clsRasterData<T, MASK_T> > raster;
+        size_t bytes;
+        std::list<string>::iterator lru_pos;
+    };
+
+    clsRasterData<T, MASK_T>* AcquireByKeys(vector<string>& filenames, bool calc_pos,
+                                            clsRasterData<MASK_T>* mask, bool use_mask_ext,
+                                            double default_value, const STRING_MAP& opts);
+
+    //! Create a consumer instance that shares the cached raster data
+    static clsRasterData<T, MASK_T>* CreateConsumer(const std::shared_ptr<clsRasterData<T, MASK_T> >& src);
+
+    //! Estimate memory size of raster data and positions owned by the raster
+    static size_t EstimateBytes(clsRasterData<T, MASK_T>* rs);
+
+    //! Evict unreferenced entries in least-recently-used order, MUST be called with mutex_ locked
+    void EvictUnreferenced(size_t budget);
+
+    std::mutex mutex_;
+    map<string, CacheEntry> entries_;
+    //! Keys of entries, the most recently used in front
+    std::list<string> lru_;
+    size_t budget_;
+    size_t usage_;
+    vuint64_t hits_;
+    vuint64_t misses_;
+    vuint64_t evictions_;
+};
+
 /*******************************************************/
 /************* Implementation Code Begin ***************/
 /*******************************************************/
@@ -2036,8 +4032,14 @@ void clsRasterData<T, MASK_T>::InitializeRasterClass(bool is_2d /* = false */) {
     raster_ = nullptr;
     pos_data_ = nullptr;
     pos_idx_ = nullptr;
+    pos_tables_ = nullptr;
     mask_ = nullptr;
+    mask_alive_.reset();
+    alive_ = std::make_shared<bool>(true); // dependents of the former instance, if any, see it released
     subset_ = map<int, SubsetPositions*>();
+    subset_arena_ = nullptr;
+    comb_plan_ = nullptr;
+    mask_mappings_ = nullptr;
     n_lyrs_ = -1;
     is_2draster = is_2d;
     raster_2d_ = nullptr;
@@ -2048,6 +4050,8 @@ void clsRasterData<T, MASK_T>::InitializeRasterClass(bool is_2d /* = false */) {
     headers_ = InitialHeader();
     options_ = InitialStrHeader();
     InitialStatsMap(stats_, stats_2d_);
+    shared_src_ = nullptr;
+    unique_id_ = NewUniqueId();
     initialized_ = true;
 }
 
@@ -2058,8 +4062,10 @@ void clsRasterData<T, MASK_T>::InitializeReadFunction(const string& filename, co
                                                       double default_value /* NODATA_VALUE */,
                                                       const STRING_MAP& opts /* = STRING_MAP() */) {
     if (!initialized_) { InitializeRasterClass(); }
+    if (IsSharedData()) { DetachSharedData(false); }
+    unique_id_ = NewUniqueId();
     full_path_ = filename;
-    mask_ = mask;
+    SetMask(mask);
     calc_pos_ = calc_pos;
     use_mask_ext_ = use_mask_ext;
     if (nullptr == mask_) { use_mask_ext_ = false; }
@@ -2205,17 +4211,55 @@ clsRasterData<T, MASK_T>* clsRasterData<T, MASK_T>::Init(vector<string>& filenam
     return rs2d;
 }
 
+template <typename T, typename MASK_T>
+int clsRasterData<T, MASK_T>::BatchMask(vector<vector<string> >& filenames, clsRasterData<MASK_T>* mask,
+                                        vector<clsRasterData<T, MASK_T>*>& rasters,
+                                        const bool calc_pos /* = false */,
+                                        const bool use_mask_ext /* = true */,
+                                        const vector<double>& default_values /* = vector<double>() */,
+                                        const STRING_MAP& opts /* = STRING_MAP() */,
+                                        int nthreads /* = 0 */,
+                                        const std::shared_ptr<MaskMappingCache>& mappings /* = nullptr */) {
+    int nrs = CVT_INT(filenames.size());
+    rasters.assign(nrs, nullptr);
+    if (nrs == 0) { return 0; }
+    std::shared_ptr<MaskMappingCache> cache = mappings;
+    if (nullptr != mask) {
+        // mask is read-only hereafter, the shared mappings indicate that it has been prepared
+        if (nullptr == cache && !mask->PrepareAsMask()) { return 0; }
+        if (nullptr == cache) { cache = std::make_shared<MaskMappingCache>(); }
+    }
+    int count = 0;
+#pragma omp parallel for schedule(dynamic) reduction(+:count) num_threads(BoundedThreadNumber(nthreads, nrs))
+    for (int i = 0; i < nrs; i++) {
+        if (filenames[i].empty() || !FilesExist(filenames[i])) { continue; }
+        double defaultv = NODATA_VALUE;
+        if (default_values.size() == filenames.size()) { defaultv = default_values[i]; }
+        clsRasterData<T, MASK_T>* rs = new clsRasterData<T, MASK_T>();
+        rs->SetOutDataType(RasterDataTypeInOptionals(opts));
+        rs->mask_mappings_ = cache;
+        bool flag = rs->ReadFromFiles(filenames[i], calc_pos, mask, use_mask_ext, defaultv, opts);
+        rs->mask_mappings_ = nullptr;
+        if (!flag) {
+            delete rs;
+            continue;
+        }
+        rasters[i] = rs;
+        count++;
+    }
+    return count;
+}
+
 template <typename T, typename MASK_T>
 clsRasterData<T, MASK_T>::clsRasterData(clsRasterData<MASK_T>* mask, T* const values, const int len,
                                         const STRING_MAP& opts /* = STRING_MAP() */) {
     InitializeRasterClass(false);
     rs_type_out_ = RasterDataTypeInOptionals(opts);
     calc_pos_ = false;
-    mask_ = mask;
+    SetMask(mask);
     use_mask_ext_ = true;
     n_lyrs_ = 1;
-    mask->GetRasterPositionData(&n_cells_, &pos_data_);
-    mask->GetRasterPositionData(&n_cells_, &pos_idx_);
+    SharePositionsFromMask();
     if (n_cells_ != len) {
         StatusMessage("Input data length MUST EQUALS TO valid cell's number of mask!");
         initialized_ = false;
@@ -2234,11 +4278,10 @@ clsRasterData<T, MASK_T>::clsRasterData(clsRasterData<MASK_T>* mask, T** const v
                                         const int lyrs, const STRING_MAP& opts /* = STRING_MAP() */) {
     InitializeRasterClass(true);
     calc_pos_ = false;
-    mask_ = mask;
+    SetMask(mask);
     use_mask_ext_ = true;
     n_lyrs_ = lyrs;
-    mask->GetRasterPositionData(&n_cells_, &pos_data_);
-    mask->GetRasterPositionData(&n_cells_, &pos_idx_);
+    SharePositionsFromMask();
     if (n_cells_ != len) {
         StatusMessage("Input data length MUST EQUALS TO valid cell's number of mask!");
         initialized_ = false;
@@ -2325,10 +4368,11 @@ bool clsRasterData<T, MASK_T>::ConstructFromSingleFile(const string& filename,
 template <typename T, typename MASK_T>
 clsRasterData<T, MASK_T>::~clsRasterData() {
     if (!core_name_.empty()) { StatusMessage(("Release raster: " + core_name_).c_str()); }
-    if (nullptr != raster_) { Release1DArray(raster_); }
-    if (nullptr != pos_data_ && store_pos_) { Release2DArray(pos_data_); }
-    if (nullptr != pos_idx_ && store_pos_) { Release1DArray(pos_idx_); }
-    if (nullptr != raster_2d_ && is_2draster) { Release2DArray(raster_2d_); }
+    if (!IsSharedData()) { // the shared data will be released by the last owner
+        if (nullptr != raster_) { Release1DArray(raster_); }
+        if (nullptr != raster_2d_ && is_2draster) { Release2DArray(raster_2d_); }
+    }
+    ReleasePositions();
     if (is_2draster && stats_calculated_) { ReleaseStatsMap2D(); }
     ReleaseSubset();
 }
@@ -2336,12 +4380,11 @@ clsRasterData<T, MASK_T>::~clsRasterData() {
 template <typename T, typename MASK_T>
 bool clsRasterData<T, MASK_T>::BuildSubSet(map<int, int> groups /* = map<int, int>() */) {
     if (!ValidateRasterData()) { return false; }
-    if (nullptr == pos_data_ || nullptr == pos_idx_) {
+    if (nullptr == pos_idx_) {
         if (!SetCalcPositions()) { return false; }
     }
     if (!subset_.empty()) { return true; }
 
-    int global_ncols = GetCols();
     map<int, vector<int> > global_idx;
     for (int vi = 0; vi < n_cells_; vi++) {
         T curv = GetValueByIndex(vi); // compatible with 2D Raster
@@ -2350,22 +4393,6 @@ bool clsRasterData<T, MASK_T>::BuildSubSet(map<int, int> groups /* = map<int, in
         if (!groups.empty() && groups.find(groupv) != groups.end()) {
             groupv = groups.at(groupv); // original raster value --> specified group ID
         }
-        //int currow = pos_data_[vi][0];
-        //int curcol = pos_data_[vi][1];
-        int currow = pos_idx_[vi] / global_ncols;
-        int curcol = pos_idx_[vi] % global_ncols;
-        if (subset_.find(groupv) == subset_.end()) {
-#ifdef HAS_VARIADIC_TEMPLATES
-            subset_.emplace(groupv, new SubsetPositions(currow, currow, curcol, curcol));
-#else
-            subset_.insert(make_pair(groupv, new SubsetPositions(currow, currow, curcol, curcol)));
-#endif
-        }
-        SubsetPositions*& cursubset = subset_.at(groupv);
-        if (currow > cursubset->g_erow) { cursubset->g_erow = currow; }
-        if (currow < cursubset->g_srow) { cursubset->g_srow = currow; }
-        if (curcol > cursubset->g_ecol) { cursubset->g_ecol = curcol; }
-        if (curcol < cursubset->g_scol) { cursubset->g_scol = curcol; }
         if (global_idx.find(groupv) == global_idx.end()) {
 #ifdef HAS_VARIADIC_TEMPLATES
             global_idx.emplace(groupv, vector<int>());
@@ -2374,30 +4401,181 @@ bool clsRasterData<T, MASK_T>::BuildSubSet(map<int, int> groups /* = map<int, in
 #endif
         }
         global_idx[groupv].emplace_back(vi);
-        cursubset->n_cells += 1;
     }
-    for (auto it = subset_.begin(); it != subset_.end(); ++it) {
-        Initialize1DArray(it->second->n_cells, it->second->global_, 0);
-        for (auto it2 = global_idx[it->first].begin(); it2 != global_idx[it->first].end(); ++it2) {
-            it->second->global_[it2 - global_idx[it->first].begin()] = *it2;
+    return BuildSubSetFromIndices(global_idx);
+}
+
+template <typename T, typename MASK_T>
+bool clsRasterData<T, MASK_T>::BuildSubSetFromIndices(map<int, vector<int> >& global_idx) {
+    int global_ncols = GetCols();
+    int subset_cells = 0;
+    for (auto it = global_idx.begin(); it != global_idx.end(); ++it) {
+        if (it->second.empty()) { continue; }
+        int currow = pos_idx_[it->second[0]] / global_ncols;
+        int curcol = pos_idx_[it->second[0]] % global_ncols;
+        SubsetPositions* cursubset = new SubsetPositions(currow, currow, curcol, curcol);
+        for (auto it2 = it->second.begin(); it2 != it->second.end(); ++it2) {
+            //int currow = pos_data_[vi][0];
+            //int curcol = pos_data_[vi][1];
+            currow = pos_idx_[*it2] / global_ncols;
+            curcol = pos_idx_[*it2] % global_ncols;
+            if (currow > cursubset->g_erow) { cursubset->g_erow = currow; }
+            if (currow < cursubset->g_srow) { cursubset->g_srow = currow; }
+            if (curcol > cursubset->g_ecol) { cursubset->g_ecol = curcol; }
+            if (curcol < cursubset->g_scol) { cursubset->g_scol = curcol; }
         }
+        cursubset->n_cells = CVT_INT(it->second.size());
+        subset_cells += cursubset->n_cells;
+#ifdef HAS_VARIADIC_TEMPLATES
+        subset_.emplace(it->first, cursubset);
+#else
+        subset_.insert(make_pair(it->first, cursubset));
+#endif
     }
+    // Allocate tables of all subsets from one block
+    subset_arena_ = std::make_shared<SubsetArena>(
+        SubsetArena::EstimatePositionBytes(CVT_INT(subset_.size()), subset_cells));
     for (auto it = subset_.begin(); it != subset_.end(); ++it) {
-        Initialize2DArray(it->second->n_cells, 2, it->second->local_pos_, -1);
-        Initialize1DArray(it->second->n_cells, it->second->local_posidx_, -1);
-
-        int nrows = it->second->g_erow - it->second->g_srow + 1;
+        it->second->arena_ = subset_arena_;
+        if (!it->second->AllocatePositions()) { return false; }
+        vector<int>& cells = global_idx.at(it->first);
         int local_ncols = it->second->g_ecol - it->second->g_scol + 1;
         for (int gidx = 0; gidx < it->second->n_cells; gidx++) {
+            it->second->global_[gidx] = cells[gidx];
             //it->second->local_pos_[gidx][0] = pos_data_[it->second->global_[gidx]][0] - it->second->g_srow;
             //it->second->local_pos_[gidx][1] = pos_data_[it->second->global_[gidx]][1] - it->second->g_scol;
-            int local_row = pos_idx_[it->second->global_[gidx]] / global_ncols - it->second->g_srow;
-            int local_col = pos_idx_[it->second->global_[gidx]] % global_ncols  - it->second->g_scol;
+            int local_row = pos_idx_[cells[gidx]] / global_ncols - it->second->g_srow;
+            int local_col = pos_idx_[cells[gidx]] % global_ncols  - it->second->g_scol;
             it->second->local_pos_[gidx][0] = local_row;
             it->second->local_pos_[gidx][1] = local_col;
             it->second->local_posidx_[gidx] = local_row * local_ncols + local_col;
         }
-        it->second->alloc_ = true;
+    }
+    return true;
+}
+
+template <typename T, typename MASK_T>
+bool clsRasterData<T, MASK_T>::BuildBalancedSubSet(const int nparts, const double* weights /* = nullptr */) {
+    if (nparts <= 0 || !ValidateRasterData()) { return false; }
+    if (nullptr == pos_idx_) {
+        if (!SetCalcPositions()) { return false; }
+    }
+    ReleaseSubset();
+    // Only cells with valid values, which is consistent with BuildSubSet()
+    vector<int> cells;
+    vector<int> cellpos;
+    vector<double> cellweights;
+    cells.reserve(n_cells_);
+    cellpos.reserve(n_cells_);
+    for (int vi = 0; vi < n_cells_; vi++) {
+        if (FloatEqual(GetValueByIndex(vi), no_data_value_)) { continue; }
+        cells.emplace_back(vi);
+        cellpos.emplace_back(pos_idx_[vi]);
+        if (nullptr != weights) { cellweights.emplace_back(weights[vi]); }
+    }
+    if (cells.empty()) { return false; }
+    vector<vector<int> > parts;
+    if (!PartitionByHilbertCurve(GetRows(), GetCols(), CVT_INT(cells.size()), &cellpos[0],
+                                 nullptr == weights ? nullptr : &cellweights[0], nparts, parts)) {
+        return false;
+    }
+    map<int, vector<int> > global_idx;
+    for (size_t i = 0; i < parts.size(); i++) {
+        if (parts[i].empty()) { continue; }
+        vector<int>& partcells = global_idx[CVT_INT(i) + 1];
+        partcells.reserve(parts[i].size());
+        for (auto it = parts[i].begin(); it != parts[i].end(); ++it) {
+            partcells.emplace_back(cells[*it]);
+        }
+    }
+    return BuildSubSetFromIndices(global_idx);
+}
+
+template <typename T, typename MASK_T>
+template <typename W, typename WMASK>
+bool clsRasterData<T, MASK_T>::BuildBalancedSubSet(const int nparts, clsRasterData<W, WMASK>* weight_rs) {
+    if (nullptr == weight_rs) { return BuildBalancedSubSet(nparts); }
+    if (!ValidateRasterData() || !weight_rs->ValidateRasterData()) { return false; }
+    if (nullptr == pos_idx_) {
+        if (!SetCalcPositions()) { return false; }
+    }
+    int ncols = GetCols();
+    vector<double> weights(n_cells_, 0.);
+    for (int vi = 0; vi < n_cells_; vi++) {
+        XY_COOR xy = GetCoordinateByRowCol(pos_idx_[vi] / ncols, pos_idx_[vi] % ncols);
+        ROW_COL rc = weight_rs->GetPositionByCoordinate(xy.first, xy.second);
+        if (rc.first < 0 || rc.second < 0) { continue; }
+        W w = weight_rs->GetValue(rc.first, rc.second);
+        if (FloatEqual(w, weight_rs->GetNoDataValue())) { continue; }
+        weights[vi] = CVT_DBL(w);
+    }
+    return BuildBalancedSubSet(nparts, &weights[0]);
+}
+
+template <typename T, typename MASK_T>
+bool clsRasterData<T, MASK_T>::BuildSubSetHalo(const int width /* = 1 */) {
+    if (width <= 0 || subset_.empty() || nullptr == pos_idx_) { return false; }
+    int nrows = GetRows();
+    int ncols = GetCols();
+    // owner subset and index in the owner of each valid cell
+    vector<int> cellidx(CVT_SIZET(nrows) * ncols, -1);
+    vector<int> owner(n_cells_, -1);
+    vector<int> owner_local(n_cells_, -1);
+    vector<int> subset_ids;
+    vector<SubsetPositions*> subsets;
+    for (int vi = 0; vi < n_cells_; vi++) { cellidx[pos_idx_[vi]] = vi; }
+    for (auto it = subset_.begin(); it != subset_.end(); ++it) {
+        if (nullptr == it->second->global_) { return false; }
+        for (int i = 0; i < it->second->n_cells; i++) {
+            owner[it->second->global_[i]] = CVT_INT(subsets.size());
+            owner_local[it->second->global_[i]] = i;
+        }
+        subset_ids.emplace_back(it->first);
+        subsets.emplace_back(it->second);
+    }
+    int nsubsets = CVT_INT(subsets.size());
+#pragma omp parallel for schedule(dynamic)
+    for (int isub = 0; isub < nsubsets; isub++) {
+        SubsetPositions* sub = subsets[isub];
+        std::shared_ptr<SubsetHalo> halo = std::make_shared<SubsetHalo>();
+        halo->width = width;
+        for (int i = 0; i < sub->n_cells; i++) {
+            int row = pos_idx_[sub->global_[i]] / ncols;
+            int col = pos_idx_[sub->global_[i]] % ncols;
+            for (int r = row - width; r <= row + width; r++) {
+                if (r < 0 || r >= nrows) { continue; }
+                for (int c = col - width; c <= col + width; c++) {
+                    if (c < 0 || c >= ncols) { continue; }
+                    int vi = cellidx[r * ncols + c];
+                    if (vi < 0 || owner[vi] < 0 || owner[vi] == isub) { continue; }
+                    halo->global.emplace_back(vi);
+                }
+            }
+        }
+        // ascending and unique, which leads to ascending position index
+        std::sort(halo->global.begin(), halo->global.end());
+        halo->global.erase(std::unique(halo->global.begin(), halo->global.end()), halo->global.end());
+        halo->n_cells = CVT_INT(halo->global.size());
+        int srow = sub->g_srow - width;
+        int scol = sub->g_scol - width;
+        int halo_nrows = sub->g_erow - sub->g_srow + 1 + 2 * width;
+        int halo_ncols = sub->g_ecol - sub->g_scol + 1 + 2 * width;
+        map<int, SubsetHalo::Exchange> plan;
+        halo->posidx.resize(halo->n_cells);
+        for (int i = 0; i < halo->n_cells; i++) {
+            int vi = halo->global[i];
+            halo->posidx[i] = (pos_idx_[vi] / ncols - srow) * halo_ncols + pos_idx_[vi] % ncols - scol;
+            SubsetHalo::Exchange& exchange = plan[subset_ids[owner[vi]]];
+            exchange.ghost.emplace_back(i);
+            exchange.source.emplace_back(owner_local[vi]);
+        }
+        for (auto it = plan.begin(); it != plan.end(); ++it) {
+            it->second.owner = it->first;
+            halo->plan.emplace_back(it->second);
+        }
+        halo->spans.Build(halo_nrows, halo_ncols, halo->n_cells,
+                          halo->posidx.empty() ? nullptr : &halo->posidx[0]);
+        sub->halo_ = halo;
     }
     return true;
 }
@@ -2411,6 +4589,8 @@ bool clsRasterData<T, MASK_T>::ReleaseSubset() {
         }
         subset_.clear();
     }
+    subset_arena_ = nullptr; // released if not shared by others
+    comb_plan_ = nullptr;
     return true;
 }
 
@@ -2543,7 +4723,7 @@ int clsRasterData<T, MASK_T>::GetPosition(const int row, const int col) {
         return -2; // means error occurred!
     }
     int pos_idx = GetCols() * row + col;
-    if (!calc_pos_ || nullptr == pos_data_ || nullptr == pos_idx_) {
+    if (!calc_pos_ || nullptr == pos_idx_) {
         return pos_idx;
     }
 // previous low-efficiency code
@@ -2613,6 +4793,7 @@ int clsRasterData<T, MASK_T>::GetPosition(const double x, const double y) {
 template <typename T, typename MASK_T>
 bool clsRasterData<T, MASK_T>::GetRasterData(int* n_cells, T** data) {
     if (ValidateRasterData() && !is_2draster) {
+        if (IsSharedData()) { DetachSharedData(); }
         *n_cells = n_cells_;
         *data = raster_;
         return true;
@@ -2625,6 +4806,7 @@ bool clsRasterData<T, MASK_T>::GetRasterData(int* n_cells, T** data) {
 template <typename T, typename MASK_T>
 bool clsRasterData<T, MASK_T>::Get2DRasterData(int* n_cells, int* n_lyrs, T*** data) {
     if (ValidateRasterData() && is_2draster) {
+        if (IsSharedData()) { DetachSharedData(); }
         *n_cells = n_cells_;
         *n_lyrs = n_lyrs_;
         *data = raster_2d_;
@@ -2638,9 +4820,9 @@ bool clsRasterData<T, MASK_T>::Get2DRasterData(int* n_cells, int* n_lyrs, T*** d
 
 template <typename T, typename MASK_T>
 void clsRasterData<T, MASK_T>::GetRasterPositionData(int* datalength, int*** positiondata) {
-    if (nullptr != pos_data_) {
+    if (nullptr != pos_data_ || nullptr != pos_idx_) {
         *datalength = n_cells_;
-        *positiondata = pos_data_;
+        *positiondata = MaterializePositionData();
     } else {
         // reCalculate position data
         if (!ValidateRasterData()) {
@@ -2650,10 +4832,31 @@ void clsRasterData<T, MASK_T>::GetRasterPositionData(int* datalength, int*** pos
         }
         CalculateValidPositionsFromGridData();
         *datalength = n_cells_;
-        *positiondata = pos_data_;
+        *positiondata = MaterializePositionData();
     }
 }
 
+template <typename T, typename MASK_T>
+int** clsRasterData<T, MASK_T>::MaterializePositionData() const {
+    if (nullptr != pos_data_ || nullptr == pos_idx_) { return pos_data_; }
+    if (nullptr == pos_tables_) {
+        // position index is assigned by users, the materialized pos_data_ is owned by itself
+        pos_tables_ = std::make_shared<PositionTables>(n_cells_, nullptr, nullptr);
+    }
+    pos_data_ = pos_tables_->MaterializePositionData(pos_idx_, GetCols());
+    return pos_data_;
+}
+
+template <typename T, typename MASK_T>
+std::shared_ptr<ValidCellSpans> clsRasterData<T, MASK_T>::GetValidCellSpans() const {
+    if (nullptr == pos_idx_ || n_cells_ <= 0) { return nullptr; }
+    if (nullptr == pos_tables_) {
+        // position index is assigned by users, the spans are owned by itself
+        pos_tables_ = std::make_shared<PositionTables>(n_cells_, nullptr, nullptr);
+    }
+    return pos_tables_->MaterializeSpans(pos_idx_, GetRows(), GetCols());
+}
+
 template <typename T, typename MASK_T>
 void clsRasterData<T, MASK_T>::GetRasterPositionData(int* datalength, int** positiondata) {
     if (nullptr != pos_idx_) {
@@ -2770,6 +4973,7 @@ void clsRasterData<T, MASK_T>::GetValue(const int row, const int col, T*& values
 
 template <typename T, typename MASK_T>
 void clsRasterData<T, MASK_T>::SetHeader(const STRDBL_MAP& refers) {
+    if (IsSharedData()) { DetachSharedData(); } // copy-on-write
     CopyHeader(refers, headers_);
     // Update header related variables
     auto it = headers_.find(HEADER_RS_CELLSNUM);
@@ -2787,6 +4991,7 @@ void clsRasterData<T, MASK_T>::SetValue(const int row, const int col, T value, c
         StatusMessage("Set value failed!");
         return;
     }
+    if (IsSharedData()) { DetachSharedData(); } // copy-on-write
     int idx = GetPosition(row, col);
     if (idx == -1) {
         // the origin value is NODATA, and positions of valid values are calculated
@@ -2813,11 +5018,11 @@ bool clsRasterData<T, MASK_T>::SetCalcPositions() {
 
 template <typename T, typename MASK_T>
 bool clsRasterData<T, MASK_T>::SetPositions(int len, int** pdata) {
+    if (IsSharedData()) { DetachSharedData(); } // copy-on-write
     if (nullptr != pos_data_) {
         if (len != n_cells_) { return false; } // cannot change origin n_cells_
-        Release2DArray(pos_data_);
     }
-    pos_data_ = pdata;
+    pos_data_ = pdata; // pos_tables_ is still valid for pos_idx_
     calc_pos_ = true;
     store_pos_ = false;
     return true;
@@ -2825,10 +5030,13 @@ bool clsRasterData<T, MASK_T>::SetPositions(int len, int** pdata) {
 
 template <typename T, typename MASK_T>
 bool clsRasterData<T, MASK_T>::SetPositions(int len, int* pdata) {
+    if (IsSharedData()) { DetachSharedData(); } // copy-on-write
     if (nullptr != pos_idx_) {
         if (len != n_cells_) { return false; } // cannot change origin n_cells_
-        Release1DArray(pos_idx_);
     }
+    // row/col pairs and spans derived from the former position index are out of date
+    if (nullptr != pos_tables_ && pos_data_ == pos_tables_->GetPositionData()) { pos_data_ = nullptr; }
+    pos_tables_ = nullptr;
     pos_idx_ = pdata;
     calc_pos_ = true;
     store_pos_ = false;
@@ -2838,7 +5046,7 @@ bool clsRasterData<T, MASK_T>::SetPositions(int len, int* pdata) {
 template <typename T, typename MASK_T>
 bool clsRasterData<T, MASK_T>::SetUseMaskExt() {
     if (!ValidateRasterData()) return false;
-    if (nullptr == mask_) return false;
+    if (nullptr == GetMask()) return false;
     if (use_mask_ext_) return false; // already set as True, no need to recalculate.
     use_mask_ext_ = true;
     return MaskAndCalculateValidPosition() >= 0;
@@ -2872,7 +5080,8 @@ bool clsRasterData<T, MASK_T>::OutputSubsetToFile(const bool out_origin /* = fal
                                                   const bool out_combined /* = true */,
                                                   const string& outname /* = string() */,
                                                   const map<vint, vector<double> >& recls /* map() */,
-                                                  const double default_value /*  = NODATA_VALUE */) {
+                                                  const double default_value /*  = NODATA_VALUE */,
+                                                  const int nthreads /* = 0 */) {
     if (!ValidateRasterData()) { return false; }
     if (subset_.empty()) { return false; }
     string outpathact = outname.empty() ? full_path_ : outname;
@@ -2896,29 +5105,72 @@ bool clsRasterData<T, MASK_T>::OutputSubsetToFile(const bool out_origin /* = fal
         Release1DArray(data1d);
         return combflag;
     }
-    STRDBL_MAP subheader;
-    bool flag = true;
-    for (auto it = subset_.begin(); it != subset_.end(); ++it) {
-        if (!it->second->usable) { continue; }
-        it->second->GetHeader(GetXllCenter(), GetYllCenter(), GetRows(),
-                              GetCellWidth(), CVT_DBL(no_data_value_), subheader);
-        T* tmpdata1d = nullptr;
-        int tmpdatalen;
-        int tmplyrs;
-        if (!PrepareSubsetData(it->first, it->second, &tmpdata1d, &tmpdatalen, &tmplyrs,
-                               out_origin, true, recls, default_value)) {
-            continue;
+    // output each subset by a bounded number of workers
+    vector<int> subids;
+    vector<SubsetPositions*> subs;
+    GetUsableSubsets(subids, subs);
+    int nsubs = CVT_INT(subs.size());
+    if (nsubs == 0) { return true; }
+    vector<int> status(nsubs, 0); // 1: succeed, 0: skipped, -1: failed
+    double xll = GetXllCenter();
+    double yll = GetYllCenter();
+    int grows = GetRows();
+    double cellsize = GetCellWidth();
+#pragma omp parallel num_threads(BoundedThreadNumber(nthreads, nsubs))
+    {
+        T* scratch = nullptr; // scratch buffer of the current worker
+        int capacity = 0;
+        STRDBL_MAP subheader;
+#pragma omp for schedule(dynamic)
+        for (int i = 0; i < nsubs; i++) {
+            subs[i]->GetHeader(xll, yll, grows, cellsize, CVT_DBL(no_data_value_), subheader);
+            int tmpdatalen;
+            int tmplyrs;
+            if (!PrepareSubsetData(subids[i], subs[i], &scratch, &tmpdatalen, &tmplyrs,
+                                   out_origin, true, recls, default_value, &capacity)) {
+                continue;
+            }
+            UpdateHeader(subheader, HEADER_RS_LAYERS, tmplyrs);
+            UpdateHeader(subheader, HEADER_RS_CELLSNUM, tmpdatalen / tmplyrs);
+            status[i] = OutputFullsizeToFiles(scratch, tmpdatalen / tmplyrs, tmplyrs,
+                                              PrefixCoreFileName(outpathact, subids[i]),
+                                              subheader, options_) ? 1 : -1;
         }
-        UpdateHeader(subheader, HEADER_RS_LAYERS, tmplyrs);
-        UpdateHeader(subheader, HEADER_RS_CELLSNUM, tmpdatalen / tmplyrs);
-        flag = flag && OutputFullsizeToFiles(tmpdata1d, tmpdatalen / tmplyrs, tmplyrs,
-                                             PrefixCoreFileName(outpathact, it->first),
-                                             subheader, options_);
-        Release1DArray(tmpdata1d);
+        if (nullptr != scratch) { Release1DArray(scratch); }
+    }
+    bool flag = true;
+    for (int i = 0; i < nsubs; i++) {
+        if (status[i] >= 0) { continue; }
+        StatusMessage("Error: Failed to output subset " + itoa(CVT_VINT(subids[i])) + "!");
+        flag = false;
     }
     return flag;
 }
 
+template <typename T, typename MASK_T>
+void clsRasterData<T, MASK_T>::GetUsableSubsets(vector<int>& subids, vector<SubsetPositions*>& subs) {
+    subids.clear();
+    subs.clear();
+    subids.reserve(subset_.size());
+    subs.reserve(subset_.size());
+    for (auto it = subset_.begin(); it != subset_.end(); ++it) {
+        if (nullptr == it->second || !it->second->usable) { continue; }
+        subids.emplace_back(it->first);
+        subs.emplace_back(it->second);
+    }
+}
+
+template <typename T, typename MASK_T>
+int clsRasterData<T, MASK_T>::BoundedThreadNumber(int nthreads, const int ntasks) {
+#ifdef SUPPORT_OMP
+    if (nthreads <= 0) { nthreads = omp_get_max_threads(); }
+#else
+    nthreads = 1;
+#endif /* SUPPORT_OMP */
+    if (nthreads > ntasks) { nthreads = ntasks; }
+    return nthreads < 1 ? 1 : nthreads;
+}
+
 template <typename T, typename MASK_T>
 bool clsRasterData<T, MASK_T>::PrepareCombSubsetData(T** values, int* datalen, int* datalyrs,
                                                      bool out_origin /* false */, bool include_nodata /* true */,
@@ -2939,9 +5191,9 @@ bool clsRasterData<T, MASK_T>::PrepareCombSubsetData(T** values, int* datalen, i
     int lyrs_subset = -1;
     for (auto it = subset_.begin(); it != subset_.end(); ++it) {
         if (!it->second->usable) { continue; }
-        if (!(nullptr != it->second->data_    // Only if all subset have data_
-            || nullptr != it->second->data2d_ // or data2d_,
-            || !recls.empty())) {             // or reclassification map specified
+        if (!(nullptr != it->second->payload_    // Only if all subset have payload_
+            || nullptr != it->second->payload2d_ // or payload2d_,
+            || !recls.empty())) {                // or reclassification map specified
             return false;
         }
         if (lyrs_subset < 0) { lyrs_subset = it->second->n_lyrs; }
@@ -2973,53 +5225,72 @@ bool clsRasterData<T, MASK_T>::PrepareCombSubsetData(T** values, int* datalen, i
     int gncells = include_nodata ? gnrows * gncols : n_cells_;
     int data_length = gncells * lyrs;
     Initialize1DArray(data_length, data1d, no_data_value_);
-    for (auto it = subset_.begin(); it != subset_.end(); ++it) {
+    // scatter subsets concurrently by the destination indexes of the plan, which are disjoint
+    std::shared_ptr<SubsetCombinePlan> plan = GetCombinePlan(include_nodata);
+    int nsubs = CVT_INT(plan->subs.size());
+    vector<int> status(nsubs, 0); // 0: succeed or skipped, -1: failed
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < nsubs; i++) {
+        SubsetPositions* sub = plan->subs[i];
+        const int* dst = plan->GetDestination(i);
         bool use_defaultv_directly = false;
-        if (!it->second->usable) {
-            if (!FloatEqual(no_data_value_, default_value)) {
-                use_defaultv_directly = true;
-            } else {
-                continue;
-            }
+        if (!sub->usable) {
+            if (FloatEqual(no_data_value_, default_value)) { continue; }
+            use_defaultv_directly = true;
         }
-        for (int vi = 0; vi < it->second->n_cells; vi++) {
-            for (int ilyr = 0; ilyr < lyrs; ilyr++) {
-                int gidx = it->second->global_[vi];
-                //int tmpr = pos_data_[gidx][0];
-                //int tmpc = pos_data_[gidx][1];
-                //int tmprc = tmpr * gncols + tmpc;
-                int tmprc = pos_idx_[gidx];
-                if (!include_nodata) { tmprc = gidx; }
-                if (!recls.empty()) { // first priority
-                    double uniqe_value = default_value;
-                    int recls_key = it->first; // default reclassification key is subset's ID
-                    if (out_origin) {
-                        if (nullptr != raster_) { recls_key = CVT_INT(raster_[gidx]); }
-                        else if (nullptr != raster_2d_) {
-                            recls_key = CVT_INT(raster_2d_[gidx][ilyr]);
-                        }
+        if (!recls.empty()) { // first priority
+            if (!out_origin) { // reclassification key is subset's ID, lookup once
+                vector<T> lookup(lyrs, static_cast<T>(default_value));
+                auto found = recls.find(plan->ids[i]);
+                if (found != recls.end()) {
+                    for (int ilyr = 0; ilyr < lyrs && ilyr < CVT_INT(found->second.size()); ilyr++) {
+                        lookup[ilyr] = static_cast<T>(found->second[ilyr]);
                     }
-                    if (recls.count(recls_key) > 0 && recls.at(recls_key).size() > ilyr) {
-                        uniqe_value = recls.at(recls_key).at(ilyr);
-                    }
-                    data1d[tmprc * lyrs + ilyr] = static_cast<T>(uniqe_value);
-                }
-                else if (use_defaultv_directly) {
-                    data1d[tmprc * lyrs + ilyr] = static_cast<T>(default_value);
                 }
-                else if (!out_origin && lyrs > 1 && nullptr != it->second->data2d_) { // raster 2D
-                    data1d[tmprc * lyrs + ilyr] = static_cast<T>(it->second->data2d_[vi][ilyr]);
+                for (int vi = 0; vi < sub->n_cells; vi++) {
+                    T* values = data1d + CVT_SIZET(dst[vi]) * lyrs;
+                    for (int ilyr = 0; ilyr < lyrs; ilyr++) { values[ilyr] = lookup[ilyr]; }
                 }
-                else if (!out_origin && lyrs == 1 && nullptr != it->second->data_) { // raster 1D
-                    data1d[tmprc * lyrs + ilyr] = static_cast<T>(it->second->data_[vi]);
-                }
-                else { // Will not happen
-                    StatusMessage("Error: No subset or reclassification map can be output!");
-                    if (nullptr != data1d) { Release1DArray(data1d); }
-                    return false;
+                continue;
+            }
+            for (int vi = 0; vi < sub->n_cells; vi++) {
+                int gidx = sub->global_[vi];
+                T* values = data1d + CVT_SIZET(dst[vi]) * lyrs;
+                for (int ilyr = 0; ilyr < lyrs; ilyr++) {
+                    int recls_key = plan->ids[i];
+                    if (nullptr != raster_) { recls_key = CVT_INT(raster_[gidx]); }
+                    else if (nullptr != raster_2d_) {
+                        recls_key = CVT_INT(raster_2d_[gidx][ilyr]);
+                    }
+                    auto found = recls.find(recls_key);
+                    double uniqe_value = default_value;
+                    if (found != recls.end() && CVT_INT(found->second.size()) > ilyr) {
+                        uniqe_value = found->second[ilyr];
+                    }
+                    values[ilyr] = static_cast<T>(uniqe_value);
                 }
             }
         }
+        else if (use_defaultv_directly) {
+            T defaultv = static_cast<T>(default_value);
+            for (int vi = 0; vi < sub->n_cells; vi++) {
+                T* values = data1d + CVT_SIZET(dst[vi]) * lyrs;
+                for (int ilyr = 0; ilyr < lyrs; ilyr++) { values[ilyr] = defaultv; }
+            }
+        }
+        else if (!out_origin) {
+            // data of the whole subset, which is converted only if stored in other type
+            if (sub->n_cells > 0 && !sub->ScatterTo(data1d, lyrs, nullptr, dst)) { status[i] = -1; }
+        }
+        else if (sub->n_cells > 0) { // Will not happen
+            status[i] = -1;
+        }
+    }
+    for (int i = 0; i < nsubs; i++) {
+        if (status[i] == 0) { continue; }
+        StatusMessage("Error: No subset or reclassification map can be output!");
+        Release1DArray(data1d);
+        return false;
     }
     *values = data1d;
     *datalen = data_length;
@@ -3032,7 +5303,8 @@ bool clsRasterData<T, MASK_T>::PrepareSubsetData(const int sub_id, SubsetPositio
                                                  T** values, int* datalen, int* datalyrs,
                                                  bool out_origin /* false */, bool include_nodata /* true */,
                                                  const map<vint, vector<double> >& recls /* map() */,
-                                                 double default_value /* NODATA_VALUE*/) {
+                                                 double default_value /* NODATA_VALUE*/,
+                                                 int* capacity /* nullptr */) {
     if (nullptr == sub) { return false; }
     T* data1d = nullptr; // Both raster 1D and 2D data can be combined as 1D array
     int lyr_recls = -1;
@@ -3063,7 +5335,32 @@ bool clsRasterData<T, MASK_T>::PrepareSubsetData(const int sub_id, SubsetPositio
     }
     int ncells = include_nodata ? nrows * ncols : sub->n_cells;
     int data_length = ncells * lyrs;
-    Initialize1DArray(data_length, data1d, no_data_value_);
+    if (nullptr != capacity) { // reuse the scratch buffer of caller
+        if (nullptr != *values && *capacity < data_length) {
+            Release1DArray(*values);
+            *capacity = 0;
+        }
+        if (nullptr == *values) {
+            if (!Initialize1DArray(data_length, *values, no_data_value_)) { return false; }
+            *capacity = data_length;
+        } else {
+            std::fill(*values, *values + data_length, no_data_value_);
+        }
+        data1d = *values;
+    } else {
+        Initialize1DArray(data_length, data1d, no_data_value_);
+    }
+    if (recls.empty() && !out_origin) { // converted only if the subset data stored in other type
+        if (sub->n_cells > 0 && !sub->ScatterTo(data1d, lyrs, include_nodata ? sub->local_posidx_ : nullptr)) {
+            StatusMessage("Error: No subset or reclassification map can be output!");
+            if (nullptr == capacity) { Release1DArray(data1d); }
+            return false;
+        }
+        *values = data1d;
+        *datalen = data_length;
+        *datalyrs = lyrs;
+        return true;
+    }
     for (int vi = 0; vi < sub->n_cells; vi++) {
         for (int ilyr = 0; ilyr < lyrs; ilyr++) {
             //int j = sub->local_pos_[vi][0] * ncols + sub->local_pos_[vi][1];
@@ -3090,15 +5387,9 @@ bool clsRasterData<T, MASK_T>::PrepareSubsetData(const int sub_id, SubsetPositio
             else if (out_origin && lyrs == 1 && nullptr != raster_) {
                 data1d[j * lyrs + ilyr] = raster_[gidx];
             }
-            else if (!out_origin && lyrs > 1 && nullptr != sub->data2d_) { // raster 2D
-                data1d[j * lyrs + ilyr] = static_cast<T>(sub->data2d_[vi][ilyr]);
-            }
-            else if (!out_origin && lyrs == 1 && nullptr != sub->data_) { // raster 1D
-                data1d[j * lyrs + ilyr] = static_cast<T>(sub->data_[vi]);
-            }
             else { // Will not happen
                 StatusMessage("Error: No subset or reclassification map can be output!");
-                if (nullptr != data1d) { Release1DArray(data1d); }
+                if (nullptr == capacity && nullptr != data1d) { Release1DArray(data1d); }
                 return false;
             }
         }
@@ -3137,16 +5428,15 @@ bool clsRasterData<T, MASK_T>::OutputAscFile(const string& filename) {
     string abs_filename = GetAbsolutePath(filename);
     // Is there need to calculate valid position index?
     int count;
-    int** position = nullptr;
     int* position_idx = nullptr;
     bool outputdirectly = true;
     if ((nullptr != pos_data_ || nullptr != pos_idx_)) {
-        GetRasterPositionData(&count, &position);
         GetRasterPositionData(&count, &position_idx);
         outputdirectly = false;
-        assert(nullptr != position);
         assert(nullptr != position_idx);
     }
+    // Iterate whole runs of valid cells if possible
+    std::shared_ptr<ValidCellSpans> spans = outputdirectly ? nullptr : GetValidCellSpans();
     // Begin to write raster data
     int rows = CVT_INT(headers_.at(HEADER_RS_NROWS));
     int cols = CVT_INT(headers_.at(HEADER_RS_NCOLS));
@@ -3163,13 +5453,17 @@ bool clsRasterData<T, MASK_T>::OutputAscFile(const string& filename) {
             }
             int index = 0;
             for (int i = 0; i < rows; ++i) {
+                if (nullptr != spans) {
+                    OutputAscRowBySpans(raster_file, *spans, i, lyr, NODATA_VALUE);
+                    continue;
+                }
                 for (int j = 0; j < cols; ++j) {
                     if (outputdirectly) {
                         index = i * cols + j;
                         raster_file << setprecision(6) << raster_2d_[index][lyr] << " ";
                         continue;
                     }
-                    if (index < n_cells_ && (position[index][0] == i && position[index][1] == j)) {
+                    if (index < n_cells_ && position_idx[index] == i * cols + j) {
                         raster_file << setprecision(6) << raster_2d_[index][lyr] << " ";
                         index++;
                     } else { raster_file << setprecision(6) << NODATA_VALUE << " "; }
@@ -3187,6 +5481,10 @@ bool clsRasterData<T, MASK_T>::OutputAscFile(const string& filename) {
         }
         int index = 0;
         for (int i = 0; i < rows; ++i) {
+            if (nullptr != spans) {
+                OutputAscRowBySpans(raster_file, *spans, i, 0, CVT_DBL(no_data_value_));
+                continue;
+            }
             for (int j = 0; j < cols; ++j) {
                 if (outputdirectly) {
                     index = i * cols + j;
@@ -3194,7 +5492,7 @@ bool clsRasterData<T, MASK_T>::OutputAscFile(const string& filename) {
                     continue;
                 }
                 if (index < n_cells_) {
-                    if (position[index][0] == i && position[index][1] == j) {
+                    if (position_idx[index] == i * cols + j) {
                         raster_file << setprecision(6) << raster_[index] << " ";
                         index++;
                     } else { raster_file << setprecision(6) << no_data_value_ << " "; }
@@ -3204,15 +5502,35 @@ bool clsRasterData<T, MASK_T>::OutputAscFile(const string& filename) {
         }
         raster_file.close();
     }
-    position = nullptr;
+    position_idx = nullptr;
     return true;
 }
 
+template <typename T, typename MASK_T>
+void clsRasterData<T, MASK_T>::OutputAscRowBySpans(std::ofstream& raster_file, const ValidCellSpans& spans,
+                                                   const int row, const int lyr, const double nodata) {
+    int first = 0;
+    int last = 0;
+    spans.GetRowSpans(row, &first, &last);
+    int cols = spans.GetCols();
+    int j = 0;
+    for (int ispan = first; ispan < last; ispan++) {
+        const ValidCellSpans::Span& span = spans.GetSpans()[ispan];
+        for (; j < span.scol; j++) { raster_file << setprecision(6) << nodata << " "; }
+        for (int k = span.offset; j <= span.ecol; j++, k++) {
+            if (is_2draster) { raster_file << setprecision(6) << raster_2d_[k][lyr] << " "; }
+            else { raster_file << setprecision(6) << raster_[k] << " "; }
+        }
+    }
+    for (; j < cols; j++) { raster_file << setprecision(6) << nodata << " "; }
+    raster_file << endl;
+}
+
 #ifdef USE_GDAL
 template <typename T, typename MASK_T>
 bool clsRasterData<T, MASK_T>::OutputFileByGdal(const string& filename) {
     string abs_filename = GetAbsolutePath(filename);
-    bool outputdirectly = (nullptr == pos_data_ || nullptr == pos_idx_);
+    bool outputdirectly = (nullptr == pos_idx_);
     int n_rows = CVT_INT(headers_.at(HEADER_RS_NROWS));
     int n_cols = CVT_INT(headers_.at(HEADER_RS_NCOLS));
     bool outflag = false;
@@ -3259,20 +5577,89 @@ bool clsRasterData<T, MASK_T>::OutputFileByGdal(const string& filename) {
         }
         if (!outflag) { return false; }
     }
-    return true;
+    return true;
+}
+#endif /* USE_GDAL */
+
+#ifdef USE_MONGODB
+template <typename T, typename MASK_T>
+bool clsRasterData<T, MASK_T>::OutputToMongoDB(MongoGridFs* gfs, const string& filename /* = string() */,
+                                               const STRING_MAP& opts /* = STRING_MAP() */,
+                                               bool include_nodata /* = true */,
+                                               bool out_origin /* true */) {
+    if (nullptr == gfs) { return false; }
+    if (!out_origin) { // Output subset's data
+        return OutputSubsetToMongoDB(gfs, filename, opts, include_nodata, false, true);
+    }
+    STRDBL_MAP tmpheader;
+    T* data_1d = nullptr;
+    int datalength;
+    bool allocated = PrepareMongoDBOutput(opts, include_nodata, tmpheader, data_1d, datalength);
+    string core_name = filename.empty() ? core_name_ : filename;
+    bool saved = WriteStreamDataAsGridfs(gfs, core_name, tmpheader,
+                                         data_1d, datalength, options_);
+    if (allocated) {
+        Release1DArray(data_1d);
+    } else {
+        data_1d = nullptr;
+    }
+    return saved;
+}
+
+/*!
+ * A newly allocated full-sized array is transferred into the write task directly,
+ *   otherwise the data is copied into a pooled buffer of the writer.
+ */
+template <typename T, typename MASK_T>
+std::shared_future<bool> clsRasterData<T, MASK_T>::OutputToMongoDBAsync(MongoGridFsAsyncWriter* writer,
+                                                                        const string& filename /* = string() */,
+                                                                        const STRING_MAP& opts /* = STRING_MAP() */,
+                                                                        bool include_nodata /* = true */,
+                                                                        bool out_origin /* = true */,
+                                                                        bool release /* = false */) {
+    if (nullptr == writer || (!out_origin && !release)) {
+        std::promise<bool> failed;
+        failed.set_value(false);
+        return failed.get_future().share();
+    }
+    vint bytes = CVT_VINT(n_cells_) * Max(n_lyrs_, 1) * CVT_VINT(sizeof(T));
+    if (release) { // Move the raster into the task and output as the synchronous way
+        std::shared_ptr<clsRasterData<T, MASK_T> > moved(new clsRasterData<T, MASK_T>(std::move(*this)));
+        string core_name = filename.empty() ? moved->GetCoreName() : filename;
+        STRING_MAP curopts;
+        CopyStringMap(opts, curopts);
+        return writer->Submit([moved, core_name, curopts, include_nodata, out_origin](MongoGridFs* gfs) {
+            return moved->OutputToMongoDB(gfs, core_name, curopts, include_nodata, out_origin);
+        }, bytes);
+    }
+    std::shared_ptr<STRDBL_MAP> header(new STRDBL_MAP());
+    T* data_1d = nullptr;
+    int datalength;
+    bool allocated = PrepareMongoDBOutput(opts, include_nodata, *header, data_1d, datalength);
+    std::shared_ptr<T> owned_data;
+    std::shared_ptr<vector<char> > snapshot;
+    if (allocated) {
+        owned_data.reset(data_1d, [](T* p) { Release1DArray(p); });
+    } else {
+        snapshot.reset(new vector<char>(writer->AcquireBuffer(CVT_SIZET(datalength) * sizeof(T))));
+        memcpy(snapshot->data(), data_1d, CVT_SIZET(datalength) * sizeof(T));
+        data_1d = reinterpret_cast<T*>(snapshot->data());
+    }
+    bytes = CVT_VINT(datalength) * CVT_VINT(sizeof(T));
+    string core_name = filename.empty() ? core_name_ : filename;
+    STRING_MAP curopts;
+    CopyStringMap(options_, curopts);
+    return writer->Submit([writer, owned_data, snapshot, header, data_1d, datalength,
+                           core_name, curopts](MongoGridFs* gfs) {
+        bool saved = WriteStreamDataAsGridfs(gfs, core_name, *header, data_1d, datalength, curopts);
+        if (nullptr != snapshot) { writer->ReleaseBuffer(*snapshot); }
+        return saved;
+    }, bytes);
 }
-#endif /* USE_GDAL */
 
-#ifdef USE_MONGODB
 template <typename T, typename MASK_T>
-bool clsRasterData<T, MASK_T>::OutputToMongoDB(MongoGridFs* gfs, const string& filename /* = string() */,
-                                               const STRING_MAP& opts /* = STRING_MAP() */,
-                                               bool include_nodata /* = true */,
-                                               bool out_origin /* true */) {
-    if (nullptr == gfs) { return false; }
-    if (!out_origin) { // Output subset's data
-        return OutputSubsetToMongoDB(gfs, filename, opts, include_nodata, false, true);
-    }
+bool clsRasterData<T, MASK_T>::PrepareMongoDBOutput(const STRING_MAP& opts, const bool include_nodata,
+                                                     STRDBL_MAP& header, T*& data, int& datalength) {
     CopyStringMap(opts, options_); // Update metadata
     // Added by ljzhu, for compatible with yjwang's code. But, can this key-value be passed by the opts argument?
     UpdateStringMapIfNotExist(options_, HEADER_RS_PARAM_ABSTRACTION_TYPE, PARAM_ABSTRACTION_TYPE_PHYSICAL);
@@ -3285,12 +5672,12 @@ bool clsRasterData<T, MASK_T>::OutputToMongoDB(MongoGridFs* gfs, const string& f
     //                                  2) pos_data_ is NULL and include_nodata is true.
     bool outputdirectly = true; // output directly or create new full size array
     int cnt;
-    int** pos = nullptr;
+    int* pos = nullptr;
     if ((nullptr != pos_data_ || nullptr != pos_idx_) && include_nodata) {
         outputdirectly = false;
         GetRasterPositionData(&cnt, &pos);
     }
-    if ((nullptr == pos_data_ || nullptr == pos_idx_) && !include_nodata) {
+    if ((nullptr == pos_idx_) && !include_nodata) {
         SetCalcPositions();
         GetRasterPositionData(&cnt, &pos);
     }
@@ -3305,8 +5692,6 @@ bool clsRasterData<T, MASK_T>::OutputToMongoDB(MongoGridFs* gfs, const string& f
     // 2. Get raster data
     T* data_1d = nullptr;
     T no_data_value = GetNoDataValue();
-    int datalength;
-    string core_name = filename.empty() ? core_name_ : filename;
     if (is_2draster) { // 2.1 2D raster data
         if (outputdirectly) {
             data_1d = raster_2d_[0]; // refers to Initialize2DArray() for why we can do this assignment
@@ -3315,7 +5700,7 @@ bool clsRasterData<T, MASK_T>::OutputToMongoDB(MongoGridFs* gfs, const string& f
             datalength = n_lyrs_ * n_fullsize;
             Initialize1DArray(datalength, data_1d, no_data_value);
             for (int idx = 0; idx < n_cells_; idx++) {
-                int rowcol_index = pos[idx][0] * n_cols + pos[idx][1];
+                int rowcol_index = pos[idx];
                 for (int k = 0; k < n_lyrs_; k++) {
                     data_1d[n_lyrs_ * rowcol_index + k] = raster_2d_[idx][k];
                 }
@@ -3329,21 +5714,14 @@ bool clsRasterData<T, MASK_T>::OutputToMongoDB(MongoGridFs* gfs, const string& f
             datalength = n_fullsize;
             Initialize1DArray(datalength, data_1d, no_data_value);
             for (int idx = 0; idx < n_cells_; idx++) {
-                data_1d[pos[idx][0] * n_cols + pos[idx][1]] = raster_[idx];
+                data_1d[pos[idx]] = raster_[idx];
             }
         }
     }
-    STRDBL_MAP tmpheader;
-    CopyHeader(headers_, tmpheader);
-    if (include_nodata) { UpdateHeader(tmpheader, HEADER_RS_CELLSNUM, n_fullsize); }
-    bool saved = WriteStreamDataAsGridfs(gfs, core_name, tmpheader,
-                                         data_1d, datalength, options_);
-    if (outputdirectly) {
-        data_1d = nullptr;
-    } else {
-        Release1DArray(data_1d);
-    }
-    return saved;
+    CopyHeader(headers_, header);
+    if (include_nodata) { UpdateHeader(header, HEADER_RS_CELLSNUM, n_fullsize); }
+    data = data_1d;
+    return !outputdirectly;
 }
 
 template <typename T, typename MASK_T>
@@ -3355,24 +5733,27 @@ bool clsRasterData<T, MASK_T>::OutputSubsetToMongoDB(MongoGridFs* gfs,
                                                      bool out_combined /* true */,
                                                      const map<vint, vector<double> >& recls /* map()*/,
                                                      double default_value /* = NODATA_VALUE */) {
-    if (!ValidateRasterData()) { return false; }
     if (nullptr == gfs) { return false; }
-    if (subset_.empty()) { return false; }
-    CopyStringMap(opts, options_); // Update metadata
-    // Added by ljzhu, for compatible with yjwang's code. But, can this key-value be passed by the opts argument?
-    UpdateStringMapIfNotExist(options_, HEADER_RS_PARAM_ABSTRACTION_TYPE, PARAM_ABSTRACTION_TYPE_PHYSICAL);
-    if (include_nodata) {
-        UpdateStringMap(options_, HEADER_INC_NODATA, "TRUE");
-    }
-    else {
-        UpdateStringMap(options_, HEADER_INC_NODATA, "FALSE");
-    }
-    if (options_.find(HEADER_RSOUT_DATATYPE) == options_.end()
-        || StringMatch("Unknown", options_.at(HEADER_RSOUT_DATATYPE))) {
-        UpdateStrHeader(options_, HEADER_RSOUT_DATATYPE,
-                        RasterDataTypeToString(TypeToRasterDataType(typeid(T))));
-    }
+    return OutputSubsetToMongoDB(vector<MongoGridFs*>(1, gfs), filename, opts, include_nodata,
+                                 out_origin, out_combined, recls, default_value);
+}
 
+template <typename T, typename MASK_T>
+bool clsRasterData<T, MASK_T>::OutputSubsetToMongoDB(const vector<MongoGridFs*>& gfs_handles,
+                                                     const string& filename /* string() */,
+                                                     const STRING_MAP& opts /* STRING_MAP() */,
+                                                     bool include_nodata /* true */,
+                                                     bool out_origin /* false */,
+                                                     bool out_combined /* true */,
+                                                     const map<vint, vector<double> >& recls /* map()*/,
+                                                     double default_value /* = NODATA_VALUE */) {
+    if (!ValidateRasterData()) { return false; }
+    if (gfs_handles.empty()) { return false; }
+    for (auto it = gfs_handles.begin(); it != gfs_handles.end(); ++it) {
+        if (nullptr == *it) { return false; }
+    }
+    if (subset_.empty()) { return false; }
+    UpdateSubsetOutputOptions(opts, include_nodata);
 
     int grows = GetRows();
     string outnameact = filename.empty() ? core_name_ : filename;
@@ -3387,32 +5768,149 @@ bool clsRasterData<T, MASK_T>::OutputSubsetToMongoDB(MongoGridFs* gfs,
         CopyHeader(headers_, tmpheader);
         UpdateHeader(tmpheader, HEADER_RS_LAYERS, sublyrs);
         UpdateHeader(tmpheader, HEADER_RS_CELLSNUM, sublen / sublyrs);
-        flag = flag && WriteStreamDataAsGridfs(gfs, "0_" + outnameact,
+        flag = flag && WriteStreamDataAsGridfs(gfs_handles[0], "0_" + outnameact,
                                                tmpheader, data1d, sublen, options_);
         Release1DArray(data1d);
         return flag;
     }
-    // output each subset
-    STRDBL_MAP subheader;
+    // output each subset, one worker per GridFS handle
+    vector<int> subids;
+    vector<SubsetPositions*> subs;
+    GetUsableSubsets(subids, subs);
+    int nsubs = CVT_INT(subs.size());
+    if (nsubs == 0) { return true; }
+    vector<int> status(nsubs, 0); // 1: succeed, 0: skipped, -1: failed
+    double xll = GetXllCenter();
+    double yll = GetYllCenter();
+    double cellsize = GetCellWidth();
+#pragma omp parallel num_threads(BoundedThreadNumber(CVT_INT(gfs_handles.size()), nsubs))
+    {
+        int tid = 0;
+#ifdef SUPPORT_OMP
+        tid = omp_get_thread_num();
+#endif /* SUPPORT_OMP */
+        MongoGridFs* gfs = gfs_handles[tid];
+        T* scratch = nullptr; // scratch buffer of the current worker
+        int capacity = 0;
+        STRDBL_MAP subheader;
+#pragma omp for schedule(dynamic)
+        for (int i = 0; i < nsubs; i++) {
+            subs[i]->GetHeader(xll, yll, grows, cellsize, CVT_DBL(no_data_value_), subheader);
+            int tmpdatalen;
+            int tmplyrs;
+            if (!PrepareSubsetData(subids[i], subs[i], &scratch, &tmpdatalen, &tmplyrs,
+                                   out_origin, include_nodata, recls, default_value, &capacity)) {
+                status[i] = -1;
+                continue;
+            }
+            UpdateHeader(subheader, HEADER_RS_LAYERS, tmplyrs);
+            UpdateHeader(subheader, HEADER_RS_CELLSNUM, tmpdatalen / tmplyrs);
+            string tmpfname = itoa(CVT_VINT(subids[i])) + "_" + outnameact;
+            status[i] = WriteStreamDataAsGridfs(gfs, tmpfname, subheader, scratch,
+                                                tmpdatalen, options_) ? 1 : -1;
+        }
+        if (nullptr != scratch) { Release1DArray(scratch); }
+    }
     bool flag = true;
-    for (auto it = subset_.begin(); it != subset_.end(); ++it) {
-        if (!it->second->usable) { continue; }
-        it->second->GetHeader(GetXllCenter(), GetYllCenter(), grows,
-                              GetCellWidth(), CVT_DBL(no_data_value_), subheader);
-        T* tmpdata1d = nullptr;
-        int tmpdatalen;
-        int tmplyrs;
-        if (!PrepareSubsetData(it->first, it->second, &tmpdata1d, &tmpdatalen, &tmplyrs,
-                               out_origin, include_nodata, recls, default_value)) {
-            continue;
+    for (int i = 0; i < nsubs; i++) {
+        if (status[i] >= 0) { continue; }
+        StatusMessage("Error: Failed to write subset " + itoa(CVT_VINT(subids[i])) + " to GridFS!");
+        flag = false;
+    }
+    return flag;
+}
+
+template <typename T, typename MASK_T>
+bool clsRasterData<T, MASK_T>::OutputSubsetToMongoDB(MongoClientPool* pool,
+                                                     const string& dbname, const string& gfsname,
+                                                     const string& filename /* string() */,
+                                                     const STRING_MAP& opts /* STRING_MAP() */,
+                                                     bool include_nodata /* true */,
+                                                     bool out_origin /* false */,
+                                                     const map<vint, vector<double> >& recls /* map()*/,
+                                                     double default_value /* = NODATA_VALUE */,
+                                                     const int batch_files /* = 64 */) {
+    if (!ValidateRasterData()) { return false; }
+    if (nullptr == pool || subset_.empty()) { return false; }
+    UpdateSubsetOutputOptions(opts, include_nodata);
+
+    int grows = GetRows();
+    string outnameact = filename.empty() ? core_name_ : filename;
+    vector<int> subids;
+    vector<SubsetPositions*> subs;
+    GetUsableSubsets(subids, subs);
+    int nsubs = CVT_INT(subs.size());
+    if (nsubs == 0) { return true; }
+    vector<string> fnames(nsubs);
+    for (int i = 0; i < nsubs; i++) {
+        fnames[i] = itoa(CVT_VINT(subids[i])) + "_" + outnameact;
+    }
+    vector<int> status(nsubs, 0); // 1: succeed, 0: skipped, -1: failed
+    double xll = GetXllCenter();
+    double yll = GetYllCenter();
+    double cellsize = GetCellWidth();
+    int nthreads = BoundedThreadNumber(0, nsubs);
+    int max_clients = pool->GetMetrics().max_size;
+    if (max_clients > 0 && nthreads > max_clients) { nthreads = max_clients; }
+#pragma omp parallel num_threads(nthreads)
+    {
+        MongoPooledClient client(pool);
+        MongoGridFsBulkWriter writer(client.Client(), dbname, gfsname, batch_files);
+        T* scratch = nullptr; // scratch buffer of the current worker
+        int capacity = 0;
+        STRDBL_MAP subheader;
+        vector<int> added; // subsets added to the writer
+#pragma omp for schedule(dynamic)
+        for (int i = 0; i < nsubs; i++) {
+            subs[i]->GetHeader(xll, yll, grows, cellsize, CVT_DBL(no_data_value_), subheader);
+            int tmpdatalen;
+            int tmplyrs;
+            if (!PrepareSubsetData(subids[i], subs[i], &scratch, &tmpdatalen, &tmplyrs,
+                                   out_origin, include_nodata, recls, default_value, &capacity)) {
+                status[i] = -1;
+                continue;
+            }
+            UpdateHeader(subheader, HEADER_RS_LAYERS, tmplyrs);
+            UpdateHeader(subheader, HEADER_RS_CELLSNUM, tmpdatalen / tmplyrs);
+            // The data is copied into the batch, hence the scratch buffer can be reused
+            if (!WriteStreamDataAsGridfs(&writer, fnames[i], subheader, scratch, tmpdatalen, options_)) {
+                status[i] = -1;
+                continue;
+            }
+            added.emplace_back(i);
+        }
+        writer.Flush();
+        std::set<string> failed(writer.FailedFiles().begin(), writer.FailedFiles().end());
+        for (auto it = added.begin(); it != added.end(); ++it) {
+            status[*it] = failed.count(fnames[*it]) > 0 ? -1 : 1;
         }
-        UpdateHeader(subheader, HEADER_RS_LAYERS, tmplyrs);
-        UpdateHeader(subheader, HEADER_RS_CELLSNUM, tmpdatalen / tmplyrs);
-        string tmpfname = itoa(CVT_VINT(it->first)) + "_" + outnameact;
-        flag = flag && WriteStreamDataAsGridfs(gfs, tmpfname, subheader, tmpdata1d, tmpdatalen, options_);
-        if (nullptr != tmpdata1d) { Release1DArray(tmpdata1d); }
+        if (nullptr != scratch) { Release1DArray(scratch); }
+    }
+    bool flag = true;
+    for (int i = 0; i < nsubs; i++) {
+        if (status[i] >= 0) { continue; }
+        StatusMessage("Error: Failed to write subset " + itoa(CVT_VINT(subids[i])) + " to GridFS!");
+        flag = false;
+    }
+    return flag;
+}
+
+template <typename T, typename MASK_T>
+void clsRasterData<T, MASK_T>::UpdateSubsetOutputOptions(const STRING_MAP& opts, const bool include_nodata) {
+    CopyStringMap(opts, options_); // Update metadata
+    // Added by ljzhu, for compatible with yjwang's code. But, can this key-value be passed by the opts argument?
+    UpdateStringMapIfNotExist(options_, HEADER_RS_PARAM_ABSTRACTION_TYPE, PARAM_ABSTRACTION_TYPE_PHYSICAL);
+    if (include_nodata) {
+        UpdateStringMap(options_, HEADER_INC_NODATA, "TRUE");
+    }
+    else {
+        UpdateStringMap(options_, HEADER_INC_NODATA, "FALSE");
+    }
+    if (options_.find(HEADER_RSOUT_DATATYPE) == options_.end()
+        || StringMatch("Unknown", options_.at(HEADER_RSOUT_DATATYPE))) {
+        UpdateStrHeader(options_, HEADER_RSOUT_DATATYPE,
+                        RasterDataTypeToString(TypeToRasterDataType(typeid(T))));
     }
-    return true;
 }
 
 #endif /* USE_MONGODB */
@@ -3568,13 +6066,11 @@ bool clsRasterData<T, MASK_T>::ReadFromMongoDB(MongoGridFs* gfs,
     // check the valid values count and determine whether we can read directly.
     bool mask_pos_subset = true;
     if (nullptr != mask_ && calc_pos_ && use_mask_ext_ && n_cells_ == mask_->GetValidNumber()) {
-        store_pos_ = false;
-        mask_->GetRasterPositionData(&n_cells_, &pos_data_);
-        mask_->GetRasterPositionData(&n_cells_, &pos_idx_);
+        SharePositionsFromMask();
         if (!mask->GetSubset().empty()) {
             map<int, SubsetPositions*>& mask_subset = mask_->GetSubset();
             for (auto it = mask_subset.begin(); it != mask_subset.end(); ++it) {
-                SubsetPositions* tmp = new SubsetPositions(it->second, true);
+                SubsetPositions* tmp = new SubsetPositions(it->second, false, GetSubsetArena());
                 tmp->n_lyrs = n_lyrs_;
 #ifdef HAS_VARIADIC_TEMPLATES
                 subset_.emplace(it->first, tmp);
@@ -3586,7 +6082,7 @@ bool clsRasterData<T, MASK_T>::ReadFromMongoDB(MongoGridFs* gfs,
         mask_pos_subset = false;
     }
 
-    if (!include_nodata && (nullptr == pos_data_ || nullptr == pos_idx_)) { return false; }
+    if (!include_nodata && (nullptr == pos_idx_)) { return false; }
 
     if (n_lyrs_ == 1) {
         is_2draster = false;
@@ -3652,20 +6148,93 @@ clsRasterData<T, MASK_T>::clsRasterData(clsRasterData<T, MASK_T>* another) {
 }
 
 template <typename T, typename MASK_T>
-void clsRasterData<T, MASK_T>::Copy(clsRasterData<T, MASK_T>* orgraster) {
-    // Release current data
+clsRasterData<T, MASK_T>::clsRasterData(clsRasterData<T, MASK_T>&& other) {
+    InitializeRasterClass(other.is_2draster);
+    MoveFrom(other);
+}
+
+template <typename T, typename MASK_T>
+clsRasterData<T, MASK_T>& clsRasterData<T, MASK_T>::operator=(clsRasterData<T, MASK_T>&& other) {
+    if (this != &other) {
+        ReleaseRasterData();
+        MoveFrom(other);
+    }
+    return *this;
+}
+
+template <typename T, typename MASK_T>
+void clsRasterData<T, MASK_T>::MoveFrom(clsRasterData<T, MASK_T>& other) {
+    n_cells_ = other.n_cells_;
+    n_lyrs_ = other.n_lyrs_;
+    rs_type_ = other.rs_type_;
+    rs_type_out_ = other.rs_type_out_;
+    no_data_value_ = other.no_data_value_;
+    default_value_ = other.default_value_;
+    full_path_.swap(other.full_path_);
+    core_name_.swap(other.core_name_);
+    raster_ = other.raster_;
+    raster_2d_ = other.raster_2d_;
+    pos_data_ = other.pos_data_;
+    pos_idx_ = other.pos_idx_;
+    pos_tables_.swap(other.pos_tables_);
+    options_.swap(other.options_);
+    headers_.swap(other.headers_);
+    stats_.swap(other.stats_);
+    stats_2d_.swap(other.stats_2d_);
+    mask_ = other.mask_;
+    mask_alive_.swap(other.mask_alive_);
+    alive_ = std::make_shared<bool>(true); // a new identity, other's dependents see it released
+    subset_.swap(other.subset_);
+    subset_arena_.swap(other.subset_arena_);
+    comb_plan_.swap(other.comb_plan_);
+    mask_mappings_.swap(other.mask_mappings_);
+    initialized_ = other.initialized_;
+    is_2draster = other.is_2draster;
+    calc_pos_ = other.calc_pos_;
+    store_pos_ = other.store_pos_;
+    use_mask_ext_ = other.use_mask_ext_;
+    stats_calculated_ = other.stats_calculated_;
+    shared_src_.swap(other.shared_src_);
+    unique_id_ = other.unique_id_;
+    // Leave other as an empty instance, DO NOT release the data taken over
+    other.raster_ = nullptr;
+    other.raster_2d_ = nullptr;
+    other.pos_data_ = nullptr;
+    other.pos_idx_ = nullptr;
+    other.options_.clear();
+    other.headers_.clear();
+    other.stats_.clear();
+    other.stats_2d_.clear();
+    other.subset_.clear();
+    other.subset_arena_ = nullptr;
+    other.comb_plan_ = nullptr;
+    other.mask_mappings_ = nullptr;
+    other.pos_tables_ = nullptr;
+    other.shared_src_ = nullptr;
+    other.InitializeRasterClass(false); // also expire the token observed by dependents of other
+}
+
+template <typename T, typename MASK_T>
+RasterView<T> clsRasterData<T, MASK_T>::GetView() const {
+    // Keep the source of shared data alive as long as the view exists
+    std::shared_ptr<const void> owner = shared_src_;
+    return RasterView<T>(raster_, raster_2d_, is_2draster, n_cells_, n_lyrs_,
+                         pos_data_, pos_idx_, headers_, no_data_value_,
+                         calc_pos_, store_pos_, use_mask_ext_, owner);
+}
+
+template <typename T, typename MASK_T>
+void clsRasterData<T, MASK_T>::ReleaseRasterData() {
+    if (IsSharedData()) {
+        DetachSharedData(false);
+    }
     if (is_2draster && nullptr != raster_2d_ && n_cells_ > 0) {
         Release2DArray(raster_2d_);
     }
     if (!is_2draster && nullptr != raster_) {
         Release1DArray(raster_);
     }
-    if (nullptr != pos_data_) {
-        Release2DArray(pos_data_);
-    }
-    if (nullptr != pos_idx_) {
-        Release1DArray(pos_idx_);
-    }
+    ReleasePositions();
     if (stats_calculated_) {
         ReleaseStatsMap2D();
         stats_calculated_ = false;
@@ -3673,6 +6242,11 @@ void clsRasterData<T, MASK_T>::Copy(clsRasterData<T, MASK_T>* orgraster) {
     if (!subset_.empty()) {
         ReleaseSubset();
     }
+}
+
+template <typename T, typename MASK_T>
+void clsRasterData<T, MASK_T>::Copy(clsRasterData<T, MASK_T>* orgraster) {
+    ReleaseRasterData();
     // Initialize now Raster and copy data
     InitializeReadFunction(orgraster->GetFilePath(), orgraster->PositionsCalculated(),
                            orgraster->GetMask(), orgraster->MaskExtented(),
@@ -3684,15 +6258,17 @@ void clsRasterData<T, MASK_T>::Copy(clsRasterData<T, MASK_T>* orgraster) {
     no_data_value_ = orgraster->GetNoDataValue();
     if (orgraster->Is2DRaster()) {
         is_2draster = true;
-        Initialize2DArray(n_cells_, n_lyrs_, raster_2d_,
-                          orgraster->Get2DRasterDataPointer());
-    } else {
-        Initialize1DArray(n_cells_, raster_, orgraster->GetRasterDataPointer());
-    }
-    if (calc_pos_) {
-        store_pos_ = true;
-        Initialize2DArray(n_cells_, 2, pos_data_, orgraster->GetRasterPositionDataPointer());
-        Initialize1DArray(n_cells_, pos_idx_, orgraster->GetRasterPositionIndexPointer());
+        Initialize2DArray(n_cells_, n_lyrs_, raster_2d_, orgraster->raster_2d_);
+    } else { // read directly, the shared data of orgraster need not be copied
+        Initialize1DArray(n_cells_, raster_, orgraster->raster_);
+    }
+    if (calc_pos_) { // pos_data_ will be materialized on demand if pos_idx_ is available
+        if (nullptr != orgraster->pos_idx_) {
+            Initialize1DArray(n_cells_, pos_idx_, orgraster->pos_idx_);
+        } else if (nullptr != orgraster->pos_data_) {
+            Initialize2DArray(n_cells_, 2, pos_data_, orgraster->pos_data_);
+        }
+        AdoptPositions();
     }
     stats_calculated_ = orgraster->StatisticsCalculated();
     if (stats_calculated_) {
@@ -3713,8 +6289,19 @@ void clsRasterData<T, MASK_T>::Copy(clsRasterData<T, MASK_T>* orgraster) {
     CopyHeader(orgraster->GetRasterHeader(), headers_);
     // deep copy subset
     if (!orgraster->GetSubset().empty()) {
+        size_t subset_bytes = 0;
+        for (auto it = orgraster->GetSubset().begin(); it != orgraster->GetSubset().end(); ++it) {
+            subset_bytes += SubsetArena::EstimatePositionBytes(1, it->second->n_cells);
+            if (nullptr != it->second->payload_) {
+                subset_bytes += SubsetArena::EstimateDataBytes(1, it->second->n_cells, 1);
+            }
+            if (nullptr != it->second->payload2d_) {
+                subset_bytes += SubsetArena::EstimateDataBytes(1, it->second->n_cells, it->second->n_lyrs);
+            }
+        }
+        subset_arena_ = std::make_shared<SubsetArena>(subset_bytes);
         for (auto it = orgraster->GetSubset().begin(); it != orgraster->GetSubset().end(); ++it) {
-            SubsetPositions* tmp = new SubsetPositions(it->second, true);
+            SubsetPositions* tmp = new SubsetPositions(it->second, true, subset_arena_);
 #ifdef HAS_VARIADIC_TEMPLATES
             subset_.emplace(it->first, tmp);
 #else
@@ -3724,8 +6311,97 @@ void clsRasterData<T, MASK_T>::Copy(clsRasterData<T, MASK_T>* orgraster) {
     }
 }
 
+template <typename T, typename MASK_T>
+bool clsRasterData<T, MASK_T>::ShareFrom(const std::shared_ptr<clsRasterData<T, MASK_T> >& src) {
+    if (nullptr == src || src.get() == this || !src->ValidateRasterData()) { return false; }
+    ReleaseRasterData();
+    full_path_ = src->full_path_;
+    core_name_ = src->core_name_;
+    calc_pos_ = src->calc_pos_;
+    mask_ = src->mask_;
+    mask_alive_ = src->mask_alive_;
+    use_mask_ext_ = src->use_mask_ext_;
+    default_value_ = src->default_value_;
+    n_cells_ = src->n_cells_;
+    n_lyrs_ = src->n_lyrs_;
+    rs_type_ = src->rs_type_;
+    rs_type_out_ = src->rs_type_out_;
+    no_data_value_ = src->no_data_value_;
+    is_2draster = src->is_2draster;
+    raster_ = src->raster_;
+    raster_2d_ = src->raster_2d_;
+    pos_data_ = src->pos_data_;
+    pos_idx_ = src->pos_idx_;
+    pos_tables_ = src->pos_tables_;
+    store_pos_ = false;
+    CopyHeader(src->headers_, headers_);
+    CopyStringMap(src->options_, options_);
+    // statistics and subsets' data are lightweight and may be changed independently
+    stats_calculated_ = src->stats_calculated_;
+    if (stats_calculated_) {
+        if (is_2draster) {
+            for (auto iter = src->stats_2d_.begin(); iter != src->stats_2d_.end(); ++iter) {
+                double* tmpstatvalues = nullptr;
+                Initialize1DArray(n_lyrs_, tmpstatvalues, iter->second);
+                stats_2d_[iter->first] = tmpstatvalues;
+            }
+        } else {
+            for (auto iter = src->stats_.begin(); iter != src->stats_.end(); ++iter) {
+                stats_[iter->first] = iter->second;
+            }
+        }
+    }
+    for (auto it = src->subset_.begin(); it != src->subset_.end(); ++it) {
+        SubsetPositions* tmp = new SubsetPositions(it->second, false, GetSubsetArena());
+#ifdef HAS_VARIADIC_TEMPLATES
+        subset_.emplace(it->first, tmp);
+#else
+        subset_.insert(make_pair(it->first, tmp));
+#endif
+    }
+    shared_src_ = src;
+    unique_id_ = src->unique_id_;
+    return true;
+}
+
+template <typename T, typename MASK_T>
+void clsRasterData<T, MASK_T>::DetachSharedData(const bool copy_data /* = true */) {
+    if (!IsSharedData()) { return; }
+    if (!copy_data) {
+        raster_ = nullptr;
+        raster_2d_ = nullptr;
+        ReleasePositions();
+        shared_src_ = nullptr;
+        unique_id_ = NewUniqueId();
+        return;
+    }
+    if (is_2draster && nullptr != raster_2d_) {
+        T** src2d = raster_2d_;
+        raster_2d_ = nullptr;
+        Initialize2DArray(n_cells_, n_lyrs_, raster_2d_, src2d);
+    } else if (nullptr != raster_) {
+        T* src1d = raster_;
+        raster_ = nullptr;
+        Initialize1DArray(n_cells_, raster_, src1d);
+    }
+    // positions are immutable and kept alive by pos_tables_, no need to copy
+    shared_src_ = nullptr;
+    unique_id_ = NewUniqueId();
+}
+
+template <typename T, typename MASK_T>
+void clsRasterData<T, MASK_T>::SharePositionsFromMask() {
+    ReleasePositions();
+    if (nullptr == mask_) { return; }
+    mask_->GetRasterPositionData(&n_cells_, &pos_idx_);
+    pos_tables_ = mask_->GetSharedPositions();
+    // pos_data_ will be materialized from the shared tables on demand
+    if (nullptr != pos_tables_) { pos_data_ = pos_tables_->GetPositionData(); }
+}
+
 template <typename T, typename MASK_T>
 void clsRasterData<T, MASK_T>::ReplaceNoData(T replacedv) {
+    if (IsSharedData()) { DetachSharedData(); } // copy-on-write
 #pragma omp parallel for
     for (int i = 0; i < n_cells_; i++) {
         for (int lyr = 0; lyr < n_lyrs_; lyr++) {
@@ -3747,6 +6423,7 @@ void clsRasterData<T, MASK_T>::ReplaceNoData(T replacedv) {
 
 template <typename T, typename MASK_T>
 void clsRasterData<T, MASK_T>::Reclassify(const map<int, T> reclass_map) {
+    if (IsSharedData()) { DetachSharedData(); } // copy-on-write
     map<int, T> recls;
     for(auto it = reclass_map.begin(); it != reclass_map.end(); ++it) {
 #ifdef HAS_VARIADIC_TEMPLATES
@@ -3808,10 +6485,10 @@ ROW_COL clsRasterData<T, MASK_T>::GetPositionByCoordinate(const double x, const
 
 template <typename T, typename MASK_T>
 void clsRasterData<T, MASK_T>::CalculateValidPositionsFromGridData() {
+    if (IsSharedData()) { DetachSharedData(); } // raster data will be recreated
     vector<T> values; // store 1st layer for both Rater1D and Raster2D
     vector<vector<T> > values_2d; // store layer 2~n
-    vector<int> pos_rows;
-    vector<int> pos_cols;
+    vector<int> pos_index;
     int nrows = CVT_INT(headers_.at(HEADER_RS_NROWS));
     int ncols = CVT_INT(headers_.at(HEADER_RS_NCOLS));
     // get all valid values (i.e., exclude NODATA_VALUE)
@@ -3833,16 +6510,14 @@ void clsRasterData<T, MASK_T>::CalculateValidPositionsFromGridData() {
                 }
                 values_2d.emplace_back(tmpv);
             }
-            pos_rows.emplace_back(i);
-            pos_cols.emplace_back(j);
+            pos_index.emplace_back(idx);
         }
     }
     vector<T>(values).swap(values);
     if (is_2draster && n_lyrs_ > 1) {
         vector<vector<T> >(values_2d).swap(values_2d);
     }
-    vector<int>(pos_rows).swap(pos_rows);
-    vector<int>(pos_cols).swap(pos_cols);
+    vector<int>(pos_index).swap(pos_index);
     // reCreate raster data array
     n_cells_ = CVT_INT(values.size());
     UpdateHeader(headers_, HEADER_RS_CELLSNUM, n_cells_);
@@ -3853,10 +6528,10 @@ void clsRasterData<T, MASK_T>::CalculateValidPositionsFromGridData() {
         Release1DArray(raster_);
         Initialize1DArray(n_cells_, raster_, no_data_value_);
     }
-    // pos_data_ is nullptr till now.
-    Initialize2DArray(n_cells_, 2, pos_data_, 0);
+    // pos_data_ will be materialized from pos_idx_ on demand.
+    ReleasePositions();
     Initialize1DArray(n_cells_, pos_idx_, 0);
-    store_pos_ = true;
+    AdoptPositions();
 #pragma omp parallel for
     for (int i = 0; i < n_cells_; ++i) {
         if (is_2draster) {
@@ -3869,19 +6544,67 @@ void clsRasterData<T, MASK_T>::CalculateValidPositionsFromGridData() {
         } else {
             raster_[i] = values.at(i);
         }
-        pos_data_[i][0] = pos_rows.at(i);
-        pos_data_[i][1] = pos_cols.at(i);
-        pos_idx_[i] = pos_rows.at(i) * ncols + pos_cols.at(i);
+        pos_idx_[i] = pos_index.at(i);
     }
     calc_pos_ = true;
 }
 
+template <typename T, typename MASK_T>
+bool clsRasterData<T, MASK_T>::PrepareAsMask() {
+    if (!ValidateRasterData()) { return false; }
+    if (!PositionsCalculated()) { SetCalcPositions(); }
+    int ncells;
+    int* posidx = nullptr;
+    GetRasterPositionData(&ncells, &posidx);
+    for (auto it = subset_.begin(); it != subset_.end(); ++it) {
+        it->second->GetSharedPositions();
+    }
+    return nullptr != posidx;
+}
+
+template <typename T, typename MASK_T>
+std::shared_ptr<MaskGridMapping> clsRasterData<T, MASK_T>::BuildMaskMapping(const int* valid_pos,
+                                                                            const int mask_ncells) {
+    if (nullptr == mask_ || nullptr == valid_pos || mask_ncells <= 0) { return nullptr; }
+    std::shared_ptr<MaskGridMapping> mapping = std::make_shared<MaskGridMapping>(headers_);
+    mapping->rows.resize(mask_ncells);
+    mapping->cols.resize(mask_ncells);
+    int mask_cols = mask_->GetCols();
+    // Header values are looked up once rather than for each cell
+    double mask_xll = mask_->GetXllCenter();
+    double mask_yll = mask_->GetYllCenter();
+    double mask_dx = mask_->GetCellWidth();
+    int mask_rows = mask_->GetRows();
+    double dx = mapping->cellsize;
+    double x_min = mapping->xll - dx / 2.;
+    double x_max = x_min + dx * mapping->n_cols;
+    double y_min = mapping->yll - dx / 2.;
+    double y_max = y_min + dx * mapping->n_rows;
+#pragma omp parallel for
+    for (int i = 0; i < mask_ncells; i++) {
+        int tmp_row = valid_pos[i] / mask_cols;
+        int tmp_col = valid_pos[i] % mask_cols;
+        // the same as GetCoordinateByRowCol() of mask and GetPositionByCoordinate()
+        double x = mask_xll + tmp_col * mask_dx;
+        double y = mask_yll + (mask_rows - tmp_row - 1) * mask_dx;
+        if ((x > x_max || x < mapping->xll) || (y > y_max || y < mapping->yll)) {
+            mapping->rows[i] = -1;
+            mapping->cols[i] = -1;
+            continue;
+        }
+        mapping->rows[i] = CVT_INT((y_max - y) / dx);
+        mapping->cols[i] = CVT_INT((x - x_min) / dx);
+    }
+    return mapping;
+}
+
 template <typename T, typename MASK_T>
 int clsRasterData<T, MASK_T>::MaskAndCalculateValidPosition() {
     int old_fullsize = GetRows() * GetCols();
+    if (nullptr != mask_ && mask_alive_.expired()) { SetMask(nullptr); } // mask has been released
     if (nullptr == mask_) {
         if (calc_pos_) {
-            if (nullptr == pos_data_ || nullptr == pos_idx_) {
+            if (nullptr == pos_idx_) {
                 CalculateValidPositionsFromGridData();
                 return 1;
             }
@@ -3893,9 +6616,10 @@ int clsRasterData<T, MASK_T>::MaskAndCalculateValidPosition() {
         return 0;
     }
     // Use mask data
+    if (IsSharedData()) { DetachSharedData(); } // raster data will be recreated
     // 1. Get new values, positions, and subsets (if exist) according to Mask's position data
     int mask_ncells;
-    int** valid_pos = nullptr;
+    int* valid_pos = nullptr;
     int mask_rows = mask_->GetRows();
     int mask_cols = mask_->GetCols();
     // Get the position data from mask
@@ -3913,12 +6637,22 @@ int clsRasterData<T, MASK_T>::MaskAndCalculateValidPosition() {
     int min_col = mask_cols;
     int masked_count = 0; // position matched count
     int matched_count = 0; // valid value matched count
+    // Mapping shared by rasters of the same grid geometry that masked together
+    std::shared_ptr<MaskGridMapping> mapping = nullptr;
+    if (nullptr != mask_mappings_) {
+        mapping = mask_mappings_->Get(headers_, [&]() { return BuildMaskMapping(valid_pos, mask_ncells); });
+    }
     // Get the valid data according to coordinate
     for (int i = 0; i < mask_ncells; i++) {
-        int tmp_row = valid_pos[i][0];
-        int tmp_col = valid_pos[i][1];
-        XY_COOR tmp_xy = mask_->GetCoordinateByRowCol(tmp_row, tmp_col);
-        ROW_COL tmp_pos = GetPositionByCoordinate(tmp_xy.first, tmp_xy.second);
+        int tmp_row = valid_pos[i] / mask_cols;
+        int tmp_col = valid_pos[i] % mask_cols;
+        ROW_COL tmp_pos;
+        if (nullptr != mapping) {
+            tmp_pos = ROW_COL(mapping->rows[i], mapping->cols[i]);
+        } else {
+            XY_COOR tmp_xy = mask_->GetCoordinateByRowCol(tmp_row, tmp_col);
+            tmp_pos = GetPositionByCoordinate(tmp_xy.first, tmp_xy.second);
+        }
         T tmp_value;
         if (tmp_pos.first == -1 || tmp_pos.second == -1) {
             tmp_value = no_data_value_; // location exceeds the extent of raster data
@@ -3971,13 +6705,13 @@ int clsRasterData<T, MASK_T>::MaskAndCalculateValidPosition() {
     UpdateStrHeader(options_, HEADER_RS_SRS, mask_->GetSrsString());
     UpdateHeader(headers_, HEADER_RS_LAYERS, n_lyrs_);
 
-    // Priority DEEP Copy subset of mask data
+    // Priority share subset positions of mask data
     map<int, SubsetPositions*>& mask_subset = mask_->GetSubset();
     bool mask_has_subset = !mask_subset.empty(); // if mask data has subsets
     if (mask_has_subset) {
         ReleaseSubset();
         for (auto it = mask_subset.begin(); it != mask_subset.end(); ++it) {
-            SubsetPositions* tmp = new SubsetPositions(it->second, true);
+            SubsetPositions* tmp = new SubsetPositions(it->second, false, GetSubsetArena());
             tmp->n_lyrs = n_lyrs_;
 #ifdef HAS_VARIADIC_TEMPLATES
             subset_.emplace(it->first, tmp);
@@ -4112,15 +6846,11 @@ int clsRasterData<T, MASK_T>::MaskAndCalculateValidPosition() {
         vector<int>(pos_rows).swap(pos_rows);
         vector<int>(pos_cols).swap(pos_cols);
 
-        store_pos_ = true;
         n_cells_ = CVT_INT(values.size());
-        if (nullptr != pos_data_) { Release2DArray(pos_data_); }
-        if (nullptr != pos_idx_) { Release1DArray(pos_idx_); }
-        Initialize2DArray(n_cells_, 2, pos_data_, 0);
+        ReleasePositions();
         Initialize1DArray(n_cells_, pos_idx_, 0);
+        AdoptPositions();
         for (size_t k = 0; k < pos_rows.size(); ++k) {
-            pos_data_[k][0] = pos_rows.at(k);
-            pos_data_[k][1] = pos_cols.at(k);
             if (upd_header_rowcol) {
                 pos_idx_[k] = pos_rows.at(k) * new_cols + pos_cols.at(k);
             } else {
@@ -4128,13 +6858,8 @@ int clsRasterData<T, MASK_T>::MaskAndCalculateValidPosition() {
             }
         }
     } else {
-        if (nullptr != pos_data_) { Release2DArray(pos_data_); }
-        if (nullptr != pos_idx_) { Release1DArray(pos_idx_); }
-        if (calc_pos_) {
-            mask_->GetRasterPositionData(&n_cells_, &pos_data_);
-            mask_->GetRasterPositionData(&n_cells_, &pos_idx_);
-        }
-        store_pos_ = false;
+        ReleasePositions();
+        if (calc_pos_) { SharePositionsFromMask(); }
     }
 
     // Release the original raster values, and create new
@@ -4199,8 +6924,8 @@ int clsRasterData<T, MASK_T>::MaskAndCalculateValidPosition() {
             vector<int> globalpos;
             for (int i = 0; i < it->second->n_cells; i++) {
                 int gi = it->second->global_[i];
-                int tmprow = valid_pos[gi][0];
-                int tmpcol = valid_pos[gi][1];
+                int tmprow = valid_pos[gi] / mask_cols;
+                int tmpcol = valid_pos[gi] % mask_cols;
                 XY_COOR tmpxy = mask_->GetCoordinateByRowCol(tmprow, tmpcol);
                 if (GetPosition(tmpxy.first, tmpxy.second) < 0) { continue; }
                 ROW_COL tmppos = GetPositionByCoordinate(tmpxy.first, tmpxy.second);
@@ -4225,23 +6950,18 @@ int clsRasterData<T, MASK_T>::MaskAndCalculateValidPosition() {
                 it->second->n_cells = count;
                 it->second->n_lyrs = n_lyrs_;
                 int local_ncols = ecol - scol + 1;
-                if (it->second->alloc_) {
-                    Release1DArray(it->second->global_);
-                    Release2DArray(it->second->local_pos_);
-                    Release1DArray(it->second->local_posidx_);
+                it->second->ReleaseData();
+                // not affect mask's subset, and allocated from arena of this raster
+                if (!it->second->AllocatePositions()) {
+                    delete it->second;
+                    subset_.erase(it++);
+                    continue;
                 }
-                it->second->global_ = nullptr; // not affect mask's subset
-                it->second->local_pos_ = nullptr;
-                it->second->local_posidx_ = nullptr;
-                it->second->alloc_ = true;
-                Initialize1DArray(count, it->second->global_, -1);
-                Initialize2DArray(count, 2, it->second->local_pos_, -1);
-                Initialize1DArray(count, it->second->local_posidx_, -1);
                 for (int ii = 0; ii < count; ii++) {
                     it->second->global_[ii] = globalpos[ii];
                     int local_row = -1;
                     int local_col = -1;
-                    if (nullptr == pos_data_ || nullptr == pos_idx_) {
+                    if (nullptr == pos_idx_) {
                         local_row = globalpos[ii] / ncols - it->second->g_srow;
                         local_col = globalpos[ii] % ncols - it->second->g_scol;
                     } else {
@@ -4254,19 +6974,226 @@ int clsRasterData<T, MASK_T>::MaskAndCalculateValidPosition() {
                     it->second->local_pos_[ii][1] = local_col;
                     it->second->local_posidx_[ii] = local_row * local_ncols + local_col;
                 }
-                it->second->data_ = nullptr;
-                it->second->data2d_ = nullptr;
-                it->second->alloc_ = true;
             }
             ++it;
         }
     }
     if (store_fullsize || recalc_pos) {
-        mask_ = nullptr;
+        SetMask(nullptr);
     }
     return 2; // all situations that use mask data
 }
 
+/*******************************************************/
+/************* clsRasterCache Implementation ***********/
+/*******************************************************/
+
+template <typename T, typename MASK_T>
+clsRasterCache<T, MASK_T>::clsRasterCache(): budget_(0), usage_(0),
+                                             hits_(0), misses_(0), evictions_(0) {
+}
+
+template <typename T, typename MASK_T>
+clsRasterCache<T, MASK_T>& clsRasterCache<T, MASK_T>::Instance() {
+    static clsRasterCache<T, MASK_T> instance; // thread-safe initialization since C++11
+    return instance;
+}
+
+template <typename T, typename MASK_T>
+clsRasterData<T, MASK_T>* clsRasterCache<T, MASK_T>::Acquire(const string& filename,
+                                                            const bool calc_pos /* = false */,
+                                                            clsRasterData<MASK_T>* mask /* = nullptr */,
+                                                            const bool use_mask_ext /* = true */,
+                                                            double default_value /* = NODATA_VALUE */,
+                                                            const STRING_MAP& opts /* = STRING_MAP() */) {
+    vector<string> filenames(1, filename);
+    return AcquireByKeys(filenames, calc_pos, mask, use_mask_ext, default_value, opts);
+}
+
+template <typename T, typename MASK_T>
+clsRasterData<T, MASK_T>* clsRasterCache<T, MASK_T>::Acquire(vector<string>& filenames,
+                                                            const bool calc_pos /* = false */,
+                                                            clsRasterData<MASK_T>* mask /* = nullptr */,
+                                                            const bool use_mask_ext /* = true */,
+                                                            double default_value /* = NODATA_VALUE */,
+                                                            const STRING_MAP& opts /* = STRING_MAP() */) {
+    return AcquireByKeys(filenames, calc_pos, mask, use_mask_ext, default_value, opts);
+}
+
+template <typename T, typename MASK_T>
+clsRasterData<T, MASK_T>* clsRasterCache<T, MASK_T>::AcquireByKeys(vector<string>& filenames,
+                                                                  const bool calc_pos,
+                                                                  clsRasterData<MASK_T>* mask,
+                                                                  const bool use_mask_ext,
+                                                                  const double default_value,
+                                                                  const STRING_MAP& opts) {
+    if (filenames.empty()) { return nullptr; }
+    // Key: paths, sizes and modification times, mask identity, reading flags, and options
+    std::ostringstream oss;
+    for (auto it = filenames.begin(); it != filenames.end(); ++it) {
+        vint64_t size = 0;
+        vint64_t mtime_ns = 0;
+        if (!GetFileStamp(*it, size, mtime_ns)) {
+            StatusMessage("Please make sure all file path existed!");
+            return nullptr;
+        }
+        oss << GetAbsolutePath(*it) << "@" << size << ":" << mtime_ns << ";";
+    }
+    oss << "|mask:" << (nullptr == mask ? 0 : mask->GetUniqueId());
+    oss << "|calc_pos:" << calc_pos << "|mask_ext:" << use_mask_ext;
+    oss << "|default:" << setprecision(17) << default_value;
+    for (auto it = opts.begin(); it != opts.end(); ++it) {
+        oss << "|" << it->first << "=" << it->second;
+    }
+    string key = oss.str();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(key);
+        if (it != entries_.end()) {
+            hits_++;
+            lru_.splice(lru_.begin(), lru_, it->second.lru_pos);
+            return CreateConsumer(it->second.raster);
+        }
+        misses_++;
+    }
+    // Read raster data without lock, concurrent requests of the same key may both read
+    clsRasterData<T, MASK_T>* loaded = filenames.size() == 1
+                                           ? clsRasterData<T, MASK_T>::Init(filenames[0], calc_pos, mask,
+                                                                            use_mask_ext, default_value,
+                                                                            opts)
+                                           : clsRasterData<T, MASK_T>::Init(filenames, calc_pos, mask,
+                                                                            use_mask_ext, default_value,
+                                                                            opts);
+    if (nullptr == loaded) { return nullptr; }
+    std::shared_ptr<clsRasterData<T, MASK_T> > src(loaded);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(key);
+    if (it != entries_.end()) { // cached by another thread, use it and discard ours
+        lru_.splice(lru_.begin(), lru_, it->second.lru_pos);
+        return CreateConsumer(it->second.raster);
+    }
+    lru_.push_front(key);
+    CacheEntry entry;
+    entry.raster = src;
+    entry.bytes = EstimateBytes(loaded);
+    entry.lru_pos = lru_.begin();
+#ifdef HAS_VARIADIC_TEMPLATES
+    entries_.emplace(key, entry);
+#else
+    entries_.insert(make_pair(key, entry));
+#endif
+    usage_ += entry.bytes;
+    clsRasterData<T, MASK_T>* consumer = CreateConsumer(src);
+    src = nullptr; // the new entry is referenced only by the cache and consumer now
+    if (budget_ > 0) { EvictUnreferenced(budget_); }
+    return consumer;
+}
+
+template <typename T, typename MASK_T>
+clsRasterData<T, MASK_T>* clsRasterCache<T, MASK_T>::CreateConsumer(
+    const std::shared_ptr<clsRasterData<T, MASK_T> >& src) {
+    clsRasterData<T, MASK_T>* rs = new clsRasterData<T, MASK_T>(src->Is2DRaster());
+    if (!rs->ShareFrom(src)) {
+        delete rs;
+        return nullptr;
+    }
+    return rs;
+}
+
+template <typename T, typename MASK_T>
+size_t clsRasterCache<T, MASK_T>::EstimateBytes(clsRasterData<T, MASK_T>* rs) {
+    size_t ncells = CVT_SIZET(rs->GetCellNumber() < 0 ? 0 : rs->GetCellNumber());
+    size_t nlyrs = CVT_SIZET(rs->GetLayers() < 1 ? 1 : rs->GetLayers());
+    size_t bytes = ncells * nlyrs * sizeof(T);
+    if (rs->Is2DRaster()) { bytes += ncells * sizeof(T*); }
+    if (rs->PositionsAllocated()) { // pos_idx_, and pos_data_ (row, col, and row pointer) if materialized
+        bytes += ncells * sizeof(int);
+        std::shared_ptr<PositionTables> tables = rs->GetSharedPositions();
+        if (nullptr != tables && nullptr != tables->GetPositionData()) {
+            bytes += ncells * (2 * sizeof(int) + sizeof(int*));
+        }
+    }
+    return bytes;
+}
+
+template <typename T, typename MASK_T>
+void clsRasterCache<T, MASK_T>::EvictUnreferenced(const size_t budget) {
+    auto lit = lru_.end();
+    while (usage_ > budget && lit != lru_.begin()) {
+        --lit;
+        auto eit = entries_.find(*lit);
+        if (eit == entries_.end() || eit->second.raster.use_count() > 1) { continue; }
+        usage_ -= eit->second.bytes;
+        entries_.erase(eit);
+        lit = lru_.erase(lit);
+        evictions_++;
+    }
+}
+
+template <typename T, typename MASK_T>
+void clsRasterCache<T, MASK_T>::SetMemoryBudget(const size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    budget_ = bytes;
+    if (budget_ > 0) { EvictUnreferenced(budget_); }
+}
+
+template <typename T, typename MASK_T>
+size_t clsRasterCache<T, MASK_T>::GetMemoryBudget() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return budget_;
+}
+
+template <typename T, typename MASK_T>
+size_t clsRasterCache<T, MASK_T>::GetMemoryUsage() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return usage_;
+}
+
+template <typename T, typename MASK_T>
+int clsRasterCache<T, MASK_T>::GetEntryCount() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return CVT_INT(entries_.size());
+}
+
+template <typename T, typename MASK_T>
+vuint64_t clsRasterCache<T, MASK_T>::GetHitCount() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return hits_;
+}
+
+template <typename T, typename MASK_T>
+vuint64_t clsRasterCache<T, MASK_T>::GetMissCount() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return misses_;
+}
+
+template <typename T, typename MASK_T>
+vuint64_t clsRasterCache<T, MASK_T>::GetEvictionCount() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return evictions_;
+}
+
+template <typename T, typename MASK_T>
+void clsRasterCache<T, MASK_T>::ResetCounters() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    hits_ = 0;
+    misses_ = 0;
+    evictions_ = 0;
+}
+
+template <typename T, typename MASK_T>
+void clsRasterCache<T, MASK_T>::Trim() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (budget_ > 0) { EvictUnreferenced(budget_); }
+}
+
+template <typename T, typename MASK_T>
+void clsRasterCache<T, MASK_T>::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    EvictUnreferenced(0);
+}
+
 } // namespace data_raster
 } // namespace ccgl
 #endif /* CCGL_DATA_RASTER_H */
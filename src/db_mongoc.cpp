@@ -13,7 +13,12 @@
 #include "db_mongoc.h"
 
 #include <cassert>
+#include <cctype>
+#include <algorithm>
+#include <set>
 #include <utility>
+#include <fstream>
+#include <exception>
 #include "basic.h"
 #include "utils_string.h"
 #include "utils_math.h"
@@ -180,8 +185,31 @@ mongoc_gridfs_t* MongoClient::GetGridFs(string const& dbname, string const& gfsn
     return gfs;
 }
 
+#ifdef USE_GRIDFS_BUCKET
+mongoc_gridfs_bucket_t* MongoClient::GetGridFsBucket(string const& dbname, string const& gfsname) {
+    mongoc_database_t* db = mongoc_client_get_database(conn_, dbname.c_str());
+    bson_t opts = BSON_INITIALIZER;
+    BSON_APPEND_UTF8(&opts, "bucketName", gfsname.c_str());
+    bson_error_t err;
+    mongoc_gridfs_bucket_t* bucket = mongoc_gridfs_bucket_new(db, &opts, NULL, &err);
+    bson_destroy(&opts);
+    mongoc_database_destroy(db);
+    if (NULL == bucket) {
+        cout << "Failed to get " + gfsname + " GridFS bucket! Error: " << err.message << endl;
+    }
+    return bucket;
+}
+#endif
+
 MongoGridFs* MongoClient::GridFs(string const& dbname, string const& gfsname) {
-    return new MongoGridFs(GetGridFs(dbname, gfsname));
+    mongoc_gridfs_t* gfs = GetGridFs(dbname, gfsname);
+    MongoGridFs* gfs_handle = nullptr;
+#ifdef USE_GRIDFS_BUCKET
+    if (NULL != gfs) { gfs_handle = new MongoGridFs(gfs, GetGridFsBucket(dbname, gfsname)); }
+#endif
+    if (nullptr == gfs_handle) { gfs_handle = new MongoGridFs(gfs); }
+    gfs_handle->SetNames(dbname, gfsname);
+    return gfs_handle;
 }
 
 /*!
@@ -194,6 +222,141 @@ void MongoClient::GetGridFsFileNames(string const& dbname, string const& gfsname
     MongoGridFs(gfs).GetFileNames(gfs_exists);
 }
 
+///////////////////////////////////////////////////
+////////////////  MongoClientPool  ////////////////
+///////////////////////////////////////////////////
+
+/*!
+ * \param[in] uri URI of MongoDB, which is copied
+ * \param[in] max_size Maximum number of clients, 0 means the default of driver (100)
+ *
+ * \note Use MongoClientPool::Init() instead, which initializes the driver
+ *       and checks the connection.
+ */
+MongoClientPool::MongoClientPool(const mongoc_uri_t* uri, const int max_size /* = 0 */) :
+    uri_(mongoc_uri_copy(uri)), pool_(nullptr) {
+    pool_ = mongoc_client_pool_new(uri_);
+    if (NULL != pool_ && max_size > 0) {
+        mongoc_client_pool_max_size(pool_, static_cast<uint32_t>(max_size));
+        metrics_.max_size = max_size;
+    }
+}
+
+MongoClientPool* MongoClientPool::Init(const char* host, const vuint16_t port,
+                                       const int max_size /* = 0 */) {
+    mongoc_init();
+    mongoc_uri_t* uri = mongoc_uri_new_for_host_port(host, port);
+    if (NULL == uri) { return nullptr; }
+    MongoClientPool* pool = Init(uri, max_size);
+    mongoc_uri_destroy(uri);
+    return pool;
+}
+
+MongoClientPool* MongoClientPool::Init(const mongoc_uri_t* uri, const int max_size /* = 0 */) {
+    mongoc_init();
+    if (NULL == uri) { return nullptr; }
+    MongoClientPool* pool = new MongoClientPool(uri, max_size);
+    if (NULL == pool->pool_) {
+        delete pool;
+        return nullptr;
+    }
+    // Validate the connection by a client checked out
+    mongoc_client_t* conn = pool->TryPop();
+    if (NULL == conn) {
+        delete pool;
+        return nullptr;
+    }
+    bson_t ping = BSON_INITIALIZER;
+    BSON_APPEND_INT32(&ping, "ping", 1);
+    bson_error_t err;
+    bool connected = mongoc_client_command_simple(conn, "admin", &ping, NULL, NULL, &err);
+    bson_destroy(&ping);
+    pool->Push(conn);
+    if (!connected) {
+        cout << "MongoClientPool::Init failed: " << err.message << endl;
+        delete pool;
+        return nullptr;
+    }
+    return pool;
+}
+
+MongoClientPool::~MongoClientPool() {
+    if (NULL != pool_) { mongoc_client_pool_destroy(pool_); }
+    if (NULL != uri_) { mongoc_uri_destroy(uri_); }
+}
+
+mongoc_client_t* MongoClientPool::Pop() {
+    mongoc_client_t* conn = TryPop();
+    if (NULL != conn) { return conn; }
+    // The pool is exhausted, wait for a client pushed back
+    double stime = TimeCounting();
+    conn = mongoc_client_pool_pop(pool_);
+    if (NULL != conn) { RecordCheckout(TimeCounting() - stime); }
+    return conn;
+}
+
+mongoc_client_t* MongoClientPool::TryPop() {
+    mongoc_client_t* conn = mongoc_client_pool_try_pop(pool_);
+    if (NULL != conn) { RecordCheckout(0.); }
+    return conn;
+}
+
+void MongoClientPool::Push(mongoc_client_t* conn) {
+    if (NULL == conn) { return; }
+    mongoc_client_pool_push(pool_, conn);
+    std::lock_guard<std::mutex> lock(metrics_mutex_);
+    metrics_.checked_out--;
+}
+
+MongoPoolMetrics MongoClientPool::GetMetrics() {
+    std::lock_guard<std::mutex> lock(metrics_mutex_);
+    return metrics_;
+}
+
+void MongoClientPool::RecordCheckout(const double wait_time) {
+    std::lock_guard<std::mutex> lock(metrics_mutex_);
+    metrics_.checkouts++;
+    metrics_.checked_out++;
+    if (metrics_.checked_out > metrics_.peak_checked_out) {
+        metrics_.peak_checked_out = metrics_.checked_out;
+    }
+    if (wait_time > 0.) {
+        metrics_.waited++;
+        metrics_.total_wait += wait_time;
+        if (wait_time > metrics_.max_wait) { metrics_.max_wait = wait_time; }
+    }
+}
+
+///////////////////////////////////////////////////
+////////////////  MongoPooledClient  //////////////
+///////////////////////////////////////////////////
+MongoPooledClient::MongoPooledClient(MongoClientPool* pool) : pool_(pool), conn_(nullptr),
+                                                              client_(nullptr) {
+    if (nullptr == pool_) { return; }
+    conn_ = pool_->Pop();
+    if (NULL != conn_) { client_ = new MongoClient(conn_); }
+}
+
+MongoPooledClient::~MongoPooledClient() {
+    // GridFS handles MUST be destroyed before the client is pushed back
+    for (auto it = gridfs_.begin(); it != gridfs_.end(); ++it) {
+        delete *it;
+    }
+    delete client_; // the wrapper does not destroy conn_
+    if (nullptr != pool_) { pool_->Push(conn_); }
+}
+
+MongoGridFs* MongoPooledClient::GridFs(string const& dbname, string const& gfsname) {
+    if (nullptr == client_) { return nullptr; }
+    MongoGridFs* gfs_handle = client_->GridFs(dbname, gfsname);
+    if (NULL == gfs_handle->GetGridFs()) {
+        delete gfs_handle;
+        return nullptr;
+    }
+    gridfs_.emplace_back(gfs_handle);
+    return gfs_handle;
+}
+
 ///////////////////////////////////////////////////
 ////////////////  MongoDatabase  //////////////////
 ///////////////////////////////////////////////////
@@ -297,12 +460,42 @@ vint MongoCollection::QueryRecordsCount() {
 ///////////////////////////////////////////////////
 ////////////////  MongoGridFs  ////////////////////
 ///////////////////////////////////////////////////
-MongoGridFs::MongoGridFs(mongoc_gridfs_t* gfs /* = NULL */) : gfs_(gfs) {
+
+/// Mutex of the handles whose metadata cache is enabled
+static std::mutex& CachingHandlesMutex() {
+    static std::mutex handles_mutex;
+    return handles_mutex;
+}
+
+/// Handles whose metadata cache is enabled, \sa MongoGridFs::InvalidateCachedFiles()
+static std::set<MongoGridFs*>& CachingHandles() {
+    static std::set<MongoGridFs*> handles;
+    return handles;
+}
+
+MongoGridFs::MongoGridFs(mongoc_gridfs_t* gfs /* = NULL */) :
+    gfs_(gfs), cache_(nullptr), meta_ttl_ms_(0) {
+#ifdef USE_GRIDFS_BUCKET
+    bucket_ = NULL;
+#endif
+}
+
+#ifdef USE_GRIDFS_BUCKET
+MongoGridFs::MongoGridFs(mongoc_gridfs_t* gfs, mongoc_gridfs_bucket_t* bucket) :
+    gfs_(gfs), bucket_(bucket), cache_(nullptr), meta_ttl_ms_(0) {
     // Do nothing.
 }
+#endif
 
 MongoGridFs::~MongoGridFs() {
+    {
+        std::lock_guard<std::mutex> lock(CachingHandlesMutex());
+        CachingHandles().erase(this);
+    }
     if (gfs_ != NULL) { mongoc_gridfs_destroy(gfs_); }
+#ifdef USE_GRIDFS_BUCKET
+    if (bucket_ != NULL) { mongoc_gridfs_bucket_destroy(bucket_); }
+#endif
 }
 
 mongoc_gridfs_file_t* MongoGridFs::GetFile(string const& gfilename, mongoc_gridfs_t* gfs /* = NULL */,
@@ -312,6 +505,11 @@ mongoc_gridfs_file_t* MongoGridFs::GetFile(string const& gfilename, mongoc_gridf
         StatusMessage("mongoc_gridfs_t must be provided for MongoGridFs!");
         return NULL;
     }
+    std::shared_ptr<bson_t> cached_file;
+    if (FindCachedFile(gfilename, opts, cached_file) && nullptr == cached_file) {
+        StatusMessage(("The file " + gfilename + " does not exist.").c_str());
+        return NULL; // no need to retry
+    }
     mongoc_gridfs_file_t* gfile = NULL;
     bson_error_t err;
     bson_t filter = BSON_INITIALIZER;
@@ -337,6 +535,16 @@ mongoc_gridfs_file_t* MongoGridFs::GetFile(string const& gfilename, mongoc_gridf
 
 bool MongoGridFs::RemoveFile(string const& gfilename, mongoc_gridfs_t* gfs /* = NULL */,
                              STRING_MAP opts /* = STRING_MAP() */) {
+    EraseCachedFile(gfilename);
+#ifdef USE_GRIDFS_BUCKET
+    if (bucket_ != NULL) {
+        vector<bson_t*> files;
+        bool found = FindFiles(gfilename, opts, files);
+        bool deleted = DeleteFiles(files);
+        for (auto it = files.begin(); it != files.end(); ++it) { bson_destroy(*it); }
+        return found && deleted;
+    }
+#endif
     if (gfs_ != NULL) { gfs = gfs_; }
     if (NULL == gfs) {
         StatusMessage("mongoc_gridfs_t must be provided for MongoGridFs!");
@@ -396,6 +604,21 @@ void MongoGridFs::GetFileNames(vector<string>& files_existed, mongoc_gridfs_t* g
 bson_t* MongoGridFs::GetFileMetadata(string const& gfilename,
                                      mongoc_gridfs_t* gfs /* = NULL */,
                                      STRING_MAP opts /* = STRING_MAP() */) {
+    std::shared_ptr<bson_t> cached_file;
+    if (FindCachedFile(gfilename, opts, cached_file)) {
+        if (nullptr == cached_file) {
+            StatusMessage(("MongoGridFs::GetFileMetadata(" + gfilename + ") failed!").c_str());
+            return NULL;
+        }
+        bson_iter_t iter;
+        if (bson_iter_init_find(&iter, cached_file.get(), "metadata") && BSON_ITER_HOLDS_DOCUMENT(&iter)) {
+            uint32_t meta_len = 0;
+            const uint8_t* meta_data = NULL;
+            bson_iter_document(&iter, &meta_len, &meta_data);
+            return bson_new_from_data(meta_data, meta_len);
+        }
+        return bson_new();
+    }
     if (gfs_ != NULL) gfs = gfs_;
     if (NULL == gfs) {
         StatusMessage("mongoc_gridfs_t must be provided for MongoGridFs!");
@@ -413,66 +636,1062 @@ bson_t* MongoGridFs::GetFileMetadata(string const& gfilename,
     return mata;
 }
 
+/*!
+ * Convert the value of an option to double as IsDouble(), i.e., the entire string is parsed
+ *   by strtod(), which is skipped if the first character cannot start a number, e.g., "FLOAT".
+ */
+static bool OptionToDouble(const string& value, double& dbl_value) {
+    if (value.empty()) { return false; }
+    unsigned char c = static_cast<unsigned char>(value[0]);
+    if (!isdigit(c) && !isspace(c) && c != '-' && c != '+' && c != '.'
+        && c != 'i' && c != 'I' && c != 'n' && c != 'N') { // inf or nan
+        return false;
+    }
+    bool is_dbl = false;
+    dbl_value = IsDouble(value, is_dbl);
+    return is_dbl;
+}
+
+/*!
+ * Match metadata of the files document with opts as the query filter built by
+ *   AppendStringOptionsToBson(), i.e., numeric strings are compared as numbers.
+ */
+static bool MatchFileOptions(const bson_t* file, const STRING_MAP& opts) {
+    for (auto it = opts.begin(); it != opts.end(); ++it) {
+        string key = "metadata." + it->first;
+        bson_iter_t iter;
+        bson_iter_t field;
+        if (!bson_iter_init(&iter, file) || !bson_iter_find_descendant(&iter, key.c_str(), &field)) {
+            return false;
+        }
+        double dbl_value = 0.;
+        if (!OptionToDouble(it->second, dbl_value)) {
+            if (!BSON_ITER_HOLDS_UTF8(&field) || it->second != bson_iter_utf8(&field, NULL)) { return false; }
+            continue;
+        }
+        double intpart;
+        if (std::modf(dbl_value, &intpart) == 0.0) { dbl_value = CVT_INT(dbl_value); }
+        if (!BSON_ITER_HOLDS_NUMBER(&field) || bson_iter_as_double(&field) != dbl_value) { return false; }
+    }
+    return true;
+}
+
+/*!
+ * All files of the names are fetched by one query of the files collection regardless of opts,
+ *   so that the cached documents can serve the following requests with any opts.
+ */
+bool MongoGridFs::GetFilesInfo(const vector<string>& gfilenames, vector<GridFsFileInfo>& infos,
+                               const STRING_MAP& opts /* = STRING_MAP() */,
+                               const bool cache_absent /* = false */) {
+    infos.clear();
+    if (gfilenames.empty()) { return true; }
+    if (NULL == gfs_) {
+        StatusMessage("mongoc_gridfs_t must be provided for MongoGridFs!");
+        return false;
+    }
+    bson_t filter = BSON_INITIALIZER;
+    bson_t name_cond;
+    bson_t names;
+    BSON_APPEND_DOCUMENT_BEGIN(&filter, "filename", &name_cond);
+    BSON_APPEND_ARRAY_BEGIN(&name_cond, "$in", &names);
+    for (size_t i = 0; i < gfilenames.size(); i++) {
+        string key = ValueToString(i);
+        BSON_APPEND_UTF8(&names, key.c_str(), gfilenames[i].c_str());
+    }
+    bson_append_array_end(&name_cond, &names);
+    bson_append_document_end(&filter, &name_cond);
+    bson_t find_opts = BSON_INITIALIZER;
+    bson_t projection;
+    BSON_APPEND_DOCUMENT_BEGIN(&find_opts, "projection", &projection);
+    BSON_APPEND_INT32(&projection, "_id", 1);
+    BSON_APPEND_INT32(&projection, "filename", 1);
+    BSON_APPEND_INT32(&projection, "length", 1);
+    BSON_APPEND_INT32(&projection, "chunkSize", 1);
+    BSON_APPEND_INT32(&projection, "uploadDate", 1);
+    BSON_APPEND_INT32(&projection, "metadata", 1);
+    bson_append_document_end(&find_opts, &projection);
+    // The files collection is owned by mongoc_gridfs_t, DO NOT destroy it
+    mongoc_cursor_t* cursor = mongoc_collection_find_with_opts(mongoc_gridfs_get_files(gfs_),
+                                                               &filter, &find_opts, NULL);
+    map<string, vector<std::shared_ptr<bson_t> > > fetched;
+    const bson_t* doc = NULL;
+    while (mongoc_cursor_next(cursor, &doc)) {
+        bson_iter_t iter;
+        if (!bson_iter_init_find(&iter, doc, "filename") || !BSON_ITER_HOLDS_UTF8(&iter)) { continue; }
+        fetched[bson_iter_utf8(&iter, NULL)].emplace_back(bson_copy(doc), bson_destroy);
+    }
+    bson_error_t err;
+    bool queried = !mongoc_cursor_error(cursor, &err);
+    if (!queried) {
+        StatusMessage(("MongoGridFs::GetFilesInfo() failed: " + string(err.message)).c_str());
+    }
+    mongoc_cursor_destroy(cursor);
+    bson_destroy(&find_opts);
+    bson_destroy(&filter);
+    if (!queried) { return false; }
+    double now = TimeCounting();
+    for (auto it = gfilenames.begin(); it != gfilenames.end(); ++it) {
+        vector<std::shared_ptr<bson_t> >& files = fetched[*it]; // empty if not existed
+        std::unique_lock<std::mutex> lock(meta_mutex_);
+        if (meta_ttl_ms_ > 0 && (cache_absent || !files.empty())) {
+            CachedFiles& cached = meta_cache_[*it];
+            cached.fetched = now;
+            cached.files = files;
+        } else {
+            meta_cache_.erase(*it); // a stale entry, if any, must not outlive this query
+        }
+        lock.unlock();
+        for (auto fit = files.begin(); fit != files.end(); ++fit) {
+            const bson_t* file = fit->get();
+            if (!MatchFileOptions(file, opts)) { continue; }
+            GridFsFileInfo info;
+            info.filename = *it;
+            info.length = -1;
+            info.chunk_size = 0;
+            info.upload_date = 0;
+            bson_iter_t iter;
+            if (bson_iter_init_find(&iter, file, "length")) { GetNumericFromBsonIterator(&iter, info.length); }
+            if (bson_iter_init_find(&iter, file, "chunkSize")) {
+                GetNumericFromBsonIterator(&iter, info.chunk_size);
+            }
+            if (bson_iter_init_find(&iter, file, "uploadDate") && BSON_ITER_HOLDS_DATE_TIME(&iter)) {
+                info.upload_date = bson_iter_date_time(&iter);
+            }
+            if (bson_iter_init_find(&iter, file, "metadata") && BSON_ITER_HOLDS_DOCUMENT(&iter)) {
+                uint32_t meta_len = 0;
+                const uint8_t* meta_data = NULL;
+                bson_iter_document(&iter, &meta_len, &meta_data);
+                info.metadata.reset(bson_new_from_data(meta_data, meta_len), bson_destroy);
+            }
+            infos.emplace_back(info);
+            break; // the first one as GetFile()
+        }
+    }
+    return true;
+}
+
+bool MongoGridFs::HasFile(string const& gfilename, const STRING_MAP& opts /* = STRING_MAP() */) {
+    std::shared_ptr<bson_t> file;
+    if (FindCachedFile(gfilename, opts, file)) { return nullptr != file; }
+    vector<GridFsFileInfo> infos;
+    return GetFilesInfo(vector<string>(1, gfilename), infos, opts) && !infos.empty();
+}
+
+void MongoGridFs::SetMetadataCacheTtl(const int ttl_ms) {
+    {
+        std::lock_guard<std::mutex> lock(CachingHandlesMutex());
+        if (ttl_ms > 0) {
+            CachingHandles().insert(this);
+        } else {
+            CachingHandles().erase(this);
+        }
+    }
+    std::lock_guard<std::mutex> lock(meta_mutex_);
+    meta_ttl_ms_ = ttl_ms > 0 ? ttl_ms : 0;
+    if (meta_ttl_ms_ == 0) { meta_cache_.clear(); }
+}
+
+void MongoGridFs::InvalidateCachedFiles(string const& dbname, string const& gfsname,
+                                        const vector<string>& gfilenames) {
+    if (gfilenames.empty()) { return; }
+    std::lock_guard<std::mutex> lock(CachingHandlesMutex());
+    std::set<MongoGridFs*>& handles = CachingHandles();
+    for (auto it = handles.begin(); it != handles.end(); ++it) {
+        MongoGridFs* handle = *it;
+        if (handle->dbname_ != dbname || handle->gfsname_ != gfsname) { continue; }
+        std::lock_guard<std::mutex> meta_lock(handle->meta_mutex_);
+        for (auto nit = gfilenames.begin(); nit != gfilenames.end(); ++nit) {
+            handle->meta_cache_.erase(*nit);
+        }
+    }
+}
+
+void MongoGridFs::ClearMetadataCache() {
+    std::lock_guard<std::mutex> lock(meta_mutex_);
+    meta_cache_.clear();
+}
+
+void MongoGridFs::EraseCachedFile(string const& gfilename) {
+    std::lock_guard<std::mutex> lock(meta_mutex_);
+    meta_cache_.erase(gfilename);
+}
+
+bool MongoGridFs::FindCachedFile(string const& gfilename, const STRING_MAP& opts,
+                                 std::shared_ptr<bson_t>& file) {
+    file.reset();
+    std::lock_guard<std::mutex> lock(meta_mutex_);
+    if (meta_ttl_ms_ <= 0) { return false; }
+    auto it = meta_cache_.find(gfilename);
+    if (it == meta_cache_.end()) { return false; }
+    if ((TimeCounting() - it->second.fetched) * 1000. > meta_ttl_ms_) { // expired
+        meta_cache_.erase(it);
+        return false;
+    }
+    for (auto fit = it->second.files.begin(); fit != it->second.files.end(); ++fit) {
+        if (MatchFileOptions(fit->get(), opts)) {
+            file = *fit; // shared, so that it survives the eviction of the entry
+            break;
+        }
+    }
+    return true;
+}
+
 bool MongoGridFs::GetStreamData(string const& gfilename, char*& databuf,
                                 vint& datalength, mongoc_gridfs_t* gfs /* = NULL */,
                                 const STRING_MAP* opts /* = nullptr */) {
-    if (gfs_ != NULL) { gfs = gfs_; }
-    if (NULL == gfs) {
-        StatusMessage("mongoc_gridfs_t must be provided for MongoGridFs!");
-        return false;
+    databuf = NULL;
+    datalength = 0;
+    bool read_ok = ReadStreamChunks(gfilename,
+                                    [&databuf, &datalength](const bson_t*, const vint length) {
+                                        datalength = length;
+                                        databuf = static_cast<char *>(malloc(length > 0 ? length : 1));
+                                        return NULL != databuf;
+                                    },
+                                    [&databuf](const char* chunk, const vint size, const vint offset) {
+                                        memcpy(databuf + offset, chunk, size);
+                                        return true;
+                                    }, gfs, opts);
+    if (!read_ok) {
+        if (NULL != databuf) { free(databuf); }
+        databuf = NULL;
+        StatusMessage(("MongoGridFs::GetStreamData(" + gfilename + ") failed!").c_str());
     }
+    return read_ok;
+}
+
+/*!
+ * Key of the cached GridFS file, i.e., `_id`, upload date (milliseconds), and length.
+ *   Empty if the `_id` is not an ObjectId, which is not cached.
+ */
+static string GridFsCacheKey(const bson_value_t* id, const vint64_t upload_date, const vint length) {
+    if (NULL == id || id->value_type != BSON_TYPE_OID) { return string(); }
+    char oid_str[25];
+    bson_oid_to_string(&id->value.v_oid, oid_str);
+    return string(oid_str) + "_" + ValueToString(upload_date) + "_" + ValueToString(length);
+}
+
+/*!
+ * The chunks are read from a download stream of the GridFS bucket (or a stream of the legacy
+ *   GridFS file) until the length declared in the files collection is reached, hence the peak
+ *   memory is one chunk (255 KB by default) besides the destination of the caller.
+ *   A short read is retried a few times before failure.
+ *
+ * If the local cache is set, the files document (queried anyway) validates the cached entry.
+ *   On hit, the chunks are sliced from the memory-mapped entry. On miss, the chunks read
+ *   are also written to a temporary file, which is committed as the entry once completed.
+ */
+bool MongoGridFs::ReadStreamChunks(string const& gfilename,
+                                   const std::function<bool(const bson_t* metadata, vint length)>& on_open,
+                                   const std::function<bool(const char* chunk, vint size, vint offset)>& on_chunk,
+                                   mongoc_gridfs_t* gfs /* = NULL */,
+                                   const STRING_MAP* opts /* = nullptr */,
+                                   const int timeout_ms /* = 0 */) {
     STRING_MAP opts_temp;
     if (nullptr == opts) {
         opts = &opts_temp;
     }
-    mongoc_gridfs_file_t* gfile = GetFile(gfilename, gfs, *opts);
-    if (NULL == gfile) {
-        databuf = NULL;
-        StatusMessage(("MongoGridFs::GetStreamData(" + gfilename + ") failed!").c_str());
-        return false;
+    mongoc_stream_t* stream = NULL;
+    mongoc_gridfs_file_t* gfile = NULL;
+    vint length = -1;
+    vint chunk_size = 0;
+    bson_error_t err;
+    string cache_key;
+    MappedFile cached;
+    bool hit = false;
+    bool found = false;
+#ifdef USE_GRIDFS_BUCKET
+    if (bucket_ != NULL) {
+        vector<bson_t*> files;
+        std::shared_ptr<bson_t> cached_file;
+        const bson_t* file = nullptr; // files document, cached or found
+        if (FindCachedFile(gfilename, *opts, cached_file)) {
+            file = cached_file.get();
+        } else {
+            FindFiles(gfilename, *opts, files);
+            if (!files.empty()) { file = files[0]; }
+        }
+        if (nullptr == file) {
+            StatusMessage(("The file " + gfilename + " does not exist.").c_str());
+            for (auto it = files.begin(); it != files.end(); ++it) { bson_destroy(*it); }
+            return false;
+        }
+        found = true;
+        bson_iter_t iter;
+        if (bson_iter_init_find(&iter, file, "length")) { GetNumericFromBsonIterator(&iter, length); }
+        if (bson_iter_init_find(&iter, file, "chunkSize")) { GetNumericFromBsonIterator(&iter, chunk_size); }
+        bson_t metadata;
+        bool has_meta = false;
+        if (bson_iter_init_find(&iter, file, "metadata") && BSON_ITER_HOLDS_DOCUMENT(&iter)) {
+            uint32_t meta_len = 0;
+            const uint8_t* meta_data = NULL;
+            bson_iter_document(&iter, &meta_len, &meta_data);
+            has_meta = bson_init_static(&metadata, meta_data, meta_len);
+        }
+        if (nullptr != cache_ && bson_iter_init_find(&iter, file, "_id")) {
+            bson_iter_t date_iter;
+            vint64_t upload_date = 0;
+            if (bson_iter_init_find(&date_iter, file, "uploadDate")
+                && BSON_ITER_HOLDS_DATE_TIME(&date_iter)) {
+                upload_date = bson_iter_date_time(&date_iter);
+            }
+            cache_key = GridFsCacheKey(bson_iter_value(&iter), upload_date, length);
+            hit = cache_->Lookup(cache_key, cached) && cached.Size() == length;
+        }
+        bool opened = length >= 0 && on_open(has_meta ? &metadata : NULL, length);
+        if (opened && !hit && bson_iter_init_find(&iter, file, "_id")) {
+            stream = mongoc_gridfs_bucket_open_download_stream(bucket_, bson_iter_value(&iter), &err);
+            if (NULL == stream) {
+                StatusMessage(("MongoGridFs::ReadStreamChunks(" + gfilename + ") failed: " +
+                                  err.message).c_str());
+            }
+        }
+        for (auto it = files.begin(); it != files.end(); ++it) { bson_destroy(*it); }
+        if (!opened || (!hit && NULL == stream)) { return false; }
+    }
+#endif
+    if (!found) {
+        if (gfs_ != NULL) { gfs = gfs_; }
+        if (NULL == gfs) {
+            StatusMessage("mongoc_gridfs_t must be provided for MongoGridFs!");
+            return false;
+        }
+        gfile = GetFile(gfilename, gfs, *opts);
+        if (NULL == gfile) { return false; }
+        length = mongoc_gridfs_file_get_length(gfile);
+        chunk_size = mongoc_gridfs_file_get_chunk_size(gfile);
+        if (nullptr != cache_) {
+            cache_key = GridFsCacheKey(mongoc_gridfs_file_get_id(gfile),
+                                       mongoc_gridfs_file_get_upload_date(gfile), length);
+            hit = cache_->Lookup(cache_key, cached) && cached.Size() == length;
+        }
+        if (!on_open(mongoc_gridfs_file_get_metadata(gfile), length)) {
+            mongoc_gridfs_file_destroy(gfile);
+            return false;
+        }
+        if (!hit) { stream = mongoc_stream_gridfs_new(gfile); }
+    }
+    if (chunk_size <= 0) { chunk_size = GRIDFS_CHUNK_SIZE; }
+    if (hit) { // the same slices as chunks read from MongoDB
+        bool read_ok = true;
+        for (vint offset = 0; offset < length && read_ok; offset += chunk_size) {
+            read_ok = on_chunk(cached.Data() + offset, Min(chunk_size, length - offset), offset);
+        }
+        if (NULL != gfile) { mongoc_gridfs_file_destroy(gfile); }
+        return read_ok;
+    }
+    string cache_temp;
+    std::ofstream cache_file;
+    if (nullptr != cache_ && cache_->Valid() && !cache_key.empty()) {
+        cache_temp = cache_->NewTempPath(cache_key);
+        cache_file.open(cache_temp.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    }
+    vector<char> chunk(CVT_SIZET(Min(chunk_size, Max(length, CVT_VINT(1)))));
+    double stime = TimeCounting();
+    vint offset = 0;
+    int retry = 0;
+    bool read_ok = true;
+    while (offset < length) {
+        if (timeout_ms > 0 && (TimeCounting() - stime) * 1000. > timeout_ms) {
+            StatusMessage(("MongoGridFs::ReadStreamChunks(" + gfilename + ") timeout!").c_str());
+            read_ok = false;
+            break;
+        }
+        size_t count = CVT_SIZET(Min(CVT_VINT(chunk.size()), length - offset));
+        // For GridFS streams, the timeout argument is ignored and reading blocks until
+        //   min_bytes have been read or the end of file is reached.
+        ssize_t nread = mongoc_stream_read(stream, chunk.data(), count, count, 0);
+        if (nread <= 0) {
+            if (nread < 0 || ++retry > 5) {
+                StatusMessage(("MongoGridFs::ReadStreamChunks(" + gfilename + ") failed at offset " +
+                                  ValueToString(offset) + "!").c_str());
+                read_ok = false;
+                break;
+            }
+            SleepMs(2); // in case of network blocking
+            continue;
+        }
+        retry = 0;
+        if (!on_chunk(chunk.data(), CVT_VINT(nread), offset)) {
+            read_ok = false;
+            break;
+        }
+        if (cache_file.is_open()) { cache_file.write(chunk.data(), nread); }
+        offset += nread;
     }
-    datalength = mongoc_gridfs_file_get_length(gfile);
-    databuf = static_cast<char *>(malloc(datalength));
-    mongoc_iovec_t iov;
-    iov.iov_base = databuf;
-    iov.iov_len = static_cast<u_long>(datalength);
-    mongoc_stream_t* stream = mongoc_stream_gridfs_new(gfile);
-    // Set 10 milliseconds for timeout
-    vint flag = mongoc_stream_readv(stream, &iov, 1, -1, 10);
     mongoc_stream_destroy(stream);
+    if (NULL != gfile) { mongoc_gridfs_file_destroy(gfile); }
+    if (cache_file.is_open()) {
+        cache_file.close();
+        if (read_ok && !cache_file.fail()) {
+            cache_->Commit(cache_key, cache_temp);
+        } else {
+            utils_filesystem::DeleteExistedFile(cache_temp);
+        }
+    }
+    return read_ok;
+}
+
+/*!
+ * The legacy GridFS file is used since the download stream of GridFS bucket cannot seek,
+ *   both of them share the same files and chunks collections.
+ *   Seeking a GridFS file only fetches the chunks covering the following reading.
+ */
+bool MongoGridFs::ReadStreamRanges(string const& gfilename, const vector<std::pair<vint, vint> >& ranges,
+                                   const std::function<bool(size_t idx, const char* data, vint size)>& on_range,
+                                   mongoc_gridfs_t* gfs /* = NULL */,
+                                   const STRING_MAP* opts /* = nullptr */) {
+    STRING_MAP opts_temp;
+    if (nullptr == opts) {
+        opts = &opts_temp;
+    }
+    if (gfs_ != NULL) { gfs = gfs_; }
+    if (NULL == gfs) {
+        StatusMessage("mongoc_gridfs_t must be provided for MongoGridFs!");
+        return false;
+    }
+    mongoc_gridfs_file_t* gfile = GetFile(gfilename, gfs, *opts);
+    if (NULL == gfile) { return false; }
+    vint length = mongoc_gridfs_file_get_length(gfile);
+    MappedFile cached;
+    bool hit = nullptr != cache_
+            && cache_->Lookup(GridFsCacheKey(mongoc_gridfs_file_get_id(gfile),
+                                             mongoc_gridfs_file_get_upload_date(gfile), length), cached)
+            && cached.Size() == length;
+    vector<char> buf;
+    bool read_ok = true;
+    for (size_t i = 0; i < ranges.size() && read_ok; i++) {
+        vint offset = ranges[i].first;
+        vint size = ranges[i].second;
+        if (offset < 0 || size < 0 || offset + size > length) {
+            StatusMessage(("MongoGridFs::ReadStreamRanges(" + gfilename + ") out of range!").c_str());
+            read_ok = false;
+            break;
+        }
+        if (hit) {
+            read_ok = on_range(i, cached.Data() + offset, size);
+            continue;
+        }
+        buf.resize(CVT_SIZET(Max(size, CVT_VINT(1))));
+        if (mongoc_gridfs_file_seek(gfile, offset, SEEK_SET) != 0) {
+            read_ok = false;
+            break;
+        }
+        vint nread = 0;
+        int retry = 0;
+        while (nread < size) {
+            mongoc_iovec_t iov;
+            iov.iov_base = buf.data() + nread;
+            iov.iov_len = static_cast<u_long>(size - nread);
+            ssize_t r = mongoc_gridfs_file_readv(gfile, &iov, 1, CVT_SIZET(size - nread), 0);
+            if (r <= 0) {
+                if (++retry > 3) { break; }
+                SleepMs(2);
+                continue;
+            }
+            nread += CVT_VINT(r);
+        }
+        bson_error_t err;
+        if (nread != size || mongoc_gridfs_file_error(gfile, &err)) {
+            StatusMessage(("MongoGridFs::ReadStreamRanges(" + gfilename + ") failed!").c_str());
+            read_ok = false;
+            break;
+        }
+        read_ok = on_range(i, buf.data(), size);
+    }
     mongoc_gridfs_file_destroy(gfile);
-    return flag >= 0;
+    return read_ok;
 }
 
 bool MongoGridFs::WriteStreamData(const string& gfilename, char*& buf,
                                   vint length, const bson_t* p,
                                   mongoc_gridfs_t* gfs /* = NULL */) {
+    vint offset = 0;
+    return WriteStreamChunks(gfilename, p,
+                             [&buf, &offset, length](char* chunk, const vint capacity) {
+                                 vint len = Min(capacity, length - offset);
+                                 if (len > 0) { memcpy(chunk, buf + offset, CVT_SIZET(len)); }
+                                 offset += len;
+                                 return len;
+                             }, nullptr, gfs);
+}
+
+bool MongoGridFs::WriteStreamChunks(const string& gfilename, const bson_t* p,
+                                    const std::function<vint(char* buf, vint capacity)>& producer,
+                                    const STRING_MAP* replace_opts /* = nullptr */,
+                                    mongoc_gridfs_t* gfs /* = NULL */) {
+    EraseCachedFile(gfilename);
+    vector<char> chunk(GRIDFS_CHUNK_SIZE);
+    bool saved = true;
+    bson_error_t err;
+    err.message[0] = '\0';
+#ifdef USE_GRIDFS_BUCKET
+    if (bucket_ != NULL) {
+        vector<bson_t*> replaced;
+        if (nullptr != replace_opts) { FindFiles(gfilename, *replace_opts, replaced); }
+        bson_t upload_opts = BSON_INITIALIZER;
+        if (nullptr != p) { BSON_APPEND_DOCUMENT(&upload_opts, "metadata", p); }
+        BSON_APPEND_INT32(&upload_opts, "chunkSizeBytes", GRIDFS_CHUNK_SIZE);
+        bson_value_t file_id;
+        mongoc_stream_t* stream = mongoc_gridfs_bucket_open_upload_stream(bucket_, gfilename.c_str(),
+                                                                          &upload_opts, &file_id, &err);
+        bson_destroy(&upload_opts);
+        if (NULL == stream) {
+            saved = false;
+        } else {
+            while (true) {
+                vint len = producer(chunk.data(), CVT_VINT(chunk.size()));
+                if (len == 0) { break; }
+                if (len < 0 || mongoc_stream_write(stream, chunk.data(), CVT_SIZET(len), 0) != len) {
+                    saved = false;
+                    break;
+                }
+            }
+            if (saved) { // the files document is inserted when closing
+                saved = mongoc_stream_close(stream) == 0 && !mongoc_gridfs_bucket_stream_error(stream, &err);
+            } else {
+                mongoc_gridfs_bucket_abort_upload(stream);
+            }
+            mongoc_stream_destroy(stream);
+            bson_value_destroy(&file_id);
+        }
+        // Existing files are replaced only if the new one has been saved
+        if (saved) { saved = DeleteFiles(replaced); }
+        for (auto it = replaced.begin(); it != replaced.end(); ++it) { bson_destroy(*it); }
+        if (!saved) {
+            StatusMessage(("MongoGridFs::WriteStreamChunks(" + gfilename + ") failed! ERROR: " +
+                              err.message).c_str());
+        }
+        return saved;
+    }
+#endif
     if (gfs_ != NULL) { gfs = gfs_; }
     if (NULL == gfs) {
         StatusMessage("mongoc_gridfs_t must be provided for MongoGridFs!");
         return false;
     }
-    mongoc_gridfs_file_t* gfile = NULL;
-    bson_error_t gfileerr;
+    if (nullptr != replace_opts) { RemoveFile(gfilename, gfs, *replace_opts); }
     mongoc_gridfs_file_opt_t gopt = {0};
     gopt.filename = gfilename.c_str();
     gopt.content_type = "NumericStream";
     gopt.metadata = p;
-    gfile = mongoc_gridfs_create_file(gfs, &gopt);
-    mongoc_iovec_t ovec;
-    ovec.iov_base = buf;
-    ovec.iov_len = static_cast<u_long>(length);
+    mongoc_gridfs_file_t* gfile = mongoc_gridfs_create_file(gfs, &gopt);
     // Modifying GridFS files is NOT thread-safe. Only one thread or process
     //   can access a GridFS file while it is being modified!
-    ssize_t writesize = mongoc_gridfs_file_writev(gfile, &ovec, 1, 0);
-    bool gfilestatus = mongoc_gridfs_file_save(gfile) && // Returns true if successful
-            !mongoc_gridfs_file_error(gfile, &gfileerr); // Returns false if no registered error
-    if (writesize == -1 || !gfilestatus) { // Failed to save GridFS file data
-        StatusMessage(("MongoGridFs::WriteStreamData(" + gfilename + ") failed!" +
-                          ". ERROR: " + gfileerr.message).c_str());
+    while (true) {
+        vint len = producer(chunk.data(), CVT_VINT(chunk.size()));
+        if (len == 0) { break; }
+        mongoc_iovec_t ovec;
+        ovec.iov_base = chunk.data();
+        ovec.iov_len = static_cast<u_long>(len);
+        if (len < 0 || mongoc_gridfs_file_writev(gfile, &ovec, 1, 0) != len) {
+            saved = false;
+            break;
+        }
+    }
+    saved = saved && mongoc_gridfs_file_save(gfile) && // Returns true if successful
+            !mongoc_gridfs_file_error(gfile, &err); // Returns false if no registered error
+    if (!saved) { // Failed to save GridFS file data
+        StatusMessage(("MongoGridFs::WriteStreamChunks(" + gfilename + ") failed! ERROR: " +
+                          err.message).c_str());
     }
     mongoc_gridfs_file_destroy(gfile);
-    return gfilestatus;
+    return saved;
+}
+
+#ifdef USE_GRIDFS_BUCKET
+bool MongoGridFs::FindFiles(string const& gfilename, const STRING_MAP& opts, vector<bson_t*>& files) {
+    bson_t filter = BSON_INITIALIZER;
+    BSON_APPEND_UTF8(&filter, "filename", gfilename.c_str());
+    AppendStringOptionsToBson(&filter, opts, "metadata.");
+    mongoc_cursor_t* cursor = mongoc_gridfs_bucket_find(bucket_, &filter, NULL);
+    const bson_t* doc = NULL;
+    while (mongoc_cursor_next(cursor, &doc)) {
+        files.emplace_back(bson_copy(doc));
+    }
+    bson_error_t err;
+    bool found = !mongoc_cursor_error(cursor, &err);
+    if (!found) {
+        StatusMessage(("MongoGridFs::FindFiles(" + gfilename + ") failed: " + err.message).c_str());
+    }
+    mongoc_cursor_destroy(cursor);
+    bson_destroy(&filter);
+    return found;
+}
+
+bool MongoGridFs::DeleteFiles(const vector<bson_t*>& files) {
+    bool deleted = true;
+    for (auto it = files.begin(); it != files.end(); ++it) {
+        bson_iter_t iter;
+        if (!bson_iter_init_find(&iter, *it, "_id")) { continue; }
+        bson_error_t err;
+        // The files document and its chunks are deleted in one bucket operation
+        if (!mongoc_gridfs_bucket_delete_by_id(bucket_, bson_iter_value(&iter), &err)) {
+            StatusMessage(("MongoGridFs::DeleteFiles failed: " + string(err.message)).c_str());
+            deleted = false;
+        }
+    }
+    return deleted;
+}
+#endif
+
+///////////////////////////////////////////////////
+//////////  MongoGridFsBulkWriter  ////////////////
+///////////////////////////////////////////////////
+static const int BULK_RETRY_TIMES = 3; // retried times of each batch, as WriteStreamDataAsGridfs()
+
+MongoGridFsBulkWriter::MongoGridFsBulkWriter(MongoClient* client, string const& dbname,
+                                             string const& gfsname, const int batch_files /* = 64 */,
+                                             const vint batch_bytes /* = 16777216 */) :
+    files_(NULL), chunks_(NULL), dbname_(dbname), gfsname_(gfsname), batch_files_(Max(batch_files, 1)),
+    batch_bytes_(Max(batch_bytes, CVT_VINT(GRIDFS_CHUNK_SIZE))), pending_bytes_(0),
+    written_(0), batches_(0) {
+    if (nullptr == client) { return; }
+    // Create the GridFS and its indexes if not existed
+    mongoc_gridfs_t* gfs = client->GetGridFs(dbname, gfsname);
+    if (NULL == gfs) { return; }
+    mongoc_gridfs_destroy(gfs);
+    files_ = mongoc_client_get_collection(client->GetConn(), dbname.c_str(), (gfsname + ".files").c_str());
+    chunks_ = mongoc_client_get_collection(client->GetConn(), dbname.c_str(), (gfsname + ".chunks").c_str());
+}
+
+MongoGridFsBulkWriter::~MongoGridFsBulkWriter() {
+    Flush();
+    if (files_ != NULL) { mongoc_collection_destroy(files_); }
+    if (chunks_ != NULL) { mongoc_collection_destroy(chunks_); }
+}
+
+/*!
+ * The data is split into chunks of GRIDFS_CHUNK_SIZE bytes except the last one,
+ *   which is required by GridFS to locate chunks by offset.
+ */
+bool MongoGridFsBulkWriter::Add(string const& gfilename, const bson_t* p,
+                                const std::function<vint(char* buf, vint capacity)>& producer,
+                                const STRING_MAP* replace_opts /* = nullptr */) {
+    for (auto it = pending_.begin(); it != pending_.end(); ++it) {
+        if (it->filename == gfilename) { // the earlier one should be replaced in its own batch
+            Flush(); // failed files are reported by FailedFiles()
+            break;
+        }
+    }
+    if (NULL == files_ || NULL == chunks_) {
+        failed_.emplace_back(gfilename);
+        return false;
+    }
+    PendingFile file;
+    file.filename = gfilename;
+    bson_oid_init(&file.id, NULL);
+    file.length = 0;
+    file.metadata = nullptr == p ? nullptr : bson_copy(p);
+    file.replace = nullptr != replace_opts;
+    if (file.replace) { CopyStringMap(*replace_opts, file.replace_opts); }
+    size_t first_chunk = chunk_docs_.size();
+    buf_.resize(GRIDFS_CHUNK_SIZE);
+    bool produced = true;
+    bool end = false;
+    int n = 0;
+    while (!end) {
+        vint filled = 0;
+        while (filled < GRIDFS_CHUNK_SIZE) {
+            vint len = producer(buf_.data() + filled, GRIDFS_CHUNK_SIZE - filled);
+            if (len < 0) { produced = false; }
+            if (len <= 0) {
+                end = true;
+                break;
+            }
+            filled += len;
+        }
+        if (!produced) { break; }
+        if (filled == 0) { break; }
+        bson_t* chunk = bson_new();
+        bson_oid_t chunk_id;
+        bson_oid_init(&chunk_id, NULL);
+        BSON_APPEND_OID(chunk, "_id", &chunk_id);
+        BSON_APPEND_OID(chunk, "files_id", &file.id);
+        BSON_APPEND_INT32(chunk, "n", n++);
+        BSON_APPEND_BINARY(chunk, "data", BSON_SUBTYPE_BINARY,
+                           reinterpret_cast<const uint8_t*>(buf_.data()), static_cast<uint32_t>(filled));
+        chunk_docs_.emplace_back(chunk);
+        chunk_owner_.emplace_back(pending_.size());
+        file.length += filled;
+    }
+    if (!produced) {
+        for (size_t i = first_chunk; i < chunk_docs_.size(); i++) { bson_destroy(chunk_docs_[i]); }
+        chunk_docs_.resize(first_chunk);
+        chunk_owner_.resize(first_chunk);
+        if (nullptr != file.metadata) { bson_destroy(file.metadata); }
+        StatusMessage(("MongoGridFsBulkWriter::Add(" + gfilename + ") failed to produce data!").c_str());
+        failed_.emplace_back(gfilename);
+        return false;
+    }
+    pending_bytes_ += file.length;
+    pending_.emplace_back(file);
+    if (CVT_INT(pending_.size()) >= batch_files_ || pending_bytes_ >= batch_bytes_) {
+        size_t n_failed = failed_.size();
+        if (!Flush()) { // only the result of this file is returned
+            return std::find(failed_.begin() + n_failed, failed_.end(), gfilename) == failed_.end();
+        }
+    }
+    return true;
+}
+
+bool MongoGridFsBulkWriter::Flush() {
+    if (pending_.empty()) { return true; }
+    batches_++;
+    bson_error_t err;
+    vector<bool> file_ok(pending_.size(), true);
+    // 1. Find the replaced files by one query
+    vector<bson_t*> old_files; // _id, filename, and metadata of replaced files
+    vector<size_t> old_owner;  // index of the pending file that replaces each old file
+    bool found = true;
+    bson_t filter = BSON_INITIALIZER;
+    bson_t or_array;
+    BSON_APPEND_ARRAY_BEGIN(&filter, "$or", &or_array);
+    int n_or = 0;
+    for (auto it = pending_.begin(); it != pending_.end(); ++it) {
+        if (!it->replace) { continue; }
+        bson_t cond;
+        string key = ValueToString(n_or++);
+        BSON_APPEND_DOCUMENT_BEGIN(&or_array, key.c_str(), &cond);
+        BSON_APPEND_UTF8(&cond, "filename", it->filename.c_str());
+        AppendStringOptionsToBson(&cond, it->replace_opts, "metadata.");
+        bson_append_document_end(&or_array, &cond);
+    }
+    bson_append_array_end(&filter, &or_array);
+    if (n_or > 0) {
+        bson_t find_opts = BSON_INITIALIZER;
+        bson_t projection;
+        BSON_APPEND_DOCUMENT_BEGIN(&find_opts, "projection", &projection);
+        BSON_APPEND_INT32(&projection, "_id", 1);
+        BSON_APPEND_INT32(&projection, "filename", 1);
+        BSON_APPEND_INT32(&projection, "metadata", 1);
+        bson_append_document_end(&find_opts, &projection);
+        for (int try_times = 0; ; try_times++) {
+            mongoc_cursor_t* cursor = mongoc_collection_find_with_opts(files_, &filter, &find_opts, NULL);
+            const bson_t* doc = NULL;
+            while (mongoc_cursor_next(cursor, &doc)) {
+                bson_iter_t iter;
+                if (!bson_iter_init_find(&iter, doc, "filename") || !BSON_ITER_HOLDS_UTF8(&iter)) { continue; }
+                string filename = bson_iter_utf8(&iter, NULL);
+                // file names are unique in a batch, see Add()
+                for (size_t i = 0; i < pending_.size(); i++) {
+                    if (!pending_[i].replace || pending_[i].filename != filename) { continue; }
+                    if (MatchFileOptions(doc, pending_[i].replace_opts)) {
+                        old_files.emplace_back(bson_copy(doc));
+                        old_owner.emplace_back(i);
+                    }
+                    break;
+                }
+            }
+            found = !mongoc_cursor_error(cursor, &err);
+            mongoc_cursor_destroy(cursor);
+            if (found || try_times >= BULK_RETRY_TIMES) { break; }
+            for (auto it = old_files.begin(); it != old_files.end(); ++it) { bson_destroy(*it); }
+            old_files.clear();
+            old_owner.clear();
+            SleepMs(2 << try_times); // back off and retry
+        }
+        if (!found) {
+            StatusMessage(("MongoGridFsBulkWriter::Flush() failed to find replaced files: " +
+                              string(err.message)).c_str());
+        }
+        bson_destroy(&find_opts);
+    }
+    bson_destroy(&filter);
+    if (!found) { // the batch fails rather than leaves duplicated files
+        for (size_t i = 0; i < file_ok.size(); i++) { file_ok[i] = false; }
+    }
+    // 2. Insert chunks
+    vector<size_t> failed_idx;
+    if (found && !BulkInsert(chunks_, chunk_docs_, failed_idx)) {
+        for (auto it = failed_idx.begin(); it != failed_idx.end(); ++it) {
+            file_ok[chunk_owner_[*it]] = false;
+        }
+    }
+    // 3. Insert files documents of the files whose chunks are all inserted
+    vector<bson_t*> file_docs;
+    vector<size_t> file_idx;
+    for (size_t i = 0; i < pending_.size() && found; i++) {
+        if (!file_ok[i]) { continue; }
+        const PendingFile& file = pending_[i];
+        bson_t* doc = bson_new();
+        BSON_APPEND_OID(doc, "_id", &file.id);
+        BSON_APPEND_INT64(doc, "length", file.length);
+        BSON_APPEND_INT32(doc, "chunkSize", GRIDFS_CHUNK_SIZE);
+        BSON_APPEND_DATE_TIME(doc, "uploadDate", static_cast<vint64_t>(time(NULL)) * 1000);
+        BSON_APPEND_UTF8(doc, "filename", file.filename.c_str());
+        if (nullptr != file.metadata) { BSON_APPEND_DOCUMENT(doc, "metadata", file.metadata); }
+        file_docs.emplace_back(doc);
+        file_idx.emplace_back(i);
+    }
+    failed_idx.clear();
+    if (!file_docs.empty() && !BulkInsert(files_, file_docs, failed_idx)) {
+        for (auto it = failed_idx.begin(); it != failed_idx.end(); ++it) {
+            file_ok[file_idx[*it]] = false;
+        }
+    }
+    for (auto it = file_docs.begin(); it != file_docs.end(); ++it) { bson_destroy(*it); }
+    // 4. Delete the files replaced by the saved ones, the others are kept as they were,
+    //    and the orphan chunks of failed files
+    bson_t old_ids = BSON_INITIALIZER; // array of _id of replaced files
+    int n_old = 0;
+    for (size_t i = 0; i < old_files.size(); i++) {
+        bson_iter_t iter;
+        if (file_ok[old_owner[i]] && bson_iter_init_find(&iter, old_files[i], "_id")) {
+            string key = ValueToString(n_old++);
+            BSON_APPEND_VALUE(&old_ids, key.c_str(), bson_iter_value(&iter));
+        }
+        bson_destroy(old_files[i]);
+    }
+    if (n_old > 0) {
+        DeleteIn(chunks_, "files_id", &old_ids);
+        DeleteIn(files_, "_id", &old_ids);
+    }
+    bson_destroy(&old_ids);
+    bson_t failed_ids = BSON_INITIALIZER;
+    int n_failed = 0;
+    for (size_t i = 0; i < pending_.size(); i++) {
+        if (file_ok[i]) {
+            written_++;
+            continue;
+        }
+        failed_.emplace_back(pending_[i].filename);
+        string key = ValueToString(n_failed++);
+        BSON_APPEND_OID(&failed_ids, key.c_str(), &pending_[i].id);
+    }
+    if (n_failed > 0) {
+        StatusMessage(("MongoGridFsBulkWriter::Flush() failed to write " + ValueToString(n_failed) +
+                          " of " + ValueToString(pending_.size()) + " files!").c_str());
+        if (found) { DeleteIn(chunks_, "files_id", &failed_ids); }
+    }
+    bson_destroy(&failed_ids);
+    // The cached files documents of the written and replaced files are stale
+    vector<string> written_names;
+    for (size_t i = 0; i < pending_.size(); i++) {
+        if (file_ok[i]) { written_names.emplace_back(pending_[i].filename); }
+    }
+    MongoGridFs::InvalidateCachedFiles(dbname_, gfsname_, written_names);
+    ClearPending();
+    return n_failed == 0;
+}
+
+/*!
+ * The failed documents are retried a few times. A duplicated key error on retry means
+ *   the document has been inserted by the former attempt whose reply was lost,
+ *   since the `_id` of each document is generated by the writer.
+ */
+bool MongoGridFsBulkWriter::BulkInsert(mongoc_collection_t* coll, const vector<bson_t*>& docs,
+                                       vector<size_t>& failed_idx) {
+    vector<size_t> remained; // indexes of documents to be inserted
+    for (size_t i = 0; i < docs.size(); i++) { remained.emplace_back(i); }
+    bson_error_t err;
+    for (int try_times = 0; !remained.empty(); try_times++) {
+        if (try_times > 0) { SleepMs(2 << (try_times - 1)); } // back off and retry
+        bson_t opts = BSON_INITIALIZER;
+        BSON_APPEND_BOOL(&opts, "ordered", false);
+        mongoc_bulk_operation_t* bulk = mongoc_collection_create_bulk_operation_with_opts(coll, &opts);
+        bson_destroy(&opts);
+        for (auto it = remained.begin(); it != remained.end(); ++it) {
+            mongoc_bulk_operation_insert(bulk, docs[*it]);
+        }
+        bson_t reply;
+        bool inserted = mongoc_bulk_operation_execute(bulk, &reply, &err) != 0;
+        vector<size_t> failed;
+        if (!inserted) {
+            bson_iter_t iter;
+            bson_iter_t errors;
+            bool located = false;
+            if (bson_iter_init_find(&iter, &reply, "writeErrors") && BSON_ITER_HOLDS_ARRAY(&iter)
+                && bson_iter_recurse(&iter, &errors)) {
+                while (bson_iter_next(&errors)) {
+                    bson_iter_t index;
+                    bson_iter_t code;
+                    if (!BSON_ITER_HOLDS_DOCUMENT(&errors) || !bson_iter_recurse(&errors, &index)
+                        || !bson_iter_find(&index, "index")) {
+                        continue;
+                    }
+                    vint idx = -1;
+                    GetNumericFromBsonIterator(&index, idx);
+                    if (idx < 0 || idx >= CVT_VINT(remained.size())) { continue; }
+                    located = true;
+                    int err_code = 0;
+                    if (bson_iter_recurse(&errors, &code) && bson_iter_find(&code, "code")) {
+                        GetNumericFromBsonIterator(&code, err_code);
+                    }
+                    if (try_times > 0 && err_code == 11000) { continue; } // duplicated key
+                    failed.emplace_back(remained[CVT_SIZET(idx)]);
+                }
+            }
+            if (!located) { failed = remained; } // e.g., network error, all documents are regarded as failed
+        }
+        bson_destroy(&reply);
+        mongoc_bulk_operation_destroy(bulk);
+        remained.swap(failed);
+        if (try_times >= BULK_RETRY_TIMES) { break; }
+    }
+    if (remained.empty()) { return true; }
+    StatusMessage(("MongoGridFsBulkWriter bulk insert failed: " + string(err.message)).c_str());
+    failed_idx.insert(failed_idx.end(), remained.begin(), remained.end());
+    return false;
+}
+
+bool MongoGridFsBulkWriter::DeleteIn(mongoc_collection_t* coll, const char* key, const bson_t* ids) {
+    bson_t selector = BSON_INITIALIZER;
+    bson_t in_doc;
+    BSON_APPEND_DOCUMENT_BEGIN(&selector, key, &in_doc);
+    BSON_APPEND_ARRAY(&in_doc, "$in", ids);
+    bson_append_document_end(&selector, &in_doc);
+    bson_error_t err;
+    bool deleted = mongoc_collection_delete_many(coll, &selector, NULL, NULL, &err);
+    if (!deleted) {
+        StatusMessage(("MongoGridFsBulkWriter failed to delete: " + string(err.message)).c_str());
+    }
+    bson_destroy(&selector);
+    return deleted;
+}
+
+void MongoGridFsBulkWriter::ClearPending() {
+    for (auto it = pending_.begin(); it != pending_.end(); ++it) {
+        if (nullptr != it->metadata) { bson_destroy(it->metadata); }
+    }
+    for (auto it = chunk_docs_.begin(); it != chunk_docs_.end(); ++it) { bson_destroy(*it); }
+    pending_.clear();
+    chunk_docs_.clear();
+    chunk_owner_.clear();
+    pending_bytes_ = 0;
+}
+
+///////////////////////////////////////////////////
+//////////  MongoGridFsAsyncWriter  ///////////////
+///////////////////////////////////////////////////
+MongoGridFsAsyncWriter::MongoGridFsAsyncWriter(MongoGridFs* gfs, const vint max_bytes /* = 268435456 */,
+                                               const int max_buffers /* = 4 */) :
+    gfs_(gfs), max_bytes_(Max(max_bytes, CVT_VINT(0))), max_buffers_(CVT_SIZET(Max(max_buffers, 0))),
+    unfinished_bytes_(0), unfinished_(0), failed_(false), failed_count_(0), stop_(false) {
+    if (nullptr == gfs_) {
+        StatusMessage("MongoGridFs must be provided for MongoGridFsAsyncWriter!");
+    }
+    thread_ = std::thread(&MongoGridFsAsyncWriter::Run, this);
+}
+
+MongoGridFsAsyncWriter::~MongoGridFsAsyncWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    queued_.notify_all();
+    if (thread_.joinable()) { thread_.join(); }
+}
+
+std::shared_future<bool> MongoGridFsAsyncWriter::Submit(const WriteTask& task, const vint bytes) {
+    QueuedTask queued;
+    queued.task = task;
+    queued.bytes = Max(bytes, CVT_VINT(0));
+    std::shared_future<bool> status = queued.status.get_future().share();
+    if (nullptr == gfs_ || !task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            failed_ = true;
+            failed_count_++;
+        }
+        queued.status.set_value(false);
+        return status;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    // A task is always admitted if no task is unfinished, even if its data exceeds the limit
+    finished_.wait(lock, [this, &queued] {
+        return unfinished_ == 0 || unfinished_bytes_ + queued.bytes <= max_bytes_;
+    });
+    unfinished_bytes_ += queued.bytes;
+    unfinished_++;
+    queue_.push_back(std::move(queued));
+    lock.unlock();
+    queued_.notify_one();
+    return status;
+}
+
+bool MongoGridFsAsyncWriter::Flush() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    finished_.wait(lock, [this] { return unfinished_ == 0; });
+    bool succeed = !failed_;
+    failed_ = false;
+    return succeed;
+}
+
+/*!
+ * The smallest released buffer that is large enough is reused,
+ *   otherwise a new buffer is allocated.
+ */
+vector<char> MongoGridFsAsyncWriter::AcquireBuffer(const size_t bytes) {
+    vector<char> buf;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t best = buffers_.size();
+        for (size_t i = 0; i < buffers_.size(); i++) {
+            if (buffers_[i].capacity() < bytes) { continue; }
+            if (best == buffers_.size() || buffers_[i].capacity() < buffers_[best].capacity()) {
+                best = i;
+            }
+        }
+        if (best < buffers_.size()) {
+            buf.swap(buffers_[best]);
+            buffers_.erase(buffers_.begin() + best);
+        }
+    }
+    buf.resize(bytes);
+    return buf;
+}
+
+void MongoGridFsAsyncWriter::ReleaseBuffer(vector<char>& buf) {
+    vector<char> released;
+    released.swap(buf);
+    released.clear();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (buffers_.size() < max_buffers_) {
+        buffers_.emplace_back(std::move(released));
+    }
+}
+
+vint MongoGridFsAsyncWriter::FailedCount() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return failed_count_;
+}
+
+/*!
+ * Tasks are written in the order of submission. The queue is drained before
+ *   the thread stops, hence no submitted task is dropped by the destructor.
+ * A task that throws is reported as failed, which keeps the thread running.
+ */
+void MongoGridFsAsyncWriter::Run() {
+    while (true) {
+        QueuedTask current;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            queued_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+            if (queue_.empty()) { return; }
+            current = std::move(queue_.front());
+            queue_.pop_front();
+        }
+        bool succeed = false;
+        try {
+            succeed = current.task(gfs_);
+        } catch (std::exception& ex) {
+            StatusMessage(("Write task of MongoGridFsAsyncWriter failed: " + string(ex.what())).c_str());
+        } catch (...) {
+            StatusMessage("Write task of MongoGridFsAsyncWriter failed by an unknown exception!");
+        }
+        current.task = nullptr; // release data held by the task before it is reported finished
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            unfinished_bytes_ -= current.bytes;
+            unfinished_--;
+            if (!succeed) {
+                failed_ = true;
+                failed_count_++;
+            }
+        }
+        current.status.set_value(succeed);
+        finished_.notify_all();
+    }
 }
 
 ///////////////////////////////////////////////////
@@ -486,20 +1705,22 @@ bool MongoGridFs::WriteStreamData(const string& gfilename, char*& buf,
 void AppendStringOptionsToBson(bson_t* bson_opts, const STRING_MAP& opts,
                                const string& prefix /* = string() */) {
     if (opts.empty()) { return; }
+    string meta_field;
     for (auto iter = opts.begin(); iter != opts.end(); ++iter) {
-        string meta_field;
-        if (prefix.empty()) { meta_field = iter->first; }
-        else { meta_field = prefix + iter->first; }
-        bool is_dbl = false;
-        double dbl_value = IsDouble(iter->second, is_dbl);
-        if (StringMatch("", iter->second) || !is_dbl) {
-            BSON_APPEND_UTF8(bson_opts, meta_field.c_str(), iter->second.c_str());
+        const char* field = iter->first.c_str();
+        if (!prefix.empty()) {
+            meta_field = prefix + iter->first;
+            field = meta_field.c_str();
+        }
+        double dbl_value = 0.;
+        if (!OptionToDouble(iter->second, dbl_value)) {
+            BSON_APPEND_UTF8(bson_opts, field, iter->second.c_str());
         } else {
             double intpart; // https://stackoverflow.com/a/1521682/4837280
             if (std::modf(dbl_value, &intpart) == 0.0) {
-                BSON_APPEND_INT32(bson_opts, meta_field.c_str(), CVT_INT(dbl_value));
+                BSON_APPEND_INT32(bson_opts, field, CVT_INT(dbl_value));
             } else {
-                BSON_APPEND_DOUBLE(bson_opts, meta_field.c_str(), dbl_value);
+                BSON_APPEND_DOUBLE(bson_opts, field, dbl_value);
             }
         }
     }
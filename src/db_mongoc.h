@@ -19,10 +19,26 @@
 #include <vector>
 #include <map>
 #include <iostream>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <future>
+#include <deque>
+#include <functional>
+#include <memory>
 
 #include <mongoc.h>
 
 #include "basic.h"
+#include "utils_filesystem.h"
+
+/// GridFS bucket API (`mongoc_gridfs_bucket_t`) is available from mongo-c-driver 1.15.0
+#if MONGOC_CHECK_VERSION(1, 15, 0)
+#define USE_GRIDFS_BUCKET
+#endif
+
+/// Default chunk size of GridFS in bytes, i.e., 255 KB
+#define GRIDFS_CHUNK_SIZE 261120
 
 using std::string;
 using std::vector;
@@ -37,6 +53,9 @@ namespace ccgl {
  * see <a href="http://mongoc.org/">MongoDB C Driver</a> for more information.
  */
 namespace db_mongoc {
+using utils_filesystem::LocalFileCache;
+using utils_filesystem::MappedFile;
+
 class MongoGridFs;
 
 /*!
@@ -72,7 +91,12 @@ public:
     /*! Get `mongoc_gridfs_t` instance */
     mongoc_gridfs_t* GetGridFs(string const& dbname, string const& gfsname);
 
-    /*! Get MongoGridFs instance */
+#ifdef USE_GRIDFS_BUCKET
+    /*! Get `mongoc_gridfs_bucket_t` instance, which shares collections with `GetGridFs()` */
+    mongoc_gridfs_bucket_t* GetGridFsBucket(string const& dbname, string const& gfsname);
+#endif
+
+    /*! Get MongoGridFs instance, with GridFS bucket if available */
     MongoGridFs* GridFs(string const& dbname, string const& gfsname);
 
     /*! Get existing database names */
@@ -90,6 +114,103 @@ private:
     mongoc_client_t* conn_; ///< Instance of `mongoc_client_t`
 };
 
+/*!
+ * \struct MongoPoolMetrics
+ * \brief Sizing and wait-time metrics of MongoClientPool
+ */
+struct MongoPoolMetrics {
+    MongoPoolMetrics() : max_size(0), checked_out(0), peak_checked_out(0),
+                         checkouts(0), waited(0), total_wait(0.), max_wait(0.) {}
+    int max_size;         ///< Maximum number of clients, 0 means the default of the driver
+    int checked_out;      ///< Number of clients currently checked out
+    int peak_checked_out; ///< Peak number of clients checked out at the same time
+    vint checkouts;       ///< Number of checkouts
+    vint waited;          ///< Number of checkouts that waited for a free client
+    double total_wait;    ///< Total time (seconds) waited for clients
+    double max_wait;      ///< Maximum time (seconds) waited by one checkout
+};
+
+/*!
+ * \class MongoClientPool
+ * \brief A thread-safe pool of MongoDB clients based on `mongoc_client_pool_t`.
+ *
+ *        Each thread checks out its own client by MongoPooledClient, while
+ *        MongoClient remains for single-threaded usage.
+ */
+class MongoClientPool: NotCopyable {
+public:
+    /*! Constructor using `mongoc_uri_t`, which is copied */
+    MongoClientPool(const mongoc_uri_t* uri, int max_size = 0);
+
+    /*! Initialization of MongoClientPool with the validation check of database */
+    static MongoClientPool* Init(const char* host, vuint16_t port, int max_size = 0);
+
+    /*! Initialization of MongoClientPool by `mongoc_uri_t`, e.g., of an existing client */
+    static MongoClientPool* Init(const mongoc_uri_t* uri, int max_size = 0);
+
+    /*! Destructor, all clients MUST have been pushed back */
+    ~MongoClientPool();
+
+    /*! Pop a client, wait if the pool is exhausted. Use MongoPooledClient instead if possible */
+    mongoc_client_t* Pop();
+
+    /*! Try to pop a client without waiting, return NULL if the pool is exhausted */
+    mongoc_client_t* TryPop();
+
+    /*! Push a client popped before back to the pool */
+    void Push(mongoc_client_t* conn);
+
+    /*! Get the snapshot of metrics */
+    MongoPoolMetrics GetMetrics();
+
+private:
+    /*! Update metrics of a checkout */
+    void RecordCheckout(double wait_time);
+
+    mongoc_uri_t* uri_;           ///< URI of MongoDB
+    mongoc_client_pool_t* pool_;  ///< Instance of `mongoc_client_pool_t`
+    MongoPoolMetrics metrics_;    ///< Sizing and wait-time metrics
+    std::mutex metrics_mutex_;    ///< Mutex of metrics
+};
+
+/*!
+ * \class MongoPooledClient
+ * \brief RAII checkout of a client from MongoClientPool, the client and
+ *        GridFS handles got from it are returned to the pool on destruction.
+ *
+ * \code
+ *   #pragma omp parallel
+ *   {
+ *       MongoPooledClient client(pool);
+ *       MongoGridFs* gfs = client.GridFs(dbname, gfsname);
+ *       // use gfs in current thread, do NOT delete it
+ *   }
+ * \endcode
+ */
+class MongoPooledClient: NotCopyable {
+public:
+    /*! Check out a client, wait if the pool is exhausted */
+    explicit MongoPooledClient(MongoClientPool* pool);
+
+    /*! Destroy GridFS handles and check in the client */
+    ~MongoPooledClient();
+
+    /*! Get the checked out `mongoc_client_t` instance */
+    mongoc_client_t* GetConn() { return conn_; }
+
+    /*! Get the wrapper of the checked out client, which MUST not be destroyed */
+    MongoClient* Client() { return client_; }
+
+    /*! Get MongoGridFs instance owned by current checkout */
+    MongoGridFs* GridFs(string const& dbname, string const& gfsname);
+
+private:
+    MongoClientPool* pool_;         ///< Pool of the checked out client
+    mongoc_client_t* conn_;         ///< Checked out `mongoc_client_t`
+    MongoClient* client_;           ///< Wrapper of conn_
+    vector<MongoGridFs*> gridfs_;   ///< GridFS handles created by current checkout
+};
+
 /*!
  * \class MongoDatabase
  * \brief A simple wrapper of the class of MongoDB database `mongoc_database_t`.
@@ -134,6 +255,17 @@ private:
     mongoc_collection_t* collection_; ///< Instance of `mongoc_collection_t`
 };
 
+/*!
+ * \brief Brief information of a GridFS file from its files document
+ */
+struct GridFsFileInfo {
+    string filename;                  ///< File name
+    vint length;                      ///< Data size (bytes)
+    vint chunk_size;                  ///< Chunk size (bytes)
+    vint64_t upload_date;             ///< Upload date, milliseconds since epoch
+    std::shared_ptr<bson_t> metadata; ///< Metadata, nullptr if not existed
+};
+
 /*!
  * \class MongoGridFs
  * \brief A simple wrapper of the class of MongoDB database `mongoc_gridfs_t`.
@@ -143,12 +275,47 @@ public:
     /*! Constructor by a `mongoc_gridfs_t` pointer or NULL */
     explicit MongoGridFs(mongoc_gridfs_t* gfs = NULL);
 
+#ifdef USE_GRIDFS_BUCKET
+    /*! Constructor by a `mongoc_gridfs_t` pointer and the GridFS bucket of the same collections */
+    MongoGridFs(mongoc_gridfs_t* gfs, mongoc_gridfs_bucket_t* bucket);
+#endif
+
     /*! Destructor */
     ~MongoGridFs();
 
     /*! Get the current instance of `mongoc_gridfs_t` */
     mongoc_gridfs_t* GetGridFs() { return gfs_; }
 
+    /*! Set names of database and GridFS, which are used to open the same GridFS by other clients */
+    void SetNames(string const& dbname, string const& gfsname) {
+        dbname_ = dbname;
+        gfsname_ = gfsname;
+    }
+
+    /*! Get name of database, empty if unknown */
+    const string& GetDbName() const { return dbname_; }
+
+    /*! Get name of GridFS, empty if unknown */
+    const string& GetGfsName() const { return gfsname_; }
+
+    /*!
+     * \brief Set the local cache of GridFS files, nullptr means no cache.
+     *
+     *        Files read entirely are cached by their `_id`, upload date, and length, hence
+     *        a replaced file is never read from the stale entry. Only the files document is
+     *        queried on hit, and the cached data is memory-mapped instead of fetching chunks.
+     *        The cache MUST live longer than the handle, and can be shared by handles.
+     */
+    void SetLocalCache(LocalFileCache* cache) { cache_ = cache; }
+
+    /*! Get the local cache of GridFS files, may be nullptr */
+    LocalFileCache* GetLocalCache() { return cache_; }
+
+#ifdef USE_GRIDFS_BUCKET
+    /*! Get the current instance of `mongoc_gridfs_bucket_t`, may be NULL */
+    mongoc_gridfs_bucket_t* GetBucket() { return bucket_; }
+#endif
+
     /*! Get GridFS file by name */
     mongoc_gridfs_file_t* GetFile(string const& gfilename, mongoc_gridfs_t* gfs = NULL,
                                   const STRING_MAP& opts = STRING_MAP());
@@ -165,20 +332,309 @@ public:
     bson_t* GetFileMetadata(string const& gfilename, mongoc_gridfs_t* gfs = NULL,
                             STRING_MAP opts = STRING_MAP());
 
+    /*!
+     * \brief Get information of GridFS files by one projected query, i.e., `_id`, filename, length,
+     *        chunkSize, uploadDate, and metadata, which are also cached to serve GetFile(),
+     *        GetFileMetadata(), HasFile(), and ReadStreamChunks() in the time to live if enabled.
+     * \param[in] gfilenames File names, all files of the names are fetched regardless of opts
+     * \param[out] infos Information of files matching opts in the order of names,
+     *                   files not existed are omitted
+     * \param[in] opts Optional key-value stored in metadata, used to filter GridFs file
+     * \param[in] cache_absent Also cache the names not existed, so that the following lookups
+     *                         of them return not existed without querying, e.g., for a prefetch
+     *                         of all inputs of a job. Otherwise, only existing files are cached.
+     * \return false if the query failed
+     */
+    bool GetFilesInfo(const vector<string>& gfilenames, vector<GridFsFileInfo>& infos,
+                      const STRING_MAP& opts = STRING_MAP(), bool cache_absent = false);
+
+    /*! Check the GridFS file exists, served by the metadata cache if possible */
+    bool HasFile(string const& gfilename, const STRING_MAP& opts = STRING_MAP());
+
+    /*!
+     * \brief Set time to live (milliseconds) of the cached files documents, 0 (default) disables
+     *        the cache. Files written or removed by this handle are always refreshed, but files
+     *        changed by others are not visible until the cached documents expire.
+     *        Files written by MongoGridFsBulkWriter are refreshed in handles of the same
+     *        database and GridFS names, \sa InvalidateCachedFiles().
+     *        The cache is guarded by a mutex, whereas a MongoGridFs instance itself is not
+     *        intended to be used by multiple threads concurrently.
+     */
+    void SetMetadataCacheTtl(int ttl_ms);
+
+    /*!
+     * \brief Drop the cached files documents of the file names in all handles whose metadata cache
+     *        is enabled and names are the same, \sa SetNames(). Handles without names are not affected.
+     */
+    static void InvalidateCachedFiles(string const& dbname, string const& gfsname,
+                                      const vector<string>& gfilenames);
+
+    /*! Clear the cached files documents */
+    void ClearMetadataCache();
+
     /*! Get stream data of a given GridFS file name */
     bool GetStreamData(string const& gfilename, char*& databuf, vint& datalength,
                        mongoc_gridfs_t* gfs = NULL,
                        const STRING_MAP* opts = nullptr);
 
+    /*!
+     * \brief Read a GridFS file chunk by chunk without buffering the entire file,
+     *        the local cache is used and populated if set
+     * \param[in] gfilename GridFS file name
+     * \param[in] on_open Invoked with metadata and length (bytes) before reading, return false to stop
+     * \param[in] on_chunk Invoked with each chunk and its offset (bytes) in file, return false to stop
+     * \param[in] gfs `mongoc_gridfs_t` used if current instance has none
+     * \param[in] opts Optional key-value stored in metadata, used to filter GridFs file
+     * \param[in] timeout_ms Timeout (milliseconds) of the entire reading, 0 means no limit
+     * \return true if the declared length has been read and consumed
+     */
+    bool ReadStreamChunks(string const& gfilename,
+                          const std::function<bool(const bson_t* metadata, vint length)>& on_open,
+                          const std::function<bool(const char* chunk, vint size, vint offset)>& on_chunk,
+                          mongoc_gridfs_t* gfs = NULL, const STRING_MAP* opts = nullptr,
+                          int timeout_ms = 0);
+
+    /*!
+     * \brief Read byte ranges of a GridFS file, only the chunks covering the ranges are fetched.
+     *        The ranges are read from the local cache if the entire file has been cached.
+     * \param[in] gfilename GridFS file name
+     * \param[in] ranges Offset and length (bytes) of each range, ascending offsets are preferred
+     * \param[in] on_range Invoked with the index of range and its data, return false to stop
+     * \param[in] gfs `mongoc_gridfs_t` used if current instance has none
+     * \param[in] opts Optional key-value stored in metadata, used to filter GridFs file
+     * \return true if all ranges have been read and consumed
+     */
+    bool ReadStreamRanges(string const& gfilename, const vector<std::pair<vint, vint> >& ranges,
+                          const std::function<bool(size_t idx, const char* data, vint size)>& on_range,
+                          mongoc_gridfs_t* gfs = NULL, const STRING_MAP* opts = nullptr);
+
     /*! Write stream data to a GridFS file */
     bool WriteStreamData(const string& gfilename, char*& buf, vint length,
                          const bson_t* p, mongoc_gridfs_t* gfs = NULL);
 
+    /*!
+     * \brief Write a GridFS file chunk by chunk without buffering the entire file
+     * \param[in] gfilename GridFS file name
+     * \param[in] p Metadata
+     * \param[in] producer Fill the buffer with at most `capacity` bytes and return the bytes filled,
+     *                     0 means the end of data and negative means failure
+     * \param[in] replace_opts If not nullptr, existing files of the same name and metadata
+     *                         matched by replace_opts are replaced after the file is saved
+     * \param[in] gfs `mongoc_gridfs_t` used if current instance has none
+     * \return true if all data produced are saved
+     */
+    bool WriteStreamChunks(const string& gfilename, const bson_t* p,
+                           const std::function<vint(char* buf, vint capacity)>& producer,
+                           const STRING_MAP* replace_opts = nullptr, mongoc_gridfs_t* gfs = NULL);
+
 private:
+    /*! Cached files documents of a file name */
+    struct CachedFiles {
+        double fetched;                            ///< Time of fetching, \sa TimeCounting()
+        vector<std::shared_ptr<bson_t> > files;    ///< Files documents, empty means not existed
+    };
+
+    /*!
+     * \brief Find the cached files document of the file name and metadata
+     * \param[out] file The first matched files document, nullptr if not existed
+     * \return false if not cached or expired
+     */
+    bool FindCachedFile(string const& gfilename, const STRING_MAP& opts,
+                        std::shared_ptr<bson_t>& file);
+
+    /*! Drop the cached files documents of the file name */
+    void EraseCachedFile(string const& gfilename);
+
+#ifdef USE_GRIDFS_BUCKET
+    /*! Find files documents of the file name and metadata, remember to destroy them after use */
+    bool FindFiles(string const& gfilename, const STRING_MAP& opts, vector<bson_t*>& files);
+
+    /*! Delete files by the _id in files documents */
+    bool DeleteFiles(const vector<bson_t*>& files);
+#endif
+
     mongoc_gridfs_t* gfs_; ///< Instance of `mongoc_gridfs_t`
+#ifdef USE_GRIDFS_BUCKET
+    mongoc_gridfs_bucket_t* bucket_; ///< Instance of `mongoc_gridfs_bucket_t`
+#endif
+    string dbname_; ///< Name of database
+    string gfsname_; ///< Name of GridFS
+    LocalFileCache* cache_; ///< Local cache of GridFS files, not owned
+    int meta_ttl_ms_; ///< Time to live of cached files documents, 0 means disabled
+    map<string, CachedFiles> meta_cache_; ///< Cached files documents by file name
+    std::mutex meta_mutex_; ///< Guard of meta_cache_
+};
+
+/*!
+ * \class MongoGridFsBulkWriter
+ * \brief Write many small GridFS files by batches, each batch costs a few bulk operations,
+ *        i.e., finding the replaced files, inserting chunks, inserting files documents,
+ *        and deleting the replaced files and their chunks.
+ *
+ *        The files documents are inserted after their chunks, and the replaced files are deleted
+ *        after the new files are inserted, hence a file is always readable once it is visible.
+ *        Failed operations of a batch are retried a few times with backoff, and the cached files
+ *        documents of the written files are dropped, \sa MongoGridFs::InvalidateCachedFiles().
+ *        `mongoc_client_t` is not thread-safe, use one writer per client in concurrent writing.
+ */
+class MongoGridFsBulkWriter: NotCopyable {
+public:
+    /*!
+     * \brief Constructor
+     * \param[in] client MongoDB client, which MUST live longer than the writer
+     * \param[in] dbname Database name
+     * \param[in] gfsname GridFS name
+     * \param[in] batch_files Maximum files number of each batch
+     * \param[in] batch_bytes Maximum data size (bytes) of each batch, i.e., 16 MB by default
+     */
+    MongoGridFsBulkWriter(MongoClient* client, string const& dbname, string const& gfsname,
+                          int batch_files = 64, vint batch_bytes = 16777216);
+
+    /*! Destructor, the pending files are flushed */
+    ~MongoGridFsBulkWriter();
+
+    /*!
+     * \brief Add a file to the current batch, which is flushed once it is full
+     * \param[in] gfilename GridFS file name
+     * \param[in] p Metadata, which is copied
+     * \param[in] producer Fill the buffer with at most `capacity` bytes and return the bytes filled,
+     *                     0 means the end of data and negative means failure
+     * \param[in] replace_opts If not nullptr, existing files of the same name and metadata
+     *                         matched by replace_opts are replaced
+     * \return false if the file cannot be added, e.g., the data cannot be produced, or it failed
+     *         in the batch flushed meanwhile. Other failed files are reported by FailedFiles().
+     */
+    bool Add(string const& gfilename, const bson_t* p,
+             const std::function<vint(char* buf, vint capacity)>& producer,
+             const STRING_MAP* replace_opts = nullptr);
+
+    /*! Write the pending files, return false if any file failed */
+    bool Flush();
+
+    /*! Names of failed files */
+    const vector<string>& FailedFiles() const { return failed_; }
+
+    /*! Number of files written */
+    vint WrittenCount() const { return written_; }
+
+    /*! Number of flushed batches */
+    vint BatchCount() const { return batches_; }
+
+private:
+    /*! Pending file whose chunks are in chunks_ */
+    struct PendingFile {
+        string filename;        ///< GridFS file name
+        bson_oid_t id;          ///< _id of the files document
+        vint length;            ///< Data size (bytes)
+        bson_t* metadata;       ///< Metadata, owned by the writer
+        bool replace;           ///< Replace existing files or not
+        STRING_MAP replace_opts; ///< Metadata to match the replaced files
+    };
+
+    /*!
+     * \brief Insert documents by an unordered bulk operation, the failed documents are retried
+     *        with backoff, and indexes of the finally failed documents are recorded
+     */
+    bool BulkInsert(mongoc_collection_t* coll, const vector<bson_t*>& docs, vector<size_t>& failed_idx);
+
+    /*! Delete documents whose `key` is in the values of array `ids` */
+    bool DeleteIn(mongoc_collection_t* coll, const char* key, const bson_t* ids);
+
+    /*! Release pending files and chunks */
+    void ClearPending();
+
+    mongoc_collection_t* files_;  ///< Files collection of GridFS
+    mongoc_collection_t* chunks_; ///< Chunks collection of GridFS
+    string dbname_;               ///< Name of database
+    string gfsname_;              ///< Name of GridFS
+    int batch_files_;             ///< Maximum files number of each batch
+    vint batch_bytes_;            ///< Maximum data size of each batch
+    vector<PendingFile> pending_; ///< Pending files
+    vector<bson_t*> chunk_docs_;  ///< Chunks documents of pending files
+    vector<size_t> chunk_owner_;  ///< Index of pending file of each chunk
+    vint pending_bytes_;          ///< Data size of pending files
+    vector<char> buf_;            ///< Buffer of one chunk
+    vector<string> failed_;       ///< Names of failed files
+    vint written_;                ///< Number of files written
+    vint batches_;                ///< Number of flushed batches
+};
+
+/*!
+ * \class MongoGridFsAsyncWriter
+ * \brief Write-behind of GridFS files, i.e., write tasks are queued and written in order
+ *        by a background thread, hence the callers can continue computing.
+ *
+ *        Submitting a task blocks while the data size of unfinished tasks exceeds the limit,
+ *        except that no task is unfinished (backpressure).
+ *        The GridFS handle is used by the background thread only, which MUST NOT be used by
+ *        other threads until Flush() returns or the writer is destroyed.
+ */
+class MongoGridFsAsyncWriter: NotCopyable {
+public:
+    /*! Write task by the GridFS handle, return true if succeed */
+    typedef std::function<bool(MongoGridFs* gfs)> WriteTask;
+
+    /*!
+     * \brief Constructor
+     * \param[in] gfs GridFS handle, which MUST live longer than the writer
+     * \param[in] max_bytes Maximum data size (bytes) of unfinished tasks, i.e., 256 MB by default
+     * \param[in] max_buffers Maximum number of buffers kept for reuse
+     */
+    explicit MongoGridFsAsyncWriter(MongoGridFs* gfs, vint max_bytes = 268435456,
+                                    int max_buffers = 4);
+
+    /*! Destructor, the unfinished tasks are written before the background thread stops */
+    ~MongoGridFsAsyncWriter();
+
+    /*!
+     * \brief Submit a write task, block while the data size of unfinished tasks exceeds the limit
+     * \param[in] task Write task, which is invoked by the background thread
+     * \param[in] bytes Data size (bytes) held by the task until it finishes
+     * \return Status of the task, which is ready once the task finishes.
+     *         An empty task or a writer without GridFS handle is counted as failed.
+     */
+    std::shared_future<bool> Submit(const WriteTask& task, vint bytes);
+
+    /*! Wait until all submitted tasks finish, return false if any task failed since the last flush */
+    bool Flush();
+
+    /*! Get a buffer of `bytes` size for snapshot of data, reused from the released if possible */
+    vector<char> AcquireBuffer(size_t bytes);
+
+    /*! Release a buffer to be reused, which is thread-safe and the buffer becomes empty */
+    void ReleaseBuffer(vector<char>& buf);
+
+    /*! Number of failed tasks, including the rejected and the thrown */
+    vint FailedCount();
+
+private:
+    /*! Queued write task */
+    struct QueuedTask {
+        WriteTask task;             ///< Write task
+        std::promise<bool> status;  ///< Status of the task
+        vint bytes;                 ///< Data size held by the task
+    };
+
+    /*! Loop of the background thread */
+    void Run();
+
+    MongoGridFs* gfs_;                 ///< GridFS handle
+    vint max_bytes_;                   ///< Maximum data size of unfinished tasks
+    size_t max_buffers_;               ///< Maximum number of buffers kept
+    std::deque<QueuedTask> queue_;     ///< Queued tasks
+    vint unfinished_bytes_;            ///< Data size of queued and running tasks
+    int unfinished_;                   ///< Number of queued and running tasks
+    bool failed_;                      ///< Any task failed since the last flush
+    vint failed_count_;                ///< Number of failed tasks
+    bool stop_;                        ///< Stop the background thread once the queue is empty
+    vector<vector<char> > buffers_;    ///< Released buffers to be reused
+    std::mutex mutex_;                 ///< Mutex of the queue, states, and buffers
+    std::condition_variable queued_;   ///< Notified when a task is queued or stopping
+    std::condition_variable finished_; ///< Notified when a task finishes
+    std::thread thread_;               ///< Background thread, started after all other members
 };
 
-/*! Append options to `bson_t` */
+/*! Append options to `bson_t`, the numeric strings are appended as int32 or double */
 void AppendStringOptionsToBson(bson_t* bson_opts, const STRING_MAP& opts,
                                const string& prefix = string());
 
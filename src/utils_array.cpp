@@ -2,9 +2,60 @@
 
 #include <sstream>
 #include <fstream>
+#include <atomic>
+#include <cstdlib>
+#if defined(__linux__)
+#include <sys/mman.h> // madvise
+#endif /* __linux__ */
+#if defined WINDOWS
+#include <malloc.h> // _aligned_malloc
+#endif /* WINDOWS */
 
 namespace ccgl {
 namespace utils_array {
+/*! Huge page size (2 MB) for transparent huge pages */
+static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+/*! Advise transparent huge pages for large arrays or not */
+static std::atomic<bool> transparent_huge_pages(false);
+
+void SetTransparentHugePages(const bool enable) {
+    transparent_huge_pages = enable;
+}
+
+bool TransparentHugePagesEnabled() {
+    return transparent_huge_pages;
+}
+
+void* AllocateAlignedMemory(const size_t bytes) {
+    if (bytes == 0) { return nullptr; }
+    size_t alignment = CCGL_ARRAY_ALIGNMENT;
+    bool huge_pages = transparent_huge_pages && bytes >= HUGE_PAGE_SIZE;
+    if (huge_pages) { alignment = HUGE_PAGE_SIZE; }
+    void* ptr = nullptr;
+#if defined WINDOWS
+    ptr = _aligned_malloc(bytes, alignment);
+#else
+    if (posix_memalign(&ptr, alignment, bytes) != 0) { ptr = nullptr; }
+#endif /* WINDOWS */
+    if (nullptr == ptr) { return nullptr; }
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (huge_pages) {
+        // Only an advice, the allocation is still usable if failed
+        madvise(ptr, bytes, MADV_HUGEPAGE);
+    }
+#endif /* __linux__ && MADV_HUGEPAGE */
+    return ptr;
+}
+
+void ReleaseAlignedMemory(void* ptr) {
+    if (nullptr == ptr) { return; }
+#if defined WINDOWS
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif /* WINDOWS */
+}
+
 void Output1DArrayToTxtFile(const int n, const float* data, const char* filename) {
     std::ofstream ofs(filename);
     for (int i = 0; i < n; i++) {
@@ -29,46 +80,50 @@ void Read1DArrayFromTxtFile(const char* filename, int& rows, T*& data) {
     std::ifstream ifs(filename);
     string tmp;
     ifs >> tmp >> rows;
-    data = new T[rows];
+    Initialize1DArray(rows, data, 0);
     for (int i = 0; i < rows; i++) {
         ifs >> data[i];
     }
     ifs.close();
 }
 
+/*!
+ * Read rows, and the count followed by values of each row, into one data pool with row pointers
+ *   as Initialize2DArray(T1*, int&, int&, T2**&), so that Release2DArray() matches the allocation.
+ */
 template <typename T>
-void Read2DArrayFromTxtFile(const char* filename, int& rows, T**& data) {
-    std::ifstream ifs(filename);
+void ReadIrregular2DArray(std::istream& is, int& rows, T**& data) {
     string tmp;
-    ifs >> tmp >> rows;
-    data = new T*[rows];
-    int n;
+    is >> tmp >> rows;
+    data = nullptr;
+    if (rows <= 0) { return; }
+    vector<T> values(1, static_cast<T>(rows));
     for (int i = 0; i < rows; i++) {
-        ifs >> n;
-        data[i] = new T[n + 1];
-        data[i][0] = n;
-        for (int j = 1; j <= n; j++) {
-            ifs >> data[i][j];
+        int n = 0;
+        is >> n;
+        if (n < 0) { n = 0; }
+        values.emplace_back(static_cast<T>(n));
+        for (int j = 0; j < n; j++) {
+            T value = T();
+            is >> value;
+            values.emplace_back(value);
         }
     }
+    int max_cols = 0;
+    Initialize2DArray(values.data(), rows, max_cols, data);
+}
+
+template <typename T>
+void Read2DArrayFromTxtFile(const char* filename, int& rows, T**& data) {
+    std::ifstream ifs(filename);
+    ReadIrregular2DArray(ifs, rows, data);
     ifs.close();
 }
 
 template <typename T>
 void Read2DArrayFromString(const char* s, int& rows, T**& data) {
     std::istringstream ifs(s);
-    string tmp;
-    ifs >> tmp >> rows;
-    data = new T*[rows];
-    int n;
-    for (int i = 0; i < rows; i++) {
-        ifs >> n;
-        data[i] = new T[n + 1];
-        data[i][0] = n;
-        for (int j = 1; j <= n; j++) {
-            ifs >> data[i][j];
-        }
-    }
+    ReadIrregular2DArray(ifs, rows, data);
 }
 } /* namespace: utils_array */
 
@@ -14,6 +14,7 @@
 
 #include <new> // std::nothrow
 #include <cstdarg> // variable arguments
+#include <type_traits> // std::is_pod
 #include <iostream>
 #include <vector>
 #include <sstream>
@@ -31,6 +32,56 @@ namespace ccgl {
  * \brief Array related functions include vector and pointer array.
  */
 namespace utils_array {
+#ifndef CCGL_ARRAY_ALIGNMENT
+/*! Alignment in bytes of arrays allocated by AllocateAlignedArray, i.e., cache line size */
+#define CCGL_ARRAY_ALIGNMENT 64
+#endif /* CCGL_ARRAY_ALIGNMENT */
+
+/*!
+ * \brief Allocate memory aligned to CCGL_ARRAY_ALIGNMENT
+ *
+ * If transparent huge pages are enabled by SetTransparentHugePages(), large memory
+ *   (not less than 2 MB) will be aligned to 2 MB and advised to use huge pages (Linux only).
+ *
+ * \param[in] bytes Memory size in bytes
+ * \return Pointer of the memory, nullptr if failed. MUST be released by ReleaseAlignedMemory().
+ */
+void* AllocateAlignedMemory(size_t bytes);
+
+/*!
+ * \brief Release memory allocated by AllocateAlignedMemory()
+ */
+void ReleaseAlignedMemory(void* ptr);
+
+/*!
+ * \brief Enable or disable the advice of transparent huge pages for large arrays, disabled by default
+ */
+void SetTransparentHugePages(bool enable);
+
+/*!
+ * \brief Is the advice of transparent huge pages enabled?
+ */
+bool TransparentHugePagesEnabled();
+
+/*!
+ * \brief Allocate array of POD type (e.g., numeric and pointer) aligned to CCGL_ARRAY_ALIGNMENT
+ *        without initialization
+ *
+ * Unlike Initialize1DArray(), the array is not allocated by `new[]`, and
+ *   MUST be released by ReleaseAlignedArray() rather than Release1DArray().
+ *
+ * \param[in] n Length of the array
+ * \return Pointer of the array, nullptr if failed.
+ */
+template <typename T>
+T* AllocateAlignedArray(size_t n);
+
+/*!
+ * \brief Release array allocated by AllocateAlignedArray(), and set it to nullptr
+ */
+template <typename T>
+void ReleaseAlignedArray(T*& data);
+
 /*!
  * \brief Initialize DT_Array1D data
  * \param[in] row
@@ -182,7 +233,7 @@ void Read1DArrayFromTxtFile(const char* filename, int& rows, T*& data);
  *
  * \sa Read1DArrayFromTxtFile(), Output1DArrayToTxtFile(), Output2DArrayToTxtFile()
  * \param[in] filename
- * \param[out] rows, data
+ * \param[out] rows, data Data in one pool with row pointers, MUST be released by Release2DArray()
  */
 template <typename T>
 void Read2DArrayFromTxtFile(const char* filename, int& rows, T**& data);
@@ -207,7 +258,7 @@ bool Read2DArrayFromCsvFile(const char* filename, const vector<string>* header,
  *        The size of data is rows * (rows + 1), the first element of each row is the rows.
  *
  * \param[in] s
- * \param[out] rows, data
+ * \param[out] rows, data Data in one pool with row pointers, MUST be released by Release2DArray()
  */
 template <typename T>
 void Read2DArrayFromString(const char* s, int& rows, T**& data);
@@ -340,6 +391,20 @@ public:
 
 
 /************ Implementation of template functions ******************/
+template <typename T>
+T* AllocateAlignedArray(const size_t n) {
+    static_assert(std::is_pod<T>::value, "Only arrays of POD types can be allocated aligned!");
+    return static_cast<T*>(AllocateAlignedMemory(n * sizeof(T)));
+}
+
+template <typename T>
+void ReleaseAlignedArray(T*& data) {
+    static_assert(std::is_pod<T>::value, "Only arrays of POD types can be allocated aligned!");
+    if (nullptr == data) { return; }
+    ReleaseAlignedMemory(const_cast<void*>(static_cast<const void*>(data)));
+    data = nullptr;
+}
+
 template <typename T, typename INI_T>
 bool Initialize1DArray(const int row, T*& data, const INI_T init_value) {
     if (nullptr != data) {
@@ -352,15 +417,14 @@ bool Initialize1DArray(const int row, T*& data, const INI_T init_value) {
         data = nullptr;
         return false;
     }
-    data = new(nothrow)T[row];
+    data = new(nothrow) T[row];
     if (nullptr == data) {
-        delete[] data;
         cout << "Bad memory allocated during 1D array initialization!" << endl;
-        data = nullptr;
         return false;
     }
     T init = static_cast<T>(init_value);
-#pragma omp parallel for
+    // First-touch by the same static partitioning as computing loops
+#pragma omp parallel for schedule(static)
     for (int i = 0; i < row; i++) {
         data[i] = init;
     }
@@ -373,17 +437,20 @@ bool Initialize1DArray(const int row, T*& data, INI_T* const init_data) {
         // cout << "The input 1D array pointer is not nullptr. No initialization performed!" << endl;
         return false;
     }
+    if (nullptr == init_data) {
+        cout << "The input parameter init_data MUST NOT be nullptr!" << endl;
+        return false;
+    }
+    if (row <= 0) {
+        cout << "The data length MUST be greater than 0!" << endl;
+        return false;
+    }
     data = new(nothrow) T[row];
     if (nullptr == data) {
-        delete[] data;
         cout << "Bad memory allocated during 1D array initialization!" << endl;
         return false;
     }
-    if (nullptr == init_data) {
-        cout << "The input parameter init_data MUST NOT be nullptr!" << endl;
-        return false;
-    }
-#pragma omp parallel for
+#pragma omp parallel for schedule(static)
     for (int i = 0; i < row; i++) {
         data[i] = static_cast<T>(init_data[i]);
     }
@@ -402,26 +469,25 @@ bool Initialize2DArray(const int row, const int col, T**& data, const INI_T init
     }
     data = new(nothrow) T*[row];
     if (nullptr == data) {
-        delete[] data;
         cout << "Bad memory allocated during initialize rows of the 2D array!" << endl;
         return false;
     }
-    T* pool = nullptr;
-    pool = new(nothrow) T[row * col];
+    T* pool = new(nothrow) T[CVT_SIZET(row) * col];
     if (nullptr == pool) {
-        delete[] pool;
+        delete[] data;
+        data = nullptr;
         cout << "Bad memory allocated during initialize data pool of the 2D array!" << endl;
         return false;
     }
-    // Initialize the data pool
+    // Point the row pointers to the appropriate positions in the data pool, and
+    //   first-touch the data pool by the same static partitioning of rows as computing loops
     T init = static_cast<T>(init_value);
-#pragma omp parallel for
-    for (int i = 0; i < row * col; i++) {
-        pool[i] = init;
-    }
-    // Now point the row pointers to the appropriate positions in the data pool
-    for (int i = 0; i < row; ++i, pool += col) {
-        data[i] = pool;
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < row; i++) {
+        data[i] = pool + CVT_SIZET(i) * col;
+        for (int j = 0; j < col; j++) {
+            data[i][j] = init;
+        }
     }
     return true;
 }
@@ -429,10 +495,30 @@ bool Initialize2DArray(const int row, const int col, T**& data, const INI_T init
 template <typename T, typename INI_T>
 bool Initialize2DArray(const int row, const int col, T**& data,
                        INI_T** const init_data) {
-    bool flag = Initialize2DArray(row, col, data, init_data[0][0]);
-    if (!flag) { return false; }
-#pragma omp parallel for
+    if (nullptr == init_data) {
+        cout << "The input parameter init_data MUST NOT be nullptr!" << endl;
+        return false;
+    }
+    if (row <= 0 || col <= 0) {
+        cout << "The row and col should not be less or equal to ZERO!" << endl;
+        return false;
+    }
+    if (nullptr != data) { return false; }
+    data = new(nothrow) T*[row];
+    if (nullptr == data) {
+        cout << "Bad memory allocated during initialize rows of the 2D array!" << endl;
+        return false;
+    }
+    T* pool = new(nothrow) T[CVT_SIZET(row) * col];
+    if (nullptr == pool) {
+        delete[] data;
+        data = nullptr;
+        cout << "Bad memory allocated during initialize data pool of the 2D array!" << endl;
+        return false;
+    }
+#pragma omp parallel for schedule(static)
     for (int i = 0; i < row; i++) {
+        data[i] = pool + CVT_SIZET(i) * col;
         for (int j = 0; j < col; j++) {
             data[i][j] = static_cast<T>(init_data[i][j]);
         }
@@ -444,9 +530,8 @@ template <typename T1, typename T2>
 bool Initialize2DArray(T1* init_data, int& rows, int& max_cols, T2**& data) {
     int idx = 0;
     rows = CVT_INT(init_data[idx++]);
-    data = new(nothrow) T2* [rows];
+    data = new(nothrow) T2*[rows];
     if (nullptr == data) {
-        delete[] data;
         cout << "Bad memory allocated during initialize rows of the 2D array!" << endl;
         return false;
     }
@@ -0,0 +1,512 @@
+#include "utils_codec.h"
+
+#include <cstring>
+
+#ifdef SUPPORT_OMP
+#include <omp.h>
+#endif /* SUPPORT_OMP */
+
+#include "utils_string.h"
+#include "utils_math.h"
+
+namespace ccgl {
+using namespace utils_string;
+
+namespace utils_codec {
+string CodecToString(const CodecType codec) {
+    switch (codec) {
+        case CODEC_SHUFFLE: return "SHUFFLE";
+        case CODEC_DELTA:   return "DELTA";
+        case CODEC_XOR:     return "XOR";
+        case CODEC_RLE:     return "RLE";
+        case CODEC_BITPACK: return "BITPACK";
+        default:            return "NONE";
+    }
+}
+
+CodecType StringToCodec(const string& str) {
+    if (StringMatch(str, "SHUFFLE")) { return CODEC_SHUFFLE; }
+    if (StringMatch(str, "DELTA")) { return CODEC_DELTA; }
+    if (StringMatch(str, "XOR")) { return CODEC_XOR; }
+    if (StringMatch(str, "RLE")) { return CODEC_RLE; }
+    if (StringMatch(str, "BITPACK")) { return CODEC_BITPACK; }
+    return CODEC_NONE;
+}
+
+bool ParseCodecs(const string& str, vector<CodecType>& codecs) {
+    codecs.clear();
+    if (str.empty()) { return true; }
+    vector<string> names = SplitString(str, '+');
+    for (auto it = names.begin(); it != names.end(); ++it) {
+        string name = *it;
+        TrimSpaces(name);
+        if (name.empty() || StringMatch(name, "NONE")) { continue; }
+        CodecType codec = StringToCodec(name);
+        if (codec == CODEC_NONE) { return false; }
+        if (!codecs.empty() && (codecs.back() == CODEC_RLE || codecs.back() == CODEC_BITPACK)) {
+            return false; // size-changing codec MUST be the last one
+        }
+        codecs.emplace_back(codec);
+    }
+    return true;
+}
+
+string CodecsToString(const vector<CodecType>& codecs) {
+    if (codecs.empty()) { return "NONE"; }
+    string str;
+    for (auto it = codecs.begin(); it != codecs.end(); ++it) {
+        if (!str.empty()) { str += "+"; }
+        str += CodecToString(*it);
+    }
+    return str;
+}
+
+bool CodecsApplicable(const vector<CodecType>& codecs, const size_t elem_size) {
+    if (elem_size == 0) { return false; }
+    bool int_size = elem_size == 1 || elem_size == 2 || elem_size == 4 || elem_size == 8;
+    for (auto it = codecs.begin(); it != codecs.end(); ++it) {
+        if ((*it == CODEC_DELTA || *it == CODEC_XOR || *it == CODEC_BITPACK) && !int_size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*** Element-preserving codecs, values are regarded as unsigned integers of the same size ***/
+
+template <typename U>
+void DeltaEncode(char* buf, const size_t n) {
+    U prev = 0;
+    for (size_t i = 0; i < n; i++) {
+        U v;
+        memcpy(&v, buf + i * sizeof(U), sizeof(U));
+        U d = static_cast<U>(v - prev);
+        prev = v;
+        // zigzag, i.e., small negative deltas become small unsigned integers
+        U sign = static_cast<U>(d >> (sizeof(U) * 8 - 1));
+        U zz = static_cast<U>(static_cast<U>(d << 1) ^ static_cast<U>(0 - sign));
+        memcpy(buf + i * sizeof(U), &zz, sizeof(U));
+    }
+}
+
+template <typename U>
+void DeltaDecode(char* buf, const size_t n) {
+    U prev = 0;
+    for (size_t i = 0; i < n; i++) {
+        U zz;
+        memcpy(&zz, buf + i * sizeof(U), sizeof(U));
+        U d = static_cast<U>(static_cast<U>(zz >> 1) ^ static_cast<U>(0 - static_cast<U>(zz & 1)));
+        U v = static_cast<U>(prev + d);
+        prev = v;
+        memcpy(buf + i * sizeof(U), &v, sizeof(U));
+    }
+}
+
+template <typename U>
+void XorEncode(char* buf, const size_t n) {
+    U prev = 0;
+    for (size_t i = 0; i < n; i++) {
+        U v;
+        memcpy(&v, buf + i * sizeof(U), sizeof(U));
+        U x = static_cast<U>(v ^ prev);
+        prev = v;
+        memcpy(buf + i * sizeof(U), &x, sizeof(U));
+    }
+}
+
+template <typename U>
+void XorDecode(char* buf, const size_t n) {
+    U prev = 0;
+    for (size_t i = 0; i < n; i++) {
+        U x;
+        memcpy(&x, buf + i * sizeof(U), sizeof(U));
+        U v = static_cast<U>(x ^ prev);
+        prev = v;
+        memcpy(buf + i * sizeof(U), &v, sizeof(U));
+    }
+}
+
+void ShuffleBytes(const char* src, const size_t n, const size_t elem_size, char* dst) {
+    for (size_t i = 0; i < n; i++) {
+        for (size_t b = 0; b < elem_size; b++) {
+            dst[b * n + i] = src[i * elem_size + b];
+        }
+    }
+}
+
+void UnshuffleBytes(const char* src, const size_t n, const size_t elem_size, char* dst) {
+    for (size_t i = 0; i < n; i++) {
+        for (size_t b = 0; b < elem_size; b++) {
+            dst[i * elem_size + b] = src[b * n + i];
+        }
+    }
+}
+
+/*!
+ * \brief Apply an element-preserving codec in place, scratch is used by SHUFFLE
+ */
+void ApplyElementCodec(const CodecType codec, const bool encode, const size_t elem_size,
+                       char* buf, const size_t n, vector<char>& scratch) {
+    if (codec == CODEC_SHUFFLE) {
+        if (elem_size <= 1) { return; }
+        scratch.resize(n * elem_size);
+        if (encode) { ShuffleBytes(buf, n, elem_size, scratch.data()); }
+        else { UnshuffleBytes(buf, n, elem_size, scratch.data()); }
+        memcpy(buf, scratch.data(), n * elem_size);
+        return;
+    }
+    if (codec != CODEC_DELTA && codec != CODEC_XOR) { return; }
+    bool delta = codec == CODEC_DELTA;
+    switch (elem_size) {
+        case 1:
+            if (delta) { encode ? DeltaEncode<vuint8_t>(buf, n) : DeltaDecode<vuint8_t>(buf, n); }
+            else { encode ? XorEncode<vuint8_t>(buf, n) : XorDecode<vuint8_t>(buf, n); }
+            break;
+        case 2:
+            if (delta) { encode ? DeltaEncode<vuint16_t>(buf, n) : DeltaDecode<vuint16_t>(buf, n); }
+            else { encode ? XorEncode<vuint16_t>(buf, n) : XorDecode<vuint16_t>(buf, n); }
+            break;
+        case 4:
+            if (delta) { encode ? DeltaEncode<vuint32_t>(buf, n) : DeltaDecode<vuint32_t>(buf, n); }
+            else { encode ? XorEncode<vuint32_t>(buf, n) : XorDecode<vuint32_t>(buf, n); }
+            break;
+        default:
+            if (delta) { encode ? DeltaEncode<vuint64_t>(buf, n) : DeltaDecode<vuint64_t>(buf, n); }
+            else { encode ? XorEncode<vuint64_t>(buf, n) : XorDecode<vuint64_t>(buf, n); }
+            break;
+    }
+}
+
+/*** Size-changing codecs ***/
+
+void PutVarint(vector<char>& out, vuint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<char>((v & 0x7F) | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+}
+
+bool GetVarint(const char* src, const size_t nbytes, size_t& pos, vuint64_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (pos >= nbytes) { return false; }
+        vuint8_t byte = static_cast<vuint8_t>(src[pos++]);
+        v |= static_cast<vuint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) { return true; }
+    }
+    return false;
+}
+
+/*!
+ * Tokens of runs and literals, the header of each token is a varint of (count << 1 | is_run),
+ *   followed by one value of the run or `count` literal values.
+ */
+void RleEncode(const char* src, const size_t n, const size_t elem_size, vector<char>& out) {
+    size_t lit_start = 0;
+    size_t i = 0;
+    while (i < n) {
+        size_t j = i + 1;
+        while (j < n && memcmp(src + i * elem_size, src + j * elem_size, elem_size) == 0) { j++; }
+        size_t run = j - i;
+        if (run < 3) { // too short to be a run
+            i = j;
+            continue;
+        }
+        if (lit_start < i) {
+            PutVarint(out, static_cast<vuint64_t>(i - lit_start) << 1);
+            out.insert(out.end(), src + lit_start * elem_size, src + i * elem_size);
+        }
+        PutVarint(out, static_cast<vuint64_t>(run) << 1 | 1);
+        out.insert(out.end(), src + i * elem_size, src + (i + 1) * elem_size);
+        i = j;
+        lit_start = j;
+    }
+    if (lit_start < n) {
+        PutVarint(out, static_cast<vuint64_t>(n - lit_start) << 1);
+        out.insert(out.end(), src + lit_start * elem_size, src + n * elem_size);
+    }
+}
+
+bool RleDecode(const char* src, const size_t nbytes, const size_t elem_size, char* dst, const size_t n) {
+    size_t pos = 0;
+    size_t count = 0;
+    while (pos < nbytes) {
+        vuint64_t token;
+        if (!GetVarint(src, nbytes, pos, token)) { return false; }
+        size_t len = CVT_SIZET(token >> 1);
+        if (len > n - count) { return false; }
+        if (token & 1) {
+            if (pos + elem_size > nbytes) { return false; }
+            for (size_t k = 0; k < len; k++) {
+                memcpy(dst + (count + k) * elem_size, src + pos, elem_size);
+            }
+            pos += elem_size;
+        } else {
+            if (pos + len * elem_size > nbytes) { return false; }
+            memcpy(dst + count * elem_size, src + pos, len * elem_size);
+            pos += len * elem_size;
+        }
+        count += len;
+    }
+    return count == n;
+}
+
+/*!
+ * The minimum value (frame of reference) and bits width of (value - minimum) are stored,
+ *   followed by the packed bits of all values.
+ */
+template <typename U>
+void BitpackEncode(const char* src, const size_t n, vector<char>& out) {
+    U minv = 0;
+    U maxv = 0;
+    for (size_t i = 0; i < n; i++) {
+        U v;
+        memcpy(&v, src + i * sizeof(U), sizeof(U));
+        if (i == 0 || v < minv) { minv = v; }
+        if (i == 0 || v > maxv) { maxv = v; }
+    }
+    U range = static_cast<U>(maxv - minv);
+    int width = 0;
+    while (width < CVT_INT(sizeof(U) * 8) && (range >> width) > 0) { width++; }
+    const char* pmin = reinterpret_cast<const char*>(&minv);
+    out.insert(out.end(), pmin, pmin + sizeof(U));
+    out.push_back(static_cast<char>(width));
+    vuint64_t acc = 0;
+    int nacc = 0;
+    for (size_t i = 0; i < n && width > 0; i++) {
+        U v;
+        memcpy(&v, src + i * sizeof(U), sizeof(U));
+        vuint64_t diff = static_cast<vuint64_t>(static_cast<U>(v - minv));
+        for (int written = 0; written < width;) {
+            int take = Min(width - written, 32);
+            acc |= ((diff >> written) & ((CVT_VUINT64(1) << take) - 1)) << nacc;
+            nacc += take;
+            written += take;
+            while (nacc >= 8) {
+                out.push_back(static_cast<char>(acc & 0xFF));
+                acc >>= 8;
+                nacc -= 8;
+            }
+        }
+    }
+    if (nacc > 0) { out.push_back(static_cast<char>(acc & 0xFF)); }
+}
+
+template <typename U>
+bool BitpackDecode(const char* src, const size_t nbytes, char* dst, const size_t n) {
+    if (nbytes < sizeof(U) + 1) { return false; }
+    U minv;
+    memcpy(&minv, src, sizeof(U));
+    int width = static_cast<vuint8_t>(src[sizeof(U)]);
+    if (width > CVT_INT(sizeof(U) * 8)) { return false; }
+    size_t pos = sizeof(U) + 1;
+    if (nbytes - pos < (CVT_VUINT64(n) * width + 7) / 8) { return false; }
+    vuint64_t acc = 0;
+    int nacc = 0;
+    for (size_t i = 0; i < n; i++) {
+        vuint64_t diff = 0;
+        for (int read = 0; read < width;) {
+            int take = Min(width - read, 32);
+            while (nacc < take) {
+                acc |= static_cast<vuint64_t>(static_cast<vuint8_t>(src[pos++])) << nacc;
+                nacc += 8;
+            }
+            diff |= (acc & ((CVT_VUINT64(1) << take) - 1)) << read;
+            acc >>= take;
+            nacc -= take;
+            read += take;
+        }
+        U v = static_cast<U>(minv + static_cast<U>(diff));
+        memcpy(dst + i * sizeof(U), &v, sizeof(U));
+    }
+    return true;
+}
+
+void BitpackEncode(const char* src, const size_t n, const size_t elem_size, vector<char>& out) {
+    switch (elem_size) {
+        case 1: BitpackEncode<vuint8_t>(src, n, out); break;
+        case 2: BitpackEncode<vuint16_t>(src, n, out); break;
+        case 4: BitpackEncode<vuint32_t>(src, n, out); break;
+        default: BitpackEncode<vuint64_t>(src, n, out); break;
+    }
+}
+
+bool BitpackDecode(const char* src, const size_t nbytes, const size_t elem_size, char* dst, const size_t n) {
+    switch (elem_size) {
+        case 1: return BitpackDecode<vuint8_t>(src, nbytes, dst, n);
+        case 2: return BitpackDecode<vuint16_t>(src, nbytes, dst, n);
+        case 4: return BitpackDecode<vuint32_t>(src, nbytes, dst, n);
+        default: return BitpackDecode<vuint64_t>(src, nbytes, dst, n);
+    }
+}
+
+/*** Blocks ***/
+
+/*! Store an unsigned 32-bit integer in little-endian regardless of the host */
+void PutUint32Le(char* dst, const vuint32_t v) {
+    for (size_t i = 0; i < sizeof(vuint32_t); i++) {
+        dst[i] = static_cast<char>((v >> (8 * i)) & 0xFF);
+    }
+}
+
+/*! Load an unsigned 32-bit integer stored in little-endian */
+vuint32_t GetUint32Le(const char* src) {
+    vuint32_t v = 0;
+    for (size_t i = 0; i < sizeof(vuint32_t); i++) {
+        v |= static_cast<vuint32_t>(static_cast<unsigned char>(src[i])) << (8 * i);
+    }
+    return v;
+}
+
+void PutBlockHeader(char* dst, const size_t block_bytes, const size_t raw_bytes, const bool encoded) {
+    PutUint32Le(dst, static_cast<vuint32_t>(block_bytes));
+    PutUint32Le(dst + sizeof(vuint32_t), static_cast<vuint32_t>(raw_bytes));
+    dst[2 * sizeof(vuint32_t)] = encoded ? 1 : 0;
+}
+
+bool EncodeBlock(const vector<CodecType>& codecs, const size_t elem_size,
+                 const char* src, const size_t nbytes, vector<char>& dst) {
+    if (!CodecsApplicable(codecs, elem_size) || nbytes % elem_size != 0
+        || nbytes > CVT_SIZET(UINT32_MAX) - CODEC_BLOCK_HEADER) {
+        return false;
+    }
+    size_t n = nbytes / elem_size;
+    vector<char> work(src, src + nbytes);
+    vector<char> scratch;
+    vector<char> payload;
+    bool sized = false;
+    for (auto it = codecs.begin(); it != codecs.end(); ++it) {
+        if (*it == CODEC_RLE) {
+            RleEncode(work.data(), n, elem_size, payload);
+            sized = true;
+        } else if (*it == CODEC_BITPACK) {
+            BitpackEncode(work.data(), n, elem_size, payload);
+            sized = true;
+        } else {
+            ApplyElementCodec(*it, true, elem_size, work.data(), n, scratch);
+        }
+    }
+    if (!sized) { payload.swap(work); }
+    size_t start = dst.size();
+    if (codecs.empty() || payload.size() >= nbytes) { // store raw values
+        dst.resize(start + CODEC_BLOCK_HEADER + nbytes);
+        PutBlockHeader(dst.data() + start, CODEC_BLOCK_HEADER + nbytes, nbytes, false);
+        if (nbytes > 0) { memcpy(dst.data() + start + CODEC_BLOCK_HEADER, src, nbytes); }
+        return true;
+    }
+    dst.resize(start + CODEC_BLOCK_HEADER + payload.size());
+    PutBlockHeader(dst.data() + start, CODEC_BLOCK_HEADER + payload.size(), nbytes, true);
+    memcpy(dst.data() + start + CODEC_BLOCK_HEADER, payload.data(), payload.size());
+    return true;
+}
+
+bool ParseBlockHeader(const char* src, const size_t avail, size_t& block_bytes, size_t& raw_bytes) {
+    if (avail < CODEC_BLOCK_HEADER) { return false; }
+    vuint32_t len = GetUint32Le(src);
+    vuint32_t raw_len = GetUint32Le(src + sizeof(vuint32_t));
+    if (len < CODEC_BLOCK_HEADER) { return false; }
+    block_bytes = len;
+    raw_bytes = raw_len;
+    return true;
+}
+
+bool DecodeBlock(const vector<CodecType>& codecs, const size_t elem_size,
+                 const char* src, const size_t block_bytes, char* dst, const size_t raw_bytes) {
+    size_t len = 0;
+    size_t raw_len = 0;
+    if (!ParseBlockHeader(src, block_bytes, len, raw_len) || len != block_bytes || raw_len != raw_bytes) {
+        return false;
+    }
+    const char* payload = src + CODEC_BLOCK_HEADER;
+    size_t payload_bytes = block_bytes - CODEC_BLOCK_HEADER;
+    if (src[2 * sizeof(vuint32_t)] == 0) { // raw values
+        if (payload_bytes != raw_bytes) { return false; }
+        if (raw_bytes > 0) { memcpy(dst, payload, raw_bytes); }
+        return true;
+    }
+    if (!CodecsApplicable(codecs, elem_size) || raw_bytes % elem_size != 0) { return false; }
+    size_t n = raw_bytes / elem_size;
+    size_t nelem = codecs.size();
+    if (!codecs.empty() && codecs.back() == CODEC_RLE) {
+        if (!RleDecode(payload, payload_bytes, elem_size, dst, n)) { return false; }
+        nelem--;
+    } else if (!codecs.empty() && codecs.back() == CODEC_BITPACK) {
+        if (!BitpackDecode(payload, payload_bytes, elem_size, dst, n)) { return false; }
+        nelem--;
+    } else {
+        if (payload_bytes != raw_bytes) { return false; }
+        memcpy(dst, payload, raw_bytes);
+    }
+    vector<char> scratch;
+    for (size_t i = nelem; i > 0; i--) { // inverse in reverse order
+        ApplyElementCodec(codecs[i - 1], false, elem_size, dst, n, scratch);
+    }
+    return true;
+}
+
+bool EncodeStream(const vector<CodecType>& codecs, const size_t elem_size,
+                  const char* src, const size_t nbytes, vector<char>& dst,
+                  size_t block_size /* = CODEC_BLOCK_SIZE */) {
+    if (elem_size == 0 || nbytes % elem_size != 0) { return false; }
+    block_size -= block_size % elem_size;
+    if (block_size == 0) { block_size = elem_size; }
+    for (size_t offset = 0; offset < nbytes; offset += block_size) {
+        size_t len = Min(block_size, nbytes - offset);
+        if (!EncodeBlock(codecs, elem_size, src + offset, len, dst)) { return false; }
+    }
+    return true;
+}
+
+vint DecodeStream(const vector<CodecType>& codecs, const size_t elem_size,
+                  const char* src, const size_t nbytes,
+                  const std::function<bool(const char* raw, size_t raw_offset, size_t raw_bytes)>& consumer,
+                  int nthreads /* = 0 */) {
+    // Locate blocks by their headers
+    vector<size_t> block_pos;
+    vector<size_t> raw_pos;
+    size_t pos = 0;
+    size_t raw_total = 0;
+    while (pos < nbytes) {
+        size_t block_bytes = 0;
+        size_t raw_bytes = 0;
+        if (!ParseBlockHeader(src + pos, nbytes - pos, block_bytes, raw_bytes)
+            || block_bytes > nbytes - pos) {
+            return -1;
+        }
+        block_pos.emplace_back(pos);
+        raw_pos.emplace_back(raw_total);
+        pos += block_bytes;
+        raw_total += raw_bytes;
+    }
+    block_pos.emplace_back(pos);
+    raw_pos.emplace_back(raw_total);
+    int nblocks = CVT_INT(block_pos.size()) - 1;
+#ifdef SUPPORT_OMP
+    if (nthreads <= 0) { nthreads = omp_get_max_threads(); }
+#endif /* SUPPORT_OMP */
+    if (nthreads > nblocks) { nthreads = nblocks; }
+    if (nthreads < 1) { nthreads = 1; }
+    bool decoded = true;
+#pragma omp parallel num_threads(nthreads)
+    {
+        vector<char> raw; // scratch of each thread
+#pragma omp for schedule(dynamic)
+        for (int i = 0; i < nblocks; i++) {
+            size_t raw_bytes = raw_pos[i + 1] - raw_pos[i];
+            raw.resize(Max(raw_bytes, CVT_SIZET(1)));
+            if (!DecodeBlock(codecs, elem_size, src + block_pos[i], block_pos[i + 1] - block_pos[i],
+                             raw.data(), raw_bytes)
+                || !consumer(raw.data(), raw_pos[i], raw_bytes)) {
+#pragma omp critical
+                {
+                    decoded = false;
+                }
+            }
+        }
+    }
+    return decoded ? CVT_VINT(raw_total) : -1;
+}
+
+} /* namespace: utils_codec */
+} /* namespace: ccgl */
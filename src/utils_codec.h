@@ -0,0 +1,142 @@
+/*!
+ * \file utils_codec.h
+ * \brief Lossless and dependency-free codecs of values in byte stream, e.g., raster data in GridFS.
+ *
+ *        A codec pipeline consists of codecs joined by '+', e.g., "DELTA+BITPACK" or "XOR+SHUFFLE+RLE".
+ *        Element-preserving codecs (SHUFFLE, DELTA, and XOR) are applied in order, and one of
+ *        size-changing codecs (RLE and BITPACK) can be the last one.
+ *        Data are encoded block by block, each block is self-described by a header,
+ *        hence the blocks can be decoded in parallel.
+ */
+#ifndef CCGL_UTILS_CODEC_H
+#define CCGL_UTILS_CODEC_H
+
+#include <vector>
+#include <functional>
+
+#include "basic.h"
+
+using std::vector;
+
+namespace ccgl {
+/*!
+ * \namespace ccgl::utils_codec
+ * \brief Lossless codecs of values in byte stream
+ */
+namespace utils_codec {
+/*! Raw bytes of values in each encoded block, i.e., 256 KB */
+#define CODEC_BLOCK_SIZE 262144
+
+/*!
+ * Bytes of the header of each encoded block, i.e., encoded length and raw length
+ * as unsigned 32-bit integers in little-endian, and a flag byte of encoded or raw
+ */
+#define CODEC_BLOCK_HEADER 9
+
+/*!
+ * \brief Codecs of values
+ */
+typedef enum {
+    CODEC_NONE,    ///< No encoding
+    CODEC_SHUFFLE, ///< Byte shuffle, i.e., the k-th bytes of all values are stored together
+    CODEC_DELTA,   ///< Zigzag-encoded delta of integers to the previous value
+    CODEC_XOR,     ///< XOR of bits to the previous value, suitable for floating point values
+    CODEC_RLE,     ///< Run-length encoding of repeated values, e.g., nodata
+    CODEC_BITPACK  ///< Frame-of-reference bit-packing of integers
+} CodecType;
+
+/*!
+ * \brief Convert CodecType to string
+ */
+string CodecToString(CodecType codec);
+
+/*!
+ * \brief Convert string to CodecType, CODEC_NONE if unknown
+ */
+CodecType StringToCodec(const string& str);
+
+/*!
+ * \brief Parse codec pipeline, e.g., "DELTA+BITPACK"
+ * \param[in] str Codec names joined by '+', empty string or "NONE" means no encoding
+ * \param[out] codecs Codecs in order, CODEC_NONE is omitted
+ * \return false if any codec is unknown or the size-changing codec is not the last one
+ */
+bool ParseCodecs(const string& str, vector<CodecType>& codecs);
+
+/*!
+ * \brief Convert codec pipeline to string, e.g., "DELTA+BITPACK"
+ */
+string CodecsToString(const vector<CodecType>& codecs);
+
+/*!
+ * \brief Check the codec pipeline is applicable to values of the element size
+ */
+bool CodecsApplicable(const vector<CodecType>& codecs, size_t elem_size);
+
+/*!
+ * \brief Encode a block of values and append to dst with the header.
+ *        The raw values are stored if the encoded is not smaller.
+ * \param[in] codecs Codec pipeline
+ * \param[in] elem_size Bytes of each value, DELTA, XOR, and BITPACK support 1, 2, 4, and 8
+ * \param[in] src Raw values
+ * \param[in] nbytes Bytes of raw values, MUST be multiple of elem_size
+ * \param[in,out] dst Encoded blocks
+ */
+bool EncodeBlock(const vector<CodecType>& codecs, size_t elem_size,
+                 const char* src, size_t nbytes, vector<char>& dst);
+
+/*!
+ * \brief Parse the header of an encoded block
+ * \param[in] src Start of the encoded block
+ * \param[in] avail Available bytes from src
+ * \param[out] block_bytes Bytes of the encoded block including the header
+ * \param[out] raw_bytes Bytes of raw values
+ * \return false if the header is incomplete or invalid
+ */
+bool ParseBlockHeader(const char* src, size_t avail, size_t& block_bytes, size_t& raw_bytes);
+
+/*!
+ * \brief Decode an encoded block
+ * \param[in] codecs Codec pipeline
+ * \param[in] elem_size Bytes of each value
+ * \param[in] src Start of the encoded block
+ * \param[in] block_bytes Bytes of the encoded block including the header
+ * \param[out] dst Raw values
+ * \param[in] raw_bytes Bytes of raw values
+ */
+bool DecodeBlock(const vector<CodecType>& codecs, size_t elem_size,
+                 const char* src, size_t block_bytes, char* dst, size_t raw_bytes);
+
+/*!
+ * \brief Encode values block by block
+ * \param[in] codecs Codec pipeline
+ * \param[in] elem_size Bytes of each value
+ * \param[in] src Raw values
+ * \param[in] nbytes Bytes of raw values
+ * \param[out] dst Encoded blocks
+ * \param[in] block_size Raw bytes of each block, rounded down to multiple of elem_size
+ */
+bool EncodeStream(const vector<CodecType>& codecs, size_t elem_size,
+                  const char* src, size_t nbytes, vector<char>& dst,
+                  size_t block_size = CODEC_BLOCK_SIZE);
+
+/*!
+ * \brief Decode blocks in parallel
+ * \param[in] codecs Codec pipeline
+ * \param[in] elem_size Bytes of each value
+ * \param[in] src Encoded blocks
+ * \param[in] nbytes Bytes of encoded blocks
+ * \param[in] consumer Invoked by multiple threads with raw values of each block and its offset
+ *                     (bytes) in raw stream, return false to indicate failure
+ * \param[in] nthreads Threads number, 0 means the default of OpenMP
+ * \return Total bytes of raw values, -1 if failed
+ */
+vint DecodeStream(const vector<CodecType>& codecs, size_t elem_size,
+                  const char* src, size_t nbytes,
+                  const std::function<bool(const char* raw, size_t raw_offset, size_t raw_bytes)>& consumer,
+                  int nthreads = 0);
+
+} /* namespace: utils_codec */
+} /* namespace: ccgl */
+
+#endif /* CCGL_UTILS_CODEC_H */
@@ -5,9 +5,15 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <algorithm>
 #include <sys/stat.h>
 #ifdef WINDOWS
 #include <io.h>
+#include <process.h>
+#include <sys/utime.h>
+#else
+#include <sys/mman.h>
+#include <utime.h>
 #endif
 #if defined(MACOS) || defined(MACOSX)
 #include <libproc.h>
@@ -54,6 +60,26 @@ bool PathExists(string const& fullpath) {
 #endif /* WINDOWS */
 }
 
+bool GetFileStamp(string const& filepath, vint64_t& size, vint64_t& mtime_ns) {
+    string abspath = GetAbsolutePath(filepath);
+#ifdef WINDOWS
+    struct _stat64 file_stat;
+    if (_stat64(abspath.c_str(), &file_stat) != 0) { return false; }
+    vint64_t nsec = 0; // whole seconds only
+#else
+    struct stat file_stat;
+    if (stat(abspath.c_str(), &file_stat) != 0) { return false; }
+#if defined(MACOS) || defined(MACOSX)
+    vint64_t nsec = static_cast<vint64_t>(file_stat.st_mtimespec.tv_nsec);
+#else
+    vint64_t nsec = static_cast<vint64_t>(file_stat.st_mtim.tv_nsec);
+#endif
+#endif /* WINDOWS */
+    size = static_cast<vint64_t>(file_stat.st_size);
+    mtime_ns = static_cast<vint64_t>(file_stat.st_mtime) * 1000000000LL + nsec;
+    return true;
+}
+
 int DeleteExistedFile(const string& filepath) {
     string abspath = GetAbsolutePath(filepath);
     if (FileExists(abspath)) {
@@ -402,6 +428,230 @@ bool LoadPlainTextFile(const string& filepath, vector<string>& content_strs) {
     }
     return b_status;
 }
+
+///////////////////////////////////////////////////
+///////////////  MappedFile  //////////////////////
+///////////////////////////////////////////////////
+MappedFile::MappedFile() : data_(nullptr), size_(-1) {
+#ifdef WINDOWS
+    file_ = INVALID_HANDLE_VALUE;
+    mapping_ = NULL;
+#endif /* WINDOWS */
+}
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+bool MappedFile::Open(const string& filepath) {
+    Close();
+#ifdef WINDOWS
+    file_ = ::CreateFile(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+                         NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (INVALID_HANDLE_VALUE == file_) { return false; }
+    LARGE_INTEGER file_size;
+    if (!::GetFileSizeEx(file_, &file_size)) {
+        Close();
+        return false;
+    }
+    size_ = CVT_VINT(file_size.QuadPart);
+    if (size_ == 0) { return true; }
+    mapping_ = ::CreateFileMapping(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (NULL != mapping_) {
+        data_ = static_cast<const char*>(::MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+    }
+#else
+    int fd = open(filepath.c_str(), O_RDONLY);
+    if (fd < 0) { return false; }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+        close(fd);
+        return false;
+    }
+    size_ = CVT_VINT(file_stat.st_size);
+    if (size_ == 0) {
+        close(fd);
+        return true;
+    }
+    void* addr = mmap(nullptr, CVT_SIZET(size_), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping is still valid after closing the descriptor
+    if (addr != MAP_FAILED) { data_ = static_cast<const char*>(addr); }
+#endif /* WINDOWS */
+    if (nullptr == data_) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::Close() {
+#ifdef WINDOWS
+    if (nullptr != data_) { ::UnmapViewOfFile(data_); }
+    if (NULL != mapping_) { ::CloseHandle(mapping_); }
+    if (INVALID_HANDLE_VALUE != file_) { ::CloseHandle(file_); }
+    mapping_ = NULL;
+    file_ = INVALID_HANDLE_VALUE;
+#else
+    if (nullptr != data_) { munmap(const_cast<char*>(data_), CVT_SIZET(size_)); }
+#endif /* WINDOWS */
+    data_ = nullptr;
+    size_ = -1;
+}
+
+///////////////////////////////////////////////////
+/////////////  LocalFileCache  ////////////////////
+///////////////////////////////////////////////////
+static const char* CACHE_ENTRY_SUFFIX = "cache";
+static const char* CACHE_TEMP_SUFFIX = "tmp";
+static const time_t CACHE_TEMP_EXPIRED = 3600; // seconds
+static const vint CACHE_RESCAN_COMMITS = 64;
+
+/// Name, size, and modified time of files in the cache directory
+struct CacheFileInfo {
+    string name;
+    vint size;
+    time_t mtime;
+};
+
+static void ListCacheFiles(const string& dirpath, vector<CacheFileInfo>& files) {
+#ifdef WINDOWS
+    string pattern = dirpath + SEP + "*";
+    WIN32_FIND_DATA find_data;
+    HANDLE h_find = ::FindFirstFile(pattern.c_str(), &find_data);
+    if (INVALID_HANDLE_VALUE == h_find) { return; }
+    do {
+        if (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) { continue; }
+        string name = find_data.cFileName;
+        struct _stat file_stat;
+        if (_stat((dirpath + SEP + name).c_str(), &file_stat) != 0) { continue; }
+        CacheFileInfo info = {name, CVT_VINT(file_stat.st_size), file_stat.st_mtime};
+        files.emplace_back(info);
+    } while (::FindNextFile(h_find, &find_data));
+    ::FindClose(h_find);
+#else
+    DIR* dir = opendir(dirpath.c_str());
+    if (nullptr == dir) { return; }
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        if (entry->d_name[0] == '.') { continue; }
+        string name = entry->d_name;
+        struct stat file_stat;
+        if (stat((dirpath + SEP + name).c_str(), &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+            continue;
+        }
+        CacheFileInfo info = {name, CVT_VINT(file_stat.st_size), file_stat.st_mtime};
+        files.emplace_back(info);
+    }
+    closedir(dir);
+#endif /* WINDOWS */
+}
+
+LocalFileCache::LocalFileCache(const string& dirpath, const vint max_bytes /* = 0 */) :
+    dir_(GetAbsolutePath(dirpath)), max_bytes_(max_bytes > 0 ? max_bytes : 0), valid_(false),
+    hits_(0), misses_(0), est_bytes_(-1), commits_(0) {
+    valid_ = MakeDirectory(dir_) || DirectoryExists(dir_); // created by another process meanwhile
+}
+
+string LocalFileCache::EntryPath(const string& key) const {
+    return ConcatFullName(dir_, key, CACHE_ENTRY_SUFFIX);
+}
+
+bool LocalFileCache::Lookup(const string& key, MappedFile& mapped) {
+    if (!valid_ || key.empty()) { return false; }
+    string path = EntryPath(key);
+    if (!mapped.Open(path)) {
+        misses_++;
+        return false;
+    }
+    hits_++;
+    // Mark as the most recently used, which is shared by processes using the same directory
+#ifdef WINDOWS
+    _utime(path.c_str(), NULL);
+#else
+    utime(path.c_str(), NULL);
+#endif /* WINDOWS */
+    return true;
+}
+
+string LocalFileCache::NewTempPath(const string& key) const {
+    static std::atomic<vuint64_t> counter(0);
+#ifdef WINDOWS
+    int pid = _getpid();
+#else
+    int pid = getpid();
+#endif /* WINDOWS */
+    return ConcatFullName(dir_, key + "." + utils_string::ValueToString(pid) + "_"
+                          + utils_string::ValueToString(++counter),
+                          CACHE_TEMP_SUFFIX);
+}
+
+/*!
+ * Renaming is atomic on the same file system, hence the readers of other processes
+ *   see either no entry or the complete one.
+ * The estimated size only adds the committed entries, which may be overestimated by
+ *   replaced entries and underestimated by other processes until the next scan.
+ */
+bool LocalFileCache::Commit(const string& key, const string& temp_path) {
+    if (!valid_ || key.empty()) {
+        DeleteExistedFile(temp_path);
+        return false;
+    }
+    string path = EntryPath(key);
+#ifdef WINDOWS
+    bool renamed = ::MoveFileEx(temp_path.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != FALSE;
+#else
+    bool renamed = rename(temp_path.c_str(), path.c_str()) == 0;
+#endif /* WINDOWS */
+    if (!renamed) {
+        DeleteExistedFile(temp_path);
+        return FileExists(path); // may be committed by another process
+    }
+    vint64_t size = 0;
+    vint64_t mtime_ns = 0;
+    GetFileStamp(path, size, mtime_ns);
+    vint estimated = est_bytes_.load();
+    bool scan = estimated < 0 || ++commits_ >= CACHE_RESCAN_COMMITS;
+    if (!scan && max_bytes_ > 0) {
+        scan = est_bytes_.fetch_add(CVT_VINT(size)) + CVT_VINT(size) > max_bytes_;
+    }
+    if (scan) { Evict(key); }
+    return true;
+}
+
+vint LocalFileCache::Evict(const string& keep /* = string() */) {
+    if (!valid_) { return 0; }
+    vector<CacheFileInfo> files;
+    ListCacheFiles(dir_, files);
+    string keep_name = keep.empty() ? string() : keep + "." + CACHE_ENTRY_SUFFIX;
+    time_t now = time(nullptr);
+    vector<CacheFileInfo> entries;
+    vint total = 0;
+    for (auto it = files.begin(); it != files.end(); ++it) {
+        size_t dot = it->name.find_last_of('.');
+        string suffix = dot == string::npos ? string() : it->name.substr(dot + 1);
+        if (suffix == CACHE_TEMP_SUFFIX) {
+            if (now - it->mtime > CACHE_TEMP_EXPIRED) { remove((dir_ + SEP + it->name).c_str()); }
+            continue;
+        }
+        if (suffix != CACHE_ENTRY_SUFFIX) { continue; }
+        total += it->size;
+        if (it->name != keep_name) { entries.emplace_back(*it); }
+    }
+    commits_ = 0;
+    if (max_bytes_ <= 0 || total <= max_bytes_) {
+        est_bytes_ = total;
+        return total;
+    }
+    std::sort(entries.begin(), entries.end(), [](const CacheFileInfo& a, const CacheFileInfo& b) {
+        return a.mtime < b.mtime;
+    });
+    for (auto it = entries.begin(); it != entries.end() && total > max_bytes_; ++it) {
+        // An entry mapped by other processes remains readable until it is unmapped (POSIX)
+        if (remove((dir_ + SEP + it->name).c_str()) == 0) { total -= it->size; }
+    }
+    est_bytes_ = total;
+    return total;
+}
 } /* namespace: utils_filesystem */
 
 } /* namespace: ccgl */
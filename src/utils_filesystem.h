@@ -14,6 +14,8 @@
 #include "basic.h"
 
 #include <vector>
+#include <ctime>
+#include <atomic>
 
 using std::vector;
 
@@ -142,6 +144,16 @@ bool FilesExist(vector<string>& filenames);
  */
 bool PathExists(string const& path);
 
+/*!
+ * \brief Get the size and last modification time of the given file, which identify a version of it
+ * \param[in] filepath String path of file
+ * \param[out] size Size in bytes
+ * \param[out] mtime_ns Modification time in nanoseconds since epoch,
+ *                      the resolution depends on the platform and file system
+ * \return false if the file is not accessible.
+ */
+bool GetFileStamp(string const& filepath, vint64_t& size, vint64_t& mtime_ns);
+
 /*!
  * \brief Delete the given file if existed.
  * \param[in] filepath \a string File path, full path or relative path
@@ -165,6 +177,100 @@ int FindFiles(const char* lp_path, const char* expression, vector<string>& vec_f
  * \return True when read successfully, and false with empty content_strs when failed
  */
 bool LoadPlainTextFile(const string& filepath, vector<string>& content_strs);
+
+/*!
+ * \class MappedFile
+ * \brief Read-only memory mapping of an entire file
+ */
+class MappedFile: NotCopyable {
+public:
+    MappedFile();
+
+    /*! Destructor, the file is unmapped */
+    ~MappedFile();
+
+    /*! Map the given file, the previous mapped file is closed first */
+    bool Open(const string& filepath);
+
+    /*! Unmap the file */
+    void Close();
+
+    /*! Mapped data, nullptr if not mapped or the file is empty */
+    const char* Data() const { return data_; }
+
+    /*! Size (bytes) of the mapped file, -1 if not mapped */
+    vint Size() const { return size_; }
+
+private:
+    const char* data_; ///< Mapped data
+    vint size_;        ///< Size of the file
+#ifdef WINDOWS
+    HANDLE file_;      ///< Handle of the file
+    HANDLE mapping_;   ///< Handle of the file mapping
+#endif /* WINDOWS */
+};
+
+/*!
+ * \class LocalFileCache
+ * \brief On-disk cache of immutable files in a directory bounded by size with LRU eviction.
+ *
+ *        Each entry is a file named by its key, which should be unique for the content,
+ *        e.g., identity and modified time of the source. An entry is written to a temporary file
+ *        and committed by renaming, hence the cache directory can be shared by processes.
+ *        The modified time of an entry is updated once it is hit and used as the LRU order.
+ */
+class LocalFileCache: NotCopyable {
+public:
+    /*!
+     * \brief Constructor
+     * \param[in] dirpath Cache directory, which is created if not existed
+     * \param[in] max_bytes Maximum size (bytes) of all entries, 0 means no limit
+     */
+    explicit LocalFileCache(const string& dirpath, vint max_bytes = 0);
+
+    /*! The cache directory is available */
+    bool Valid() const { return valid_; }
+
+    /*! Path of the entry, the key MUST consist of characters valid in file name */
+    string EntryPath(const string& key) const;
+
+    /*! Map the entry if existed, and mark it as the most recently used */
+    bool Lookup(const string& key, MappedFile& mapped);
+
+    /*! Path of a new temporary file to be written and committed as the entry */
+    string NewTempPath(const string& key) const;
+
+    /*!
+     * \brief Commit the temporary file as the entry, then evict the least recently used entries.
+     *        The directory is scanned only if the estimated total size exceeds the limit,
+     *        or every 64 commits to account for the other processes.
+     * \return false if failed, and the temporary file is deleted
+     */
+    bool Commit(const string& key, const string& temp_path);
+
+    /*!
+     * \brief Delete the least recently used entries until the total size is within the limit.
+     *        Temporary files left by interrupted writers for more than one hour are also deleted.
+     * \param[in] keep Key of the entry that is never evicted, e.g., the one just committed
+     * \return Total size (bytes) of remained entries, which resets the estimated total size
+     */
+    vint Evict(const string& keep = string());
+
+    /*! Number of hits */
+    vint Hits() const { return hits_; }
+
+    /*! Number of misses */
+    vint Misses() const { return misses_; }
+
+private:
+    string dir_;               ///< Cache directory
+    vint max_bytes_;           ///< Maximum size of all entries
+    bool valid_;               ///< The cache directory is available
+    std::atomic<vint> hits_;   ///< Number of hits
+    std::atomic<vint> misses_; ///< Number of misses
+    std::atomic<vint> est_bytes_; ///< Estimated size of all entries, -1 if not scanned yet
+    std::atomic<vint> commits_;   ///< Number of commits since the last scan
+};
 } /* namespace: utils_filesystem */
 
 } /* namespace: ccgl */
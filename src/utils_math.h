@@ -415,7 +415,8 @@ T Sum(const int row, int*& idx, const T* data) {
 template <typename T>
 void BasicStatistics(const T* values, const int num, double** derivedvalues,
                      T exclude /* = CVT_TYP(NODATA_VALUE) */) {
-    double* tmpstats = new double[6];
+    double* tmpstats = nullptr;
+    utils_array::Initialize1DArray(6, tmpstats, 0.);
     double maxv = MISSINGFLOAT;
     double minv = MAXIMUMFLOAT;
     int validnum = 0;
@@ -448,9 +449,10 @@ void BasicStatistics(const T* values, const int num, double** derivedvalues,
 template <typename T>
 void BasicStatistics(const T*const * values, const int num, const int lyrs,
                      double*** derivedvalues, T exclude /* = CVT_TYP(NODATA_VALUE) */) {
-    double** tmpstats = new double *[6];
+    double** tmpstats = nullptr; // released by Release1DArray() for each row and row pointers
+    utils_array::Initialize1DArray(6, tmpstats, nullptr);
     for (int i = 0; i < 6; i++) {
-        tmpstats[i] = new double[lyrs];
+        utils_array::Initialize1DArray(lyrs, tmpstats[i], 0.);
     }
     for (int j = 0; j < lyrs; j++) {
         tmpstats[0][j] = 0.;                    /// valid number
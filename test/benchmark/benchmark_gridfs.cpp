@@ -0,0 +1,188 @@
+/*!
+ * \brief Throughput measurements of raster data in MongoDB GridFS, which are kept out of
+ *        the unit tests and not registered to ctest.
+ *
+ *        Usage: benchmark_gridfs [-host 127.0.0.1] [-port 27017]
+ */
+#ifdef USE_MONGODB
+#include "../../src/basic.h"
+#include "../../src/utils_array.h"
+#include "../../src/utils_string.h"
+#include "../../src/utils_time.h"
+#include "../../src/db_mongoc.h"
+#include "../../src/data_raster.hpp"
+
+using namespace ccgl;
+using namespace db_mongoc;
+using namespace utils_array;
+using namespace utils_string;
+using namespace utils_time;
+using namespace data_raster;
+
+/*! Compression ratio and read throughput of codec pipelines */
+void BenchmarkCodecs(MongoGridFs* gfs) {
+    int nrows = 1000;
+    int ncols = 1000;
+    int datalength = nrows * ncols;
+    float* data = nullptr;
+    Initialize1DArray(datalength, data, -9999.f);
+    for (int i = 0; i < nrows; i++) {
+        for (int j = i / 4; j < ncols - i / 4; j++) {
+            data[i * ncols + j] = CVT_FLT(i + j) * 0.5f;
+        }
+    }
+    STRDBL_MAP header = InitialHeader();
+    header[HEADER_RS_NROWS] = nrows;
+    header[HEADER_RS_NCOLS] = ncols;
+    header[HEADER_RS_LAYERS] = 1;
+    header[HEADER_RS_CELLSNUM] = datalength;
+    header[HEADER_RS_NODATA] = -9999.;
+    const char* pipelines[] = {"NONE", "XOR+SHUFFLE+RLE", "SHUFFLE+RLE", "XOR+BITPACK"};
+    const char* datatypes[] = {"FLOAT", "FLOAT", "FLOAT", "INT32"};
+    string fname = "benchmark_data_codec";
+    for (int k = 0; k < 4; k++) {
+        STRING_MAP opts;
+        opts[HEADER_RS_CODEC] = pipelines[k];
+        opts[HEADER_RSOUT_DATATYPE] = datatypes[k];
+        if (!WriteStreamDataAsGridfs(gfs, fname, header, data, datalength, opts)) { continue; }
+        mongoc_gridfs_file_t* gfile = gfs->GetFile(fname);
+        if (nullptr == gfile) { continue; }
+        double stored_bytes = CVT_DBL(mongoc_gridfs_file_get_length(gfile));
+        mongoc_gridfs_file_destroy(gfile);
+        float* read_data = nullptr;
+        GridFsHeader read_header;
+        double stime = TimeCounting();
+        bool read = ReadGridFsFile(gfs, fname, read_data, read_header);
+        double elapsed = Max(TimeCounting() - stime, 1.e-6);
+        Release1DArray(read_data);
+        if (!read) { continue; }
+        double raw_bytes = datalength * 4.; // both FLOAT and INT32
+        cout << pipelines[k] << ": compression ratio " << raw_bytes / Max(stored_bytes, 1.)
+                << ", read and decode " << raw_bytes / elapsed / 1.e9 << " GB/s" << endl;
+    }
+    gfs->RemoveFile(fname);
+    Release1DArray(data);
+}
+
+/*! Small files written one per round trip and in batches */
+void BenchmarkBulkWrites(MongoClient* client) {
+    int nfiles = 500;
+    int datalength = 400; // e.g., a small subbasin
+    float* data = nullptr;
+    Initialize1DArray(datalength, data, 1.5f);
+    STRDBL_MAP header = InitialHeader();
+    header[HEADER_RS_NROWS] = 20;
+    header[HEADER_RS_NCOLS] = 20;
+    header[HEADER_RS_LAYERS] = 1;
+    header[HEADER_RS_CELLSNUM] = datalength;
+    header[HEADER_RS_NODATA] = -9999.;
+    STRING_MAP opts;
+    opts["TEST"] = "benchmark_bulk";
+    MongoGridFs* gfs = client->GridFs("test", "spatial");
+    if (nullptr == gfs) {
+        Release1DArray(data);
+        return;
+    }
+    double stime = TimeCounting();
+    for (int i = 0; i < nfiles; i++) {
+        WriteStreamDataAsGridfs(gfs, "benchmark_single_" + ValueToString(i), header, data, datalength, opts);
+    }
+    double single_time = Max(TimeCounting() - stime, 1.e-6);
+    stime = TimeCounting();
+    MongoGridFsBulkWriter writer(client, "test", "spatial", 100);
+    for (int i = 0; i < nfiles; i++) {
+        WriteStreamDataAsGridfs(&writer, "benchmark_batch_" + ValueToString(i), header, data, datalength, opts);
+    }
+    writer.Flush();
+    double bulk_time = Max(TimeCounting() - stime, 1.e-6);
+    cout << "Single writes: " << nfiles / single_time << " files/s, bulk writes: "
+            << nfiles / bulk_time << " files/s" << endl;
+    for (int i = 0; i < nfiles; i++) {
+        gfs->RemoveFile("benchmark_single_" + ValueToString(i));
+        gfs->RemoveFile("benchmark_batch_" + ValueToString(i));
+    }
+    delete gfs;
+    Release1DArray(data);
+}
+
+/*! Metadata decoded into maps or typed header, and options encoded */
+void BenchmarkMetadata() {
+    STRDBL_MAP header = InitialHeader();
+    header[HEADER_RS_NCOLS] = 256;
+    header[HEADER_RS_NROWS] = 128;
+    header[HEADER_RS_CELLSIZE] = 30.;
+    header[HEADER_RS_NODATA] = -9999.;
+    header[HEADER_RS_LAYERS] = 2;
+    header[HEADER_RS_CELLSNUM] = 256 * 128;
+    STRING_MAP opts;
+    opts[HEADER_RSOUT_DATATYPE] = "FLOAT";
+    opts[HEADER_RS_CODEC] = "DELTA+BITPACK";
+    opts[HEADER_RS_SRS] = "EPSG:32650";
+    opts["SUBBASINID"] = "17";
+    bson_t meta = BSON_INITIALIZER;
+    for (auto it = header.begin(); it != header.end(); ++it) {
+        BSON_APPEND_DOUBLE(&meta, it->first.c_str(), it->second);
+    }
+    AppendStringOptionsToBson(&meta, opts);
+    int times = 100000;
+    double stime = TimeCounting();
+    for (int i = 0; i < times; i++) {
+        STRDBL_MAP tmp_dbl = InitialHeader();
+        STRING_MAP tmp_str = InitialStrHeader();
+        ParseGridFsMetadata(&meta, tmp_dbl, tmp_str);
+    }
+    double maps_time = Max(TimeCounting() - stime, 1e-6);
+    stime = TimeCounting();
+    for (int i = 0; i < times; i++) {
+        GridFsHeader tmp;
+        tmp.Parse(&meta);
+    }
+    double typed_time = Max(TimeCounting() - stime, 1e-6);
+    stime = TimeCounting();
+    for (int i = 0; i < times; i++) {
+        bson_t tmp = BSON_INITIALIZER;
+        AppendStringOptionsToBson(&tmp, opts);
+        bson_destroy(&tmp);
+    }
+    double encode_time = Max(TimeCounting() - stime, 1e-6);
+    cout << "Metadata decoded into maps: " << times / maps_time << " files/s, typed header: "
+            << times / typed_time << " files/s, options encoded: " << times / encode_time
+            << " files/s" << endl;
+    bson_destroy(&meta);
+}
+
+int main(int argc, char** argv) {
+    int i = 1;
+    char* strend = nullptr;
+    string mongo_host = "127.0.0.1";
+    vint16_t mongo_port = 27017;
+    while (argc > i) {
+        if (StringMatch(argv[i], "-host") && argc > i + 1) {
+            mongo_host = argv[i + 1];
+            i += 2;
+        }
+        else if (StringMatch(argv[i], "-port") && argc > i + 1) {
+            mongo_port = static_cast<vint16_t>(strtol(argv[i + 1], &strend, 10));
+            i += 2;
+        }
+        else {
+            i++;
+        }
+    }
+    SetDefaultOpenMPThread();
+    MongoClient* client = MongoClient::Init(mongo_host.c_str(), mongo_port);
+    if (nullptr == client) { return 1; }
+    MongoGridFs* gfs = client->GridFs("test", "spatial");
+    if (nullptr == gfs) {
+        delete client;
+        return 1;
+    }
+    BenchmarkCodecs(gfs);
+    BenchmarkBulkWrites(client);
+    BenchmarkMetadata();
+    delete gfs;
+    delete client;
+    return 0;
+}
+
+#endif /* USE_MONGODB */
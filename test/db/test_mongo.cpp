@@ -1,13 +1,18 @@
 #ifdef USE_MONGODB
 #include "gtest/gtest.h"
+#include <stdexcept>
 #include "../../src/basic.h"
 #include "../../src/utils_array.h"
+#include "../../src/utils_filesystem.h"
 #include "../../src/db_mongoc.h"
+#include "../../src/data_raster.hpp"
 #include "../test_global.h"
 
 using namespace ccgl;
 using namespace db_mongoc;
 using namespace utils_array;
+using namespace utils_filesystem;
+using namespace data_raster;
 
 extern GlobalEnvironment* GlobalEnv;
 
@@ -62,4 +67,517 @@ TEST(MongoGridFS, removeFile) {
     Release1DArray(data1d);
 }
 
+TEST(MongoClientPoolTest, checkoutInParallel) {
+    const mongoc_uri_t* uri = mongoc_client_get_uri(GlobalEnv->client_->GetConn());
+    MongoClientPool* pool = MongoClientPool::Init(uri, 2);
+    ASSERT_NE(nullptr, pool);
+    int nthreads = 4;
+    vector<int> found(nthreads, 0);
+#pragma omp parallel for num_threads(nthreads)
+    for (int i = 0; i < nthreads; i++) {
+        MongoPooledClient client(pool);
+        MongoGridFs* gfs = client.GridFs("test", "spatial");
+        if (nullptr == gfs) { continue; }
+        vector<string> gfs_names;
+        gfs->GetFileNames(gfs_names);
+        found[i] = 1;
+    }
+    for (int i = 0; i < nthreads; i++) {
+        EXPECT_EQ(1, found[i]);
+    }
+    MongoPoolMetrics metrics = pool->GetMetrics();
+    EXPECT_EQ(2, metrics.max_size);
+    EXPECT_EQ(0, metrics.checked_out);
+    EXPECT_LE(metrics.peak_checked_out, 2);
+    EXPECT_EQ(nthreads + 1, metrics.checkouts); // including the validation of Init()
+    EXPECT_GE(metrics.total_wait, metrics.max_wait);
+    delete pool;
+}
+
+TEST(MongoGridFS, codecRoundTrip) {
+    // Raster-like values, i.e., large nodata areas and smooth valid values
+    int nrows = 1000;
+    int ncols = 1000;
+    int datalength = nrows * ncols;
+    float* data = nullptr;
+    Initialize1DArray(datalength, data, -9999.f);
+    for (int i = 0; i < nrows; i++) {
+        for (int j = i / 4; j < ncols - i / 4; j++) {
+            data[i * ncols + j] = CVT_FLT(i + j) * 0.5f;
+        }
+    }
+    STRDBL_MAP header;
+    header[HEADER_RS_NROWS] = nrows;
+    header[HEADER_RS_NCOLS] = ncols;
+    header[HEADER_RS_LAYERS] = 1;
+    header[HEADER_RS_CELLSNUM] = datalength;
+    header[HEADER_RS_NODATA] = -9999.;
+    const char* pipelines[] = {"NONE", "XOR+SHUFFLE+RLE", "SHUFFLE+RLE", "XOR+BITPACK"};
+    const char* datatypes[] = {"FLOAT", "FLOAT", "FLOAT", "INT32"};
+    string fname = "test_data_codec";
+    for (int k = 0; k < 4; k++) {
+        STRING_MAP opts;
+        opts[HEADER_RS_CODEC] = pipelines[k];
+        opts[HEADER_RSOUT_DATATYPE] = datatypes[k];
+        EXPECT_TRUE(WriteStreamDataAsGridfs(GlobalEnv->gfs_, fname, header, data, datalength, opts));
+        mongoc_gridfs_file_t* gfile = GlobalEnv->gfs_->GetFile(fname);
+        ASSERT_NE(nullptr, gfile);
+        double stored_bytes = CVT_DBL(mongoc_gridfs_file_get_length(gfile));
+        mongoc_gridfs_file_destroy(gfile);
+
+        float* read_data = nullptr;
+        STRDBL_MAP read_header;
+        read_header[HEADER_RS_NROWS] = -1;
+        read_header[HEADER_RS_NCOLS] = -1;
+        read_header[HEADER_RS_LAYERS] = -1;
+        read_header[HEADER_RS_CELLSNUM] = -1;
+        STRING_MAP header_str;
+        ASSERT_TRUE(ReadGridFsFile(GlobalEnv->gfs_, fname, read_data, read_header, header_str));
+        for (int i = 0; i < datalength; i++) {
+            if (k == 3) { EXPECT_FLOAT_EQ(CVT_FLT(CVT_INT(data[i])), read_data[i]); }
+            else { EXPECT_FLOAT_EQ(data[i], read_data[i]); }
+        }
+        if (k > 0) { EXPECT_LT(stored_bytes, datalength * 4.); } // both FLOAT and INT32
+        Release1DArray(read_data);
+    }
+    GlobalEnv->gfs_->RemoveFile(fname);
+    Release1DArray(data);
+}
+
+TEST(MongoGridFS, tiledWindow) {
+    int nrows = 300;
+    int ncols = 200;
+    int datalength = nrows * ncols;
+    float* data = nullptr;
+    Initialize1DArray(datalength, data, -9999.f);
+    for (int i = 0; i < datalength; i++) {
+        if (i % 7 != 0) { data[i] = CVT_FLT(i); }
+    }
+    STRDBL_MAP header;
+    header[HEADER_RS_NROWS] = nrows;
+    header[HEADER_RS_NCOLS] = ncols;
+    header[HEADER_RS_LAYERS] = 1;
+    header[HEADER_RS_CELLSNUM] = datalength;
+    header[HEADER_RS_NODATA] = -9999.;
+    const mongoc_uri_t* uri = mongoc_client_get_uri(GlobalEnv->client_->GetConn());
+    MongoClientPool* pool = MongoClientPool::Init(uri, 4);
+    ASSERT_NE(nullptr, pool);
+    MongoGridFs* gfs = GlobalEnv->client_->GridFs("test", "spatial");
+    ASSERT_NE(nullptr, gfs);
+    const char* pipelines[] = {"NONE", "XOR+SHUFFLE+RLE"};
+    string fname = "test_data_tiled";
+    for (int k = 0; k < 4; k++) { // tiled, and not tiled that is clipped while streaming
+        STRING_MAP opts;
+        opts[HEADER_RS_CODEC] = pipelines[k % 2];
+        if (k < 2) { opts[HEADER_RS_TILE_SIZE] = "64"; }
+        EXPECT_TRUE(WriteStreamDataAsGridfs(gfs, fname, header, data, datalength, opts));
+        // entire raster
+        float* fulldata = nullptr;
+        STRDBL_MAP read_header = InitialHeader();
+        STRING_MAP header_str;
+        ASSERT_TRUE(ReadGridFsFile(gfs, fname, fulldata, read_header, header_str, STRING_MAP()));
+        EXPECT_TRUE(header_str.find(HEADER_RS_TILE_INDEX) == header_str.end());
+        for (int i = 0; i < datalength; i++) {
+            EXPECT_FLOAT_EQ(data[i], fulldata[i]);
+        }
+        Release1DArray(fulldata);
+        // window across tiles, fetched in parallel
+        int srow = 50;
+        int erow = 170;
+        int scol = 60;
+        int ecol = 140;
+        float* window = nullptr;
+        ASSERT_TRUE(ReadGridFsWindow(gfs, fname, srow, erow, scol, ecol, window,
+                                     read_header, header_str, STRING_MAP(), pool));
+        int idx = 0;
+        for (int i = srow; i <= erow; i++) {
+            for (int j = scol; j <= ecol; j++) {
+                EXPECT_FLOAT_EQ(data[i * ncols + j], window[idx++]);
+            }
+        }
+        Release1DArray(window);
+    }
+    gfs->RemoveFile(fname);
+    delete gfs;
+    delete pool;
+    Release1DArray(data);
+}
+
+TEST(MongoGridFS, bulkWriteSmallFiles) {
+    int nfiles = 500;
+    int datalength = 400; // e.g., a small subbasin
+    float* data = nullptr;
+    Initialize1DArray(datalength, data, 1.5f);
+    STRDBL_MAP header;
+    header[HEADER_RS_NROWS] = 20;
+    header[HEADER_RS_NCOLS] = 20;
+    header[HEADER_RS_LAYERS] = 1;
+    header[HEADER_RS_CELLSNUM] = datalength;
+    header[HEADER_RS_NODATA] = -9999.;
+    STRING_MAP opts;
+    opts["TEST"] = "bulk";
+    MongoGridFs* gfs = GlobalEnv->client_->GridFs("test", "spatial");
+    ASSERT_NE(nullptr, gfs);
+    // one file per round trip
+    for (int i = 0; i < nfiles; i++) {
+        EXPECT_TRUE(WriteStreamDataAsGridfs(gfs, "bulk_single_" + ValueToString(i),
+                                            header, data, datalength, opts));
+    }
+    // batches, written twice to check the replacement
+    for (int k = 0; k < 2; k++) {
+        data[0] = CVT_FLT(k);
+        MongoGridFsBulkWriter writer(GlobalEnv->client_, "test", "spatial", 100);
+        for (int i = 0; i < nfiles; i++) {
+            EXPECT_TRUE(WriteStreamDataAsGridfs(&writer, "bulk_batch_" + ValueToString(i),
+                                                header, data, datalength, opts));
+        }
+        EXPECT_TRUE(writer.Flush());
+        EXPECT_EQ(nfiles, writer.WrittenCount());
+        EXPECT_EQ(nfiles / 100, writer.BatchCount());
+        EXPECT_TRUE(writer.FailedFiles().empty());
+    }
+    vector<string> names;
+    STRING_MAP filter;
+    filter["TEST"] = "bulk";
+    gfs->GetFileNames(names, NULL, filter);
+    int nbatch = 0;
+    for (auto it = names.begin(); it != names.end(); ++it) {
+        if (it->find("bulk_batch_") == 0) { nbatch++; }
+    }
+    EXPECT_EQ(nfiles, nbatch); // replaced rather than duplicated
+    float* read_data = nullptr;
+    STRDBL_MAP read_header = InitialHeader();
+    STRING_MAP header_str;
+    ASSERT_TRUE(ReadGridFsFile(gfs, "bulk_batch_7", read_data, read_header, header_str, filter));
+    EXPECT_FLOAT_EQ(1.f, read_data[0]);
+    EXPECT_FLOAT_EQ(1.5f, read_data[datalength - 1]);
+    Release1DArray(read_data);
+
+    for (int i = 0; i < nfiles; i++) {
+        gfs->RemoveFile("bulk_single_" + ValueToString(i), NULL, filter);
+        gfs->RemoveFile("bulk_batch_" + ValueToString(i), NULL, filter);
+    }
+    delete gfs;
+    Release1DArray(data);
+}
+
+TEST(MongoGridFS, bulkWriteKeepsReplacedOnFailure) {
+    int datalength = 4;
+    float* data = nullptr;
+    Initialize1DArray(datalength, data, 1.f);
+    STRDBL_MAP header;
+    header[HEADER_RS_NROWS] = 2;
+    header[HEADER_RS_NCOLS] = 2;
+    header[HEADER_RS_LAYERS] = 1;
+    header[HEADER_RS_CELLSNUM] = datalength;
+    header[HEADER_RS_NODATA] = -9999.;
+    MongoGridFs* gfs = GlobalEnv->client_->GridFs("test", "bulkfail");
+    ASSERT_NE(nullptr, gfs);
+    // the new version of a file conflicts with the old one by a unique index, so its insert fails
+    bson_t cmd = BSON_INITIALIZER;
+    bson_t indexes;
+    bson_t index;
+    bson_t keys;
+    BSON_APPEND_UTF8(&cmd, "createIndexes", "bulkfail.files");
+    BSON_APPEND_ARRAY_BEGIN(&cmd, "indexes", &indexes);
+    BSON_APPEND_DOCUMENT_BEGIN(&indexes, "0", &index);
+    BSON_APPEND_DOCUMENT_BEGIN(&index, "key", &keys);
+    BSON_APPEND_INT32(&keys, "metadata.UNIQ", 1);
+    bson_append_document_end(&index, &keys);
+    BSON_APPEND_UTF8(&index, "name", "uniq");
+    BSON_APPEND_BOOL(&index, "unique", true);
+    BSON_APPEND_BOOL(&index, "sparse", true);
+    bson_append_document_end(&indexes, &index);
+    bson_append_array_end(&cmd, &indexes);
+    bson_error_t err;
+    ASSERT_TRUE(mongoc_client_command_simple(GlobalEnv->client_->GetConn(), "test", &cmd,
+                                             NULL, NULL, &err));
+    bson_destroy(&cmd);
+    STRING_MAP victim_opts;
+    victim_opts["TEST"] = "bulkfail";
+    victim_opts["UNIQ"] = "victim";
+    EXPECT_TRUE(WriteStreamDataAsGridfs(gfs, "bulk_fail_victim", header, data, datalength, victim_opts));
+
+    STRING_MAP other_opts;
+    other_opts["TEST"] = "bulkfail";
+    other_opts["UNIQ"] = "other";
+    data[0] = 2.f;
+    MongoGridFsBulkWriter writer(GlobalEnv->client_, "test", "bulkfail");
+    EXPECT_TRUE(WriteStreamDataAsGridfs(&writer, "bulk_fail_victim", header, data, datalength, victim_opts));
+    EXPECT_TRUE(WriteStreamDataAsGridfs(&writer, "bulk_fail_other", header, data, datalength, other_opts));
+    EXPECT_FALSE(writer.Flush());
+    EXPECT_EQ(1, writer.WrittenCount());
+    ASSERT_EQ(1, writer.FailedFiles().size());
+    EXPECT_EQ("bulk_fail_victim", writer.FailedFiles()[0]);
+
+    // the old version survives since its replacement failed
+    float* read_data = nullptr;
+    STRDBL_MAP read_header = InitialHeader();
+    STRING_MAP header_str;
+    ASSERT_TRUE(ReadGridFsFile(gfs, "bulk_fail_victim", read_data, read_header, header_str, victim_opts));
+    EXPECT_FLOAT_EQ(1.f, read_data[0]);
+    Release1DArray(read_data);
+    ASSERT_TRUE(ReadGridFsFile(gfs, "bulk_fail_other", read_data, read_header, header_str, other_opts));
+    EXPECT_FLOAT_EQ(2.f, read_data[0]);
+    Release1DArray(read_data);
+
+    EXPECT_TRUE(mongoc_gridfs_drop(gfs->GetGridFs(), &err));
+    delete gfs;
+    Release1DArray(data);
+}
+
+TEST(MongoGridFS, asyncWriteBehind) {
+    int nrows = 50;
+    int ncols = 40;
+    float* data = nullptr;
+    Initialize1DArray(nrows * ncols, data, 0.f);
+    FltRaster* rs = new FltRaster(data, ncols, nrows, -9999.f, 30., 0., 0.);
+    Release1DArray(data);
+    MongoGridFs* gfs = GlobalEnv->client_->GridFs("test", "spatial");
+    ASSERT_NE(nullptr, gfs);
+    STRING_MAP opts;
+    opts["TEST"] = "async";
+    int nsteps = 10;
+    vector<std::shared_future<bool> > status;
+    {
+        // a small limit to exercise the backpressure
+        MongoGridFsAsyncWriter writer(gfs, 2 * nrows * ncols * sizeof(float));
+        for (int i = 0; i < nsteps; i++) {
+            rs->SetValue(0, 0, CVT_FLT(i)); // the computing of each time step
+            status.emplace_back(rs->OutputToMongoDBAsync(&writer, "async_" + ValueToString(i), opts));
+        }
+        rs->SetValue(0, 0, -1.f); // not affect the snapshots
+        status.emplace_back(rs->OutputToMongoDBAsync(&writer, "async_released", opts,
+                                                     true, true, true));
+        EXPECT_EQ(-1, rs->GetCellNumber()); // the raster data is given up
+        EXPECT_TRUE(writer.Flush());
+        EXPECT_EQ(0, writer.FailedCount());
+        // a throwing task and an empty task are reported as failed
+        std::shared_future<bool> thrown = writer.Submit([](MongoGridFs*) -> bool {
+            throw std::runtime_error("write failed");
+        }, 0);
+        std::shared_future<bool> empty = writer.Submit(MongoGridFsAsyncWriter::WriteTask(), 0);
+        EXPECT_FALSE(thrown.get());
+        EXPECT_FALSE(empty.get());
+        EXPECT_FALSE(writer.Flush());
+        EXPECT_EQ(2, writer.FailedCount());
+    }
+    for (auto it = status.begin(); it != status.end(); ++it) {
+        EXPECT_TRUE(it->get());
+    }
+    STRING_MAP filter;
+    filter["TEST"] = "async";
+    for (int i = 0; i <= nsteps; i++) {
+        string fname = i < nsteps ? "async_" + ValueToString(i) : "async_released";
+        float* read_data = nullptr;
+        STRDBL_MAP read_header = InitialHeader();
+        STRING_MAP header_str;
+        ASSERT_TRUE(ReadGridFsFile(gfs, fname, read_data, read_header, header_str, filter));
+        EXPECT_FLOAT_EQ(i < nsteps ? CVT_FLT(i) : -1.f, read_data[0]);
+        EXPECT_FLOAT_EQ(0.f, read_data[nrows * ncols - 1]);
+        Release1DArray(read_data);
+        gfs->RemoveFile(fname, NULL, filter);
+    }
+    delete rs;
+    delete gfs;
+}
+
+TEST(MongoGridFS, localCache) {
+    int datalength = 10000;
+    float* data = nullptr;
+    Initialize1DArray(datalength, data, 2.5f);
+    STRDBL_MAP header;
+    header[HEADER_RS_NROWS] = 100;
+    header[HEADER_RS_NCOLS] = 100;
+    header[HEADER_RS_LAYERS] = 1;
+    header[HEADER_RS_CELLSNUM] = datalength;
+    header[HEADER_RS_NODATA] = -9999.;
+    MongoGridFs* gfs = GlobalEnv->client_->GridFs("test", "spatial");
+    ASSERT_NE(nullptr, gfs);
+    string fname = "test_data_cached";
+    EXPECT_TRUE(WriteStreamDataAsGridfs(gfs, fname, header, data, datalength));
+    string cachedir = GetAppPath() + "./data/gridfsCache";
+    DeleteDirectory(cachedir);
+    LocalFileCache cache(cachedir, 1048576);
+    gfs->SetLocalCache(&cache);
+    for (int k = 0; k < 3; k++) {
+        if (k == 2) { // replaced file is never read from the stale entry
+            data[0] = 1.f;
+            EXPECT_TRUE(WriteStreamDataAsGridfs(gfs, fname, header, data, datalength));
+        }
+        float* read_data = nullptr;
+        STRDBL_MAP read_header = InitialHeader();
+        STRING_MAP header_str;
+        ASSERT_TRUE(ReadGridFsFile(gfs, fname, read_data, read_header, header_str, STRING_MAP()));
+        EXPECT_FLOAT_EQ(data[0], read_data[0]);
+        EXPECT_FLOAT_EQ(2.5f, read_data[datalength - 1]);
+        Release1DArray(read_data);
+    }
+    EXPECT_EQ(1, cache.Hits());
+    EXPECT_EQ(2, cache.Misses());
+    gfs->SetLocalCache(nullptr);
+    gfs->RemoveFile(fname);
+    delete gfs;
+    Release1DArray(data);
+    EXPECT_TRUE(DeleteDirectory(cachedir));
+}
+
+TEST(MongoGridFS, filesInfo) {
+    int datalength = 100;
+    float* data = nullptr;
+    Initialize1DArray(datalength, data, 3.f);
+    STRDBL_MAP header;
+    header[HEADER_RS_NROWS] = 10;
+    header[HEADER_RS_NCOLS] = 10;
+    header[HEADER_RS_LAYERS] = 1;
+    header[HEADER_RS_CELLSNUM] = datalength;
+    header[HEADER_RS_NODATA] = -9999.;
+    MongoGridFs* gfs = GlobalEnv->client_->GridFs("test", "spatial");
+    ASSERT_NE(nullptr, gfs);
+    vector<string> names;
+    for (int i = 0; i < 3; i++) {
+        names.emplace_back("test_info_" + ValueToString(i));
+        STRING_MAP opts;
+        opts["TEST"] = "info";
+        opts["INDEX"] = ValueToString(i);
+        EXPECT_TRUE(WriteStreamDataAsGridfs(gfs, names.back(), header, data, datalength, opts));
+    }
+    names.emplace_back("test_info_not_existed");
+    vector<GridFsFileInfo> infos;
+    ASSERT_TRUE(gfs->GetFilesInfo(names, infos));
+    ASSERT_EQ(3, infos.size());
+    // the cache is disabled by default, and absent names are cached only if requested
+    gfs->SetMetadataCacheTtl(10000);
+    ASSERT_TRUE(gfs->GetFilesInfo(names, infos));
+    ASSERT_EQ(3, infos.size());
+    MongoGridFs* other = GlobalEnv->client_->GridFs("test", "spatial");
+    ASSERT_NE(nullptr, other);
+    EXPECT_TRUE(WriteStreamDataAsGridfs(other, "test_info_not_existed", header, data, datalength,
+                                        STRING_MAP()));
+    EXPECT_TRUE(gfs->HasFile("test_info_not_existed")); // written by others is visible
+    other->RemoveFile("test_info_not_existed");
+    delete other;
+    ASSERT_TRUE(gfs->GetFilesInfo(names, infos, STRING_MAP(), true));
+    for (int i = 0; i < 3; i++) {
+        EXPECT_EQ(names[i], infos[i].filename);
+        EXPECT_EQ(datalength * sizeof(float), infos[i].length);
+        ASSERT_NE(nullptr, infos[i].metadata);
+        EXPECT_EQ(ValueToString(i), GetStringFromBson(infos[i].metadata.get(), "INDEX"));
+    }
+    // served by the cached files documents
+    EXPECT_FALSE(gfs->HasFile("test_info_not_existed"));
+    // written by the bulk writer of the same GridFS is refreshed
+    {
+        MongoGridFsBulkWriter writer(GlobalEnv->client_, "test", "spatial");
+        EXPECT_TRUE(WriteStreamDataAsGridfs(&writer, "test_info_not_existed", header, data, datalength,
+                                            STRING_MAP()));
+        EXPECT_TRUE(writer.Flush());
+    }
+    EXPECT_TRUE(gfs->HasFile("test_info_not_existed"));
+    gfs->RemoveFile("test_info_not_existed");
+    STRING_MAP filter;
+    filter["INDEX"] = "1";
+    EXPECT_TRUE(gfs->HasFile(names[1], filter));
+    EXPECT_FALSE(gfs->HasFile(names[2], filter));
+    bson_t* bmeta = gfs->GetFileMetadata(names[1], NULL, filter);
+    ASSERT_NE(nullptr, bmeta);
+    EXPECT_EQ("info", GetStringFromBson(bmeta, "TEST"));
+    bson_destroy(bmeta);
+    float* read_data = nullptr;
+    STRDBL_MAP read_header = InitialHeader();
+    STRING_MAP header_str;
+    ASSERT_TRUE(ReadGridFsFile(gfs, names[0], read_data, read_header, header_str, STRING_MAP()));
+    EXPECT_FLOAT_EQ(3.f, read_data[datalength - 1]);
+    Release1DArray(read_data);
+    // removed by this handle is refreshed
+    gfs->RemoveFile(names[0]);
+    EXPECT_FALSE(gfs->HasFile(names[0]));
+    gfs->RemoveFile(names[1]);
+    gfs->RemoveFile(names[2]);
+    gfs->SetMetadataCacheTtl(0);
+    delete gfs;
+    Release1DArray(data);
+}
+
+TEST(MongoGridFS, typedHeader) {
+    // Metadata of a small subset file as written by WriteStreamDataAsGridfs()
+    STRDBL_MAP header = InitialHeader();
+    header[HEADER_RS_NCOLS] = 256;
+    header[HEADER_RS_NROWS] = 128;
+    header[HEADER_RS_XLL] = 4.5;
+    header[HEADER_RS_YLL] = 102.25;
+    header[HEADER_RS_CELLSIZE] = 30.;
+    header[HEADER_RS_NODATA] = -9999.;
+    header[HEADER_RS_LAYERS] = 2;
+    header[HEADER_RS_CELLSNUM] = 256 * 128;
+    STRING_MAP opts;
+    opts[HEADER_RSOUT_DATATYPE] = "FLOAT";
+    opts[HEADER_RS_CODEC] = "DELTA+BITPACK";
+    opts[HEADER_RS_TILE_SIZE] = "64";
+    opts[HEADER_RS_TILE_INDEX] = "0,1024,2048,3072,4096,5120,6144,7168,8192";
+    opts[HEADER_RS_SRS] = "EPSG:32650";
+    opts["SUBBASINID"] = "17";
+    opts["SCENARIO"] = "0.5";
+    bson_t meta = BSON_INITIALIZER;
+    for (auto it = header.begin(); it != header.end(); ++it) {
+        BSON_APPEND_DOUBLE(&meta, it->first.c_str(), it->second);
+    }
+    AppendStringOptionsToBson(&meta, opts);
+
+    GridFsHeader gheader;
+    ASSERT_TRUE(gheader.Parse(&meta));
+    EXPECT_EQ(128, gheader.Rows());
+    EXPECT_EQ(256, gheader.Cols());
+    EXPECT_EQ(2, gheader.Layers());
+    EXPECT_EQ(256 * 128, gheader.CellsNumber());
+    EXPECT_DOUBLE_EQ(-9999., gheader.Nodata());
+    EXPECT_DOUBLE_EQ(102.25, gheader.Yll());
+    EXPECT_EQ(RDT_Float, gheader.DataType());
+    EXPECT_EQ("DELTA+BITPACK", gheader.Codec());
+    EXPECT_TRUE(gheader.Tiled());
+    EXPECT_EQ(64, gheader.TileSize());
+    vector<vint> offsets;
+    ASSERT_TRUE(gheader.TileOffsets(offsets));
+    ASSERT_EQ(9, offsets.size());
+    EXPECT_EQ(8192, offsets[8]);
+    string value;
+    EXPECT_TRUE(gheader.GetString("SUBBASINID", value));
+    EXPECT_EQ("17", value);
+    EXPECT_FALSE(gheader.GetString("NOT_EXISTED", value));
+    // Same header information as parsed one by one, TILE_INDEX is excluded by both
+    STRDBL_MAP header_dbl = InitialHeader();
+    STRING_MAP header_str;
+    ParseGridFsMetadata(&meta, header_dbl, header_str);
+    EXPECT_TRUE(header_str.find(HEADER_RS_TILE_INDEX) == header_str.end());
+    STRDBL_MAP typed_dbl = InitialHeader();
+    STRING_MAP typed_str;
+    gheader.ToHeaders(typed_dbl, typed_str);
+    EXPECT_TRUE(header_dbl == typed_dbl);
+    EXPECT_TRUE(header_str == typed_str);
+    // Binary tile index, i.e., 64-bit integers in little-endian
+    bson_t binary = BSON_INITIALIZER;
+    BSON_APPEND_INT32(&binary, HEADER_RS_TILE_SIZE, 64);
+    uint8_t index_bytes[16] = {0};
+    index_bytes[9] = 0x20; // 8192
+    BSON_APPEND_BINARY(&binary, HEADER_RS_TILE_INDEX, BSON_SUBTYPE_BINARY, index_bytes, 16);
+    ASSERT_TRUE(gheader.Parse(&binary));
+    ASSERT_TRUE(gheader.TileOffsets(offsets));
+    ASSERT_EQ(2, offsets.size());
+    EXPECT_EQ(0, offsets[0]);
+    EXPECT_EQ(8192, offsets[1]);
+    bson_destroy(&binary);
+    // Not tiled
+    bson_t plain = BSON_INITIALIZER;
+    BSON_APPEND_INT32(&plain, HEADER_RS_NROWS, 2);
+    ASSERT_TRUE(gheader.Parse(&plain));
+    EXPECT_FALSE(gheader.Tiled());
+    EXPECT_TRUE(gheader.Codec().empty());
+    EXPECT_EQ(RDT_Unknown, gheader.DataType());
+    EXPECT_EQ(CVT_INT(NODATA_VALUE), gheader.Cols());
+    EXPECT_FALSE(gheader.TileOffsets(offsets));
+    bson_destroy(&plain);
+
+    bson_destroy(&meta);
+}
+
 #endif /* USE_MONGODB */
@@ -1803,6 +1803,40 @@ TEST_P(clsRasterDataTestMaskWithin, NotMatchExactCalcPosUseMaskExt) {
     delete rs_;
 }
 
+TEST_P(clsRasterDataTestMaskWithin, BatchMask) {
+    // the raster twice, the mask (another grid geometry), and a nonexistent file
+    vector<vector<string> > filenames;
+    filenames.emplace_back(vector<string>(1, GetParam()->raster_name));
+    filenames.emplace_back(vector<string>(1, GetParam()->mask_name));
+    filenames.emplace_back(vector<string>(1, GetParam()->raster_name));
+    filenames.emplace_back(vector<string>(1, Apppath + "./data/raster/not_existed.asc"));
+    vector<double> defaults = {-9999., 0., 5., -9999.};
+    for (int calc_pos = 0; calc_pos < 2; calc_pos++) {
+        vector<FltIntRaster*> rasters;
+        int count = FltIntRaster::BatchMask(filenames, maskrs2_, rasters, calc_pos == 1, true, defaults);
+        EXPECT_EQ(3, count);
+        ASSERT_EQ(4, rasters.size());
+        EXPECT_EQ(nullptr, rasters[3]);
+        for (int i = 0; i < 3; i++) {
+            ASSERT_NE(nullptr, rasters[i]);
+            FltIntRaster* expected = FltIntRaster::Init(filenames[i][0], calc_pos == 1, maskrs2_,
+                                                        true, defaults[i]);
+            ASSERT_NE(nullptr, expected);
+            EXPECT_EQ(expected->GetCellNumber(), rasters[i]->GetCellNumber());
+            EXPECT_EQ(expected->GetRows(), rasters[i]->GetRows());
+            EXPECT_EQ(expected->GetCols(), rasters[i]->GetCols());
+            EXPECT_EQ(expected->PositionsCalculated(), rasters[i]->PositionsCalculated());
+            for (int ir = 0; ir < expected->GetRows(); ir++) {
+                for (int ic = 0; ic < expected->GetCols(); ic++) {
+                    EXPECT_FLOAT_EQ(expected->GetValue(ir, ic), rasters[i]->GetValue(ir, ic));
+                }
+            }
+            delete expected;
+            delete rasters[i];
+        }
+    }
+}
+
 #ifdef USE_GDAL
 INSTANTIATE_TEST_CASE_P(SingleLayer, clsRasterDataTestMaskWithin,
                         Values(new InputRasterFiles(AscFile, MaskAscFileS, MaskAscFileS2),
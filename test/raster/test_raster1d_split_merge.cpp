@@ -8,7 +8,7 @@
  *        Since we mainly support ASC and GDAL(e.g., TIFF),
  *        value-parameterized tests of Google Test will be used.
  * \cite https://github.com/google/googletest/blob/master/googletest/samples/sample7_unittest.cc
- * \version 1.2
+ * \version 1.3
  * \authors Liangjun Zhu, zlj(at)lreis.ac.cn; crazyzlj(at)gmail.com
  * \remarks 2021-12-12 - lj - Original version.
  *          2022-04-02 - lj - Add MongoDB supports.
@@ -334,15 +334,15 @@ TEST_P(clsRasterDataSplitMerge, MaskLyrIO) {
         EXPECT_EQ(full->g_erow, valid->g_erow);
         EXPECT_EQ(full->g_scol, valid->g_scol);
         EXPECT_EQ(full->g_ecol, valid->g_ecol);
-        EXPECT_NE(nullptr, full->data_);
-        EXPECT_EQ(nullptr, full->data2d_);
-        EXPECT_NE(nullptr, valid->data_);
-        EXPECT_EQ(nullptr, valid->data2d_);
+        EXPECT_NE(nullptr, full->GetData<double>());
+        EXPECT_EQ(nullptr, full->Get2DData<double>());
+        EXPECT_NE(nullptr, valid->GetData<double>());
+        EXPECT_EQ(nullptr, valid->Get2DData<double>());
         for (int i = 0; i < full->n_cells; i++) {
             EXPECT_EQ(full->local_pos_[i][0], valid->local_pos_[i][0]);
             EXPECT_EQ(full->local_pos_[i][1], valid->local_pos_[i][1]);
             EXPECT_EQ(full->local_posidx_[i], valid->local_posidx_[i]);
-            EXPECT_DOUBLE_EQ(full->data_[i], valid->data_[i]);
+            EXPECT_DOUBLE_EQ(full->GetData<double>()[i], valid->GetData<double>()[i]);
         }
     }
 
@@ -579,6 +579,426 @@ TEST_P(clsRasterDataSplitMerge, SplitRaster) {
 }
 
 
+// Rasters masked by the same mask layer share positions and subsets' positions,
+//   which are still valid after the mask layer is released.
+TEST_P(clsRasterDataSplitMerge, SharedPositions) {
+    EXPECT_TRUE(maskrsflt_->BuildSubSet());
+    int ncells = -1;
+    int* mask_posidx = nullptr;
+    maskrsflt_->GetRasterPositionData(&ncells, &mask_posidx);
+    ASSERT_NE(nullptr, mask_posidx);
+    EXPECT_NE(nullptr, maskrsflt_->GetSharedPositions());
+
+    float* values = nullptr;
+    Initialize1DArray(ncells, values, 0.f);
+    for (int i = 0; i < ncells; i++) { values[i] = CVT_FLT(i); }
+    FltRaster* rs1 = new FltRaster(maskrsflt_, values, ncells);
+    FltRaster* rs2 = new FltRaster(maskrsflt_, values, ncells);
+    EXPECT_EQ(mask_posidx, rs1->GetRasterPositionIndexPointer());
+    EXPECT_EQ(mask_posidx, rs2->GetRasterPositionIndexPointer());
+    EXPECT_EQ(maskrsflt_->GetSharedPositions(), rs1->GetSharedPositions());
+    EXPECT_FALSE(rs1->PositionsAllocated());
+    // Only position index is stored, and row/col pairs are materialized on demand
+    EXPECT_EQ(nullptr, maskrsflt_->GetSharedPositions()->pos_data);
+    int** rs1_posdata = rs1->GetRasterPositionDataPointer();
+    ASSERT_NE(nullptr, rs1_posdata);
+    EXPECT_EQ(rs1_posdata, maskrsflt_->GetSharedPositions()->pos_data);
+    EXPECT_EQ(rs1_posdata, rs2->GetRasterPositionDataPointer());
+    EXPECT_EQ(mask_posidx[ncells - 1] / maskrsflt_->GetCols(), rs1_posdata[ncells - 1][0]);
+    EXPECT_EQ(mask_posidx[ncells - 1] % maskrsflt_->GetCols(), rs1_posdata[ncells - 1][1]);
+
+    FltRaster* rs3 = FltRaster::Init(GetParam()->mask_name, true, maskrsflt_, true);
+    ASSERT_NE(nullptr, rs3);
+    EXPECT_EQ(mask_posidx, rs3->GetRasterPositionIndexPointer());
+    map<int, SubsetPositions*>& subset = maskrsflt_->GetSubset();
+    map<int, SubsetPositions*>& rs3_subset = rs3->GetSubset();
+    EXPECT_EQ(subset.size(), rs3_subset.size());
+    for (auto it = subset.begin(); it != subset.end(); ++it) {
+        ASSERT_TRUE(rs3_subset.find(it->first) != rs3_subset.end());
+        EXPECT_EQ(it->second->global_, rs3_subset.at(it->first)->global_);
+        EXPECT_EQ(it->second->local_posidx_, rs3_subset.at(it->first)->local_posidx_);
+    }
+
+    int row = mask_posidx[ncells - 1] / maskrsflt_->GetCols();
+    int col = mask_posidx[ncells - 1] % maskrsflt_->GetCols();
+    float lastv = rs3->GetValue(row, col);
+    // release mask layer first
+    delete maskrsflt_;
+    maskrsflt_ = nullptr;
+    EXPECT_EQ(nullptr, rs1->GetMask());
+    EXPECT_EQ(nullptr, rs3->GetMask());
+    EXPECT_FLOAT_EQ(CVT_FLT(ncells - 1), rs1->GetValueByIndex(ncells - 1));
+    EXPECT_FLOAT_EQ(CVT_FLT(ncells - 1), rs2->GetValueByIndex(ncells - 1));
+    EXPECT_FLOAT_EQ(lastv, rs3->GetValue(row, col));
+    for (auto it = rs3_subset.begin(); it != rs3_subset.end(); ++it) {
+        EXPECT_GE(it->second->global_[it->second->n_cells - 1], 0);
+        EXPECT_LT(it->second->global_[it->second->n_cells - 1], ncells);
+    }
+
+    delete rs1;
+    delete rs2;
+    delete rs3;
+    Release1DArray(values);
+}
+
+TEST_P(clsRasterDataSplitMerge, SubsetArena) {
+    EXPECT_TRUE(maskrsflt_->BuildSubSet());
+    map<int, SubsetPositions*>& subset = maskrsflt_->GetSubset();
+    ASSERT_FALSE(subset.empty());
+    std::shared_ptr<SubsetArena> arena = maskrsflt_->GetSubsetArena();
+    ASSERT_NE(nullptr, arena);
+    // All position tables are allocated from one reserved block
+    EXPECT_EQ(1, arena->GetBlockNumber());
+    EXPECT_LE(arena->GetUsedSize(), arena->GetMemorySize());
+    for (auto it = subset.begin(); it != subset.end(); ++it) {
+        EXPECT_EQ(arena, it->second->arena_);
+        EXPECT_FALSE(it->second->alloc_);
+        double* subdata = nullptr;
+        Initialize1DArray(it->second->n_cells, subdata, CVT_DBL(it->first));
+        EXPECT_TRUE(it->second->SetData(it->second->n_cells, subdata));
+        Release1DArray(subdata);
+    }
+    // Data of changed type reuse the released slot rather than growing the arena
+    SubsetPositions* first_sub = subset.begin()->second;
+    size_t used = arena->GetUsedSize();
+    for (int k = 0; k < 10; k++) {
+        int* intdata = nullptr;
+        Initialize1DArray(first_sub->n_cells, intdata, k);
+        EXPECT_TRUE(first_sub->SetData(first_sub->n_cells, intdata));
+        Release1DArray(intdata);
+        double* dbldata = nullptr;
+        Initialize1DArray(first_sub->n_cells, dbldata, CVT_DBL(subset.begin()->first));
+        EXPECT_TRUE(first_sub->SetData(first_sub->n_cells, dbldata));
+        Release1DArray(dbldata);
+    }
+    EXPECT_EQ(used, arena->GetUsedSize());
+
+    // Deep copy also allocates all subsets in one block
+    FltRaster* copyrs = new FltRaster();
+    copyrs->Copy(maskrsflt_);
+    map<int, SubsetPositions*>& copy_subset = copyrs->GetSubset();
+    EXPECT_EQ(subset.size(), copy_subset.size());
+    EXPECT_NE(arena, copyrs->GetSubsetArena());
+    EXPECT_EQ(1, copyrs->GetSubsetArena()->GetBlockNumber());
+    for (auto it = subset.begin(); it != subset.end(); ++it) {
+        SubsetPositions* sub = copy_subset.at(it->first);
+        EXPECT_NE(it->second->global_, sub->global_);
+        for (int i = 0; i < sub->n_cells; i++) {
+            EXPECT_EQ(it->second->global_[i], sub->global_[i]);
+            EXPECT_EQ(it->second->local_posidx_[i], sub->local_posidx_[i]);
+            EXPECT_EQ(it->second->local_pos_[i][1], sub->local_pos_[i][1]);
+            EXPECT_DOUBLE_EQ(CVT_DBL(it->first), sub->GetData<double>()[i]);
+        }
+    }
+
+    // Positions shared with masked rasters keep the arena alive
+    FltRaster* rs = FltRaster::Init(GetParam()->mask_name, true, maskrsflt_, true);
+    ASSERT_NE(nullptr, rs);
+    map<int, SubsetPositions*>& rs_subset = rs->GetSubset();
+    ASSERT_EQ(subset.size(), rs_subset.size());
+    int first_group = subset.begin()->first;
+    int* first_global = subset.begin()->second->global_;
+    EXPECT_EQ(first_global, rs_subset.at(first_group)->global_);
+    delete maskrsflt_;
+    maskrsflt_ = nullptr;
+    arena = nullptr;
+    SubsetPositions* rs_sub = rs_subset.at(first_group);
+    EXPECT_EQ(first_global, rs_sub->global_);
+    EXPECT_GE(rs_sub->global_[rs_sub->n_cells - 1], 0);
+    // Data of shallow copied subsets are allocated from its own arena
+    double* rsdata = nullptr;
+    Initialize1DArray(rs_sub->n_cells, rsdata, 1.);
+    EXPECT_TRUE(rs_sub->SetData(rs_sub->n_cells, rsdata));
+    EXPECT_EQ(rs->GetSubsetArena(), rs_sub->arena_);
+    EXPECT_GT(rs->GetSubsetArena()->GetUsedSize(), 0);
+    Release1DArray(rsdata);
+
+    delete rs;
+    delete copyrs;
+}
+
+TEST_P(clsRasterDataSplitMerge, TypedSubsetData) {
+    EXPECT_TRUE(maskrsflt_->BuildSubSet());
+    map<int, SubsetPositions*>& subset = maskrsflt_->GetSubset();
+    ASSERT_FALSE(subset.empty());
+    for (auto it = subset.begin(); it != subset.end(); ++it) {
+        EXPECT_EQ(RDT_Unknown, it->second->GetDataType());
+        int* subdata = nullptr;
+        Initialize1DArray(it->second->n_cells, subdata, it->first);
+        EXPECT_TRUE(it->second->SetData(it->second->n_cells, subdata));
+        Release1DArray(subdata);
+        // stored as int without conversion
+        EXPECT_EQ(RDT_Int32, it->second->GetDataType());
+        EXPECT_EQ(nullptr, it->second->GetData<double>());
+        ASSERT_NE(nullptr, it->second->GetData<int>());
+        EXPECT_EQ(it->first, it->second->GetData<int>()[it->second->n_cells - 1]);
+        // converted only when output
+        vector<float*> fulldata;
+        it->second->Output(-9999.f, fulldata);
+        ASSERT_EQ(1, fulldata.size());
+        int j = it->second->local_posidx_[0];
+        EXPECT_FLOAT_EQ(CVT_FLT(it->first), fulldata[0][j]);
+        Release1DArray(fulldata[0]);
+    }
+    // combine subsets of int to float raster, i.e., the subset values are the mask values
+    string outfile = Dstpath + "typed_" + maskrsflt_->GetCoreName() + "." + GetSuffix(GetParam()->mask_name);
+    EXPECT_TRUE(maskrsflt_->OutputSubsetToFile(false, true, outfile));
+    FltRaster* comb_rs = FltRaster::Init(PrefixCoreFileName(outfile, 0), true);
+    ASSERT_NE(nullptr, comb_rs);
+    EXPECT_EQ(maskrsflt_->GetCellNumber(), comb_rs->GetCellNumber());
+    for (int k = 0; k < comb_rs->GetCellNumber(); k++) {
+        EXPECT_FLOAT_EQ(maskrsflt_->GetValueByIndex(k), comb_rs->GetValueByIndex(k));
+    }
+    delete comb_rs;
+
+    // data in another type replaces the former one, and deep copy keeps the type
+    SubsetPositions* sub = subset.begin()->second;
+    double** data2d = nullptr;
+    Initialize2DArray(sub->n_cells, 2, data2d, 1.5);
+    EXPECT_TRUE(sub->Set2DData(sub->n_cells, 2, data2d));
+    Release2DArray(data2d);
+    EXPECT_EQ(RDT_Double, sub->GetDataType());
+    EXPECT_EQ(nullptr, sub->GetData<double>());
+    EXPECT_EQ(2, sub->n_lyrs);
+    SubsetPositions* copysub = new SubsetPositions(sub, true);
+    EXPECT_EQ(RDT_Double, copysub->GetDataType());
+    ASSERT_NE(nullptr, copysub->Get2DData<double>());
+    EXPECT_NE(sub->Get2DData<double>(), copysub->Get2DData<double>());
+    EXPECT_DOUBLE_EQ(1.5, copysub->Get2DData<double>()[sub->n_cells - 1][1]);
+    delete copysub;
+}
+
+TEST(HilbertCurveTest, IndexAndPartition) {
+    // Each cell is visited once, and consecutive cells along the curve are adjacent
+    int n = 8;
+    vector<int> rows(n * n, -1);
+    vector<int> cols(n * n, -1);
+    for (int row = 0; row < n; row++) {
+        for (int col = 0; col < n; col++) {
+            vint64_t d = HilbertCurveIndex(n, row, col);
+            ASSERT_GE(d, 0);
+            ASSERT_LT(d, n * n);
+            EXPECT_EQ(-1, rows[d]);
+            rows[d] = row;
+            cols[d] = col;
+        }
+    }
+    for (int d = 1; d < n * n; d++) {
+        EXPECT_EQ(1, abs(rows[d] - rows[d - 1]) + abs(cols[d] - cols[d - 1]));
+    }
+
+    // 6 rows * 5 cols, all valid
+    int ncells = 30;
+    int* posidx = nullptr;
+    Initialize1DArray(ncells, posidx, 0);
+    for (int i = 0; i < ncells; i++) { posidx[i] = i; }
+    vector<vector<int> > parts;
+    EXPECT_FALSE(PartitionByHilbertCurve(6, 5, ncells, posidx, nullptr, 0, parts));
+    EXPECT_TRUE(PartitionByHilbertCurve(6, 5, ncells, posidx, nullptr, 4, parts));
+    ASSERT_EQ(4, parts.size());
+    int count = 0;
+    for (auto it = parts.begin(); it != parts.end(); ++it) {
+        EXPECT_GE(it->size(), 7);
+        EXPECT_LE(it->size(), 8);
+        for (size_t i = 1; i < it->size(); i++) { EXPECT_LT(it->at(i - 1), it->at(i)); }
+        count += CVT_INT(it->size());
+    }
+    EXPECT_EQ(ncells, count);
+    // The first two cells along the curve weigh as much as the others
+    double* weights = nullptr;
+    Initialize1DArray(ncells, weights, 1.);
+    weights[0] = 14.;
+    weights[5] = 14.;
+    EXPECT_TRUE(PartitionByHilbertCurve(6, 5, ncells, posidx, weights, 2, parts));
+    ASSERT_EQ(2, parts.size());
+    ASSERT_EQ(2, parts[0].size());
+    EXPECT_EQ(0, parts[0][0]);
+    EXPECT_EQ(5, parts[0][1]);
+    EXPECT_EQ(28, parts[1].size());
+    Release1DArray(weights);
+    Release1DArray(posidx);
+}
+
+TEST_P(clsRasterDataSplitMerge, BalancedSubSet) {
+    EXPECT_FALSE(maskrsflt_->BuildBalancedSubSet(0));
+    EXPECT_TRUE(maskrsflt_->BuildBalancedSubSet(3));
+    map<int, SubsetPositions*>& subset = maskrsflt_->GetSubset();
+    ASSERT_EQ(3, subset.size());
+    int validnum = 0;
+    for (int i = 0; i < maskrsflt_->GetCellNumber(); i++) {
+        if (!FloatEqual(maskrsflt_->GetValueByIndex(i), maskrsflt_->GetNoDataValue())) { validnum++; }
+    }
+    int count = 0;
+    int minsize = validnum;
+    int maxsize = 0;
+    int ncols = maskrsflt_->GetCols();
+    int* posidx = maskrsflt_->GetRasterPositionIndexPointer();
+    for (auto it = subset.begin(); it != subset.end(); ++it) {
+        EXPECT_GE(it->first, 1);
+        EXPECT_LE(it->first, 3);
+        SubsetPositions* sub = it->second;
+        count += sub->n_cells;
+        if (sub->n_cells < minsize) { minsize = sub->n_cells; }
+        if (sub->n_cells > maxsize) { maxsize = sub->n_cells; }
+        for (int i = 0; i < sub->n_cells; i++) {
+            int row = posidx[sub->global_[i]] / ncols;
+            int col = posidx[sub->global_[i]] % ncols;
+            EXPECT_GE(row, sub->g_srow);
+            EXPECT_LE(row, sub->g_erow);
+            EXPECT_GE(col, sub->g_scol);
+            EXPECT_LE(col, sub->g_ecol);
+            EXPECT_EQ((row - sub->g_srow) * (sub->g_ecol - sub->g_scol + 1) + col - sub->g_scol,
+                      sub->local_posidx_[i]);
+        }
+        EXPECT_NE(nullptr, sub->GetSpans());
+    }
+    EXPECT_EQ(validnum, count);
+    EXPECT_LE(maxsize - minsize, 1);
+
+    // Weighted by the raster itself, and rebuild subsets
+    EXPECT_TRUE(maskrsflt_->BuildBalancedSubSet(2, maskrsflt_));
+    EXPECT_LE(maskrsflt_->GetSubset().size(), 2);
+    count = 0;
+    for (auto it = maskrsflt_->GetSubset().begin(); it != maskrsflt_->GetSubset().end(); ++it) {
+        count += it->second->n_cells;
+    }
+    EXPECT_EQ(validnum, count);
+}
+
+TEST_P(clsRasterDataSplitMerge, SubsetHalo) {
+    EXPECT_FALSE(maskrsflt_->BuildSubSetHalo(1)); // no subsets
+    EXPECT_TRUE(maskrsflt_->BuildSubSet());
+    EXPECT_FALSE(maskrsflt_->BuildSubSetHalo(0));
+    EXPECT_TRUE(maskrsflt_->BuildSubSetHalo(1));
+    map<int, SubsetPositions*>& subset = maskrsflt_->GetSubset();
+    int ncols = maskrsflt_->GetCols();
+    int* posidx = maskrsflt_->GetRasterPositionIndexPointer();
+    float* values = maskrsflt_->GetRasterDataPointer();
+    for (auto it = subset.begin(); it != subset.end(); ++it) {
+        SubsetPositions* sub = it->second;
+        ASSERT_NE(nullptr, sub->halo_);
+        std::shared_ptr<SubsetHalo> halo = sub->halo_;
+        EXPECT_EQ(1, halo->width);
+        float* subdata = nullptr;
+        Initialize1DArray(sub->n_cells, subdata, 0.f);
+        for (int i = 0; i < sub->n_cells; i++) { subdata[i] = values[sub->global_[i]]; }
+        EXPECT_TRUE(sub->SetData(sub->n_cells, subdata));
+        Release1DArray(subdata);
+        int planned = 0;
+        for (auto pit = halo->plan.begin(); pit != halo->plan.end(); ++pit) {
+            EXPECT_NE(it->first, pit->owner);
+            ASSERT_TRUE(subset.find(pit->owner) != subset.end());
+            planned += CVT_INT(pit->ghost.size());
+        }
+        EXPECT_EQ(halo->n_cells, planned);
+        for (int i = 0; i < halo->n_cells; i++) {
+            int vi = halo->global[i];
+            int row = posidx[vi] / ncols - sub->g_srow;
+            int col = posidx[vi] % ncols - sub->g_scol;
+            EXPECT_EQ(i, halo->GetIndex(row, col));
+            // adjacent to at least one cell of the subset
+            bool adjacent = false;
+            for (int dr = -1; dr <= 1 && !adjacent; dr++) {
+                for (int dc = -1; dc <= 1 && !adjacent; dc++) {
+                    std::shared_ptr<ValidCellSpans> spans = sub->GetSpans();
+                    if (spans->GetIndex(row + dr, col + dc) >= 0) { adjacent = true; }
+                }
+            }
+            EXPECT_TRUE(adjacent);
+        }
+    }
+    for (auto it = subset.begin(); it != subset.end(); ++it) {
+        std::shared_ptr<SubsetHalo> halo = it->second->halo_;
+        if (halo->n_cells == 0) { continue; }
+        float* gathered = nullptr;
+        float* exchanged = nullptr;
+        Initialize1DArray(halo->n_cells, gathered, -1.f);
+        Initialize1DArray(halo->n_cells, exchanged, -2.f);
+        EXPECT_TRUE(it->second->GatherHalo(values, gathered));
+        EXPECT_TRUE(it->second->ExchangeHalo(subset, exchanged));
+        EXPECT_FALSE(it->second->ExchangeHalo(subset, reinterpret_cast<int*>(exchanged)));
+        for (int i = 0; i < halo->n_cells; i++) {
+            EXPECT_FLOAT_EQ(gathered[i], exchanged[i]);
+            EXPECT_NE(CVT_FLT(it->first), gathered[i]); // owned by other subsets
+        }
+        Release1DArray(gathered);
+        Release1DArray(exchanged);
+    }
+}
+
+TEST_P(clsRasterDataSplitMerge, ParallelSubsetOutput) {
+    EXPECT_TRUE(maskrsflt_->BuildSubSet());
+    map<int, SubsetPositions*>& subset = maskrsflt_->GetSubset();
+    ASSERT_FALSE(subset.empty());
+    string suffix = "." + GetSuffix(GetParam()->mask_name);
+    string serialfile = Dstpath + "serial_" + maskrsflt_->GetCoreName() + suffix;
+    string parallelfile = Dstpath + "parallel_" + maskrsflt_->GetCoreName() + suffix;
+    EXPECT_TRUE(maskrsflt_->OutputSubsetToFile(true, false, serialfile,
+                                               map<vint, vector<double> >(), NODATA_VALUE, 1));
+    EXPECT_TRUE(maskrsflt_->OutputSubsetToFile(true, false, parallelfile,
+                                               map<vint, vector<double> >(), NODATA_VALUE, 3));
+    for (auto it = subset.begin(); it != subset.end(); ++it) {
+        FltRaster* serial_rs = FltRaster::Init(PrefixCoreFileName(serialfile, it->first), true);
+        FltRaster* parallel_rs = FltRaster::Init(PrefixCoreFileName(parallelfile, it->first), true);
+        ASSERT_NE(nullptr, serial_rs);
+        ASSERT_NE(nullptr, parallel_rs);
+        EXPECT_EQ(it->second->n_cells, parallel_rs->GetCellNumber());
+        EXPECT_EQ(serial_rs->GetRows(), parallel_rs->GetRows());
+        EXPECT_EQ(serial_rs->GetCols(), parallel_rs->GetCols());
+        EXPECT_EQ(serial_rs->GetCellNumber(), parallel_rs->GetCellNumber());
+        for (int k = 0; k < parallel_rs->GetCellNumber(); k++) {
+            EXPECT_FLOAT_EQ(CVT_FLT(it->first), parallel_rs->GetValueByIndex(k));
+            EXPECT_FLOAT_EQ(serial_rs->GetValueByIndex(k), parallel_rs->GetValueByIndex(k));
+        }
+        delete serial_rs;
+        delete parallel_rs;
+    }
+}
+
+TEST_P(clsRasterDataSplitMerge, CombinePlan) {
+    EXPECT_TRUE(maskrsflt_->BuildSubSet());
+    map<int, SubsetPositions*>& subset = maskrsflt_->GetSubset();
+    ASSERT_FALSE(subset.empty());
+    std::shared_ptr<SubsetCombinePlan> plan = maskrsflt_->GetCombinePlan();
+    ASSERT_NE(nullptr, plan);
+    EXPECT_EQ(plan, maskrsflt_->GetCombinePlan()); // reused until subsets changed
+    EXPECT_NE(plan, maskrsflt_->GetCombinePlan(false));
+    plan = maskrsflt_->GetCombinePlan();
+    ASSERT_EQ(subset.size(), plan->subs.size());
+    int* posidx = maskrsflt_->GetRasterPositionIndexPointer();
+    size_t i = 0;
+    for (auto it = subset.begin(); it != subset.end(); ++it, i++) {
+        EXPECT_EQ(it->first, plan->ids[i]);
+        const int* dst = plan->GetDestination(i);
+        for (int vi = 0; vi < it->second->n_cells; vi++) {
+            EXPECT_EQ(posidx[it->second->global_[vi]], dst[vi]);
+        }
+    }
+    EXPECT_EQ(CVT_SIZET(maskrsflt_->GetValidNumber()), plan->dst.size());
+
+    // reclassified by subset ID, and missed IDs use the default value
+    map<vint, vector<double> > recls;
+    for (auto it = subset.begin(); it != subset.end(); ++it) {
+        if (it == subset.begin()) { continue; }
+        recls[it->first] = vector<double>(1, it->first * 10.);
+    }
+    string outfile = Dstpath + "recls_" + maskrsflt_->GetCoreName() + "." + GetSuffix(GetParam()->mask_name);
+    EXPECT_TRUE(maskrsflt_->OutputSubsetToFile(false, true, outfile, recls, -1.));
+    FltRaster* comb_rs = FltRaster::Init(PrefixCoreFileName(outfile, 0), true);
+    ASSERT_NE(nullptr, comb_rs);
+    EXPECT_EQ(maskrsflt_->GetCellNumber(), comb_rs->GetCellNumber());
+    for (int k = 0; k < comb_rs->GetCellNumber(); k++) {
+        float maskv = maskrsflt_->GetValueByIndex(k);
+        float expected = FloatEqual(maskv, CVT_FLT(subset.begin()->first)) ? -1.f : maskv * 10.f;
+        EXPECT_FLOAT_EQ(expected, comb_rs->GetValueByIndex(k));
+    }
+    delete comb_rs;
+
+    EXPECT_TRUE(maskrsflt_->RebuildSubSet());
+    EXPECT_NE(plan, maskrsflt_->GetCombinePlan());
+}
+
+
 #ifdef USE_GDAL
 INSTANTIATE_TEST_CASE_P(SingleLayer, clsRasterDataSplitMerge,
                         Values(new InputRasterFiles(mask_asc_file, rs1_asc),
@@ -389,16 +389,16 @@ TEST_P(clsRasterData2DSplitMerge, MaskLyrIO) {
         EXPECT_EQ(full->g_erow, valid->g_erow);
         EXPECT_EQ(full->g_scol, valid->g_scol);
         EXPECT_EQ(full->g_ecol, valid->g_ecol);
-        EXPECT_EQ(nullptr, full->data_);
-        EXPECT_NE(nullptr, full->data2d_);
-        EXPECT_EQ(nullptr, valid->data_);
-        EXPECT_NE(nullptr, valid->data2d_);
+        EXPECT_EQ(nullptr, full->GetData<double>());
+        EXPECT_NE(nullptr, full->Get2DData<double>());
+        EXPECT_EQ(nullptr, valid->GetData<double>());
+        EXPECT_NE(nullptr, valid->Get2DData<double>());
         for (int i = 0; i < full->n_cells; i++) {
             EXPECT_EQ(full->local_pos_[i][0], valid->local_pos_[i][0]);
             EXPECT_EQ(full->local_pos_[i][1], valid->local_pos_[i][1]);
             EXPECT_EQ(full->local_posidx_[i], valid->local_posidx_[i]);
             for (int l = 0; l < newlyrs; l++) {
-                EXPECT_DOUBLE_EQ(full->data2d_[i][l], valid->data2d_[i][l]);
+                EXPECT_DOUBLE_EQ(full->Get2DData<double>()[i][l], valid->Get2DData<double>()[i][l]);
             }
         }
     }
@@ -0,0 +1,181 @@
+/*!
+ * \brief Test description
+ *
+ *        TEST CASE NAME (or TEST SUITE):
+ *            clsRasterCacheTest: Share read-only raster data by clsRasterCache,
+ *                                including hit/miss counters, copy-on-write, and eviction.
+ *
+ * \version 1.0
+ *
+ */
+#include "gtest/gtest.h"
+#include "../../src/data_raster.hpp"
+#include "../../src/utils_filesystem.h"
+#include "../test_global.h"
+
+using namespace ccgl;
+using namespace ccgl::data_raster;
+using namespace ccgl::utils_filesystem;
+
+extern GlobalEnvironment* GlobalEnv;
+
+namespace {
+string Rspath = GetAppPath() + "./data/raster/";
+string mask_asc = Rspath + "tinydemo_raster_r4c7.asc";
+string rs_asc = Rspath + "tinydemo_raster_r5c8.asc";
+
+TEST(clsRasterCacheTest, ShareAndCopyOnWrite) {
+    clsRasterCache<float, int>& cache = clsRasterCache<float, int>::Instance();
+    cache.Clear();
+    cache.ResetCounters();
+    cache.SetMemoryBudget(0);
+
+    IntRaster* mask = IntRaster::Init(mask_asc, true);
+    ASSERT_NE(nullptr, mask);
+
+    clsRasterData<float, int>* rs1 = cache.Acquire(rs_asc, true, mask, true);
+    ASSERT_NE(nullptr, rs1);
+    clsRasterData<float, int>* rs2 = cache.Acquire(rs_asc, true, mask, true);
+    ASSERT_NE(nullptr, rs2);
+    EXPECT_EQ(1, cache.GetMissCount());
+    EXPECT_EQ(1, cache.GetHitCount());
+    EXPECT_EQ(1, cache.GetEntryCount());
+    EXPECT_GT(cache.GetMemoryUsage(), 0);
+
+    // The same immutable buffer is shared, and read by const pointers without copying
+    const clsRasterData<float, int>* crs1 = rs1;
+    const clsRasterData<float, int>* crs2 = rs2;
+    const clsRasterData<float, int>* crs3 = nullptr;
+    EXPECT_TRUE(rs1->IsSharedData());
+    EXPECT_TRUE(rs2->IsSharedData());
+    EXPECT_EQ(crs1->GetRasterDataPointer(), crs2->GetRasterDataPointer());
+    EXPECT_EQ(rs1->GetRasterPositionIndexPointer(), rs2->GetRasterPositionIndexPointer());
+    EXPECT_EQ(rs1->GetCellNumber(), rs2->GetCellNumber());
+    EXPECT_FLOAT_EQ(rs1->GetValue(2, 2), rs2->GetValue(2, 2));
+
+    // Different options lead to another entry
+    clsRasterData<float, int>* rs3 = cache.Acquire(rs_asc, true);
+    ASSERT_NE(nullptr, rs3);
+    crs3 = rs3;
+    EXPECT_EQ(2, cache.GetMissCount());
+    EXPECT_EQ(2, cache.GetEntryCount());
+    EXPECT_NE(crs1->GetRasterDataPointer(), crs3->GetRasterDataPointer());
+    EXPECT_TRUE(rs3->IsSharedData());
+
+    // Copy-on-write
+    float origin = rs1->GetValue(2, 2);
+    rs2->SetValue(2, 2, origin + 10.f);
+    EXPECT_FALSE(rs2->IsSharedData());
+    EXPECT_NE(crs1->GetRasterDataPointer(), crs2->GetRasterDataPointer());
+    EXPECT_FLOAT_EQ(origin + 10.f, rs2->GetValue(2, 2));
+    EXPECT_FLOAT_EQ(origin, rs1->GetValue(2, 2));
+    // Mutable pointer gets a private copy
+    const float* shared_data = crs1->GetRasterDataPointer();
+    float* private_data = rs1->GetRasterDataPointer();
+    EXPECT_FALSE(rs1->IsSharedData());
+    EXPECT_NE(shared_data, private_data);
+    private_data[0] += 1.f;
+    EXPECT_FLOAT_EQ(shared_data[0] + 1.f, private_data[0]);
+    rs1->ReplaceNoData(-1.f);
+    EXPECT_FALSE(rs1->IsSharedData());
+
+    // Entries referenced by rs3 will not be evicted
+    delete rs1;
+    delete rs2;
+    cache.SetMemoryBudget(1);
+    EXPECT_EQ(1, cache.GetEntryCount());
+    EXPECT_EQ(1, cache.GetEvictionCount());
+    EXPECT_TRUE(rs3->IsSharedData());
+    EXPECT_FLOAT_EQ(1.1f, rs3->GetValue(0, 1));
+    delete rs3;
+    cache.Trim();
+    EXPECT_EQ(0, cache.GetEntryCount());
+    EXPECT_EQ(0, cache.GetMemoryUsage());
+
+    // Mask identity is part of the key
+    clsRasterData<float, int>* rs4 = cache.Acquire(rs_asc, true, mask, true);
+    ASSERT_NE(nullptr, rs4);
+    IntRaster* mask2 = IntRaster::Init(mask_asc, true);
+    clsRasterData<float, int>* rs5 = cache.Acquire(rs_asc, true, mask2, true);
+    ASSERT_NE(nullptr, rs5);
+    const clsRasterData<float, int>* crs4 = rs4;
+    const clsRasterData<float, int>* crs5 = rs5;
+    EXPECT_NE(crs4->GetRasterDataPointer(), crs5->GetRasterDataPointer());
+    delete rs4;
+    delete rs5;
+    cache.Clear();
+    EXPECT_EQ(0, cache.GetEntryCount());
+
+    delete mask;
+    delete mask2;
+}
+
+TEST(clsRasterCacheTest, ReloadRewrittenFile) {
+    clsRasterCache<float, int>& cache = clsRasterCache<float, int>::Instance();
+    cache.Clear();
+    cache.ResetCounters();
+    string rewritten = Rspath + "result/cache_rewritten.asc";
+    string content = "ncols 2\nnrows 1\nxllcorner 0\nyllcorner 0\ncellsize 1\nNODATA_value -9999\n";
+    std::ofstream ofs(rewritten.c_str());
+    ofs << content << "1 2" << endl;
+    ofs.close();
+    clsRasterData<float, int>* rs1 = cache.Acquire(rewritten);
+    ASSERT_NE(nullptr, rs1);
+    EXPECT_FLOAT_EQ(1.f, rs1->GetValue(0, 0));
+    // Rewritten within the same second, the size differs
+    ofs.open(rewritten.c_str());
+    ofs << content << "10 2" << endl;
+    ofs.close();
+    clsRasterData<float, int>* rs2 = cache.Acquire(rewritten);
+    ASSERT_NE(nullptr, rs2);
+    EXPECT_EQ(2, cache.GetMissCount());
+    EXPECT_FLOAT_EQ(10.f, rs2->GetValue(0, 0));
+    delete rs1;
+    delete rs2;
+    cache.Clear();
+    DeleteExistedFile(rewritten);
+}
+
+TEST(clsRasterCacheTest, WriteThroughGetRasterData) {
+    clsRasterCache<float, int>& cache = clsRasterCache<float, int>::Instance();
+    cache.Clear();
+    // 1D raster
+    clsRasterData<float, int>* rs1 = cache.Acquire(rs_asc, true);
+    ASSERT_NE(nullptr, rs1);
+    int ncells = -1;
+    float* data = nullptr;
+    ASSERT_TRUE(rs1->GetRasterData(&ncells, &data));
+    EXPECT_FALSE(rs1->IsSharedData());
+    float origin = data[0];
+    data[0] = origin + 10.f;
+    clsRasterData<float, int>* rs2 = cache.Acquire(rs_asc, true);
+    ASSERT_NE(nullptr, rs2);
+    EXPECT_TRUE(rs2->IsSharedData());
+    const clsRasterData<float, int>* crs2 = rs2;
+    EXPECT_FLOAT_EQ(origin, crs2->GetRasterDataPointer()[0]);
+    delete rs1;
+    delete rs2;
+    // 2D raster
+    vector<string> files;
+    files.push_back(Rspath + "tinydemo_raster_r5c8.asc");
+    files.push_back(Rspath + "tinydemo_raster_r5c8_2.asc");
+    files.push_back(Rspath + "tinydemo_raster_r5c8_3.asc");
+    clsRasterData<float, int>* rs3 = cache.Acquire(files, true);
+    ASSERT_NE(nullptr, rs3);
+    int nlyrs = -1;
+    float** data2d = nullptr;
+    ASSERT_TRUE(rs3->Get2DRasterData(&ncells, &nlyrs, &data2d));
+    EXPECT_FALSE(rs3->IsSharedData());
+    origin = data2d[0][1];
+    data2d[0][1] = origin + 10.f;
+    clsRasterData<float, int>* rs4 = cache.Acquire(files, true);
+    ASSERT_NE(nullptr, rs4);
+    EXPECT_TRUE(rs4->IsSharedData());
+    const clsRasterData<float, int>* crs4 = rs4;
+    EXPECT_FLOAT_EQ(origin, crs4->Get2DRasterDataPointer()[0][1]);
+    delete rs3;
+    delete rs4;
+    cache.Clear();
+}
+
+} /* namespace */
@@ -207,6 +207,59 @@ TEST(clsRasterDataFailedConstructor, FailedCases) {
     delete noexisted_rs;
 }
 
+TEST(clsRasterDataMoveAndView, ASCFile) {
+    IntRaster rs(not_std_asc, true);
+    EXPECT_TRUE(rs.ValidateRasterData());
+    int* data = rs.GetRasterDataPointer();
+    int* posidx = rs.GetRasterPositionIndexPointer();
+    EXPECT_NE(nullptr, data);
+    EXPECT_NE(nullptr, posidx);
+    if (HasFailure()) { return; }
+    EXPECT_EQ(2, rs.GetCellNumber());
+
+    // Move constructor takes over data without copying
+    IntRaster moved(std::move(rs));
+    EXPECT_EQ(data, moved.GetRasterDataPointer());
+    EXPECT_EQ(posidx, moved.GetRasterPositionIndexPointer());
+    EXPECT_EQ(2, moved.GetCellNumber());
+    EXPECT_TRUE(moved.PositionsAllocated());
+    EXPECT_FALSE(rs.ValidateRasterData());
+    EXPECT_EQ(nullptr, rs.GetRasterDataPointer());
+    EXPECT_EQ(nullptr, rs.GetRasterPositionIndexPointer());
+
+    // Move assignment and storing in containers
+    vector<IntRaster> rasters;
+    rasters.emplace_back(std::move(moved));
+    rasters.emplace_back(IntRaster(not_std_asc, true));
+    rasters[1] = std::move(rasters[0]);
+    EXPECT_EQ(data, rasters[1].GetRasterDataPointer());
+    EXPECT_EQ(nullptr, rasters[0].GetRasterDataPointer());
+
+    // Rasters masked by a moved raster see the mask released
+    IntRaster mask(not_std_asc, true);
+    int values[2] = {1, 2};
+    IntRaster masked(&mask, values, 2);
+    EXPECT_EQ(&mask, masked.GetMask());
+    IntRaster new_mask(std::move(mask));
+    EXPECT_EQ(nullptr, masked.GetMask());
+
+    // Read-only view
+    RasterView<int> view = rasters[1].GetView();
+    EXPECT_TRUE(view.Valid());
+    EXPECT_EQ(data, view.GetRasterDataPointer());
+    EXPECT_EQ(posidx, view.GetRasterPositionIndexPointer());
+    EXPECT_EQ(2, view.GetCellNumber());
+    EXPECT_EQ(2, view.GetRows());
+    EXPECT_EQ(2, view.GetCols());
+    EXPECT_TRUE(view.PositionsOwned());
+    for (int i = 0; i < view.GetRows(); i++) {
+        for (int j = 0; j < view.GetCols(); j++) {
+            EXPECT_EQ(rasters[1].GetValue(i, j), view.GetValue(i, j));
+        }
+    }
+    EXPECT_FALSE(RasterView<int>().Valid());
+}
+
 #ifdef USE_GDAL
 TEST(clsRasterDataUnsignedByte, FullIO) {
     clsRasterData<vuint8_t>* mask_rs = clsRasterData<vuint8_t>::Init(rs_mask);
@@ -554,4 +607,107 @@ TEST(clsRasterDataDouble, FullIO) {
 
 #endif
 
+TEST(RasterDataTypeStream, ConvertChunks) {
+    EXPECT_EQ(0, RasterDataTypeSize(RDT_Unknown));
+    EXPECT_EQ(1, RasterDataTypeSize(RDT_Int8));
+    EXPECT_EQ(2, RasterDataTypeSize(RDT_UInt16));
+    EXPECT_EQ(4, RasterDataTypeSize(RDT_Float));
+    EXPECT_EQ(8, RasterDataTypeSize(RDT_Int64));
+
+    vint16_t src[5] = {-3, 0, 7, 300, -32768};
+    // unaligned stream
+    char buf[sizeof(src) + 1];
+    memcpy(buf + 1, src, sizeof(src));
+    double dst[5];
+    EXPECT_TRUE(ConvertStreamValues(RDT_Int16, buf + 1, 5, dst));
+    for (int i = 0; i < 5; i++) {
+        EXPECT_DOUBLE_EQ(CVT_DBL(src[i]), dst[i]);
+    }
+    float fsrc[3] = {1.5f, -2.25f, 1e6f};
+    int idst[3];
+    EXPECT_TRUE(ConvertStreamValues(RDT_Float, reinterpret_cast<const char*>(fsrc), 3, idst));
+    EXPECT_EQ(1, idst[0]);
+    EXPECT_EQ(-2, idst[1]);
+    EXPECT_EQ(1000000, idst[2]);
+    EXPECT_FALSE(ConvertStreamValues(RDT_Unknown, buf, 1, dst));
+
+    // round trip through an unaligned stream of another type
+    char out[sizeof(vint32_t) * 5 + 1];
+    EXPECT_TRUE(ConvertToStreamValues(RDT_Int32, dst, 5, out + 1));
+    vint16_t back[5];
+    EXPECT_TRUE(ConvertStreamValues(RDT_Int32, out + 1, 5, back));
+    for (int i = 0; i < 5; i++) {
+        EXPECT_EQ(src[i], back[i]);
+    }
+    EXPECT_FALSE(ConvertToStreamValues(RDT_Unknown, dst, 1, out));
+}
+
+TEST(RasterTilesTest, TilesInWindow) {
+    EXPECT_FALSE(RasterTiles(0, 5, 2).Valid());
+    RasterTiles tiles(5, 7, 3); // 2 x 3 tiles, the last row and column are smaller
+    EXPECT_TRUE(tiles.Valid());
+    EXPECT_EQ(6, tiles.Count());
+    EXPECT_EQ(9, tiles.CellsNumber(0));
+    EXPECT_EQ(3, tiles.CellsNumber(2));
+    EXPECT_EQ(2, tiles.CellsNumber(5));
+    int srow, erow, scol, ecol;
+    tiles.Extent(5, srow, erow, scol, ecol);
+    EXPECT_EQ(3, srow);
+    EXPECT_EQ(4, erow);
+    EXPECT_EQ(6, scol);
+    EXPECT_EQ(6, ecol);
+
+    vector<int> tile_ids;
+    EXPECT_TRUE(tiles.InWindow(2, 3, 2, 3, tile_ids));
+    ASSERT_EQ(4, tile_ids.size());
+    EXPECT_EQ(0, tile_ids[0]);
+    EXPECT_EQ(1, tile_ids[1]);
+    EXPECT_EQ(3, tile_ids[2]);
+    EXPECT_EQ(4, tile_ids[3]);
+    EXPECT_FALSE(tiles.InWindow(0, 5, 0, 0, tile_ids));
+
+    vector<vint> offsets;
+    tiles.RawOffsets(2, sizeof(float), offsets);
+    ASSERT_EQ(7, offsets.size());
+    EXPECT_EQ(0, offsets[0]);
+    EXPECT_EQ(9 * 2 * 4, offsets[1]);
+    EXPECT_EQ(5 * 7 * 2 * 4, offsets[6]);
+}
+
+TEST(RasterTilesTest, WindowFromTiles) {
+    int nrows = 5;
+    int ncols = 7;
+    int nlyrs = 2;
+    vector<float> values(nrows * ncols * nlyrs);
+    for (size_t i = 0; i < values.size(); i++) { values[i] = CVT_FLT(i); }
+    RasterTiles tiles(nrows, ncols, 3);
+    vector<vint> offsets;
+    tiles.RawOffsets(nlyrs, sizeof(vint32_t), offsets);
+    vector<char> stream(offsets.back());
+    for (int i = 0; i < tiles.Count(); i++) {
+        EXPECT_TRUE(ConvertToTileValues(tiles, i, nlyrs, RDT_Int32, values.data(), ncols,
+                                        stream.data() + offsets[i]));
+    }
+    // window across four tiles
+    int srow = 1;
+    int erow = 4;
+    int scol = 2;
+    int ecol = 5;
+    vector<int> tile_ids;
+    EXPECT_TRUE(tiles.InWindow(srow, erow, scol, ecol, tile_ids));
+    vector<double> window((erow - srow + 1) * (ecol - scol + 1) * nlyrs, -1.);
+    for (auto it = tile_ids.begin(); it != tile_ids.end(); ++it) {
+        EXPECT_TRUE(ConvertTileValues(tiles, *it, nlyrs, RDT_Int32, stream.data() + offsets[*it],
+                                      srow, erow, scol, ecol, window.data()));
+    }
+    int idx = 0;
+    for (int i = srow; i <= erow; i++) {
+        for (int j = scol; j <= ecol; j++) {
+            for (int k = 0; k < nlyrs; k++) {
+                EXPECT_DOUBLE_EQ(values[(i * ncols + j) * nlyrs + k], window[idx++]);
+            }
+        }
+    }
+}
+
 } /* namespace */
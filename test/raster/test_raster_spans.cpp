@@ -0,0 +1,127 @@
+/*!
+ * \brief Test description
+ *
+ *        TEST CASE NAME (or TEST SUITE):
+ *            ValidCellSpansTest: Run-length compressed valid cells, including lookup,
+ *                                span iteration, and conversion from/to position index.
+ *
+ * \version 1.0
+ *
+ */
+#include "gtest/gtest.h"
+#include "../../src/data_raster.hpp"
+#include "../../src/utils_filesystem.h"
+#include "../test_global.h"
+
+using namespace ccgl;
+using namespace ccgl::data_raster;
+using namespace ccgl::utils_filesystem;
+
+extern GlobalEnvironment* GlobalEnv;
+
+namespace {
+string Rspath = GetAppPath() + "./data/raster/";
+string mask_asc = Rspath + "tinydemo_raster_r4c7.asc";
+
+TEST(ValidCellSpansTest, BuildAndLookup) {
+    // 4 rows * 5 cols
+    //   0 1 1 0 1
+    //   1 1 1 1 1
+    //   0 0 0 0 0
+    //   0 0 0 1 1
+    int posidx[] = {1, 2, 4, 5, 6, 7, 8, 9, 18, 19};
+    int n = 10;
+    ValidCellSpans spans(4, 5, n, posidx);
+    EXPECT_EQ(4, spans.GetRows());
+    EXPECT_EQ(5, spans.GetCols());
+    EXPECT_EQ(n, spans.GetCellNumber());
+    EXPECT_EQ(4, spans.GetSpanNumber());
+
+    const vector<ValidCellSpans::Span>& runs = spans.GetSpans();
+    EXPECT_EQ(0, runs[0].row);
+    EXPECT_EQ(1, runs[0].scol);
+    EXPECT_EQ(2, runs[0].ecol);
+    EXPECT_EQ(0, runs[0].offset);
+    EXPECT_EQ(4, runs[1].scol);
+    EXPECT_EQ(2, runs[1].offset);
+    EXPECT_EQ(1, runs[2].row);
+    EXPECT_EQ(0, runs[2].scol);
+    EXPECT_EQ(4, runs[2].ecol);
+    EXPECT_EQ(3, runs[2].offset);
+    EXPECT_EQ(3, runs[3].row);
+    EXPECT_EQ(8, runs[3].offset);
+
+    int first = -1;
+    int last = -1;
+    EXPECT_TRUE(spans.GetRowSpans(2, &first, &last));
+    EXPECT_EQ(first, last); // no valid cells
+    EXPECT_TRUE(spans.GetRowSpans(0, &first, &last));
+    EXPECT_EQ(0, first);
+    EXPECT_EQ(2, last);
+    EXPECT_FALSE(spans.GetRowSpans(4, &first, &last));
+
+    for (int i = 0; i < n; i++) {
+        EXPECT_EQ(i, spans.GetIndex(posidx[i] / 5, posidx[i] % 5));
+        int row = -1;
+        int col = -1;
+        EXPECT_TRUE(spans.GetRowCol(i, &row, &col));
+        EXPECT_EQ(posidx[i], row * 5 + col);
+    }
+    EXPECT_EQ(-1, spans.GetIndex(0, 0));
+    EXPECT_EQ(-1, spans.GetIndex(2, 3));
+    EXPECT_EQ(-1, spans.GetIndex(3, 5));
+    EXPECT_FALSE(spans.GetRowCol(n, &first, &last));
+
+    int converted[10];
+    EXPECT_TRUE(spans.ToPositionIndex(converted));
+    for (int i = 0; i < n; i++) { EXPECT_EQ(posidx[i], converted[i]); }
+
+    // position index MUST be ascending
+    int unordered[] = {2, 1};
+    ValidCellSpans failed(4, 5, 2, unordered);
+    EXPECT_EQ(0, failed.GetSpanNumber());
+    EXPECT_EQ(0, failed.GetCellNumber());
+}
+
+TEST(ValidCellSpansTest, RasterAndSubset) {
+    IntRaster* mask = IntRaster::Init(mask_asc, true);
+    ASSERT_NE(nullptr, mask);
+    ASSERT_TRUE(mask->BuildSubSet());
+    std::shared_ptr<ValidCellSpans> spans = mask->GetValidCellSpans();
+    ASSERT_NE(nullptr, spans);
+    EXPECT_EQ(spans, mask->GetValidCellSpans()); // built only once
+    EXPECT_EQ(mask->GetCellNumber(), spans->GetCellNumber());
+    int ncells = -1;
+    int* posidx = nullptr;
+    mask->GetRasterPositionData(&ncells, &posidx);
+    for (int i = 0; i < ncells; i++) {
+        EXPECT_EQ(i, spans->GetIndex(posidx[i] / mask->GetCols(), posidx[i] % mask->GetCols()));
+    }
+    // Spans of valid cells are iterated in the same order with values
+    int count = 0;
+    for (auto it = spans->GetSpans().begin(); it != spans->GetSpans().end(); ++it) {
+        for (int col = it->scol; col <= it->ecol; col++) {
+            EXPECT_EQ(mask->GetValueByIndex(it->offset + col - it->scol),
+                      mask->GetValue(it->row, col));
+            count++;
+        }
+    }
+    EXPECT_EQ(ncells, count);
+
+    map<int, SubsetPositions*>& subset = mask->GetSubset();
+    for (auto it = subset.begin(); it != subset.end(); ++it) {
+        std::shared_ptr<ValidCellSpans> subspans = it->second->GetSpans();
+        ASSERT_NE(nullptr, subspans);
+        EXPECT_EQ(it->second->n_cells, subspans->GetCellNumber());
+        EXPECT_EQ(it->second->g_ecol - it->second->g_scol + 1, subspans->GetCols());
+        for (int i = 0; i < it->second->n_cells; i++) {
+            int row = -1;
+            int col = -1;
+            EXPECT_TRUE(subspans->GetRowCol(i, &row, &col));
+            EXPECT_EQ(it->second->local_posidx_[i], row * subspans->GetCols() + col);
+        }
+    }
+    delete mask;
+}
+
+} /* namespace */
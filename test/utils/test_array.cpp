@@ -46,3 +46,27 @@ TEST(TestutilsArray, Handle2DArray) {
     Release2DArray(float_2d_copy);
     EXPECT_EQ(nullptr, float_2d_copy);
 }
+
+TEST(TestutilsArray, AlignedArray) {
+    int n = 1000;
+    double* dbl_1d = AllocateAlignedArray<double>(n);
+    ASSERT_NE(nullptr, dbl_1d);
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(dbl_1d) % CCGL_ARRAY_ALIGNMENT);
+    dbl_1d[n - 1] = 1.;
+    EXPECT_DOUBLE_EQ(1., dbl_1d[n - 1]);
+    ReleaseAlignedArray(dbl_1d);
+    EXPECT_EQ(nullptr, dbl_1d);
+
+    // Huge pages are opt-in, and large arrays are still aligned as requested
+    EXPECT_FALSE(TransparentHugePagesEnabled());
+    SetTransparentHugePages(true);
+    EXPECT_TRUE(TransparentHugePagesEnabled());
+    float* large = AllocateAlignedArray<float>(1 << 20);
+    ASSERT_NE(nullptr, large);
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(large) % CCGL_ARRAY_ALIGNMENT);
+    large[(1 << 20) - 1] = 0.f;
+    EXPECT_FLOAT_EQ(0.f, large[(1 << 20) - 1]);
+    ReleaseAlignedArray(large);
+    SetTransparentHugePages(false);
+    EXPECT_FALSE(TransparentHugePagesEnabled());
+}
@@ -0,0 +1,136 @@
+#include "../../src/utils_codec.h"
+#include "gtest/gtest.h"
+
+#include <cstring>
+#include <cstdlib>
+
+using namespace ccgl;
+using namespace ccgl::utils_codec;
+
+namespace {
+const char* kPipelines[] = {"NONE", "SHUFFLE", "DELTA", "XOR", "RLE", "BITPACK",
+                            "DELTA+BITPACK", "XOR+SHUFFLE+RLE", "SHUFFLE+RLE", "DELTA+RLE"};
+
+template <typename T>
+void CheckRoundTrip(const std::vector<T>& values, const std::string& pipeline,
+                    const size_t block_size = CODEC_BLOCK_SIZE) {
+    std::vector<CodecType> codecs;
+    ASSERT_TRUE(ParseCodecs(pipeline, codecs));
+    if (!CodecsApplicable(codecs, sizeof(T))) { return; }
+    const char* src = reinterpret_cast<const char*>(values.data());
+    size_t nbytes = values.size() * sizeof(T);
+    std::vector<char> encoded;
+    ASSERT_TRUE(EncodeStream(codecs, sizeof(T), src, nbytes, encoded, block_size));
+    std::vector<T> decoded(values.size());
+    char* dst = reinterpret_cast<char*>(decoded.data());
+    auto consumer = [&](const char* raw, const size_t offset, const size_t raw_bytes) -> bool {
+        if (offset + raw_bytes > nbytes) { return false; }
+        memcpy(dst + offset, raw, raw_bytes);
+        return true;
+    };
+    EXPECT_EQ(CVT_VINT(nbytes), DecodeStream(codecs, sizeof(T), encoded.data(),
+                                             encoded.size(), consumer, 2));
+    EXPECT_EQ(0, memcmp(values.data(), decoded.data(), nbytes)) << pipeline;
+}
+} /* namespace */
+
+TEST(TestutilsCodec, ParseCodecs) {
+    std::vector<CodecType> codecs;
+    EXPECT_TRUE(ParseCodecs("", codecs));
+    EXPECT_TRUE(codecs.empty());
+    EXPECT_TRUE(ParseCodecs("none", codecs));
+    EXPECT_TRUE(codecs.empty());
+    EXPECT_TRUE(ParseCodecs("delta+Bitpack", codecs));
+    ASSERT_EQ(2, codecs.size());
+    EXPECT_EQ(CODEC_DELTA, codecs[0]);
+    EXPECT_EQ(CODEC_BITPACK, codecs[1]);
+    EXPECT_EQ("DELTA+BITPACK", CodecsToString(codecs));
+    EXPECT_FALSE(ParseCodecs("RLE+DELTA", codecs));
+    EXPECT_FALSE(ParseCodecs("RLE+BITPACK", codecs));
+    EXPECT_FALSE(ParseCodecs("ZSTD", codecs));
+
+    EXPECT_TRUE(ParseCodecs("SHUFFLE+RLE", codecs));
+    EXPECT_TRUE(CodecsApplicable(codecs, 3));
+    EXPECT_TRUE(ParseCodecs("XOR", codecs));
+    EXPECT_FALSE(CodecsApplicable(codecs, 3));
+    EXPECT_TRUE(CodecsApplicable(codecs, 8));
+}
+
+TEST(TestutilsCodec, IntegersRoundTrip) {
+    std::vector<vint32_t> ints;
+    std::vector<vuint8_t> bytes;
+    std::vector<vint16_t> shorts;
+    srand(1);
+    for (int i = 0; i < 100003; i++) { // not multiple of the block size
+        bool nodata = i % 1000 < 300;
+        ints.emplace_back(nodata ? -9999 : 1000 + i % 37 - rand() % 5);
+        bytes.emplace_back(nodata ? 255 : static_cast<vuint8_t>(i % 7));
+        shorts.emplace_back(static_cast<vint16_t>(nodata ? -32768 : 32767 - i % 11));
+    }
+    for (size_t i = 0; i < sizeof(kPipelines) / sizeof(kPipelines[0]); i++) {
+        CheckRoundTrip(ints, kPipelines[i]);
+        CheckRoundTrip(ints, kPipelines[i], 4096 + 3);
+        CheckRoundTrip(bytes, kPipelines[i]);
+        CheckRoundTrip(shorts, kPipelines[i], 1000);
+    }
+}
+
+TEST(TestutilsCodec, FloatsRoundTrip) {
+    std::vector<float> flts;
+    std::vector<double> dbls;
+    srand(2);
+    for (int i = 0; i < 50001; i++) {
+        bool nodata = i % 500 < 100;
+        flts.emplace_back(nodata ? -3.40282346639e+38f : static_cast<float>(rand()) / RAND_MAX);
+        dbls.emplace_back(nodata ? -9999. : 100. + i * 0.01);
+    }
+    for (size_t i = 0; i < sizeof(kPipelines) / sizeof(kPipelines[0]); i++) {
+        CheckRoundTrip(flts, kPipelines[i]);
+        CheckRoundTrip(dbls, kPipelines[i], 8000);
+    }
+}
+
+TEST(TestutilsCodec, CompressNodata) {
+    std::vector<float> flts(100000, -9999.f);
+    for (int i = 40000; i < 40100; i++) { flts[i] = CVT_FLT(i); }
+    std::vector<CodecType> codecs;
+    ASSERT_TRUE(ParseCodecs("XOR+SHUFFLE+RLE", codecs));
+    std::vector<char> encoded;
+    ASSERT_TRUE(EncodeStream(codecs, sizeof(float), reinterpret_cast<const char*>(flts.data()),
+                             flts.size() * sizeof(float), encoded));
+    EXPECT_LT(encoded.size() * 20, flts.size() * sizeof(float));
+}
+
+TEST(TestutilsCodec, CorruptedStream) {
+    std::vector<vint32_t> ints(1000, 7);
+    std::vector<CodecType> codecs;
+    ASSERT_TRUE(ParseCodecs("DELTA+RLE", codecs));
+    std::vector<char> encoded;
+    ASSERT_TRUE(EncodeStream(codecs, sizeof(vint32_t), reinterpret_cast<const char*>(ints.data()),
+                             ints.size() * sizeof(vint32_t), encoded));
+    auto consumer = [](const char*, size_t, size_t) -> bool { return true; };
+    EXPECT_EQ(-1, DecodeStream(codecs, sizeof(vint32_t), encoded.data(),
+                               encoded.size() - 1, consumer));
+    encoded.resize(encoded.size() + CODEC_BLOCK_HEADER - 1, 0);
+    EXPECT_EQ(-1, DecodeStream(codecs, sizeof(vint32_t), encoded.data(),
+                               encoded.size(), consumer));
+}
+
+TEST(TestutilsCodec, LittleEndianHeader) {
+    std::vector<vint32_t> ints(300, 0);
+    std::vector<CodecType> codecs;
+    std::vector<char> encoded;
+    ASSERT_TRUE(EncodeBlock(codecs, sizeof(vint32_t), reinterpret_cast<const char*>(ints.data()),
+                            ints.size() * sizeof(vint32_t), encoded));
+    ASSERT_EQ(CODEC_BLOCK_HEADER + 1200, encoded.size());
+    // 1209 = 0x04B9 and 1200 = 0x04B0, the least significant byte first
+    const unsigned char expected[] = {0xB9, 0x04, 0, 0, 0xB0, 0x04, 0, 0, 0};
+    for (int i = 0; i < CODEC_BLOCK_HEADER; i++) {
+        EXPECT_EQ(expected[i], static_cast<unsigned char>(encoded[i]));
+    }
+    size_t block_bytes = 0;
+    size_t raw_bytes = 0;
+    ASSERT_TRUE(ParseBlockHeader(encoded.data(), encoded.size(), block_bytes, raw_bytes));
+    EXPECT_EQ(1209, block_bytes);
+    EXPECT_EQ(1200, raw_bytes);
+}
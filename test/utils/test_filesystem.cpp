@@ -1,6 +1,14 @@
 #include "gtest/gtest.h"
 #include "../../src/utils_filesystem.h"
 
+#include <fstream>
+#ifdef WINDOWS
+#include <sys/utime.h>
+#else
+#include <utime.h>
+#endif
+
+using namespace ccgl;
 using namespace ccgl::utils_filesystem;
 
 TEST(TestutilsFileIO, GetAbsolutePath) {
@@ -96,3 +104,96 @@ TEST(TestutilsFileIO, PathExists) { // directory or file paths
     string realfile = GetAppPath() + "./data/raster/int32.tif";
     EXPECT_TRUE(PathExists(realfile));
 }
+
+TEST(TestutilsFileIO, GetFileStamp) {
+    string testfile = GetAppPath() + "./data/fileStamp.txt";
+    vint64_t size = -1;
+    vint64_t mtime_ns = -1;
+    EXPECT_FALSE(GetFileStamp(testfile, size, mtime_ns));
+    std::ofstream ofs(testfile.c_str());
+    ofs << "stamp";
+    ofs.close();
+    ASSERT_TRUE(GetFileStamp(testfile, size, mtime_ns));
+    EXPECT_EQ(5, size);
+    EXPECT_GT(mtime_ns, 0);
+    ofs.open(testfile.c_str(), std::ios::app);
+    ofs << "ed";
+    ofs.close();
+    vint64_t new_size = -1;
+    ASSERT_TRUE(GetFileStamp(testfile, new_size, mtime_ns));
+    EXPECT_EQ(7, new_size); // a rewrite within the same second is told by the size
+    EXPECT_EQ(0, DeleteExistedFile(testfile));
+}
+
+namespace {
+void WriteCacheEntry(LocalFileCache& cache, const string& key, char value, size_t bytes) {
+    string temp = cache.NewTempPath(key);
+    std::ofstream ofs(temp.c_str(), std::ios::out | std::ios::binary);
+    string content(bytes, value);
+    ofs.write(content.data(), content.size());
+    ofs.close();
+    EXPECT_TRUE(cache.Commit(key, temp));
+    EXPECT_FALSE(FileExists(temp));
+}
+
+void SetModifiedTime(const string& path, time_t mtime) {
+#ifdef WINDOWS
+    struct _utimbuf times = {mtime, mtime};
+    _utime(path.c_str(), &times);
+#else
+    struct utimbuf times = {mtime, mtime};
+    utime(path.c_str(), &times);
+#endif /* WINDOWS */
+}
+} /* namespace */
+
+TEST(TestutilsFileIO, LocalFileCache) {
+    string cachedir = GetAppPath() + "./data/localFileCache";
+    DeleteDirectory(cachedir);
+    LocalFileCache cache(cachedir, 250);
+    ASSERT_TRUE(cache.Valid());
+    MappedFile mapped;
+    EXPECT_FALSE(cache.Lookup("a", mapped));
+    EXPECT_EQ(-1, mapped.Size());
+    WriteCacheEntry(cache, "a", 'a', 100);
+    WriteCacheEntry(cache, "b", 'b', 100);
+    ASSERT_TRUE(cache.Lookup("a", mapped));
+    ASSERT_EQ(100, mapped.Size());
+    EXPECT_EQ('a', mapped.Data()[0]);
+    EXPECT_EQ('a', mapped.Data()[99]);
+    EXPECT_EQ(1, cache.Hits());
+    EXPECT_EQ(1, cache.Misses());
+    // b is the least recently used, a is marked as used by the next lookup
+    time_t now = time(nullptr);
+    SetModifiedTime(cache.EntryPath("a"), now - 100);
+    SetModifiedTime(cache.EntryPath("b"), now - 50);
+    MappedFile mapped_a;
+    EXPECT_TRUE(cache.Lookup("a", mapped_a));
+    // stale temporary file of an interrupted writer
+    string stale = cache.NewTempPath("d");
+    std::ofstream ofs(stale.c_str());
+    ofs << "stale";
+    ofs.close();
+    SetModifiedTime(stale, now - 7200);
+    WriteCacheEntry(cache, "c", 'c', 100);
+    EXPECT_TRUE(FileExists(cache.EntryPath("a")));
+    EXPECT_FALSE(FileExists(cache.EntryPath("b")));
+    EXPECT_TRUE(FileExists(cache.EntryPath("c")));
+    EXPECT_FALSE(FileExists(stale));
+    EXPECT_EQ(200, cache.Evict());
+    // the directory is not scanned while the estimated size is within the limit
+    string stale2 = cache.NewTempPath("f");
+    std::ofstream ofs2(stale2.c_str());
+    ofs2 << "stale";
+    ofs2.close();
+    SetModifiedTime(stale2, now - 7200);
+    WriteCacheEntry(cache, "e", 'e', 10);
+    EXPECT_TRUE(FileExists(stale2));
+    EXPECT_EQ(210, cache.Evict());
+    EXPECT_FALSE(FileExists(stale2));
+    // the mapped entry is still readable after the cache is updated
+    EXPECT_EQ('a', mapped.Data()[50]);
+    mapped.Close();
+    mapped_a.Close();
+    EXPECT_TRUE(DeleteDirectory(cachedir));
+}